@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "addrtrace.h"
+
+#define ADDRTRACE_RECORD_SIZE 9
+
+static void put_u32(unsigned char* buf, unsigned int value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = (value >> 8) & 0xff;
+    buf[2] = (value >> 16) & 0xff;
+    buf[3] = (value >> 24) & 0xff;
+}
+
+static unsigned int get_u32(const unsigned char* buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned int)buf[3] << 24);
+}
+
+static void write_header(FILE* file, long long accesses, long long instructions)
+{
+    AddrTraceHeader header;
+    header.magic = ADDRTRACE_MAGIC;
+    header.version = ADDRTRACE_VERSION;
+    header.accesses = accesses;
+    header.instructions = instructions;
+    fwrite(&header, sizeof(header), 1, file);
+}
+
+/*
+ * This function creates an address trace file, returns NULL if it cannot
+ * be opened.
+ */
+AddrTraceFile* addrtrace_open(const char* filename)
+{
+    AddrTraceFile* trace = (AddrTraceFile*)calloc(1, sizeof(AddrTraceFile));
+    if (!trace) {
+        return NULL;
+    }
+
+    trace->file = fopen(filename, "wb");
+    if (trace->file == NULL) {
+        printf("Error opening address trace file %s\n", filename);
+        free(trace);
+        return NULL;
+    }
+
+    // Counts are filled in by addrtrace_close
+    write_header(trace->file, 0, 0);
+    return trace;
+}
+
+void addrtrace_write(AddrTraceFile* trace, const AddrTraceRecord* record)
+{
+    unsigned char buf[ADDRTRACE_RECORD_SIZE];
+
+    put_u32(buf, record->pc);
+    put_u32(buf + 4, record->addr);
+    buf[8] = record->is_store;
+    fwrite(buf, ADDRTRACE_RECORD_SIZE, 1, trace->file);
+    trace->accesses++;
+}
+
+/*
+ * Closes a trace opened for writing or reading, writers get their header
+ * counts patched.
+ */
+void addrtrace_close(AddrTraceFile* trace, long long instructions)
+{
+    if(!trace)
+        return;
+
+    if(instructions >= 0)
+    {
+        rewind(trace->file);
+        write_header(trace->file, trace->accesses, instructions);
+    }
+    fclose(trace->file);
+    free(trace);
+}
+
+/*
+ * This function opens an address trace for streaming, returns NULL on a
+ * missing or malformed file.
+ */
+AddrTraceFile* addrtrace_open_read(const char* filename, AddrTraceHeader* header)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("Error opening address trace file %s\n", filename);
+        return NULL;
+    }
+
+    if(fread(header, sizeof(*header), 1, file) != 1 || header->magic != ADDRTRACE_MAGIC
+        || header->version != ADDRTRACE_VERSION)
+    {
+        printf("Error: %s is not an address trace\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    AddrTraceFile* trace = (AddrTraceFile*)calloc(1, sizeof(AddrTraceFile));
+    if (!trace) {
+        fclose(file);
+        return NULL;
+    }
+    trace->file = file;
+    return trace;
+}
+
+bool addrtrace_read(AddrTraceFile* trace, AddrTraceRecord* record)
+{
+    unsigned char buf[ADDRTRACE_RECORD_SIZE];
+
+    if(fread(buf, ADDRTRACE_RECORD_SIZE, 1, trace->file) != 1)
+        return false;
+
+    record->pc = get_u32(buf);
+    record->addr = get_u32(buf + 4);
+    record->is_store = buf[8] != 0;
+    trace->accesses++;
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef _ADDRTRACE_H_
+#define _ADDRTRACE_H_
+#include <stdbool.h>
+#include <stdio.h>
+
+#define ADDRTRACE_MAGIC 0x52544441u   // "ADTR"
+#define ADDRTRACE_VERSION 1
+
+/*
+ * Data address trace: a header (host byte order) followed by one 9 byte
+ * little endian record per load or store leaving memory_first_stage.
+ */
+typedef struct AddrTraceHeader {
+    unsigned int magic;
+    unsigned int version;
+    long long accesses;
+    long long instructions;    // retired instructions of the traced run
+} AddrTraceHeader;
+
+typedef struct AddrTraceRecord {
+    unsigned int pc;           // instruction byte address
+    unsigned int addr;         // data byte address
+    bool is_store;
+} AddrTraceRecord;
+
+typedef struct AddrTraceFile {
+    FILE *file;
+    long long accesses;
+} AddrTraceFile;
+
+AddrTraceFile* addrtrace_open(const char* filename);
+void addrtrace_write(AddrTraceFile* trace, const AddrTraceRecord* record);
+void addrtrace_close(AddrTraceFile* trace, long long instructions);
+
+AddrTraceFile* addrtrace_open_read(const char* filename, AddrTraceHeader* header);
+bool addrtrace_read(AddrTraceFile* trace, AddrTraceRecord* record);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// Chunk header rounded up so the data after it stays aligned
+#define CHUNK_HEADER ((sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static ArenaChunk* chunk_create(size_t size)
+{
+    ArenaChunk* chunk = (ArenaChunk*)malloc(CHUNK_HEADER + size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+static char* chunk_data(ArenaChunk* chunk)
+{
+    return (char*)chunk + CHUNK_HEADER;
+}
+
+Arena* arena_create(size_t chunk_size)
+{
+    Arena* arena = (Arena*)calloc(1, sizeof(Arena));
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK_SIZE;
+    arena->first = chunk_create(arena->chunk_size);
+    if(!arena->first)
+    {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    arena->reserved = arena->first->size;
+    return arena;
+}
+
+void arena_destroy(Arena* arena)
+{
+    if(!arena)
+        return;
+    for(ArenaChunk* chunk = arena->first; chunk; )
+    {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+/*
+ * Returns size zeroed bytes aligned to ARENA_ALIGN, calloc'ed when arena
+ * is NULL. Chunks after the current one, kept by an earlier rewind, are
+ * reused when the request fits; otherwise a new chunk is linked in front
+ * of them.
+ */
+void* arena_alloc(Arena* arena, size_t size)
+{
+    if(!arena)
+        return calloc(1, size > 0 ? size : 1);
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaChunk* chunk = arena->current;
+
+    if(chunk->used + size > chunk->size)
+    {
+        ArenaChunk* next = chunk->next;
+        if(next && size <= next->size)
+            next->used = 0;
+        else
+        {
+            size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+            next = chunk_create(chunk_size);
+            if(!next)
+                return NULL;
+            next->next = chunk->next;
+            chunk->next = next;
+            arena->reserved += next->size;
+        }
+        arena->current = chunk = next;
+    }
+
+    void* ptr = chunk_data(chunk) + chunk->used;
+    chunk->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/*
+ * Frees an allocation made without an arena; arena allocations are only
+ * released by a rewind.
+ */
+void arena_release(Arena* arena, void* ptr)
+{
+    if(!arena)
+        free(ptr);
+}
+
+ArenaMark arena_mark(Arena* arena)
+{
+    ArenaMark mark;
+
+    mark.chunk = arena->current;
+    mark.used = arena->current->used;
+    return mark;
+}
+
+/*
+ * Releases everything allocated since mark was taken.
+ */
+void arena_rewind(Arena* arena, ArenaMark mark)
+{
+    arena->current = mark.chunk;
+    arena->current->used = mark.used;
+}
@@ -0,0 +1,43 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)   // bytes, larger requests get their own chunk
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;              // usable bytes after the header
+    size_t used;
+} ArenaChunk;
+
+/*
+ * Bump allocator for everything that lives as long as one simulation.
+ * Allocations are never freed one by one; arena_rewind drops everything
+ * allocated after a mark in O(1) and keeps the chunks for the next
+ * allocations, so a reused arena stops growing once it has seen its
+ * largest job. Functions taking an Arena* fall back to the heap when it
+ * is NULL.
+ */
+typedef struct Arena {
+    ArenaChunk *first;
+    ArenaChunk *current;
+    size_t chunk_size;
+    size_t reserved;          // bytes held in chunks
+} Arena;
+
+typedef struct ArenaMark {
+    ArenaChunk *chunk;
+    size_t used;
+} ArenaMark;
+
+Arena* arena_create(size_t chunk_size);
+void arena_destroy(Arena* arena);
+
+void* arena_alloc(Arena* arena, size_t size);
+void arena_release(Arena* arena, void* ptr);
+
+ArenaMark arena_mark(Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+
+#endif
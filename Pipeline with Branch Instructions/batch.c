@@ -0,0 +1,887 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include "cpu.h"
+#include "interp.h"
+#include "batch.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#else
+#define BATCH_X86 0
+#endif
+
+// One decoded instruction, checked like interp_run does
+typedef struct BatchOp {
+    int opcode;        // -1: not an instruction, executed as a nop
+    bool bad;          // register outside the register file
+    int dest;
+    int src1;
+    int src2;          // second source, or the address register of st
+    int imm;
+    int target;        // instruction index of a branch target
+} BatchOp;
+
+/*
+ * Kernels over one SoA row, the values of one register in every lane.
+ * Lanes that left the group are computed too, their values are dead.
+ * Loads and stores only touch the active lanes whose address word is
+ * inside their memory, and return the active lanes whose word is not.
+ */
+typedef struct BatchKernels {
+    const char* name;
+    void (*binary)(int opcode, int* dest, const int* a, const int* b);
+    void (*immediate)(int opcode, int* dest, const int* a, int imm);
+    unsigned int (*branch)(int opcode, const int* a);   // lanes taking the branch
+    unsigned int (*load)(int* dest, const int* memory, const int* addr, const int* len, unsigned int active);
+    unsigned int (*store)(int* memory, const int* value, const int* addr, const int* len, unsigned int active);
+} BatchKernels;
+
+// Final state of one instance
+typedef struct BatchResult {
+    enum interpStatus_enum status;
+    long long instructions;
+    unsigned int memory_hash;     // FNV-1a of the final memory, as fork runs report it
+    bool scalar;                  // diverged and finished on the scalar interpreter
+    bool missing;                 // the memory image could not be read
+} BatchResult;
+
+// Up to BATCH_LANES instances in lockstep
+typedef struct BatchGroup {
+    int regs[NUM_REGS][BATCH_LANES] __attribute__((aligned(64)));
+    int *memory;                  // word major, memory[word * BATCH_LANES + lane]
+    int words;                    // longest memory of the group
+    int memory_len[BATCH_LANES];
+    int first;                    // instance in lane 0
+    unsigned int active;          // lanes still in lockstep
+} BatchGroup;
+
+typedef struct Batch {
+    const BatchKernels* kernels;
+    BatchOp* ops;
+    int count;
+    long long budget;
+    int start_pc;
+    int start_regs[NUM_REGS];
+    CPU* cpu;                     // runs the lanes that diverge
+    BatchResult* results;
+    long long lockstep_instructions;
+    long long scalar_instructions;
+    int diverged;
+} Batch;
+
+static const char* batch_isa_names[] = { "auto", "scalar", "avx2", "avx512" };
+
+bool batch_parse_isa(const char* name, enum batchIsa_enum* isa)
+{
+    for(int i = batch_isa_auto; i <= batch_isa_avx512; i++)
+    {
+        if(strcmp(name, batch_isa_names[i]) == 0)
+        {
+            *isa = (enum batchIsa_enum)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void binary_scalar(int opcode, int* dest, const int* a, const int* b)
+{
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        if(opcode == fmt_add)
+            dest[l] = a[l] + b[l];
+        else if(opcode == fmt_sub)
+            dest[l] = a[l] - b[l];
+        else
+            dest[l] = a[l] * b[l];
+    }
+}
+
+static void immediate_scalar(int opcode, int* dest, const int* a, int imm)
+{
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        if(opcode == fmt_set)
+            dest[l] = imm;
+        else if(opcode == fmt_add_imm)
+            dest[l] = a[l] + imm;
+        else if(opcode == fmt_sub_imm)
+            dest[l] = a[l] - imm;
+        else
+            dest[l] = imm * a[l];
+    }
+}
+
+static unsigned int branch_scalar(int opcode, const int* a)
+{
+    unsigned int taken = 0;
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        bool cond = opcode == fmt_bez_imm ? a[l] == 0 : opcode == fmt_bgez_imm ? a[l] >= 0
+            : opcode == fmt_blez_imm ? a[l] <= 0 : opcode == fmt_bgtz_imm ? a[l] > 0 : a[l] < 0;
+        taken |= (unsigned int)cond << l;
+    }
+    return taken;
+}
+
+static unsigned int load_scalar(int* dest, const int* memory, const int* addr, const int* len, unsigned int active)
+{
+    unsigned int bad = 0;
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        unsigned int word = (unsigned int)(addr[l] / 4);
+        if(!(active & (1u << l)))
+            continue;
+        if(word >= (unsigned int)len[l])
+            bad |= 1u << l;
+        else
+            dest[l] = memory[word * BATCH_LANES + l];
+    }
+    return bad;
+}
+
+static unsigned int store_scalar(int* memory, const int* value, const int* addr, const int* len, unsigned int active)
+{
+    unsigned int bad = 0;
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        unsigned int word = (unsigned int)(addr[l] / 4);
+        if(!(active & (1u << l)))
+            continue;
+        if(word >= (unsigned int)len[l])
+            bad |= 1u << l;
+        else
+            memory[word * BATCH_LANES + l] = value[l];
+    }
+    return bad;
+}
+
+static const BatchKernels scalar_kernels = { "scalar", binary_scalar, immediate_scalar, branch_scalar,
+    load_scalar, store_scalar };
+
+#if BATCH_X86
+
+__attribute__((target("avx2")))
+static void binary_avx2(int opcode, int* dest, const int* a, const int* b)
+{
+    for(int l = 0; l < BATCH_LANES; l += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + l));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + l));
+        __m256i r = opcode == fmt_add ? _mm256_add_epi32(x, y)
+            : opcode == fmt_sub ? _mm256_sub_epi32(x, y) : _mm256_mullo_epi32(x, y);
+        _mm256_storeu_si256((__m256i*)(dest + l), r);
+    }
+}
+
+__attribute__((target("avx2")))
+static void immediate_avx2(int opcode, int* dest, const int* a, int imm)
+{
+    __m256i y = _mm256_set1_epi32(imm);
+    for(int l = 0; l < BATCH_LANES; l += 8)
+    {
+        if(opcode == fmt_set)
+        {
+            _mm256_storeu_si256((__m256i*)(dest + l), y);
+            continue;
+        }
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + l));
+        __m256i r = opcode == fmt_add_imm ? _mm256_add_epi32(x, y)
+            : opcode == fmt_sub_imm ? _mm256_sub_epi32(x, y) : _mm256_mullo_epi32(x, y);
+        _mm256_storeu_si256((__m256i*)(dest + l), r);
+    }
+}
+
+__attribute__((target("avx2")))
+static unsigned int branch_avx2(int opcode, const int* a)
+{
+    __m256i zero = _mm256_setzero_si256();
+    unsigned int taken = 0;
+    for(int l = 0; l < BATCH_LANES; l += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + l));
+        __m256i cond;
+        if(opcode == fmt_bez_imm)
+            cond = _mm256_cmpeq_epi32(x, zero);
+        else if(opcode == fmt_bgez_imm || opcode == fmt_bltz_imm)
+            cond = _mm256_cmpgt_epi32(zero, x);
+        else
+            cond = _mm256_cmpgt_epi32(x, zero);
+        unsigned int bits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(cond));
+        // bgez and blez are the complements of bltz and bgtz
+        if(opcode == fmt_bgez_imm || opcode == fmt_blez_imm)
+            bits ^= 0xff;
+        taken |= bits << l;
+    }
+    return taken;
+}
+
+/*
+ * Memory index of every lane with the lanes whose address word is inside
+ * their memory, the word being addr / 4 rounded toward zero and compared
+ * unsigned like interp_run does.
+ */
+__attribute__((target("avx2")))
+static __m256i index_avx2(const int* addr, const int* len, int first, __m256i* inside)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i x = _mm256_loadu_si256((const __m256i*)(addr + first));
+    __m256i round = _mm256_and_si256(_mm256_srai_epi32(x, 31), _mm256_set1_epi32(3));
+    __m256i word = _mm256_srai_epi32(_mm256_add_epi32(x, round), 2);
+    __m256i limit = _mm256_loadu_si256((const __m256i*)(len + first));
+    *inside = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, word), _mm256_cmpgt_epi32(limit, word));
+    __m256i lanes = _mm256_setr_epi32(first, first + 1, first + 2, first + 3, first + 4, first + 5,
+        first + 6, first + 7);
+    return _mm256_add_epi32(_mm256_slli_epi32(word, 4), lanes);
+}
+
+// Active lanes of a row half as a vector mask
+__attribute__((target("avx2")))
+static __m256i lanes_avx2(unsigned int active, int first)
+{
+    __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i mask = _mm256_set1_epi32((active >> first) & 0xff);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(mask, bits), bits);
+}
+
+__attribute__((target("avx2")))
+static unsigned int load_avx2(int* dest, const int* memory, const int* addr, const int* len, unsigned int active)
+{
+    unsigned int bad = 0;
+    for(int l = 0; l < BATCH_LANES; l += 8)
+    {
+        __m256i inside;
+        __m256i index = index_avx2(addr, len, l, &inside);
+        __m256i lanes = lanes_avx2(active, l);
+        __m256i ok = _mm256_and_si256(inside, lanes);
+        __m256i old = _mm256_loadu_si256((const __m256i*)(dest + l));
+        __m256i value = _mm256_mask_i32gather_epi32(old, memory, index, ok, 4);
+        _mm256_storeu_si256((__m256i*)(dest + l), value);
+        bad |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(inside, lanes))) << l;
+    }
+    return bad;
+}
+
+// AVX2 has no scatter, the stores themselves go lane by lane
+__attribute__((target("avx2")))
+static unsigned int store_avx2(int* memory, const int* value, const int* addr, const int* len, unsigned int active)
+{
+    int index[BATCH_LANES];
+    unsigned int ok = 0;
+    for(int l = 0; l < BATCH_LANES; l += 8)
+    {
+        __m256i inside;
+        _mm256_storeu_si256((__m256i*)(index + l), index_avx2(addr, len, l, &inside));
+        ok |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(inside)) << l;
+    }
+    for(int l = 0; l < BATCH_LANES; l++)
+        if(ok & active & (1u << l))
+            memory[index[l]] = value[l];
+    return active & ~ok;
+}
+
+static const BatchKernels avx2_kernels = { "avx2", binary_avx2, immediate_avx2, branch_avx2,
+    load_avx2, store_avx2 };
+
+__attribute__((target("avx512f")))
+static void binary_avx512(int opcode, int* dest, const int* a, const int* b)
+{
+    __m512i x = _mm512_loadu_si512(a);
+    __m512i y = _mm512_loadu_si512(b);
+    __m512i r = opcode == fmt_add ? _mm512_add_epi32(x, y)
+        : opcode == fmt_sub ? _mm512_sub_epi32(x, y) : _mm512_mullo_epi32(x, y);
+    _mm512_storeu_si512(dest, r);
+}
+
+__attribute__((target("avx512f")))
+static void immediate_avx512(int opcode, int* dest, const int* a, int imm)
+{
+    __m512i y = _mm512_set1_epi32(imm);
+    if(opcode == fmt_set)
+    {
+        _mm512_storeu_si512(dest, y);
+        return;
+    }
+    __m512i x = _mm512_loadu_si512(a);
+    __m512i r = opcode == fmt_add_imm ? _mm512_add_epi32(x, y)
+        : opcode == fmt_sub_imm ? _mm512_sub_epi32(x, y) : _mm512_mullo_epi32(x, y);
+    _mm512_storeu_si512(dest, r);
+}
+
+__attribute__((target("avx512f")))
+static unsigned int branch_avx512(int opcode, const int* a)
+{
+    __m512i x = _mm512_loadu_si512(a);
+    __m512i zero = _mm512_setzero_si512();
+    switch(opcode)
+    {
+    case fmt_bez_imm:
+        return _mm512_cmpeq_epi32_mask(x, zero);
+    case fmt_bgez_imm:
+        return _mm512_cmpge_epi32_mask(x, zero);
+    case fmt_blez_imm:
+        return _mm512_cmple_epi32_mask(x, zero);
+    case fmt_bgtz_imm:
+        return _mm512_cmpgt_epi32_mask(x, zero);
+    default:
+        return _mm512_cmplt_epi32_mask(x, zero);
+    }
+}
+
+__attribute__((target("avx512f")))
+static __m512i index_avx512(const int* addr, const int* len, __mmask16* inside)
+{
+    __m512i x = _mm512_loadu_si512(addr);
+    __m512i round = _mm512_and_si512(_mm512_srai_epi32(x, 31), _mm512_set1_epi32(3));
+    __m512i word = _mm512_srai_epi32(_mm512_add_epi32(x, round), 2);
+    *inside = _mm512_cmplt_epu32_mask(word, _mm512_loadu_si512(len));
+    __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm512_add_epi32(_mm512_slli_epi32(word, 4), lanes);
+}
+
+__attribute__((target("avx512f")))
+static unsigned int load_avx512(int* dest, const int* memory, const int* addr, const int* len, unsigned int active)
+{
+    __mmask16 inside;
+    __m512i index = index_avx512(addr, len, &inside);
+    __m512i value = _mm512_mask_i32gather_epi32(_mm512_loadu_si512(dest), inside & active, index, memory, 4);
+    _mm512_storeu_si512(dest, value);
+    return active & ~inside;
+}
+
+__attribute__((target("avx512f")))
+static unsigned int store_avx512(int* memory, const int* value, const int* addr, const int* len, unsigned int active)
+{
+    __mmask16 inside;
+    __m512i index = index_avx512(addr, len, &inside);
+    _mm512_mask_i32scatter_epi32(memory, inside & active, index, _mm512_loadu_si512(value), 4);
+    return active & ~inside;
+}
+
+static const BatchKernels avx512_kernels = { "avx512", binary_avx512, immediate_avx512, branch_avx512,
+    load_avx512, store_avx512 };
+
+#endif
+
+/*
+ * Kernels for the requested instruction set, or the widest the host runs
+ * when it is auto or not supported.
+ */
+static const BatchKernels* select_kernels(enum batchIsa_enum isa)
+{
+#if BATCH_X86
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2");
+
+    if(isa == batch_isa_scalar)
+        return &scalar_kernels;
+    if(isa == batch_isa_avx512 && !avx512)
+        printf("The host has no AVX-512, ignored\n");
+    if(isa == batch_isa_avx2 && avx2)
+        return &avx2_kernels;
+    if(isa == batch_isa_avx2 && !avx2)
+        printf("The host has no AVX2, ignored\n");
+    if(avx512)
+        return &avx512_kernels;
+    if(avx2)
+        return &avx2_kernels;
+#else
+    if(isa == batch_isa_avx2 || isa == batch_isa_avx512)
+        printf("Vector kernels need an x86-64 host, ignored\n");
+#endif
+    return &scalar_kernels;
+}
+
+static bool valid_reg(int reg)
+{
+    return reg >= 0 && reg < NUM_REGS;
+}
+
+/*
+ * Decodes the program of cpu with the checks of interp_run, an operand
+ * register outside the register file stops every lane reaching it.
+ */
+static BatchOp* decode_ops(CPU* cpu)
+{
+    int count = cpu->tot_instructions;
+    BatchOp* ops = (BatchOp*)calloc(count + 1, sizeof(BatchOp));
+    if (!ops) {
+        return NULL;
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        int *decoded = &cpu->instruction_memory[i * 7];
+        BatchOp* op = &ops[i];
+        op->opcode = decoded[0];
+        op->dest = decoded[1];
+        op->src1 = decoded[2];
+        op->imm = decoded[3];
+        op->src2 = decoded[4];
+        if(op->opcode < fmt_set || op->opcode > fmt_ret)
+        {
+            op->opcode = -1;
+            continue;
+        }
+
+        switch (op->opcode)
+        {
+        case fmt_ret:
+            break;
+        case fmt_set:
+        case fmt_ld_imm:
+            op->bad = !valid_reg(op->dest);
+            break;
+        case fmt_st:
+            op->bad = !valid_reg(op->dest) || !valid_reg(op->src1);
+            op->src2 = op->dest;
+            break;
+        case fmt_st_imm:
+            op->bad = !valid_reg(op->src1);
+            break;
+        case fmt_bez_imm:
+        case fmt_bgez_imm:
+        case fmt_blez_imm:
+        case fmt_bgtz_imm:
+        case fmt_bltz_imm:
+            op->bad = !valid_reg(op->src1);
+            op->target = op->imm / 4;
+            if(op->target < 0 || op->target > count)
+                op->target = count;
+            break;
+        default:
+            op->bad = !valid_reg(op->dest) || !valid_reg(op->src1) || ((op->opcode == fmt_add
+                || op->opcode == fmt_sub || op->opcode == fmt_mul || op->opcode == fmt_div)
+                && !valid_reg(op->src2));
+            break;
+        }
+
+        // Unused operands may hold anything, keep them inside the rows
+        op->dest &= NUM_REGS - 1;
+        op->src1 &= NUM_REGS - 1;
+        op->src2 &= NUM_REGS - 1;
+    }
+    return ops;
+}
+
+static unsigned int hash_word(unsigned int hash, int value)
+{
+    return (hash ^ (unsigned int)value) * 16777619u;
+}
+
+/*
+ * Records the final state of the lanes in mask, which stopped in lockstep
+ * after executed instructions.
+ */
+static void finish_lanes(Batch* batch, BatchGroup* group, unsigned int mask, enum interpStatus_enum status,
+    long long executed)
+{
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        if(!(mask & (1u << l)))
+            continue;
+
+        BatchResult* result = &batch->results[group->first + l];
+        result->status = status;
+        result->instructions = executed;
+        result->memory_hash = 2166136261u;
+        for(int w = 0; w < group->memory_len[l]; w++)
+            result->memory_hash = hash_word(result->memory_hash, group->memory[w * BATCH_LANES + l]);
+    }
+    group->active &= ~mask;
+    batch->lockstep_instructions += executed * __builtin_popcount(mask);
+}
+
+/*
+ * A lane whose branch at instruction pc went the other way than the
+ * group: its registers and memory are copied out of the group and the
+ * scalar interpreter runs it from that branch to the end.
+ */
+static void diverge_lane(Batch* batch, BatchGroup* group, int lane, int pc, long long executed)
+{
+    CPU* cpu = batch->cpu;
+    BatchResult* result = &batch->results[group->first + lane];
+    int words = group->memory_len[lane];
+    int* memory = (int*)malloc((words > 0 ? words : 1) * sizeof(int));
+    if (!memory) {
+        printf("Error allocating the memory of instance %d\n", group->first + lane);
+        exit(1);
+    }
+
+    for(int w = 0; w < words; w++)
+        memory[w] = group->memory[w * BATCH_LANES + lane];
+    for(int r = 0; r < NUM_REGS; r++)
+        cpu->regs[r].value = group->regs[r][lane];
+    int* own_memory = cpu->memory;
+    int own_len = cpu->memoryLen;
+    cpu->memory = memory;
+    cpu->memoryLen = words;
+    cpu->pc = pc * 7;
+    cpu->tot_instructions_done = 0;
+    cpu->cpu_halted = false;
+
+    result->status = interp_run(cpu, batch->budget - executed);
+    result->instructions = executed + cpu->tot_instructions_done;
+    result->scalar = true;
+    result->memory_hash = 2166136261u;
+    for(int w = 0; w < words; w++)
+        result->memory_hash = hash_word(result->memory_hash, memory[w]);
+
+    cpu->memory = own_memory;
+    cpu->memoryLen = own_len;
+    free(memory);
+
+    group->active &= ~(1u << lane);
+    batch->lockstep_instructions += executed;
+    batch->scalar_instructions += cpu->tot_instructions_done;
+    batch->diverged++;
+}
+
+/*
+ * Runs the lanes of a group in lockstep until each has stopped or left.
+ * Arithmetic and branch conditions use the vector kernels on whole rows;
+ * division and memory accesses, whose addresses differ from lane to lane,
+ * go lane by lane.
+ */
+static void run_group(Batch* batch, BatchGroup* group)
+{
+    const BatchKernels* k = batch->kernels;
+    int imm_addr[BATCH_LANES];
+    unsigned int bad;
+    long long executed = 0;
+    int pc = batch->start_pc;
+    enum interpStatus_enum status = interp_end_of_program;
+
+    while(group->active)
+    {
+        if(pc >= batch->count)
+        {
+            status = interp_end_of_program;
+            break;
+        }
+
+        const BatchOp* op = &batch->ops[pc];
+        if(op->bad)
+        {
+            status = interp_bad_instruction;
+            break;
+        }
+
+        int* dest = group->regs[op->dest];
+        const int* src1 = group->regs[op->src1];
+        bad = 0;
+        switch(op->opcode)
+        {
+        case fmt_set:
+        case fmt_add_imm:
+        case fmt_sub_imm:
+        case fmt_mul_imm:
+            k->immediate(op->opcode, dest, src1, op->imm);
+            break;
+        case fmt_add:
+        case fmt_sub:
+        case fmt_mul:
+            k->binary(op->opcode, dest, src1, group->regs[op->src2]);
+            break;
+        case fmt_div:
+        case fmt_div_imm:
+            for(int l = 0; l < BATCH_LANES; l++)
+                if(group->active & (1u << l))
+                    dest[l] = src1[l] / (op->opcode == fmt_div ? group->regs[op->src2][l] : op->imm);
+            break;
+        case fmt_ld:
+            bad = k->load(dest, group->memory, src1, group->memory_len, group->active);
+            break;
+        case fmt_ld_imm:
+            k->immediate(fmt_set, imm_addr, NULL, op->imm);
+            bad = k->load(dest, group->memory, imm_addr, group->memory_len, group->active);
+            break;
+        case fmt_st:
+            bad = k->store(group->memory, src1, group->regs[op->src2], group->memory_len, group->active);
+            break;
+        case fmt_st_imm:
+            k->immediate(fmt_set, imm_addr, NULL, op->imm);
+            bad = k->store(group->memory, src1, imm_addr, group->memory_len, group->active);
+            break;
+        case fmt_bez_imm:
+        case fmt_bgez_imm:
+        case fmt_blez_imm:
+        case fmt_bgtz_imm:
+        case fmt_bltz_imm:
+        {
+            unsigned int taken = k->branch(op->opcode, src1) & group->active;
+            if(taken && taken != group->active)
+            {
+                // The smaller side leaves the group
+                unsigned int leave = 2 * __builtin_popcount(taken) >= __builtin_popcount(group->active)
+                    ? group->active & ~taken : taken;
+                for(int l = 0; l < BATCH_LANES; l++)
+                    if(leave & (1u << l))
+                        diverge_lane(batch, group, l, pc, executed);
+                taken &= group->active;
+            }
+
+            executed++;
+            if(!taken)
+            {
+                pc++;
+                continue;
+            }
+            pc = op->target;
+            if(executed >= batch->budget)
+            {
+                status = interp_limit;
+                finish_lanes(batch, group, group->active, status, executed);
+            }
+            continue;
+        }
+        case fmt_ret:
+            executed++;
+            finish_lanes(batch, group, group->active, interp_halted, executed);
+            continue;
+        default:
+            break;
+        }
+
+        // Lanes whose ld or st address is outside their memory stop here
+        if(bad)
+            finish_lanes(batch, group, bad, interp_bad_address, executed);
+        executed++;
+        pc++;
+    }
+
+    if(group->active)
+        finish_lanes(batch, group, group->active, status, executed);
+}
+
+static char* read_text(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("Error opening %s\n", filename);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* text = malloc(size + 1);
+    if (text && fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    if (text) {
+        text[size] = '\0';
+    }
+    return text;
+}
+
+/*
+ * Reads a memory image in the format of memory_map.txt, returns NULL if
+ * the file cannot be opened.
+ */
+static int* read_memory(const char* filename, int* words)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        return NULL;
+    }
+
+    int value, size = 0;
+    while(fscanf(file, "%d", &value) == 1)
+        size++;
+    rewind(file);
+
+    int* memory = (int*)malloc((size > 0 ? size : 1) * sizeof(int));
+    for(int i = 0; memory && i < size; i++)
+    {
+        if(fscanf(file, "%d", &memory[i]) != 1)
+            memory[i] = 0;
+    }
+    fclose(file);
+    *words = size;
+    return memory;
+}
+
+/*
+ * Reads the list of memory images, one file name per line. Empty lines
+ * and lines starting with # are skipped. Returns the number of names.
+ */
+static int parse_inputs(const char* filename, char*** names)
+{
+    char line[MAX_BATCH_LINE];
+    int count = 0, capacity = 0;
+
+    *names = NULL;
+    FILE* file = fopen(filename, "r");
+    if(!file)
+    {
+        printf("Error opening %s\n", filename);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* start = line + strspn(line, " \t");
+        if(*start == '\0' || *start == '#')
+            continue;
+        start[strcspn(start, " \t")] = '\0';
+
+        if(count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            char** grown = (char**)realloc(*names, capacity * sizeof(char*));
+            if(!grown)
+                break;
+            *names = grown;
+        }
+        (*names)[count++] = strdup(start);
+    }
+
+    fclose(file);
+    return count;
+}
+
+/*
+ * Loads the memory images of instances first.. into the lanes of group.
+ * An image that cannot be read stops its lane before the first
+ * instruction.
+ */
+static void load_group(Batch* batch, BatchGroup* group, char** names, int first, int count)
+{
+    int* images[BATCH_LANES];
+
+    group->first = first;
+    group->active = 0;
+    group->words = 1;
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        images[l] = NULL;
+        group->memory_len[l] = 0;
+        if(first + l >= count)
+            continue;
+        images[l] = read_memory(names[first + l], &group->memory_len[l]);
+        if(!images[l])
+        {
+            printf("Error opening %s\n", names[first + l]);
+            batch->results[first + l].missing = true;
+            continue;
+        }
+        group->active |= 1u << l;
+        if(group->memory_len[l] > group->words)
+            group->words = group->memory_len[l];
+    }
+
+    group->memory = (int*)calloc((size_t)group->words * BATCH_LANES, sizeof(int));
+    if(!group->memory)
+    {
+        printf("Error allocating the memory of a group\n");
+        exit(1);
+    }
+    for(int l = 0; l < BATCH_LANES; l++)
+    {
+        for(int w = 0; w < group->memory_len[l]; w++)
+            group->memory[w * BATCH_LANES + l] = images[l][w];
+        free(images[l]);
+    }
+    for(int r = 0; r < NUM_REGS; r++)
+        for(int l = 0; l < BATCH_LANES; l++)
+            group->regs[r][l] = batch->start_regs[r];
+}
+
+int batch_run(const char* filename, const SimConfig* config)
+{
+    struct timespec start, end;
+    char** names;
+
+    SimConfig base = *config;
+    if(base.bptrace_file[0] || base.addrtrace_file[0] || base.intervals_file[0] || base.whatif_features)
+        printf("Traces are not recorded in batch runs, ignored\n");
+    base.bptrace_file[0] = '\0';
+    base.addrtrace_file[0] = '\0';
+    base.intervals_file[0] = '\0';
+    base.whatif_features = 0;
+    base.extrapolate = false;
+
+    int count = parse_inputs(config->batch_file, &names);
+    if(count < 0)
+        return -1;
+
+    char* program = read_text(filename);
+    CPU* cpu = program ? CPU_init_buffers(program, NULL, 0, &base) : NULL;
+    free(program);
+    if(!cpu)
+    {
+        printf("Error loading %s\n", filename);
+        exit(1);
+    }
+
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.kernels = select_kernels(config->batch_isa);
+    batch.cpu = cpu;
+    batch.count = cpu->tot_instructions;
+    batch.ops = decode_ops(cpu);
+    batch.budget = config->longrun ? LLONG_MAX : (long long)MAX_CPU_CYCLES * 1000;
+    batch.start_pc = cpu->pc / 7;
+    for(int r = 0; r < NUM_REGS; r++)
+        batch.start_regs[r] = cpu->regs[r].value;
+    batch.results = (BatchResult*)calloc(count > 0 ? count : 1, sizeof(BatchResult));
+    BatchGroup* group = (BatchGroup*)aligned_alloc(64, sizeof(BatchGroup));
+    if(!batch.ops || !batch.results || !group)
+    {
+        printf("Error allocating the batch\n");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int first = 0; first < count; first += BATCH_LANES)
+    {
+        load_group(&batch, group, names, first, count);
+        run_group(&batch, group);
+        free(group->memory);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long long instructions = batch.lockstep_instructions + batch.scalar_instructions;
+
+    if(DEBUG_STATS)
+    {
+        printf("%6s %-18s %12s %9s %-8s  %s\n", "inst", "status", "instructions", "memory", "mode", "input");
+        for(int i = 0; i < count; i++)
+        {
+            BatchResult* r = &batch.results[i];
+            if(r->missing)
+            {
+                printf("%6d %-18s %12s %9s %-8s  %s\n", i, "no input", "-", "-", "-", names[i]);
+                continue;
+            }
+            printf("%6d %-18s %12lld  %08x %-8s  %s\n", i, interp_status_name(r->status), r->instructions,
+                r->memory_hash, r->scalar ? "scalar" : "lockstep", names[i]);
+        }
+        printf("Instances: %d in groups of %d, %s kernels, %d diverged\n", count, BATCH_LANES,
+            batch.kernels->name, batch.diverged);
+        printf("Instructions: %lld, %f in lockstep\n", instructions,
+            instructions ? (double)batch.lockstep_instructions / instructions : 0.0);
+        printf("Host time: %f s, simulated instructions/sec: %f\n", seconds,
+            seconds > 0 ? instructions / seconds : 0.0);
+    }
+
+    for(int i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    free(group);
+    free(batch.results);
+    free(batch.ops);
+    CPU_stop(cpu);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+#include <stdbool.h>
+
+#define BATCH_LANES 16          // instances run in lockstep, one AVX-512 vector of ints
+#define MAX_BATCH_LINE 1024
+
+struct SimConfig;
+
+// Instruction set of the lockstep kernels
+enum batchIsa_enum {
+    batch_isa_auto,     // the widest the host supports
+    batch_isa_scalar,
+    batch_isa_avx2,
+    batch_isa_avx512,
+};
+
+bool batch_parse_isa(const char* name, enum batchIsa_enum* isa);
+
+/*
+ * Batch run. The program is run functionally once per memory image listed
+ * in config->batch_file, one file per line. BATCH_LANES instances at a
+ * time keep their registers and memory in SoA layout and execute the
+ * instructions they have in common with vector kernels; an instance whose
+ * branch goes the other way than most of its group leaves the group and
+ * finishes on the scalar interpreter. The final state of each instance
+ * is reported.
+ */
+int batch_run(const char* filename, const struct SimConfig* config);
+
+#endif
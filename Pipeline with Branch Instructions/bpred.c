@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bpred.h"
+
+static const char* bpred_names[] = { "bimodal", "gshare", "tournament", "tage" };
+
+// Default table sizes (log2 entries) when no size is given
+static const int bpred_default_bits[] = { 4, 10, 10, 10 };
+
+// History lengths of the TAGE tagged tables, shortest first
+static const int tage_history_lengths[TAGE_TABLES] = { 4, 10, 24, 60 };
+
+// Entry of a TAGE tagged table
+typedef struct TageEntry {
+    unsigned short tag;
+    signed char counter;    // 3-bit signed, taken when >= 0
+    unsigned char useful;   // 2-bit
+} TageEntry;
+
+typedef struct TageTables {
+    unsigned char *base;                // 2-bit counters
+    TageEntry *tagged[TAGE_TABLES];
+} TageTables;
+
+typedef struct TournamentTables {
+    unsigned char *local;     // bimodal 2-bit counters
+    unsigned char *global;    // gshare 2-bit counters
+    unsigned char *chooser;   // 2-bit, >= 2 selects the global component
+} TournamentTables;
+
+static unsigned int table_mask(BranchPredictor* bp)
+{
+    return (1u << bp->table_bits) - 1;
+}
+
+static void counter_update(unsigned char* counter, bool taken, unsigned char max)
+{
+    if(taken)
+    {
+        if(*counter < max)
+            (*counter)++;
+    }
+    else
+    {
+        if(*counter > 0)
+            (*counter)--;
+    }
+}
+
+/*
+ * Bimodal: 3-bit counters indexed by the instruction address, the counter
+ * predicts taken from 4 upwards (same scheme as the original PredTable).
+ */
+static bool bimodal_predict(BranchPredictor* bp, unsigned int pc, unsigned long long history)
+{
+    unsigned char* counters = bp->tables;
+    return counters[(pc >> 2) & table_mask(bp)] >= 4;
+}
+
+static void bimodal_update(BranchPredictor* bp, unsigned int pc, unsigned long long history, bool taken)
+{
+    unsigned char* counters = bp->tables;
+    counter_update(&counters[(pc >> 2) & table_mask(bp)], taken, 7);
+}
+
+/*
+ * Gshare: 2-bit counters indexed by the address xor the global history.
+ */
+static unsigned int gshare_index(BranchPredictor* bp, unsigned int pc, unsigned long long history)
+{
+    return ((pc >> 2) ^ (unsigned int)history) & table_mask(bp);
+}
+
+static bool gshare_predict(BranchPredictor* bp, unsigned int pc, unsigned long long history)
+{
+    unsigned char* counters = bp->tables;
+    return counters[gshare_index(bp, pc, history)] >= 2;
+}
+
+static void gshare_update(BranchPredictor* bp, unsigned int pc, unsigned long long history, bool taken)
+{
+    unsigned char* counters = bp->tables;
+    counter_update(&counters[gshare_index(bp, pc, history)], taken, 3);
+}
+
+/*
+ * Tournament: bimodal and gshare components, a per-address chooser learns
+ * which one to trust.
+ */
+static bool tournament_predict(BranchPredictor* bp, unsigned int pc, unsigned long long history)
+{
+    TournamentTables* tables = bp->tables;
+    unsigned int index = (pc >> 2) & table_mask(bp);
+
+    if(tables->chooser[index] >= 2)
+        return tables->global[gshare_index(bp, pc, history)] >= 2;
+    return tables->local[index] >= 2;
+}
+
+static void tournament_update(BranchPredictor* bp, unsigned int pc, unsigned long long history, bool taken)
+{
+    TournamentTables* tables = bp->tables;
+    unsigned int index = (pc >> 2) & table_mask(bp);
+    unsigned char* local = &tables->local[index];
+    unsigned char* global = &tables->global[gshare_index(bp, pc, history)];
+    bool local_correct = (*local >= 2) == taken;
+    bool global_correct = (*global >= 2) == taken;
+
+    if(local_correct != global_correct)
+        counter_update(&tables->chooser[index], global_correct, 3);
+
+    counter_update(local, taken, 3);
+    counter_update(global, taken, 3);
+}
+
+/*
+ * Folds the newest length bits of the history into bits bits.
+ */
+static unsigned int fold_history(unsigned long long history, int length, int bits)
+{
+    unsigned long long value = length >= 64 ? history : history & ((1ull << length) - 1);
+    unsigned int folded = 0;
+
+    while(length > 0)
+    {
+        folded ^= (unsigned int)(value & ((1ull << bits) - 1));
+        value >>= bits;
+        length -= bits;
+    }
+    return folded;
+}
+
+static unsigned int tage_index(BranchPredictor* bp, int table, unsigned int pc, unsigned long long history)
+{
+    unsigned int addr = pc >> 2;
+    return (addr ^ (addr >> bp->table_bits)
+        ^ fold_history(history, tage_history_lengths[table], bp->table_bits)) & table_mask(bp);
+}
+
+static unsigned short tage_tag(int table, unsigned int pc, unsigned long long history)
+{
+    int length = tage_history_lengths[table];
+    unsigned int tag = (pc >> 2) ^ fold_history(history, length, TAGE_TAG_BITS)
+        ^ (fold_history(history, length, TAGE_TAG_BITS - 1) << 1);
+    return tag & ((1u << TAGE_TAG_BITS) - 1);
+}
+
+/*
+ * Finds the longest matching table (provider) and the next one below it
+ * (alternate), -1 stands for the base predictor.
+ */
+static void tage_lookup(BranchPredictor* bp, unsigned int pc, unsigned long long history,
+    int* provider, int* alternate)
+{
+    TageTables* tables = bp->tables;
+
+    *provider = -1;
+    *alternate = -1;
+    for(int table = TAGE_TABLES - 1; table >= 0; table--)
+    {
+        TageEntry* entry = &tables->tagged[table][tage_index(bp, table, pc, history)];
+        if(entry->tag == tage_tag(table, pc, history))
+        {
+            if(*provider < 0)
+                *provider = table;
+            else
+            {
+                *alternate = table;
+                break;
+            }
+        }
+    }
+}
+
+static bool tage_component_predict(BranchPredictor* bp, int table, unsigned int pc, unsigned long long history)
+{
+    TageTables* tables = bp->tables;
+
+    if(table < 0)
+        return tables->base[(pc >> 2) & table_mask(bp)] >= 2;
+    return tables->tagged[table][tage_index(bp, table, pc, history)].counter >= 0;
+}
+
+static bool tage_predict(BranchPredictor* bp, unsigned int pc, unsigned long long history)
+{
+    int provider, alternate;
+    tage_lookup(bp, pc, history, &provider, &alternate);
+    return tage_component_predict(bp, provider, pc, history);
+}
+
+static void tage_update(BranchPredictor* bp, unsigned int pc, unsigned long long history, bool taken)
+{
+    TageTables* tables = bp->tables;
+    int provider, alternate;
+
+    tage_lookup(bp, pc, history, &provider, &alternate);
+    bool prediction = tage_component_predict(bp, provider, pc, history);
+    bool alt_prediction = tage_component_predict(bp, alternate, pc, history);
+
+    if(provider >= 0)
+    {
+        TageEntry* entry = &tables->tagged[provider][tage_index(bp, provider, pc, history)];
+
+        if(prediction != alt_prediction)
+        {
+            if(prediction == taken && entry->useful < 3)
+                entry->useful++;
+            else if(prediction != taken && entry->useful > 0)
+                entry->useful--;
+        }
+
+        if(taken && entry->counter < 3)
+            entry->counter++;
+        else if(!taken && entry->counter > -4)
+            entry->counter--;
+    }
+    else
+        counter_update(&tables->base[(pc >> 2) & table_mask(bp)], taken, 3);
+
+    // On a misprediction allocate one entry in a longer history table
+    if(prediction != taken && provider < TAGE_TABLES - 1)
+    {
+        bool allocated = false;
+        for(int table = provider + 1; table < TAGE_TABLES && !allocated; table++)
+        {
+            TageEntry* entry = &tables->tagged[table][tage_index(bp, table, pc, history)];
+            if(entry->useful == 0)
+            {
+                entry->tag = tage_tag(table, pc, history);
+                entry->counter = taken ? 0 : -1;
+                allocated = true;
+            }
+        }
+        if(!allocated)
+        {
+            for(int table = provider + 1; table < TAGE_TABLES; table++)
+            {
+                TageEntry* entry = &tables->tagged[table][tage_index(bp, table, pc, history)];
+                if(entry->useful > 0)
+                    entry->useful--;
+            }
+        }
+    }
+
+    // Periodically age the useful bits so stale entries can be replaced
+    if(++bp->branches_seen % TAGE_USEFUL_RESET == 0)
+    {
+        for(int table = 0; table < TAGE_TABLES; table++)
+            for(unsigned int i = 0; i <= table_mask(bp); i++)
+                tables->tagged[table][i].useful >>= 1;
+    }
+}
+
+/*
+ * This function allocates a predictor of the given type from arena,
+ * table_bits <= 0 selects the default size of that type. It returns NULL
+ * when table_bits is above BPRED_MAX_TABLE_BITS or any table could not be
+ * allocated.
+ */
+BranchPredictor* bpred_create(Arena* arena, enum bpredType_enum type, int table_bits)
+{
+    if(table_bits > BPRED_MAX_TABLE_BITS)
+        return NULL;
+
+    BranchPredictor* bp = (BranchPredictor*)arena_alloc(arena, sizeof(BranchPredictor));
+    if (!bp) {
+        return NULL;
+    }
+
+    bp->arena = arena;
+    bp->type = type;
+    bp->table_bits = table_bits > 0 ? table_bits : bpred_default_bits[type];
+    size_t entries = (size_t)1 << bp->table_bits;
+
+    switch (type)
+    {
+    case bpred_bimodal:
+        bp->tables = arena_alloc(arena, entries);
+        if(bp->tables)
+            memset(bp->tables, 3, entries);   // weakly not taken
+        bp->predict = bimodal_predict;
+        bp->update = bimodal_update;
+        break;
+    case bpred_gshare:
+        bp->tables = arena_alloc(arena, entries);
+        if(bp->tables)
+            memset(bp->tables, 1, entries);
+        bp->predict = gshare_predict;
+        bp->update = gshare_update;
+        break;
+    case bpred_tournament:
+    {
+        TournamentTables* tables = arena_alloc(arena, sizeof(TournamentTables));
+        if(tables)
+        {
+            tables->local = arena_alloc(arena, entries);
+            tables->global = arena_alloc(arena, entries);
+            tables->chooser = arena_alloc(arena, entries);
+            if(!tables->local || !tables->global || !tables->chooser)
+            {
+                arena_release(arena, tables->local);
+                arena_release(arena, tables->global);
+                arena_release(arena, tables->chooser);
+                arena_release(arena, tables);
+                tables = NULL;
+            }
+            else
+            {
+                memset(tables->local, 1, entries);
+                memset(tables->global, 1, entries);
+                memset(tables->chooser, 1, entries);
+            }
+        }
+        bp->tables = tables;
+        bp->predict = tournament_predict;
+        bp->update = tournament_update;
+        break;
+    }
+    case bpred_tage:
+    {
+        TageTables* tables = arena_alloc(arena, sizeof(TageTables));
+        if(tables)
+        {
+            bool complete = (tables->base = arena_alloc(arena, entries)) != NULL;
+            for(int table = 0; table < TAGE_TABLES; table++)
+            {
+                tables->tagged[table] = arena_alloc(arena, entries * sizeof(TageEntry));
+                complete = complete && tables->tagged[table];
+            }
+            if(!complete)
+            {
+                arena_release(arena, tables->base);
+                for(int table = 0; table < TAGE_TABLES; table++)
+                    arena_release(arena, tables->tagged[table]);
+                arena_release(arena, tables);
+                tables = NULL;
+            }
+            else
+                memset(tables->base, 1, entries);
+        }
+        bp->tables = tables;
+        bp->predict = tage_predict;
+        bp->update = tage_update;
+        break;
+    }
+    }
+
+    if(!bp->tables)
+    {
+        arena_release(arena, bp);
+        return NULL;
+    }
+    return bp;
+}
+
+void bpred_free(BranchPredictor* bp)
+{
+    if(!bp)
+        return;
+
+    if(bp->type == bpred_tournament)
+    {
+        TournamentTables* tables = bp->tables;
+        arena_release(bp->arena, tables->local);
+        arena_release(bp->arena, tables->global);
+        arena_release(bp->arena, tables->chooser);
+    }
+    else if(bp->type == bpred_tage)
+    {
+        TageTables* tables = bp->tables;
+        arena_release(bp->arena, tables->base);
+        for(int table = 0; table < TAGE_TABLES; table++)
+            arena_release(bp->arena, tables->tagged[table]);
+    }
+    arena_release(bp->arena, bp->tables);
+    arena_release(bp->arena, bp);
+}
+
+/*
+ * Direction prediction at fetch, pc is the instruction byte address.
+ */
+bool bpred_predict(BranchPredictor* bp, unsigned int pc)
+{
+    return bp->predict(bp, pc, bp->history);
+}
+
+/*
+ * Shifts the direction fetch followed into the speculative history.
+ */
+void bpred_speculate(BranchPredictor* bp, bool taken)
+{
+    bp->history = (bp->history << 1) | taken;
+}
+
+/*
+ * Trains the predictor when the branch resolves. history is the checkpoint
+ * taken before the branch was predicted.
+ */
+void bpred_update(BranchPredictor* bp, unsigned int pc, unsigned long long history, bool predicted, bool taken)
+{
+    bp->predictions++;
+    if(predicted != taken)
+        bp->mispredictions++;
+    bp->update(bp, pc, history, taken);
+}
+
+/*
+ * Rebuilds the speculative history after a flush: the checkpoint of the
+ * resolved branch followed by its real direction.
+ */
+void bpred_recover(BranchPredictor* bp, unsigned long long history, bool taken)
+{
+    bp->history = (history << 1) | taken;
+}
+
+bool bpred_parse_type(const char* name, enum bpredType_enum* type)
+{
+    for(int i = bpred_bimodal; i <= bpred_tage; i++)
+    {
+        if(strcmp(name, bpred_names[i]) == 0)
+        {
+            *type = (enum bpredType_enum)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static unsigned long long hash_bytes(unsigned long long hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+/*
+ * Folds everything that decides future predictions into hash: the tables
+ * and the history bits the predictor indexes with. Statistics are left out.
+ */
+unsigned long long bpred_state_hash(BranchPredictor* bp, unsigned long long hash)
+{
+    size_t entries = (size_t)1 << bp->table_bits;
+    unsigned long long history = bp->history & bpred_history_mask(bp);
+
+    hash = hash_bytes(hash, &history, sizeof(history));
+    switch (bp->type)
+    {
+    case bpred_bimodal:
+    case bpred_gshare:
+        hash = hash_bytes(hash, bp->tables, entries);
+        break;
+    case bpred_tournament:
+    {
+        TournamentTables* tables = bp->tables;
+        hash = hash_bytes(hash, tables->local, entries);
+        hash = hash_bytes(hash, tables->global, entries);
+        hash = hash_bytes(hash, tables->chooser, entries);
+        break;
+    }
+    case bpred_tage:
+    {
+        TageTables* tables = bp->tables;
+        hash = hash_bytes(hash, tables->base, entries);
+        for(int table = 0; table < TAGE_TABLES; table++)
+            hash = hash_bytes(hash, tables->tagged[table], entries * sizeof(TageEntry));
+        break;
+    }
+    }
+    return hash;
+}
+
+/*
+ * History bits that reach an index or a tag, the rest never changes a
+ * prediction.
+ */
+unsigned long long bpred_history_mask(BranchPredictor* bp)
+{
+    switch (bp->type)
+    {
+    case bpred_bimodal:
+        return 0;
+    case bpred_gshare:
+    case bpred_tournament:
+        return bp->table_bits >= 32 ? 0xffffffffull : (1ull << bp->table_bits) - 1;
+    case bpred_tage:
+        break;
+    }
+    return (1ull << tage_history_lengths[TAGE_TABLES - 1]) - 1;
+}
+
+/*
+ * Updates left before the periodic TAGE reset, -1 when the predictor has
+ * no time dependent behaviour.
+ */
+long long bpred_updates_before_reset(BranchPredictor* bp)
+{
+    if(bp->type != bpred_tage)
+        return -1;
+    return TAGE_USEFUL_RESET - 1 - bp->branches_seen % TAGE_USEFUL_RESET;
+}
+
+const char* bpred_name(enum bpredType_enum type)
+{
+    return bpred_names[type];
+}
+
+/*
+ * This function prints direction prediction accuracy and MPKI.
+ */
+void bpred_print_stats(BranchPredictor* bp, long long instructions)
+{
+    printf("Branch predictor: %s, %d entries per table\n", bpred_name(bp->type), 1 << bp->table_bits);
+    printf("Branches predicted: %lld, mispredicted: %lld\n", bp->predictions, bp->mispredictions);
+    printf("Prediction accuracy: %f, MPKI: %f\n",
+        bp->predictions ? 1.0 - (double)bp->mispredictions / bp->predictions : 0.0,
+        instructions ? (double)bp->mispredictions * 1000.0 / instructions : 0.0);
+}
@@ -0,0 +1,56 @@
+#ifndef _BPRED_H_
+#define _BPRED_H_
+#include <stdbool.h>
+#include "arena.h"
+
+#define BPRED_MAX_TABLE_BITS 24   // largest table, 16M entries
+#define TAGE_TABLES 4          // tagged components of TAGE
+#define TAGE_TAG_BITS 9
+#define TAGE_USEFUL_RESET 256000   // branches between resets of the useful bits
+
+enum bpredType_enum {
+    bpred_bimodal,      // 3-bit counters indexed by pc
+    bpred_gshare,       // 2-bit counters indexed by pc xor global history
+    bpred_tournament,   // bimodal and gshare with a per-pc chooser
+    bpred_tage,         // bimodal base plus tagged geometric history tables
+};
+
+/*
+ * Direction predictor interface. predict is called at fetch and returns the
+ * direction, the caller then shifts the direction it actually followed into
+ * the speculative history with bpred_speculate. update is called when the
+ * branch resolves with the history checkpoint taken at fetch, and
+ * bpred_recover repairs the history after a flush.
+ */
+typedef struct BranchPredictor {
+    enum bpredType_enum type;
+    int table_bits;                 // log2 of the entries of each table
+    unsigned long long history;     // speculative global history, newest bit 0
+
+    bool (*predict)(struct BranchPredictor* bp, unsigned int pc, unsigned long long history);
+    void (*update)(struct BranchPredictor* bp, unsigned int pc, unsigned long long history, bool taken);
+    void *tables;                   // predictor specific state
+    long long branches_seen;        // drives periodic TAGE resets
+
+    long long predictions;
+    long long mispredictions;
+    Arena *arena;                   // NULL: tables are on the heap
+} BranchPredictor;
+
+BranchPredictor* bpred_create(Arena* arena, enum bpredType_enum type, int table_bits);
+void bpred_free(BranchPredictor* bp);
+
+bool bpred_predict(BranchPredictor* bp, unsigned int pc);
+void bpred_speculate(BranchPredictor* bp, bool taken);
+void bpred_update(BranchPredictor* bp, unsigned int pc, unsigned long long history, bool predicted, bool taken);
+void bpred_recover(BranchPredictor* bp, unsigned long long history, bool taken);
+
+unsigned long long bpred_state_hash(BranchPredictor* bp, unsigned long long hash);
+unsigned long long bpred_history_mask(BranchPredictor* bp);
+long long bpred_updates_before_reset(BranchPredictor* bp);
+
+bool bpred_parse_type(const char* name, enum bpredType_enum* type);
+const char* bpred_name(enum bpredType_enum type);
+void bpred_print_stats(BranchPredictor* bp, long long instructions);
+
+#endif
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bptrace.h"
+
+#define BPTRACE_HEADER_SIZE 24
+#define BPTRACE_RECORD_SIZE 9
+
+static void put_u32(unsigned char* buf, unsigned int value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = (value >> 8) & 0xff;
+    buf[2] = (value >> 16) & 0xff;
+    buf[3] = (value >> 24) & 0xff;
+}
+
+static unsigned int get_u32(const unsigned char* buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned int)buf[3] << 24);
+}
+
+static void put_u64(unsigned char* buf, unsigned long long value)
+{
+    put_u32(buf, (unsigned int)(value & 0xffffffffu));
+    put_u32(buf + 4, (unsigned int)(value >> 32));
+}
+
+static unsigned long long get_u64(const unsigned char* buf)
+{
+    return get_u32(buf) | ((unsigned long long)get_u32(buf + 4) << 32);
+}
+
+static void write_header(FILE* file, long long branches, long long instructions)
+{
+    unsigned char buf[BPTRACE_HEADER_SIZE];
+
+    put_u32(buf, BPTRACE_MAGIC);
+    put_u32(buf + 4, BPTRACE_VERSION);
+    put_u64(buf + 8, (unsigned long long)branches);
+    put_u64(buf + 16, (unsigned long long)instructions);
+    fwrite(buf, BPTRACE_HEADER_SIZE, 1, file);
+}
+
+/*
+ * This function creates a branch trace file, returns NULL if it cannot be
+ * opened.
+ */
+BPTraceWriter* bptrace_open(const char* filename)
+{
+    BPTraceWriter* writer = (BPTraceWriter*)calloc(1, sizeof(BPTraceWriter));
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->file = fopen(filename, "wb");
+    if (writer->file == NULL) {
+        printf("Error opening branch trace file %s\n", filename);
+        free(writer);
+        return NULL;
+    }
+
+    // Counts are filled in by bptrace_close
+    write_header(writer->file, 0, 0);
+    return writer;
+}
+
+void bptrace_write(BPTraceWriter* writer, const BPTraceRecord* record)
+{
+    unsigned char buf[BPTRACE_RECORD_SIZE];
+
+    put_u32(buf, record->pc);
+    put_u32(buf + 4, record->target);
+    buf[8] = (record->opcode & 0x7f) | (record->taken ? 0x80 : 0);
+    fwrite(buf, BPTRACE_RECORD_SIZE, 1, writer->file);
+    writer->branches++;
+}
+
+void bptrace_close(BPTraceWriter* writer, long long instructions)
+{
+    if(!writer)
+        return;
+
+    rewind(writer->file);
+    write_header(writer->file, writer->branches, instructions);
+    fclose(writer->file);
+    free(writer);
+}
+
+/*
+ * This function opens a branch trace for reading in pieces and fills in
+ * its header, returns NULL on a missing or malformed file. The branch
+ * count of a file cut short is lowered to the records it holds.
+ */
+BPTraceReader* bptrace_reader_open(const char* filename, BPTraceHeader* header)
+{
+    unsigned char buf[BPTRACE_HEADER_SIZE];
+
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("Error opening branch trace file %s\n", filename);
+        return NULL;
+    }
+
+    bool valid = fread(buf, BPTRACE_HEADER_SIZE, 1, file) == 1;
+    if(valid)
+    {
+        header->magic = get_u32(buf);
+        header->version = get_u32(buf + 4);
+        header->branches = (long long)get_u64(buf + 8);
+        header->instructions = (long long)get_u64(buf + 16);
+        valid = header->magic == BPTRACE_MAGIC && header->version == BPTRACE_VERSION
+            && header->branches >= 0 && header->instructions >= 0;
+    }
+    if(!valid)
+    {
+        printf("Error: %s is not a branch trace\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    BPTraceReader* reader = (BPTraceReader*)calloc(1, sizeof(BPTraceReader));
+    if (!reader) {
+        fclose(file);
+        return NULL;
+    }
+
+    long long held = header->branches;
+    if(fseek(file, 0, SEEK_END) == 0)
+    {
+        long size = ftell(file);
+        if(size >= BPTRACE_HEADER_SIZE)
+            held = (size - BPTRACE_HEADER_SIZE) / BPTRACE_RECORD_SIZE;
+        fseek(file, BPTRACE_HEADER_SIZE, SEEK_SET);
+    }
+    if(held < header->branches)
+    {
+        printf("Warning: %s holds %lld of %lld branches\n", filename, held, header->branches);
+        header->branches = held;
+    }
+
+    reader->file = file;
+    reader->remaining = header->branches;
+    return reader;
+}
+
+/*
+ * This function reads up to max records, returns how many it read, 0 at
+ * the end of the trace.
+ */
+int bptrace_read(BPTraceReader* reader, BPTraceRecord* records, int max)
+{
+    unsigned char buf[BPTRACE_RECORD_SIZE];
+    int count = 0;
+
+    while(count < max && reader->remaining > 0 && fread(buf, BPTRACE_RECORD_SIZE, 1, reader->file) == 1)
+    {
+        records[count].pc = get_u32(buf);
+        records[count].target = get_u32(buf + 4);
+        records[count].opcode = buf[8] & 0x7f;
+        records[count].taken = (buf[8] & 0x80) != 0;
+        reader->remaining--;
+        count++;
+    }
+    return count;
+}
+
+void bptrace_reader_close(BPTraceReader* reader)
+{
+    if(!reader)
+        return;
+
+    fclose(reader->file);
+    free(reader);
+}
@@ -0,0 +1,46 @@
+#ifndef _BPTRACE_H_
+#define _BPTRACE_H_
+#include <stdbool.h>
+#include <stdio.h>
+
+#define BPTRACE_MAGIC 0x52545042u   // "BPTR"
+#define BPTRACE_VERSION 1
+
+/*
+ * Branch trace file: a 24 byte header followed by one 9 byte record per
+ * resolved branch, all little endian. The header counts are patched when
+ * the trace is closed.
+ */
+typedef struct BPTraceHeader {
+    unsigned int magic;
+    unsigned int version;
+    long long branches;
+    long long instructions;    // retired instructions of the traced run, for MPKI
+} BPTraceHeader;
+
+typedef struct BPTraceRecord {
+    unsigned int pc;           // branch byte address
+    unsigned int target;       // taken target byte address
+    unsigned char opcode;      // opcodeFmt_enum value
+    bool taken;                // outcome derived from src1_value
+} BPTraceRecord;
+
+typedef struct BPTraceWriter {
+    FILE *file;
+    long long branches;
+} BPTraceWriter;
+
+typedef struct BPTraceReader {
+    FILE *file;
+    long long remaining;       // records left to read
+} BPTraceReader;
+
+BPTraceWriter* bptrace_open(const char* filename);
+void bptrace_write(BPTraceWriter* writer, const BPTraceRecord* record);
+void bptrace_close(BPTraceWriter* writer, long long instructions);
+
+BPTraceReader* bptrace_reader_open(const char* filename, BPTraceHeader* header);
+int bptrace_read(BPTraceReader* reader, BPTraceRecord* records, int max);
+void bptrace_reader_close(BPTraceReader* reader);
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "btb.h"
+
+static int get_index_by_pc(BTB* btb, unsigned int pc)
+{
+    return (pc >> 2) & (btb->num_sets - 1);
+}
+
+/*
+ * Tag of a branch address, the bits above the index and byte offset,
+ * truncated to tag_bits when partial tags are configured.
+ */
+static int get_tag_by_pc(BTB* btb, unsigned int pc)
+{
+    unsigned int tag = pc >> (2 + btb->index_bits);
+    if(btb->tag_bits > 0 && btb->tag_bits < 31)
+        tag &= (1u << btb->tag_bits) - 1;
+    return (int)tag;
+}
+
+static BTBEntry* find_entry(BTB* btb, unsigned int pc)
+{
+    BTBEntry* set = &btb->table[get_index_by_pc(btb, pc) * btb->assoc];
+    int tag = get_tag_by_pc(btb, pc);
+
+    for(int way = 0; way < btb->assoc; way++)
+    {
+        if(set[way].tag == tag)
+            return &set[way];
+    }
+    return NULL;
+}
+
+/*
+ * This function allocates a BTB, entries and assoc are expected to be powers
+ * of two.
+ */
+BTB* btb_create(Arena* arena, int entries, int assoc, int tag_bits)
+{
+    BTB* btb = (BTB*)arena_alloc(arena, sizeof(BTB));
+    if (!btb) {
+        return NULL;
+    }
+    btb->arena = arena;
+
+    if(assoc < 1)
+        assoc = 1;
+    if(entries < assoc)
+        entries = assoc;
+
+    btb->entries = entries;
+    btb->assoc = assoc;
+    btb->num_sets = entries / assoc;
+    while((1 << btb->index_bits) < btb->num_sets)
+        btb->index_bits++;
+    btb->tag_bits = tag_bits;
+
+    btb->table = (BTBEntry*)arena_alloc(arena, entries * sizeof(BTBEntry));
+    if(!btb->table)
+    {
+        arena_release(arena, btb);
+        return NULL;
+    }
+    for(int i = 0; i < entries; i++)
+    {
+        btb->table[i].tag = -1;
+        btb->table[i].target = -1;
+    }
+    return btb;
+}
+
+void btb_free(BTB* btb)
+{
+    if(!btb)
+        return;
+    arena_release(btb->arena, btb->table);
+    arena_release(btb->arena, btb);
+}
+
+/*
+ * Lookup at fetch, returns true and the target when an entry matches.
+ */
+bool btb_lookup(BTB* btb, unsigned int pc, int* target)
+{
+    BTBEntry* entry = find_entry(btb, pc);
+
+    btb->lookups++;
+    if(!entry)
+        return false;
+
+    btb->hits++;
+    if(entry->pc != pc)
+        btb->alias_hits++;
+    entry->stamp = ++btb->stamp;
+    *target = entry->target;
+    return true;
+}
+
+bool btb_contains(BTB* btb, unsigned int pc)
+{
+    return find_entry(btb, pc) != NULL;
+}
+
+/*
+ * Called when the branch resolves, installs or refreshes its target
+ * replacing the least recently used entry of the set.
+ */
+void btb_update(BTB* btb, unsigned int pc, int target)
+{
+    BTBEntry* entry = find_entry(btb, pc);
+
+    if(!entry)
+    {
+        BTBEntry* set = &btb->table[get_index_by_pc(btb, pc) * btb->assoc];
+        entry = &set[0];
+        for(int way = 0; way < btb->assoc; way++)
+        {
+            if(set[way].tag == -1)
+            {
+                entry = &set[way];
+                break;
+            }
+            if(set[way].stamp < entry->stamp)
+                entry = &set[way];
+        }
+        if(entry->tag != -1)
+            btb->conflict_evictions++;
+        entry->tag = get_tag_by_pc(btb, pc);
+    }
+
+    entry->pc = pc;
+    entry->target = target;
+    entry->stamp = ++btb->stamp;
+}
+
+static unsigned long long hash_int(unsigned long long hash, int value)
+{
+    for(int i = 0; i < 4; i++)
+        hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 1099511628211ull;
+    return hash;
+}
+
+/*
+ * Folds the contents of the BTB into hash. Stamps only matter through the
+ * LRU order inside each set, so each entry contributes its rank instead.
+ */
+unsigned long long btb_state_hash(BTB* btb, unsigned long long hash)
+{
+    for(int i = 0; i < btb->entries; i++)
+    {
+        BTBEntry* entry = &btb->table[i];
+        BTBEntry* set = &btb->table[i / btb->assoc * btb->assoc];
+        int rank = 0;
+
+        for(int way = 0; way < btb->assoc; way++)
+            if(set[way].stamp > entry->stamp)
+                rank++;
+
+        hash = hash_int(hash, entry->tag);
+        hash = hash_int(hash, entry->target);
+        hash = hash_int(hash, (int)entry->pc);
+        hash = hash_int(hash, rank);
+    }
+    return hash;
+}
+
+/*
+ * This function prints the content of the btb table used for debugging.
+ */
+void btb_print(BTB* btb)
+{
+    printf("\n============ BTB =================================\n\n");
+    for (int i=0; i<btb->entries; i++) {
+        printf("|	 BTB[%2d]	|	TAG=%d   |   TARGET=%d   |\n",i,btb->table[i].tag,btb->table[i].target);
+    }
+}
+
+/*
+ * This function prints BTB hit rate and aliasing, independent of the
+ * direction predictor.
+ */
+void btb_print_stats(BTB* btb)
+{
+    printf("BTB: %d entries, %d ways, %s tags\n", btb->entries, btb->assoc,
+        btb->tag_bits > 0 ? "partial" : "full");
+    printf("BTB lookups: %lld, hits: %lld, hit rate: %f\n", btb->lookups, btb->hits,
+        btb->lookups ? (double)btb->hits / btb->lookups : 0.0);
+    printf("BTB aliasing: %lld hits on another branch's entry, %lld conflict evictions\n",
+        btb->alias_hits, btb->conflict_evictions);
+}
@@ -0,0 +1,43 @@
+#ifndef _BTB_H_
+#define _BTB_H_
+#include <stdbool.h>
+#include "arena.h"
+
+// BTB table entry to store instruction tag and target instruction address
+typedef struct BTBEntry{
+    int tag;
+    int target;
+    unsigned int pc;            // full branch address, only used to detect aliasing
+    unsigned long long stamp;   // last use, for LRU inside a set
+} BTBEntry;
+
+/* Set-associative branch target buffer indexed by instruction byte address */
+typedef struct BTB {
+    int entries;
+    int assoc;
+    int num_sets;
+    int index_bits;
+    int tag_bits;               // 0 keeps the full tag
+    BTBEntry *table;            // num_sets * assoc, set major
+    unsigned long long stamp;
+
+    long long lookups;
+    long long hits;
+    long long alias_hits;       // tag matched but the entry belongs to another branch
+    long long conflict_evictions;   // valid entry of another branch replaced
+    Arena *arena;               // NULL: allocated on the heap
+} BTB;
+
+BTB* btb_create(Arena* arena, int entries, int assoc, int tag_bits);
+void btb_free(BTB* btb);
+
+bool btb_lookup(BTB* btb, unsigned int pc, int* target);
+bool btb_contains(BTB* btb, unsigned int pc);
+void btb_update(BTB* btb, unsigned int pc, int target);
+
+unsigned long long btb_state_hash(BTB* btb, unsigned long long hash);
+
+void btb_print(BTB* btb);
+void btb_print_stats(BTB* btb);
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bypass.h"
+
+// Names of the stages, NULL for those that cannot be a path source
+static const char* path_names[] = { "add", "mul", "div", NULL, NULL, "mem2", "wb" };
+
+/*
+ * This function parses --bypass, a comma separated list of add, mul, div,
+ * mem2 and wb, or none. Each names the stage a path forwards from, not
+ * the instructions it carries. A bare --bypass enables all of them.
+ */
+bool bypass_parse_paths(const char* value, unsigned int* paths)
+{
+    char token[16];
+
+    *paths = 0;
+    if(strcmp(value, "1") == 0 || strcmp(value, "all") == 0)
+    {
+        *paths = BYPASS_ALL_PATHS;
+        return true;
+    }
+    if(strcmp(value, "0") == 0 || strcmp(value, "none") == 0)
+        return true;
+
+    while(*value)
+    {
+        size_t len = strcspn(value, ",");
+        int s;
+        if(len >= sizeof(token))
+            return false;
+        memcpy(token, value, len);
+        token[len] = '\0';
+        for(s = 0; s < bypass_stage_cnt && !(path_names[s] && strcmp(token, path_names[s]) == 0); s++);
+        if(s == bypass_stage_cnt)
+            return false;
+        *paths |= BYPASS_PATH(s);
+        value += len + (value[len] == ',');
+    }
+    return true;
+}
+
+void bypass_init(BypassStats* stats, unsigned int paths)
+{
+    memset(stats, 0, sizeof(BypassStats));
+    stats->paths = paths;
+}
+
+/*
+ * Cycles an operand forwarded from stage would have waited without that
+ * path: the producer moves one stage a cycle until an enabled path at or
+ * after result_stage carries it, or until it has been written back.
+ */
+int bypass_saved(unsigned int paths, int stage, int result_stage)
+{
+    for(int s = stage + 1; s < bypass_stage_cnt; s++)
+        if(s >= result_stage && (paths & BYPASS_PATH(s)))
+            return s - stage;
+    return bypass_stage_cnt - stage;
+}
+
+// Adds times the change from one snapshot of the statistics to another
+void bypass_extrapolate(BypassStats* stats, const BypassStats* from, const BypassStats* to, long long times)
+{
+    for(int s = 0; s < bypass_stage_cnt; s++)
+    {
+        stats->uses[s] += times * (to->uses[s] - from->uses[s]);
+        stats->saved[s] += times * (to->saved[s] - from->saved[s]);
+    }
+    for(int r = 0; r <= bypass_stall_load; r++)
+        stats->stalls[r] += times * (to->stalls[r] - from->stalls[r]);
+}
+
+void bypass_print_stats(const BypassStats* stats)
+{
+    printf("Bypass paths from stages:");
+    for(int s = 0; s < bypass_stage_cnt; s++)
+        if(stats->paths & BYPASS_PATH(s))
+            printf(" %s", path_names[s]);
+    printf("%s\n", stats->paths ? "" : " none");
+
+    for(int s = 0; s < bypass_stage_cnt; s++)
+        if(stats->paths & BYPASS_PATH(s))
+            printf("Bypass from %s stage: %lld operands, %lld stall cycles avoided\n", path_names[s], stats->uses[s],
+                stats->saved[s]);
+    printf("Data hazard stalls: %lld load-use, %lld result latency, %lld without a bypass path\n",
+        stats->stalls[bypass_stall_load], stats->stalls[bypass_stall_latency], stats->stalls[bypass_stall_path]);
+}
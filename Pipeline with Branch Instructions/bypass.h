@@ -0,0 +1,50 @@
+#ifndef _BYPASS_H_
+#define _BYPASS_H_
+#include <stdbool.h>
+
+// Stages after RR. A bypass path forwards any computed result leaving the
+// named stage in the cycle it is read, whichever instruction produced it
+enum bypassStage_enum {
+    bypass_add,     // leaving the adder: add, sub and set results
+    bypass_mul,     // leaving MUL: mul results and those computed in the adder
+    bypass_div,     // leaving DIV: every result but load data
+    bypass_br,
+    bypass_mem1,
+    bypass_mem2,    // leaving Mem2: every result, load data included
+    bypass_wb,      // a register written back in the cycle RR reads it
+    bypass_stage_cnt
+};
+
+#define BYPASS_PATH(stage) (1u << (stage))
+#define BYPASS_ALL_PATHS (BYPASS_PATH(bypass_add) | BYPASS_PATH(bypass_mul) | BYPASS_PATH(bypass_div) \
+    | BYPASS_PATH(bypass_mem2) | BYPASS_PATH(bypass_wb))
+
+// Why an operand could not be read
+enum bypassStall_enum {
+    bypass_stall_none,
+    bypass_stall_path,      // the value exists but no enabled path carries it
+    bypass_stall_latency,   // the producer has not computed it yet
+    bypass_stall_load       // the producer is a load still before Mem2
+};
+
+/*
+ * Bypass network statistics. A use is one operand read from a path
+ * instead of the register file. The cycles saved by a use are how much
+ * longer the operand would have waited for the next enabled path or the
+ * register file; this is a first-order figure, the other operand may
+ * have hidden part of it.
+ */
+typedef struct BypassStats {
+    unsigned int paths;                     // enabled paths, BYPASS_PATH bits
+    long long uses[bypass_stage_cnt];
+    long long saved[bypass_stage_cnt];
+    long long stalls[bypass_stall_load + 1];   // RR stall cycles by their worst operand
+} BypassStats;
+
+bool bypass_parse_paths(const char* value, unsigned int* paths);
+void bypass_init(BypassStats* stats, unsigned int paths);
+int bypass_saved(unsigned int paths, int stage, int result_stage);
+void bypass_extrapolate(BypassStats* stats, const BypassStats* from, const BypassStats* to, long long times);
+void bypass_print_stats(const BypassStats* stats);
+
+#endif
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "cache.h"
+
+static int log2_int(int value)
+{
+    int bits = 0;
+    while((1 << bits) < value)
+        bits++;
+    return bits;
+}
+
+static bool power_of_two(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+/*
+ * Tells whether config describes a cache the set index arithmetic can
+ * handle: size, associativity and line size powers of two, lines of at
+ * least one word and room for at least one full set.
+ */
+bool cache_geometry_valid(const CacheConfig* config)
+{
+    return power_of_two(config->size) && power_of_two(config->assoc) && power_of_two(config->line_size)
+        && config->line_size >= 4 && config->size / config->line_size >= config->assoc;
+}
+
+/*
+ * This function allocates a cache level. Size, associativity and line size
+ * are expected to be powers of two.
+ */
+Cache* cache_create(Arena* arena, const char* name, CacheConfig config, Cache* next_level, int mem_latency)
+{
+    Cache* cache = (Cache*)arena_alloc(arena, sizeof(Cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->arena = arena;
+
+    if(config.assoc < 1)
+        config.assoc = 1;
+    if(config.line_size < 4)
+        config.line_size = 4;
+
+    cache->name = name;
+    cache->config = config;
+    cache->num_sets = config.size / (config.assoc * config.line_size);
+    if(cache->num_sets < 1)
+        cache->num_sets = 1;
+    cache->offset_bits = log2_int(config.line_size);
+    cache->index_bits = log2_int(cache->num_sets);
+    cache->next_level = next_level;
+    cache->mem_latency = mem_latency;
+
+    cache->lines = (CacheLine*)arena_alloc(arena, cache->num_sets * config.assoc * sizeof(CacheLine));
+    cache->plru_bits = (unsigned int*)arena_alloc(arena, cache->num_sets * sizeof(unsigned int));
+    if(!cache->lines || !cache->plru_bits)
+    {
+        cache_free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+/*
+ * This function de-allocates a cache level (but not the levels behind it).
+ */
+void cache_free(Cache* cache)
+{
+    if(!cache)
+        return;
+    arena_release(cache->arena, cache->lines);
+    arena_release(cache->arena, cache->plru_bits);
+    arena_release(cache->arena, cache);
+}
+
+/*
+ * Walks the PLRU tree of a set towards the least recently used way.
+ */
+static int plru_victim(Cache* cache, int set)
+{
+    unsigned int bits = cache->plru_bits[set];
+    int node = 0;
+    int way = 0;
+    for(int level = cache->config.assoc >> 1; level > 0; level >>= 1)
+    {
+        int right = (bits >> node) & 1;
+        way += right ? level : 0;
+        node = 2 * node + 1 + right;
+    }
+    return way;
+}
+
+/*
+ * Points every tree node on the path to way away from it.
+ */
+static void plru_touch(Cache* cache, int set, int way)
+{
+    unsigned int bits = cache->plru_bits[set];
+    int node = 0;
+    int base = 0;
+    for(int level = cache->config.assoc >> 1; level > 0; level >>= 1)
+    {
+        int right = way >= base + level;
+        if(right)
+        {
+            bits &= ~(1u << node);
+            base += level;
+        }
+        else
+            bits |= (1u << node);
+        node = 2 * node + 1 + right;
+    }
+    cache->plru_bits[set] = bits;
+}
+
+static void touch_line(Cache* cache, int set, int way)
+{
+    cache->lines[set * cache->config.assoc + way].stamp = ++cache->stamp;
+    if(cache->config.repl == repl_plru)
+        plru_touch(cache, set, way);
+}
+
+static int find_victim(Cache* cache, int set)
+{
+    CacheLine* ways = &cache->lines[set * cache->config.assoc];
+
+    // Invalid ways are always filled first
+    for(int way = 0; way < cache->config.assoc; way++)
+    {
+        if(!ways[way].valid)
+            return way;
+    }
+
+    if(cache->config.repl == repl_plru)
+        return plru_victim(cache, set);
+
+    int victim = 0;
+    for(int way = 1; way < cache->config.assoc; way++)
+    {
+        if(ways[way].stamp < ways[victim].stamp)
+            victim = way;
+    }
+    return victim;
+}
+
+/*
+ * Latency of going past this level: next cache level or main memory.
+ */
+static int next_level_access(Cache* cache, unsigned int addr, bool is_write)
+{
+    if(cache->next_level)
+        return cache_access(cache->next_level, addr, is_write);
+    if(cache->dram)
+        return dram_access(cache->dram, addr, is_write, cache->now + cache->config.hit_latency);
+    return cache->mem_latency;
+}
+
+/*
+ * Picks the victim way of a set and writes it back if it is dirty.
+ */
+static CacheLine* evict_line(Cache* cache, int set)
+{
+    int victim = find_victim(cache, set);
+    CacheLine* line = &cache->lines[set * cache->config.assoc + victim];
+
+    if(line->valid && line->prefetched)
+        cache->prefetch_useless++;
+
+    if(line->valid && line->dirty)
+    {
+        // Evicted dirty line goes to the next level through a writeback buffer
+        unsigned int victim_block = (line->tag << cache->index_bits) | set;
+        cache->writebacks++;
+        next_level_access(cache, victim_block << cache->offset_bits, true);
+    }
+    return line;
+}
+
+/*
+ * Returns the valid line holding addr, or NULL, without touching
+ * replacement state or statistics.
+ */
+CacheLine* cache_lookup(Cache* cache, unsigned int addr)
+{
+    unsigned int block = addr >> cache->offset_bits;
+    int set = block & (cache->num_sets - 1);
+    unsigned int tag = block >> cache->index_bits;
+    CacheLine* ways = &cache->lines[set * cache->config.assoc];
+
+    for(int way = 0; way < cache->config.assoc; way++)
+    {
+        if(ways[way].valid && ways[way].tag == tag)
+            return &ways[way];
+    }
+    return NULL;
+}
+
+/*
+ * Returns true when the line holding addr is present, without touching
+ * replacement state or statistics.
+ */
+bool cache_probe(Cache* cache, unsigned int addr)
+{
+    return cache_lookup(cache, addr) != NULL;
+}
+
+/*
+ * Evicts a victim in the set of addr and puts the line holding addr in its
+ * place, the caller accounts for the fill latency.
+ */
+static CacheLine* install_line(Cache* cache, unsigned int addr, bool is_write)
+{
+    unsigned int block = addr >> cache->offset_bits;
+    int set = block & (cache->num_sets - 1);
+    CacheLine* line = evict_line(cache, set);
+
+    line->valid = true;
+    line->tag = block >> cache->index_bits;
+    line->prefetched = false;
+    line->ready = 0;
+    line->dirty = is_write && cache->config.write_back;
+    touch_line(cache, set, line - &cache->lines[set * cache->config.assoc]);
+    return line;
+}
+
+/*
+ * This function performs one demand access and returns its latency in cycles,
+ * including the latency of every level that had to be visited on a miss.
+ */
+int cache_access(Cache* cache, unsigned int addr, bool is_write)
+{
+    unsigned int block = addr >> cache->offset_bits;
+    int set = block & (cache->num_sets - 1);
+    unsigned int tag = block >> cache->index_bits;
+    CacheLine* ways = &cache->lines[set * cache->config.assoc];
+    int latency = cache->config.hit_latency;
+
+    for(int way = 0; way < cache->config.assoc; way++)
+    {
+        if(ways[way].valid && ways[way].tag == tag)
+        {
+            // First demand reference to a prefetched line, wait for the
+            // fill if the prefetch was issued too late
+            if(ways[way].prefetched)
+            {
+                ways[way].prefetched = false;
+                cache->prefetch_useful++;
+                if(ways[way].ready > cache->now)
+                {
+                    cache->prefetch_late++;
+                    latency += ways[way].ready - cache->now;
+                }
+            }
+
+            if(is_write)
+            {
+                cache->write_hits++;
+                if(cache->config.write_back)
+                    ways[way].dirty = true;
+                else
+                    next_level_access(cache, addr, true);   // write-through is buffered
+            }
+            else
+                cache->read_hits++;
+
+            touch_line(cache, set, way);
+            return latency;
+        }
+    }
+
+    if(is_write)
+        cache->write_misses++;
+    else
+        cache->read_misses++;
+
+    // Write miss without allocation goes straight to the next level
+    if(is_write && !cache->config.write_allocate)
+    {
+        next_level_access(cache, addr, true);
+        return latency;
+    }
+
+    install_line(cache, addr, is_write);
+    latency += next_level_access(cache, addr, false);
+    if(is_write && !cache->config.write_back)
+        next_level_access(cache, addr, true);
+
+    return latency;
+}
+
+/*
+ * This function handles a demand miss whose data comes from somewhere other
+ * than the next level (another cache on the bus), fill_latency is the
+ * transfer time. Returns the latency like cache_access.
+ */
+int cache_fill(Cache* cache, unsigned int addr, bool is_write, int fill_latency)
+{
+    if(is_write)
+        cache->write_misses++;
+    else
+        cache->read_misses++;
+
+    install_line(cache, addr, is_write);
+    return cache->config.hit_latency + fill_latency;
+}
+
+/*
+ * Writes the line holding addr back to the next level if it is dirty,
+ * the line stays valid and clean.
+ */
+void cache_write_back(Cache* cache, unsigned int addr)
+{
+    CacheLine* line = cache_lookup(cache, addr);
+    if(!line || !line->dirty)
+        return;
+
+    cache->writebacks++;
+    line->dirty = false;
+    next_level_access(cache, addr, true);
+}
+
+/*
+ * This function fills the line holding addr ahead of demand. The fill does
+ * not stall anybody, the line becomes usable once the next level answered.
+ */
+void cache_prefetch(Cache* cache, unsigned int addr)
+{
+    if(cache_probe(cache, addr))
+    {
+        cache->prefetch_redundant++;
+        return;
+    }
+
+    unsigned int block = addr >> cache->offset_bits;
+    int set = block & (cache->num_sets - 1);
+    CacheLine* line = evict_line(cache, set);
+
+    cache->prefetch_issued++;
+    line->valid = true;
+    line->dirty = false;
+    line->tag = block >> cache->index_bits;
+    line->prefetched = true;
+    line->ready = cache->now + next_level_access(cache, addr, false);
+    touch_line(cache, set, line - &cache->lines[set * cache->config.assoc]);
+}
+
+long long cache_hits(Cache* cache)
+{
+    return cache->read_hits + cache->write_hits;
+}
+
+long long cache_misses(Cache* cache)
+{
+    return cache->read_misses + cache->write_misses;
+}
+
+/*
+ * This function prints hits, misses and MPKI of a cache level.
+ */
+void cache_print_stats(Cache* cache, long long instructions)
+{
+    long long hits = cache_hits(cache);
+    long long misses = cache_misses(cache);
+    long long accesses = hits + misses;
+
+    printf("%s: %d sets x %d ways x %dB lines (%s)\n", cache->name, cache->num_sets,
+        cache->config.assoc, cache->config.line_size,
+        cache->config.repl == repl_plru ? "PLRU" : "LRU");
+    printf("%s accesses: %lld, hits: %lld, misses: %lld, writebacks: %lld\n",
+        cache->name, accesses, hits, misses, cache->writebacks);
+    printf("%s miss rate: %f, MPKI: %f\n", cache->name,
+        accesses ? (double)misses / accesses : 0.0,
+        instructions ? (double)misses * 1000.0 / instructions : 0.0);
+}
+
+/*
+ * This function prints accuracy, coverage and timeliness of the prefetches
+ * filled into this level.
+ */
+void cache_print_prefetch_stats(Cache* cache)
+{
+    long long covered = cache->prefetch_useful + cache_misses(cache);
+
+    printf("%s prefetches issued: %lld, useful: %lld, late: %lld, useless: %lld, redundant: %lld\n",
+        cache->name, cache->prefetch_issued, cache->prefetch_useful, cache->prefetch_late,
+        cache->prefetch_useless, cache->prefetch_redundant);
+    printf("%s prefetch accuracy: %f, coverage: %f, timeliness: %f\n", cache->name,
+        cache->prefetch_issued ? (double)cache->prefetch_useful / cache->prefetch_issued : 0.0,
+        covered ? (double)cache->prefetch_useful / covered : 0.0,
+        cache->prefetch_useful ? (double)(cache->prefetch_useful - cache->prefetch_late) / cache->prefetch_useful : 0.0);
+}
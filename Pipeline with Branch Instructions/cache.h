@@ -0,0 +1,88 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+#include <stdbool.h>
+#include "arena.h"
+#include "dram.h"
+
+// Replacement policy used inside a set
+enum cacheRepl_enum {
+    repl_lru,     // true LRU using per-line access stamps
+    repl_plru,    // tree pseudo-LRU, needs a power of two associativity
+};
+
+// MESI state of a line, only maintained for caches on a coherence bus
+enum mesiState_enum {
+    mesi_invalid,
+    mesi_shared,
+    mesi_exclusive,
+    mesi_modified,
+};
+
+// Geometry and policy of one cache level
+typedef struct CacheConfig {
+    int size;              // total capacity in bytes
+    int assoc;             // ways per set
+    int line_size;         // bytes per line
+    enum cacheRepl_enum repl;
+    bool write_back;       // true: write-back, false: write-through
+    bool write_allocate;   // true: fill the line on a write miss
+    int hit_latency;       // cycles for a hit in this level
+} CacheConfig;
+
+typedef struct CacheLine {
+    unsigned int tag;
+    bool valid;
+    bool dirty;
+    unsigned long long stamp;   // last access stamp, used by LRU
+    bool prefetched;            // filled by a prefetch and not referenced yet
+    long long ready;            // cycle at which a prefetch fill completes
+    enum mesiState_enum mesi;
+} CacheLine;
+
+/* Model of one cache level, tags only (data lives in cpu->memory) */
+typedef struct Cache {
+    const char* name;
+    CacheConfig config;
+    int num_sets;
+    int offset_bits;
+    int index_bits;
+    CacheLine *lines;           // num_sets * assoc lines, set major
+    unsigned int *plru_bits;    // one tree per set for repl_plru
+    unsigned long long stamp;   // access counter driving LRU
+
+    struct Cache *next_level;   // NULL: next level is main memory
+    int mem_latency;            // latency of main memory behind this level
+    Dram *dram;                 // NULL: main memory answers in mem_latency cycles
+    long long now;              // simulated clock, set by the owner before accesses
+
+    long long read_hits;
+    long long read_misses;
+    long long write_hits;
+    long long write_misses;
+    long long writebacks;       // dirty lines written to the next level
+
+    long long prefetch_issued;     // fills started by a prefetcher
+    long long prefetch_redundant;  // prefetches for lines already present
+    long long prefetch_useful;     // prefetched lines later hit by demand
+    long long prefetch_late;       // useful prefetches that were still in flight
+    long long prefetch_useless;    // prefetched lines evicted unreferenced
+    Arena *arena;               // NULL: allocated on the heap
+} Cache;
+
+Cache* cache_create(Arena* arena, const char* name, CacheConfig config, Cache* next_level, int mem_latency);
+void cache_free(Cache* cache);
+bool cache_geometry_valid(const CacheConfig* config);
+
+int cache_access(Cache* cache, unsigned int addr, bool is_write);
+bool cache_probe(Cache* cache, unsigned int addr);
+CacheLine* cache_lookup(Cache* cache, unsigned int addr);
+int cache_fill(Cache* cache, unsigned int addr, bool is_write, int fill_latency);
+void cache_write_back(Cache* cache, unsigned int addr);
+void cache_prefetch(Cache* cache, unsigned int addr);
+
+long long cache_hits(Cache* cache);
+long long cache_misses(Cache* cache);
+void cache_print_stats(Cache* cache, long long instructions);
+void cache_print_prefetch_stats(Cache* cache);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "coherence.h"
+
+/*
+ * This function allocates an empty bus, caches are added with
+ * coherence_attach.
+ */
+Coherence* coherence_create(int bus_latency)
+{
+    Coherence* bus = (Coherence*)calloc(1, sizeof(Coherence));
+    if (!bus) {
+        return NULL;
+    }
+
+    bus->bus_latency = bus_latency > 0 ? bus_latency : 1;
+    pthread_mutex_init(&bus->bus_lock, NULL);
+    for(int i = 0; i < MAX_CORES; i++)
+        pthread_mutex_init(&bus->cache_locks[i], NULL);
+    return bus;
+}
+
+/*
+ * This function de-allocates the bus (but not the caches on it).
+ */
+void coherence_free(Coherence* bus)
+{
+    if(!bus)
+        return;
+    pthread_mutex_destroy(&bus->bus_lock);
+    for(int i = 0; i < MAX_CORES; i++)
+        pthread_mutex_destroy(&bus->cache_locks[i]);
+    free(bus);
+}
+
+/*
+ * Puts a write-back, write-allocate cache on the bus and returns the core
+ * number its accesses are made with, -1 when the bus is full.
+ */
+int coherence_attach(Coherence* bus, Cache* cache)
+{
+    if(bus->num_caches >= MAX_CORES)
+        return -1;
+    bus->caches[bus->num_caches] = cache;
+    return bus->num_caches++;
+}
+
+/*
+ * Snoops every other cache for the line holding addr. A read downgrades
+ * their copies to shared, a modified copy is written back first; a write
+ * invalidates them, a modified copy is handed over. Returns true when any
+ * other cache held the line.
+ */
+static bool snoop_others(Coherence* bus, int core, unsigned int addr, bool is_write)
+{
+    bool shared = false;
+
+    for(int other = 0; other < bus->num_caches; other++)
+    {
+        if(other == core)
+            continue;
+
+        pthread_mutex_lock(&bus->cache_locks[other]);
+        CacheLine* line = cache_lookup(bus->caches[other], addr);
+        if(line)
+        {
+            shared = true;
+            if(line->mesi == mesi_modified)
+            {
+                bus->counters[other].interventions++;
+                if(!is_write)
+                    cache_write_back(bus->caches[other], addr);
+            }
+
+            if(is_write)
+            {
+                line->valid = false;
+                line->dirty = false;
+                line->mesi = mesi_invalid;
+                bus->counters[other].invalidations++;
+            }
+            else
+                line->mesi = mesi_shared;
+        }
+        pthread_mutex_unlock(&bus->cache_locks[other]);
+    }
+    return shared;
+}
+
+/*
+ * This function performs one demand access of a core and returns its
+ * latency in cycles, now is the core's clock. Hits that need no
+ * transaction only lock the core's own cache, no thread ever holds two
+ * cache locks.
+ */
+int coherence_access(Coherence* bus, int core, unsigned int addr, bool is_write, long long now)
+{
+    Cache* cache = bus->caches[core];
+    CoherenceCounters* counters = &bus->counters[core];
+    int latency;
+
+    pthread_mutex_lock(&bus->cache_locks[core]);
+    CacheLine* line = cache_lookup(cache, addr);
+    if(line && (!is_write || line->mesi != mesi_shared))
+    {
+        latency = cache_access(cache, addr, is_write);
+        if(is_write)
+            line->mesi = mesi_modified;
+        pthread_mutex_unlock(&bus->cache_locks[core]);
+        return latency;
+    }
+    pthread_mutex_unlock(&bus->cache_locks[core]);
+
+    pthread_mutex_lock(&bus->bus_lock);
+
+    // Wait for the transactions ahead of this one
+    long long wait = bus->bus_free - now;
+    long long max_wait = (long long)(bus->num_caches - 1) * bus->bus_latency;
+    if(wait > max_wait)
+        wait = max_wait;
+    if(wait > 0)
+    {
+        counters->contended++;
+        counters->contention_cycles += wait;
+    }
+    else
+        wait = 0;
+    if(bus->bus_free < now + wait + bus->bus_latency)
+        bus->bus_free = now + wait + bus->bus_latency;
+
+    // Other cores can only have taken the line away since the lookup above,
+    // and only while holding the bus, so it is stable from here on
+    pthread_mutex_lock(&bus->cache_locks[core]);
+    line = cache_lookup(cache, addr);
+    pthread_mutex_unlock(&bus->cache_locks[core]);
+
+    bool shared = snoop_others(bus, core, addr, is_write);
+
+    pthread_mutex_lock(&bus->cache_locks[core]);
+
+    if(line)
+    {
+        // Write to a shared line, the data is already here
+        counters->bus_upgrades++;
+        latency = cache_access(cache, addr, true) + bus->bus_latency;
+        line->mesi = mesi_modified;
+    }
+    else
+    {
+        if(is_write)
+            counters->bus_read_excl++;
+        else
+            counters->bus_reads++;
+
+        if(shared)
+        {
+            counters->peer_fills++;
+            latency = cache_fill(cache, addr, is_write, bus->bus_latency);
+        }
+        else
+            latency = cache_access(cache, addr, is_write) + bus->bus_latency;
+
+        line = cache_lookup(cache, addr);
+        if(line)
+            line->mesi = is_write ? mesi_modified : shared ? mesi_shared : mesi_exclusive;
+    }
+
+    pthread_mutex_unlock(&bus->cache_locks[core]);
+    pthread_mutex_unlock(&bus->bus_lock);
+    return latency + wait;
+}
+
+/*
+ * This function prints the bus traffic, invalidations and contention of
+ * every core and their totals.
+ */
+void coherence_print_stats(Coherence* bus)
+{
+    CoherenceCounters total;
+    memset(&total, 0, sizeof(total));
+
+    printf("Coherence: MESI snooping bus, %d caches, %d cycles per transaction\n",
+        bus->num_caches, bus->bus_latency);
+    for(int core = 0; core < bus->num_caches; core++)
+    {
+        CoherenceCounters* c = &bus->counters[core];
+        printf("Core %d bus reads: %lld, read-exclusive: %lld, upgrades: %lld, filled by peers: %lld\n",
+            core, c->bus_reads, c->bus_read_excl, c->bus_upgrades, c->peer_fills);
+        printf("Core %d invalidations received: %lld, interventions: %lld, contended transactions: %lld (%lld cycles)\n",
+            core, c->invalidations, c->interventions, c->contended, c->contention_cycles);
+
+        total.bus_reads += c->bus_reads;
+        total.bus_read_excl += c->bus_read_excl;
+        total.bus_upgrades += c->bus_upgrades;
+        total.peer_fills += c->peer_fills;
+        total.invalidations += c->invalidations;
+        total.interventions += c->interventions;
+        total.contended += c->contended;
+        total.contention_cycles += c->contention_cycles;
+    }
+
+    long long transactions = total.bus_reads + total.bus_read_excl + total.bus_upgrades;
+    printf("Bus transactions: %lld, filled by peers: %lld, invalidations: %lld, interventions: %lld\n",
+        transactions, total.peer_fills, total.invalidations, total.interventions);
+    printf("Bus contention: %lld transactions waited %lld cycles, %f cycles per transaction\n",
+        total.contended, total.contention_cycles,
+        transactions ? (double)total.contention_cycles / transactions : 0.0);
+}
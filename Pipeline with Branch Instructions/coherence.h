@@ -0,0 +1,48 @@
+#ifndef _COHERENCE_H_
+#define _COHERENCE_H_
+#include <stdbool.h>
+#include <pthread.h>
+#include "cache.h"
+
+#define MAX_CORES 16
+
+// Bus transactions and snoop results of one core
+typedef struct CoherenceCounters {
+    long long bus_reads;          // BusRd, read misses
+    long long bus_read_excl;      // BusRdX, write misses
+    long long bus_upgrades;       // BusUpgr, writes to shared lines
+    long long peer_fills;         // misses served by another cache
+    long long invalidations;      // lines this core lost to other writers
+    long long interventions;      // modified lines this core supplied to others
+    long long contended;          // transactions that found the bus busy
+    long long contention_cycles;  // cycles spent waiting for the bus
+} CoherenceCounters;
+
+/*
+ * Snooping MESI bus between the private L1 data caches of the cores. It
+ * only models tags and timing, the data itself lives in the shared memory
+ * array. Transactions are serialised by bus_lock and each one occupies the
+ * bus for bus_latency cycles. Cores run on their own host threads and are
+ * only synchronised every quantum, so a core can find the bus reserved by
+ * a core that is ahead in simulated time; the wait is capped at one
+ * transaction per other core, which is the longest a FIFO bus can queue.
+ */
+typedef struct Coherence {
+    int num_caches;
+    Cache *caches[MAX_CORES];
+    pthread_mutex_t cache_locks[MAX_CORES]; // guard the tags of each cache
+    pthread_mutex_t bus_lock;               // held for a whole transaction
+    int bus_latency;
+    long long bus_free;                     // cycle the bus becomes idle
+    CoherenceCounters counters[MAX_CORES];
+} Coherence;
+
+Coherence* coherence_create(int bus_latency);
+void coherence_free(Coherence* bus);
+
+int coherence_attach(Coherence* bus, Cache* cache);
+int coherence_access(Coherence* bus, int core, unsigned int addr, bool is_write, long long now);
+
+void coherence_print_stats(Coherence* bus);
+
+#endif
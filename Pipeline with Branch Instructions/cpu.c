@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
+#include <limits.h>
 #include "cpu.h"
 
 #define REG_COUNT 16
@@ -38,7 +40,7 @@ void load_memory(const char* filename, CPU* cpu)
 
     rewind(file);
     // Create dynamic memory for array
-    arr = (int*) malloc(size * sizeof(int));
+    arr = (int*) arena_alloc(cpu->arena, size * sizeof(int));
 
     // Read integers from file and store in array
     for (i = 0; i < size; i++) {
@@ -50,6 +52,12 @@ void load_memory(const char* filename, CPU* cpu)
     fclose(file);    
 }
 
+// Lines with nothing but white space hold no instruction and are skipped
+static bool blank_line(const char* line)
+{
+    return line[strspn(line, " \t\r\n")] == '\0';
+}
+
 void get_lines(const char* filename, CPU* cpu)
 {
     FILE *file_ptr;
@@ -64,6 +72,8 @@ void get_lines(const char* filename, CPU* cpu)
 
     while (fgets(cpu->lines[line_count], 50, file_ptr) != NULL) {
         cpu->lines[line_count][strcspn(cpu->lines[line_count], "\n")] = '\0'; // remove trailing newline
+        if(blank_line(cpu->lines[line_count]))
+            continue;
         line_count++;
         if (line_count >= 150) {
             printf("Maximum number of lines reached\n");
@@ -79,19 +89,465 @@ void get_lines(const char* filename, CPU* cpu)
     // }
 }
 
+/*
+ * This function fills the configuration with the compile time defaults.
+ */
+void sim_config_defaults(SimConfig* config)
+{
+    config->dcache_enabled = DCACHE_ENABLED;
+
+    config->l1d.size = L1D_SIZE;
+    config->l1d.assoc = L1D_ASSOC;
+    config->l1d.line_size = L1D_LINE_SIZE;
+    config->l1d.repl = repl_lru;
+    config->l1d.write_back = true;
+    config->l1d.write_allocate = true;
+    config->l1d.hit_latency = L1D_HIT_LATENCY;
+
+    config->l2_enabled = L2_ENABLED;
+    config->l2.size = L2_SIZE;
+    config->l2.assoc = L2_ASSOC;
+    config->l2.line_size = L2_LINE_SIZE;
+    config->l2.repl = repl_lru;
+    config->l2.write_back = true;
+    config->l2.write_allocate = true;
+    config->l2.hit_latency = L2_HIT_LATENCY;
+
+    config->mem_latency = MEM_LATENCY;
+    config->mshrs = MSHR_ENTRIES;
+    config->dram_enabled = DRAM_ENABLED;
+    config->dram.banks = DRAM_BANKS;
+    config->dram.row_size = DRAM_ROW_SIZE;
+    config->dram.t_cas = DRAM_TCAS;
+    config->dram.t_rcd = DRAM_TRCD;
+    config->dram.t_rp = DRAM_TRP;
+    config->dram.t_burst = DRAM_TBURST;
+
+    config->icache_enabled = ICACHE_ENABLED;
+    config->l1i.size = L1I_SIZE;
+    config->l1i.assoc = L1I_ASSOC;
+    config->l1i.line_size = L1I_LINE_SIZE;
+    config->l1i.repl = repl_lru;
+    config->l1i.write_back = true;
+    config->l1i.write_allocate = true;
+    config->l1i.hit_latency = L1I_HIT_LATENCY;
+    config->l1i_miss_latency = L1I_MISS_LATENCY;
+    config->fetch_width = FETCH_WIDTH;
+
+    config->prefetcher = PREFETCHER;
+    config->prefetch_degree = PREFETCH_DEGREE;
+    config->store_buffer = STORE_BUFFER_ENTRIES;
+
+    config->bpred = BPRED;
+    config->bpred_table_bits = BPRED_TABLE_BITS;
+
+    config->btb_entries = BTB_ENTRIES;
+    config->btb_assoc = BTB_ASSOC;
+    config->btb_tag_bits = BTB_TAG_BITS;
+
+    config->bptrace_file[0] = '\0';
+    config->addrtrace_file[0] = '\0';
+    config->intervals_file[0] = '\0';
+    config->interval_cycles = INTERVAL_CYCLES;
+    config->functional = false;
+    config->jit = false;
+    config->extrapolate = LOOP_EXTRAPOLATION;
+    config->cores = NUM_CORES;
+    config->quantum = QUANTUM_CYCLES;
+    config->ordered_cores = ORDERED_CORES;
+    config->bus_latency = BUS_LATENCY;
+    config->slices = SLICES;
+    config->slice_warmup = SLICE_WARMUP;
+    config->simpoint = false;
+    config->bbv_file[0] = '\0';
+    config->simpoint_interval = SIMPOINT_INTERVAL;
+    config->simpoint_max_k = SIMPOINT_MAX_K;
+    config->critpath = false;
+    config->whatif_features = 0;
+    config->bypass_paths = BYPASS_PATHS;
+    config->fork_file[0] = '\0';
+    config->batch_file[0] = '\0';
+    config->batch_isa = BATCH_ISA;
+    config->fork_at = FORK_AT;
+    config->fork_jobs = FORK_JOBS;
+    config->longrun = false;
+    config->watchdog_cycles = 0;
+    config->watchdog_seconds = 0.0;
+    config->heartbeat = HEARTBEAT_CYCLES;
+}
+
+static bool parse_bool(const char* value)
+{
+    return strcmp(value, "1") == 0 || strcmp(value, "true") == 0 || strcmp(value, "on") == 0;
+}
+
+static bool power_of_two(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+/*
+ * Sets one field of a cache level, key is the part after "l1d." or "l2."
+ * Size, associativity and line size must be powers of two; whether they
+ * fit together is left to sim_config_check once every option is set.
+ */
+static bool cache_config_set(CacheConfig* cache, const char* key, const char* value)
+{
+    if(strcmp(key, "size") == 0)
+    {
+        cache->size = atoi(value);
+        return power_of_two(cache->size);
+    }
+    else if(strcmp(key, "assoc") == 0)
+    {
+        cache->assoc = atoi(value);
+        return power_of_two(cache->assoc);
+    }
+    else if(strcmp(key, "line") == 0)
+    {
+        cache->line_size = atoi(value);
+        return cache->line_size >= 4 && power_of_two(cache->line_size);
+    }
+    else if(strcmp(key, "hit") == 0)
+        cache->hit_latency = atoi(value);
+    else if(strcmp(key, "wb") == 0)
+        cache->write_back = parse_bool(value);
+    else if(strcmp(key, "walloc") == 0)
+        cache->write_allocate = parse_bool(value);
+    else if(strcmp(key, "repl") == 0)
+    {
+        if(strcmp(value, "lru") == 0)
+            cache->repl = repl_lru;
+        else if(strcmp(value, "plru") == 0)
+            cache->repl = repl_plru;
+        else
+            return false;
+    }
+    else
+        return false;
+    return true;
+}
+
+/*
+ * Sets one field of the main memory model, key is the part after "dram."
+ */
+static bool dram_config_set(DramConfig* dram, const char* key, const char* value)
+{
+    if(strcmp(key, "banks") == 0)
+        dram->banks = atoi(value);
+    else if(strcmp(key, "row") == 0)
+        dram->row_size = atoi(value);
+    else if(strcmp(key, "tcas") == 0)
+        dram->t_cas = atoi(value);
+    else if(strcmp(key, "trcd") == 0)
+        dram->t_rcd = atoi(value);
+    else if(strcmp(key, "trp") == 0)
+        dram->t_rp = atoi(value);
+    else if(strcmp(key, "burst") == 0)
+        dram->t_burst = atoi(value);
+    else
+        return false;
+    return true;
+}
+
+/*
+ * This function sets one configuration value by name, returns false for an
+ * unknown key or value.
+ */
+bool sim_config_set(SimConfig* config, const char* key, const char* value)
+{
+    if(strcmp(key, "dcache") == 0)
+        config->dcache_enabled = parse_bool(value);
+    else if(strcmp(key, "l2") == 0)
+        config->l2_enabled = parse_bool(value);
+    else if(strcmp(key, "mem.latency") == 0)
+        config->mem_latency = atoi(value);
+    else if(strcmp(key, "mshrs") == 0)
+        config->mshrs = atoi(value);
+    else if(strcmp(key, "dram") == 0)
+        config->dram_enabled = parse_bool(value);
+    else if(strcmp(key, "icache") == 0)
+        config->icache_enabled = parse_bool(value);
+    else if(strcmp(key, "l1i.miss") == 0)
+        config->l1i_miss_latency = atoi(value);
+    else if(strcmp(key, "fetch.width") == 0)
+        config->fetch_width = atoi(value);
+    else if(strcmp(key, "prefetch") == 0)
+        return prefetcher_parse_type(value, &config->prefetcher);
+    else if(strcmp(key, "prefetch.degree") == 0)
+        config->prefetch_degree = atoi(value);
+    else if(strcmp(key, "storebuf") == 0)
+        config->store_buffer = atoi(value);
+    else if(strcmp(key, "bpred") == 0)
+        return bpred_parse_type(value, &config->bpred);
+    else if(strcmp(key, "bpred.bits") == 0)
+    {
+        config->bpred_table_bits = atoi(value);
+        return config->bpred_table_bits >= 0 && config->bpred_table_bits <= BPRED_MAX_TABLE_BITS;
+    }
+    else if(strcmp(key, "btb.entries") == 0)
+    {
+        config->btb_entries = atoi(value);
+        return power_of_two(config->btb_entries);
+    }
+    else if(strcmp(key, "btb.assoc") == 0)
+    {
+        config->btb_assoc = atoi(value);
+        return power_of_two(config->btb_assoc);
+    }
+    else if(strcmp(key, "btb.tagbits") == 0)
+        config->btb_tag_bits = atoi(value);
+    else if(strcmp(key, "bptrace") == 0)
+    {
+        if(strlen(value) >= MAX_PATH_SIZE)
+            return false;
+        strcpy(config->bptrace_file, value);
+    }
+    else if(strcmp(key, "functional") == 0)
+        config->functional = parse_bool(value);
+    else if(strcmp(key, "extrapolate") == 0)
+        config->extrapolate = parse_bool(value);
+    else if(strcmp(key, "cores") == 0)
+        config->cores = atoi(value);
+    else if(strcmp(key, "quantum") == 0)
+        config->quantum = atoi(value);
+    else if(strcmp(key, "quantum.ordered") == 0)
+        config->ordered_cores = parse_bool(value);
+    else if(strcmp(key, "bus.latency") == 0)
+        config->bus_latency = atoi(value);
+    else if(strcmp(key, "slices") == 0)
+        config->slices = atoi(value);
+    else if(strcmp(key, "slice.warmup") == 0)
+        config->slice_warmup = atoll(value);
+    else if(strcmp(key, "simpoint") == 0)
+        config->simpoint = parse_bool(value);
+    else if(strcmp(key, "bbv") == 0)
+    {
+        if(strlen(value) >= MAX_PATH_SIZE)
+            return false;
+        strcpy(config->bbv_file, value);
+    }
+    else if(strcmp(key, "simpoint.interval") == 0)
+        config->simpoint_interval = atoll(value);
+    else if(strcmp(key, "simpoint.maxk") == 0)
+        config->simpoint_max_k = atoi(value);
+    else if(strcmp(key, "critpath") == 0)
+        config->critpath = parse_bool(value);
+    else if(strcmp(key, "bypass") == 0)
+        return bypass_parse_paths(value, &config->bypass_paths);
+    else if(strcmp(key, "whatif") == 0)
+        return whatif_parse_features(value, &config->whatif_features);
+    else if(strcmp(key, "fork") == 0)
+    {
+        if(strlen(value) >= MAX_PATH_SIZE)
+            return false;
+        strcpy(config->fork_file, value);
+    }
+    else if(strcmp(key, "batch") == 0)
+    {
+        if(strlen(value) >= MAX_PATH_SIZE)
+            return false;
+        strcpy(config->batch_file, value);
+    }
+    else if(strcmp(key, "batch.isa") == 0)
+        return batch_parse_isa(value, &config->batch_isa);
+    else if(strcmp(key, "fork.at") == 0)
+        config->fork_at = atoll(value);
+    else if(strcmp(key, "fork.jobs") == 0)
+        config->fork_jobs = atoi(value);
+    else if(strcmp(key, "longrun") == 0)
+        config->longrun = parse_bool(value);
+    else if(strcmp(key, "watchdog.cycles") == 0)
+        config->watchdog_cycles = atoll(value);
+    else if(strcmp(key, "watchdog.seconds") == 0)
+        config->watchdog_seconds = atof(value);
+    else if(strcmp(key, "heartbeat") == 0)
+        config->heartbeat = atoll(value);
+    else if(strcmp(key, "jit") == 0)
+    {
+        config->jit = parse_bool(value);
+        config->functional |= config->jit;
+    }
+    else if(strcmp(key, "addrtrace") == 0)
+    {
+        if(strlen(value) >= MAX_PATH_SIZE)
+            return false;
+        strcpy(config->addrtrace_file, value);
+    }
+    else if(strcmp(key, "intervals") == 0)
+    {
+        if(strlen(value) >= MAX_PATH_SIZE)
+            return false;
+        strcpy(config->intervals_file, value);
+    }
+    else if(strcmp(key, "interval") == 0)
+        config->interval_cycles = atoll(value);
+    else if(strncmp(key, "l1i.", 4) == 0)
+        return cache_config_set(&config->l1i, key + 4, value);
+    else if(strncmp(key, "l1d.", 4) == 0)
+        return cache_config_set(&config->l1d, key + 4, value);
+    else if(strncmp(key, "l2.", 3) == 0)
+        return cache_config_set(&config->l2, key + 3, value);
+    else if(strncmp(key, "dram.", 5) == 0)
+        return dram_config_set(&config->dram, key + 5, value);
+    else
+        return false;
+    return true;
+}
+
+/*
+ * This function parses a command line option of the form --key=value,
+ * a bare --key is the same as --key=1.
+ */
+bool sim_config_parse_arg(SimConfig* config, const char* arg)
+{
+    char key[64];
+
+    if(strncmp(arg, "--", 2) != 0)
+        return false;
+    arg += 2;
+
+    const char* value = strchr(arg, '=');
+    size_t key_len = value ? (size_t)(value - arg) : strlen(arg);
+    if(key_len >= sizeof(key))
+        return false;
+
+    memcpy(key, arg, key_len);
+    key[key_len] = '\0';
+    return sim_config_set(config, key, value ? value + 1 : "1");
+}
+
+/*
+ * Checks the settings that depend on each other, once every option is
+ * applied. Returns NULL for a usable configuration, else what is wrong.
+ */
+const char* sim_config_check(const SimConfig* config)
+{
+    if(!cache_geometry_valid(&config->l1d))
+        return "l1d geometry, size must hold assoc x line";
+    if(!cache_geometry_valid(&config->l2))
+        return "l2 geometry, size must hold assoc x line";
+    if(!cache_geometry_valid(&config->l1i))
+        return "l1i geometry, size must hold assoc x line";
+    if(config->btb_entries < config->btb_assoc)
+        return "btb geometry, entries must hold assoc";
+    return NULL;
+}
+
+/*
+ * This function creates the data cache hierarchy described by cpu->config.
+ * Returns false when a part of it could not be allocated.
+ */
+static bool create_data_caches(CPU* cpu)
+{
+    cpu->l1d = NULL;
+    cpu->l2 = NULL;
+    cpu->prefetcher = NULL;
+    cpu->mshr = NULL;
+    cpu->dram = NULL;
+
+    if(!cpu->config.dcache_enabled)
+        return true;
+
+    if(cpu->config.l2_enabled)
+    {
+        cpu->l2 = cache_create(cpu->arena, "L2", cpu->config.l2, NULL, cpu->config.mem_latency);
+        if(!cpu->l2)
+            return false;
+    }
+    cpu->l1d = cache_create(cpu->arena, "L1D", cpu->config.l1d, cpu->l2, cpu->config.mem_latency);
+    if(!cpu->l1d)
+        return false;
+    cpu->prefetcher = prefetcher_create(cpu->arena, cpu->config.prefetcher, cpu->config.prefetch_degree, cpu->l1d);
+    cpu->mshr = mshr_create(cpu->arena, cpu->config.mshrs, cpu->config.l1d.line_size);
+    if((cpu->config.prefetcher != prefetch_none && !cpu->prefetcher) || (cpu->config.mshrs > 0 && !cpu->mshr))
+        return false;
+
+    // The DRAM model answers the misses of the last level
+    if(cpu->config.dram_enabled)
+    {
+        cpu->dram = dram_create(cpu->arena, cpu->config.dram);
+        if(!cpu->dram)
+            return false;
+        (cpu->l2 ? cpu->l2 : cpu->l1d)->dram = cpu->dram;
+    }
+    return true;
+}
+
+/*
+ * This function creates the instruction cache and empties the fetch buffer.
+ * Returns false when the cache could not be allocated.
+ */
+static bool create_instruction_cache(CPU* cpu)
+{
+    cpu->l1i = NULL;
+    if(cpu->config.icache_enabled)
+        cpu->l1i = cache_create(cpu->arena, "L1I", cpu->config.l1i, NULL, cpu->config.l1i_miss_latency);
+
+    cpu->fetch_buf_start = -1;
+    cpu->fetch_buf_end = -1;
+    cpu->fetch_stall_cycles = 0;
+    return !cpu->config.icache_enabled || cpu->l1i;
+}
+
 CPU* CPU_init(const char* filename)
 {
-     CPU* cpu = (CPU*)malloc(sizeof(CPU));
+    return CPU_init_config(filename, NULL);
+}
+
+/*
+ * Sets the configuration of an empty CPU and allocates its register file.
+ */
+static bool init_cpu(CPU* cpu, const SimConfig* config)
+{
+    if(config)
+        cpu->config = *config;
+    else
+        sim_config_defaults(&cpu->config);
 
+    /* Create register files */
+    cpu->regs = create_registers(cpu->arena, REG_COUNT);
+    return cpu->regs != NULL;
+}
+
+/*
+ * Creates the arena of a CPU with the CPU itself as its first allocation,
+ * then the configuration and register file. The program and memory are
+ * loaded by the caller before setup_cpu.
+ */
+static CPU* alloc_cpu(const SimConfig* config)
+{
+    Arena* arena = arena_create(ARENA_CHUNK_SIZE);
+    if (!arena) {
+        return NULL;
+    }
+
+    CPU* cpu = (CPU*)arena_alloc(arena, sizeof(CPU));
     if (!cpu) {
+        arena_destroy(arena);
         return NULL;
     }
+    cpu->arena = arena;
+    cpu->arena_mark = arena_mark(arena);
 
-    /* Create register files */
-    get_lines(filename, cpu);
-    cpu->regs= create_registers(REG_COUNT);
-    load_memory("./memory_map.txt", cpu);
-    cpu->instruction_memory = file_parser(filename, cpu);
+    if(!init_cpu(cpu, config))
+    {
+        arena_destroy(arena);
+        return NULL;
+    }
+    return cpu;
+}
+
+/*
+ * Puts the pipeline, predictors and caches of a loaded CPU in their
+ * initial state. Returns NULL when its configuration fails
+ * sim_config_check or the arena cannot hold the predictors, caches or
+ * buffers it asks for, cpu must then only be stopped.
+ */
+static CPU* setup_cpu(CPU* cpu)
+{
+    if(sim_config_check(&cpu->config))
+        return NULL;
 
     cpu->pc = 0;   
     cpu->clock = 1;
@@ -133,31 +589,316 @@ CPU* CPU_init(const char* filename)
     cpu->writeback.dest = -1;
 
 
-    // initialize forward registers value to -1
-    for(int i=0;i<NUM_REGS;i++)
+    bypass_init(&cpu->bypass, cpu->config.bypass_paths);
+
+    // Initializing BTB table and the direction predictor
+    cpu->btb = btb_create(cpu->arena, cpu->config.btb_entries, cpu->config.btb_assoc, cpu->config.btb_tag_bits);
+    cpu->bpred = bpred_create(cpu->arena, cpu->config.bpred, cpu->config.bpred_table_bits);
+    if(!cpu->btb || !cpu->bpred)
+        return NULL;
+    cpu->branch_flush_cnt = 0;
+    cpu->bptrace = NULL;
+    if(cpu->config.bptrace_file[0])
+        cpu->bptrace = bptrace_open(cpu->config.bptrace_file);
+    cpu->addrtrace = NULL;
+    if(cpu->config.addrtrace_file[0])
+        cpu->addrtrace = addrtrace_open(cpu->config.addrtrace_file);
+    cpu->intervals = NULL;
+    memset(&cpu->interval_base, 0, sizeof(IntervalRecord));
+    cpu->load_cnt = 0;
+    cpu->store_cnt = 0;
+    cpu->forward_cnt = 0;
+    if(cpu->config.intervals_file[0])
     {
-        cpu->forward_regs[i].value = -9999;
-        cpu->forward_regs[i].regNum = i + 1;
-        cpu->forward_regs[i].has_value = false;
+        if(cpu->config.interval_cycles < 1)
+            cpu->config.interval_cycles = 1;
+        cpu->intervals = intervals_open(cpu->config.intervals_file, cpu->config.interval_cycles);
     }
 
-    // Initializing BTBtable and PredTable entry
-    for(int i = 0;i < REG_COUNT;i++)
+    if(!create_data_caches(cpu) || !create_instruction_cache(cpu))
+        return NULL;
+    cpu->storebuf = storebuf_create(cpu->arena, cpu->config.store_buffer);
+    if(cpu->config.store_buffer > 0 && !cpu->storebuf)
+        return NULL;
+    cpu->fetch_stall_cnt = 0;
+    cpu->mem_stall_cycles = 0;
+    cpu->mem_stall_cnt = 0;
+    cpu->miss_wait_cnt = 0;
+    for(int reg = 0; reg < NUM_REGS; reg++)
+        cpu->miss_ready[reg] = 0;
+
+    cpu->coherence = NULL;
+    cpu->core_id = 0;
+
+    cpu->whatif = NULL;
+    cpu->fetch_seq = 0;
+    if(cpu->config.whatif_features)
+        cpu->whatif = whatif_create(cpu->config.whatif_features);
+
+    cpu->loop = NULL;
+    cpu->loop_branch_pc = -1;
+    if(cpu->config.extrapolate)
     {
-        cpu->BTBTable[i].tag = -1;
-        cpu->BTBTable[i].target = -1;
-        cpu->PredTable[i].counter = 3;
+        if(cpu->l1d || cpu->l1i || cpu->storebuf || cpu->bptrace || cpu->addrtrace || cpu->intervals || cpu->whatif)
+            printf("Loop extrapolation needs the cache models and traces off, ignored\n");
+        else
+            cpu->loop = loop_create();
     }
 
     return cpu;
 }
 
+CPU* CPU_init_config(const char* filename, const SimConfig* config)
+{
+    CPU* cpu = alloc_cpu(config);
+    if (!cpu) {
+        return NULL;
+    }
+
+    get_lines(filename, cpu);
+    load_memory("./memory_map.txt", cpu);
+    cpu->instruction_memory = file_parser(filename, cpu);
+
+    if(!setup_cpu(cpu))
+    {
+        CPU_stop(cpu);
+        return NULL;
+    }
+    return cpu;
+}
+
+/*
+ * Copies memory_len words of initial memory and decodes program into the
+ * arena of cpu.
+ */
+static bool load_buffers(CPU* cpu, const char* program, const int* memory, int memory_len)
+{
+    cpu->memoryLen = memory_len;
+    cpu->memory = (int*)arena_alloc(cpu->arena, (memory_len > 0 ? memory_len : 1) * sizeof(int));
+    if(!cpu->memory)
+        return false;
+    if(memory_len > 0)
+        memcpy(cpu->memory, memory, memory_len * sizeof(int));
+
+    cpu->instruction_memory = text_parser(program, cpu);
+    return cpu->instruction_memory != NULL;
+}
+
 /*
- * This function de-allocates CPU cpu.
+ * Creates a CPU from a program held in memory, in the format of the input
+ * files, and a copy of memory_len words of initial memory. Returns NULL if
+ * a line of the program is malformed or the CPU could not be allocated.
+ */
+CPU* CPU_init_buffers(const char* program, const int* memory, int memory_len, const SimConfig* config)
+{
+    CPU* cpu = alloc_cpu(config);
+    if (!cpu) {
+        return NULL;
+    }
+
+    if(!load_buffers(cpu, program, memory, memory_len) || !setup_cpu(cpu))
+    {
+        CPU_stop(cpu);
+        return NULL;
+    }
+    return cpu;
+}
+
+/*
+ * Cycles lost to data cache misses so far: the memory stages frozen on a
+ * blocking miss, or RR waiting for the fill of a load that missed with
+ * MSHRs.
+ */
+static long long memory_stalls(const CPU* cpu)
+{
+    return cpu->mem_stall_cnt + cpu->miss_wait_cnt;
+}
+
+/*
+ * Writes the counters of the interval that ends after cycle cycles as the
+ * difference to the totals at its start, then starts the next interval.
+ */
+static void record_interval(CPU* cpu, long long cycles)
+{
+    IntervalRecord totals, record;
+
+    totals.start = 0;
+    totals.cycles = cycles;
+    totals.instructions = cpu->tot_instructions_done;
+    totals.data_stalls = cpu->cpu_stalled_cnt;
+    totals.mem_stalls = memory_stalls(cpu);
+    totals.fetch_stalls = cpu->fetch_stall_cnt;
+    totals.flushes = cpu->branch_flush_cnt;
+    totals.mispredictions = cpu->bpred->mispredictions;
+    totals.loads = cpu->load_cnt;
+    totals.stores = cpu->store_cnt;
+    totals.forwards = cpu->forward_cnt;
+
+    const long long* now = &totals.start;
+    const long long* base = &cpu->interval_base.start;
+    long long* delta = &record.start;
+    for(int i = 0; i < INTERVALS_FIELDS; i++)
+        delta[i] = now[i] - base[i];
+    record.start = cpu->interval_base.cycles + 1;
+
+    intervals_write(cpu->intervals, &record);
+    cpu->interval_base = totals;
+}
+
+/*
+ * Closes the traces and frees the loop detector, the parts of a CPU that
+ * do not live in its arena. The last interval, usually a partial one, ends
+ * at the cycle count the statistics report.
+ */
+static void release_components(CPU* cpu)
+{
+    bptrace_close(cpu->bptrace, cpu->tot_instructions_done);
+    addrtrace_close(cpu->addrtrace, cpu->tot_instructions_done);
+    if(cpu->intervals && cpu->clock > cpu->interval_base.cycles)
+        record_interval(cpu, cpu->clock);
+    intervals_close(cpu->intervals);
+    whatif_free(cpu->whatif);
+    loop_free(cpu->loop);
+}
+
+/*
+ * This function de-allocates CPU cpu. Everything else, the CPU included,
+ * goes with its arena.
  */
 void CPU_stop(CPU* cpu)
 {
-    free(cpu);
+    release_components(cpu);
+    arena_destroy(cpu->arena);
+}
+
+/*
+ * Puts cpu back in the state CPU_init_buffers creates, with another
+ * program, memory and configuration. Everything allocated for the previous
+ * job is dropped at once by rewinding the arena to just after the CPU, so
+ * a CPU reset job after job keeps reusing the same chunks. Returns false
+ * when the arena cannot grow, cpu must then only be stopped.
+ */
+bool CPU_reset(CPU* cpu, const char* program, const int* memory, int memory_len, const SimConfig* config)
+{
+    Arena* arena = cpu->arena;
+    ArenaMark mark = cpu->arena_mark;
+
+    release_components(cpu);
+    arena_rewind(arena, mark);
+    memset(cpu, 0, sizeof(CPU));
+    cpu->arena = arena;
+    cpu->arena_mark = mark;
+
+    return init_cpu(cpu, config) && load_buffers(cpu, program, memory, memory_len) && setup_cpu(cpu);
+}
+
+static bool cache_config_equal(const CacheConfig* a, const CacheConfig* b)
+{
+    return a->size == b->size && a->assoc == b->assoc && a->line_size == b->line_size
+        && a->repl == b->repl && a->write_back == b->write_back
+        && a->write_allocate == b->write_allocate && a->hit_latency == b->hit_latency;
+}
+
+static bool dram_config_equal(const DramConfig* a, const DramConfig* b)
+{
+    return a->banks == b->banks && a->row_size == b->row_size && a->t_cas == b->t_cas
+        && a->t_rcd == b->t_rcd && a->t_rp == b->t_rp && a->t_burst == b->t_burst;
+}
+
+/*
+ * Switches a CPU in the middle of a run to another configuration. The
+ * pipeline, registers and memory are kept; predictors and caches are only
+ * rebuilt, cold, when their settings changed, and their statistics start
+ * over. Misses in flight when the data caches are rebuilt complete at
+ * once, the new hierarchy has no record of them. Traces, extrapolation
+ * and the run mode stay as the CPU was created.
+ *
+ * The replaced parts are not freed: they stay in the arena until it is
+ * rewound, so every switch that rebuilds something grows the arena by the
+ * size of the new part.
+ *
+ * Returns false when config fails sim_config_check, the CPU is then left
+ * as it was, or when the arena cannot hold the rebuilt parts, cpu must
+ * then only be stopped.
+ */
+bool CPU_reconfigure(CPU* cpu, const SimConfig* config)
+{
+    if(sim_config_check(config))
+        return false;
+
+    SimConfig old = cpu->config;
+    bool complete = true;
+
+    cpu->config = *config;
+    strcpy(cpu->config.bptrace_file, old.bptrace_file);
+    strcpy(cpu->config.addrtrace_file, old.addrtrace_file);
+    strcpy(cpu->config.intervals_file, old.intervals_file);
+    cpu->config.interval_cycles = old.interval_cycles;
+    cpu->config.whatif_features = old.whatif_features;
+    cpu->config.extrapolate = old.extrapolate;
+    cpu->config.functional = old.functional;
+    cpu->config.jit = old.jit;
+    cpu->bypass.paths = config->bypass_paths;
+
+    if(old.bpred != config->bpred || old.bpred_table_bits != config->bpred_table_bits)
+    {
+        bpred_free(cpu->bpred);
+        cpu->bpred = bpred_create(cpu->arena, config->bpred, config->bpred_table_bits);
+    }
+    if(old.btb_entries != config->btb_entries || old.btb_assoc != config->btb_assoc
+        || old.btb_tag_bits != config->btb_tag_bits)
+    {
+        btb_free(cpu->btb);
+        cpu->btb = btb_create(cpu->arena, config->btb_entries, config->btb_assoc, config->btb_tag_bits);
+    }
+    if(old.dcache_enabled != config->dcache_enabled || old.l2_enabled != config->l2_enabled
+        || old.mem_latency != config->mem_latency || old.prefetcher != config->prefetcher
+        || old.prefetch_degree != config->prefetch_degree || old.mshrs != config->mshrs
+        || old.dram_enabled != config->dram_enabled || !dram_config_equal(&old.dram, &config->dram)
+        || !cache_config_equal(&old.l1d, &config->l1d) || !cache_config_equal(&old.l2, &config->l2))
+    {
+        prefetcher_free(cpu->prefetcher);
+        mshr_free(cpu->mshr);
+        dram_free(cpu->dram);
+        cache_free(cpu->l1d);
+        cache_free(cpu->l2);
+        complete = create_data_caches(cpu);
+        cpu->mem_stall_cycles = 0;
+        for(int reg = 0; reg < NUM_REGS; reg++)
+            cpu->miss_ready[reg] = 0;
+    }
+    if(old.icache_enabled != config->icache_enabled || old.l1i_miss_latency != config->l1i_miss_latency
+        || old.fetch_width != config->fetch_width || !cache_config_equal(&old.l1i, &config->l1i))
+    {
+        cache_free(cpu->l1i);
+        complete = create_instruction_cache(cpu) && complete;
+    }
+    if(old.store_buffer != config->store_buffer)
+    {
+        if(cpu->storebuf)
+            storebuf_flush(cpu->storebuf, cpu->memory);
+        storebuf_free(cpu->storebuf);
+        cpu->storebuf = storebuf_create(cpu->arena, config->store_buffer);
+        complete = complete && (config->store_buffer <= 0 || cpu->storebuf);
+    }
+    return complete && cpu->bpred && cpu->btb;
+}
+
+/*
+ * Reports an event about the instruction in stage to the event hook.
+ */
+static void report_event(CPU* cpu, enum cpuEvent_enum type, Stage* stage, int dest, bool taken, bool mispredicted)
+{
+    CPUEvent event;
+    event.type = type;
+    event.clock = cpu->clock;
+    event.pc = stage->curr_pc/7 * 4;
+    event.opcode = stage->opcode;
+    event.dest = dest;
+    event.value = dest >= 0 ? stage->dest_value : 0;
+    event.taken = taken;
+    event.mispredicted = mispredicted;
+    cpu->event_hook(&event, cpu->event_user);
 }
 
 /*
@@ -178,50 +919,71 @@ void print_registers(CPU *cpu){
  */
 void print_btb_table(CPU *cpu){
     
-    //printf("================================\n");
-    printf("\n============ BTB =================================\n\n");
-    for (int reg=0; reg<REG_COUNT; reg++) {
-        printf("|	 BTB[%2d]	|	TAG=%d   |   TARGET=%d   |\n",reg,cpu->BTBTable[reg].tag,cpu->BTBTable[reg].target);
-        //printf("--------------------------------\n");
-    }
-    //printf("================================\n\n");
+    btb_print(cpu->btb);
 }
 
+
 /*
- * This function prints the content of the pred table used for debugging.
+ * Drains the store buffer in the background. The oldest store starts its
+ * data cache write once the previous one completed, and reaches memory
+ * when the write does, so a miss holds up the stores behind it but not
+ * the pipeline.
  */
-void print_pred_table(CPU *cpu){
-    
-    //printf("================================\n");
-    printf("\n============ Prediction Table  ==================\n\n");
-    for (int reg=0; reg<REG_COUNT; reg++) {
-        printf("|	 PT[%2d] |  Pattern=%d   |\n",reg,cpu->PredTable[reg].counter);
-        //printf("--------------------------------\n");
+static void drain_store_buffer(CPU* cpu)
+{
+    StoreEntry* oldest = cpu->storebuf ? storebuf_oldest(cpu->storebuf) : NULL;
+    if(!oldest)
+        return;
+
+    if(cpu->storebuf->drain_done < 0)
+    {
+        int latency = 1;
+        if(cpu->l1d)
+        {
+            long long misses = cache_misses(cpu->l1d);
+
+            cpu->l1d->now = cpu->clock;
+            if(cpu->l2)
+                cpu->l2->now = cpu->clock;
+            latency = cache_access(cpu->l1d, oldest->addr, true);
+            if(cpu->prefetcher)
+                cpu->prefetcher->observe(cpu->prefetcher, oldest->pc, oldest->addr,
+                    cache_misses(cpu->l1d) != misses);
+        }
+        cpu->storebuf->drain_done = cpu->clock + latency - 1;
     }
-    printf("\n");
 
-    //printf("================================\n\n");
+    if(cpu->clock >= cpu->storebuf->drain_done)
+        storebuf_retire(cpu->storebuf, cpu->memory);
 }
 
-
 /*
- *  CPU CPU simulation loop
+ * Simulates one clock cycle, returns true once ret has been written back
+ * or a load or store went outside memory, see cpu->bad_address.
  */
-int CPU_run(CPU* cpu)
+bool CPU_cycle(CPU* cpu)
 {
-    for(int i=0; i < MAX_CPU_CYCLES;i++)
+    cpu->loop_branch_pc = -1;
+
+    if(cpu->intervals && cpu->clock - 1 - cpu->interval_base.cycles >= cpu->config.interval_cycles)
+        record_interval(cpu, cpu->clock - 1);
+
+    drain_store_buffer(cpu);
+    bool done = writeback_stage(cpu);
+
+    // A data cache miss holds the access in the memory stages,
+    // everything behind writeback waits for it
+    if(cpu->mem_stall_cycles > 0)
+    {
+        cpu->mem_stall_cycles--;
+        cpu->mem_stall_cnt++;
+    }
+    else
     {
-        if(1)
-        {
-            printf("================================\n");
-            printf("Clock Cycle #: %d\n", cpu->clock);
-            //printf("--------------------------------\n");
-        }
-        
-        bool done = writeback_stage(cpu);
-    
         memory_second_stage(cpu);
         memory_first_stage(cpu);
+        if(cpu->bad_address)
+            return true;
         branch_stage(cpu);
         divider_stage(cpu);
         multipler_stage(cpu);
@@ -230,12 +992,33 @@ int CPU_run(CPU* cpu)
         instruction_analyse_stage(cpu);
         decode_stage(cpu);
         fetch_stage(cpu);
+    }
+    return done;
+}
+
+/*
+ *  CPU CPU simulation loop
+ */
+int CPU_run(CPU* cpu)
+{
+    bool halted = false;
+
+    for(long long i=0; i < MAX_CPU_CYCLES;i++)
+    {
+        if(1)
+        {
+            printf("================================\n");
+            printf("Clock Cycle #: %lld\n", cpu->clock);
+            //printf("--------------------------------\n");
+        }
+        
+        bool done = CPU_cycle(cpu);
 
         if(done)
         {
             print_registers(cpu);
             // print_btb_table(cpu);
-            // print_pred_table(cpu);
+            halted = !cpu->bad_address;
             break;
         }
 
@@ -243,7 +1026,18 @@ int CPU_run(CPU* cpu)
 
         print_registers(cpu);
         // print_btb_table(cpu);
-        // print_pred_table(cpu);
+
+        // A loop back edge resolved, skip the iterations that repeat this one
+        if(cpu->loop && cpu->loop_branch_pc >= 0)
+        {
+            long long skipped = loop_extrapolate(cpu, cpu->loop_branch_pc, MAX_CPU_CYCLES - i - 1);
+            if(skipped > 0)
+            {
+                printf("Loop at %04d in steady state, %lld cycles extrapolated\n",
+                    cpu->loop_branch_pc / 7 * 4, skipped);
+                i += skipped;
+            }
+        }
 
         cpu->clock++;
     } 
@@ -256,17 +1050,229 @@ int CPU_run(CPU* cpu)
 
     print_registers(cpu);
 
+    if(cpu->bad_address)
+        print_bad_address(cpu);
+    else if(!halted)
+    {
+        print_truncation(cpu, "MAX_CPU_CYCLES reached");
+        printf("Use --longrun to simulate until ret\n");
+    }
+
+    if(DEBUG_STATS)
+        CPU_print_stats(cpu);
+
+    output_memory_map_file(cpu);
+
+    return halted ? 0 : -1;
+}
+
+/*
+ * Long-run simulation loop for runs far beyond MAX_CPU_CYCLES: nothing is
+ * printed per cycle and the run goes on until ret, unless the cycle or
+ * wall-clock watchdog of the configuration fires first or nothing retires
+ * for LONGRUN_STALL_LIMIT cycles, as when fetch ran off the end of a
+ * program without ret. A heartbeat with the progress so far is printed
+ * every config.heartbeat cycles.
+ */
+int CPU_run_long(CPU* cpu)
+{
+    struct timespec start, now;
+    long long limit = cpu->config.watchdog_cycles;
+    double seconds_limit = cpu->config.watchdog_seconds;
+    long long heartbeat = cpu->config.heartbeat;
+    long long next_beat = heartbeat > 0 ? heartbeat : LLONG_MAX;
+    long long next_check = WATCHDOG_CHECK_CYCLES;
+    const char* stop = NULL;
+    bool halted = false;
+    double seconds = 0.0;
+    long long retired = cpu->tot_instructions_done;
+    long long progress = cpu->clock;
+    char stalled[64];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i = 0; ; i++)
+    {
+        if(limit > 0 && i >= limit)
+        {
+            stop = "cycle watchdog fired";
+            break;
+        }
+
+        if(CPU_cycle(cpu))
+        {
+            halted = !cpu->bad_address;
+            break;
+        }
+
+        if(cpu->loop && cpu->loop_branch_pc >= 0)
+        {
+            long long skipped = loop_extrapolate(cpu, cpu->loop_branch_pc, limit > 0 ? limit - i - 1 : LLONG_MAX);
+            if(skipped > 0)
+                i += skipped;
+        }
+
+        // A pipeline that stopped retiring will not reach ret
+        if(cpu->tot_instructions_done != retired)
+        {
+            retired = cpu->tot_instructions_done;
+            progress = cpu->clock;
+        }
+        else if(cpu->clock - progress > LONGRUN_STALL_LIMIT)
+        {
+            snprintf(stalled, sizeof(stalled), "no instruction retired for %d cycles", LONGRUN_STALL_LIMIT);
+            stop = stalled;
+            break;
+        }
+
+        cpu->clock++;
+
+        // The host clock is only read every WATCHDOG_CHECK_CYCLES cycles
+        if(i >= next_check || cpu->clock >= next_beat)
+        {
+            next_check = i + WATCHDOG_CHECK_CYCLES;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+            if(cpu->clock >= next_beat)
+            {
+                printf("Heartbeat: cycle %lld, %lld instructions, IPC %f, %f s, %f cycles/s\n",
+                    cpu->clock, cpu->tot_instructions_done, (double)cpu->tot_instructions_done / cpu->clock,
+                    seconds, seconds > 0 ? cpu->clock / seconds : 0.0);
+                fflush(stdout);
+                while(next_beat <= cpu->clock)
+                    next_beat += heartbeat;
+            }
+            if(seconds_limit > 0 && seconds >= seconds_limit)
+            {
+                stop = "wall-clock watchdog fired";
+                break;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
+    printf("\n");
+
+    print_registers(cpu);
+
+    if(cpu->bad_address)
+        print_bad_address(cpu);
+    else if(!halted)
+        print_truncation(cpu, stop);
+
     if(DEBUG_STATS)
     {
-        printf("Stalled cycles due to data hazard: %d \n", cpu->cpu_stalled_cnt);
-        printf("Total execution cycles: %d\n", cpu->clock);
-        printf("Total instruction simulated: %d\n", cpu->tot_instructions_done);
-        printf("IPC: %f\n", (float)cpu->tot_instructions_done/cpu->clock);
+        CPU_print_stats(cpu);
+        printf("Host time: %f s, simulated cycles/sec: %f\n", seconds,
+            seconds > 0 ? cpu->clock / seconds : 0.0);
     }
 
     output_memory_map_file(cpu);
 
-    return 0;
+    return halted ? 0 : -1;
+}
+
+/*
+ * Says why a run stopped before ret; the statistics printed after it only
+ * cover the part that was simulated.
+ */
+void print_truncation(CPU* cpu, const char* reason)
+{
+    printf("Run truncated: %s at cycle %lld, %lld instructions retired, next fetch at %04d\n",
+        reason, cpu->clock, cpu->tot_instructions_done, cpu->pc / 7 * 4);
+    printf("The statistics only cover the simulated part of the program\n");
+}
+
+/*
+ * Says which load or store stopped the run by going outside memory.
+ */
+void print_bad_address(CPU* cpu)
+{
+    char reason[80];
+
+    snprintf(reason, sizeof(reason), "access to address %d outside memory by %04d",
+        cpu->bad_address_addr, cpu->bad_address_pc);
+    print_truncation(cpu, reason);
+}
+
+/*
+ * This function prints the statistics of a finished run.
+ */
+void CPU_print_stats(CPU* cpu)
+{
+    printf("Stalled cycles due to data hazard: %lld \n", cpu->cpu_stalled_cnt);
+    bypass_print_stats(&cpu->bypass);
+    printf("Total execution cycles: %lld\n", cpu->clock);
+    printf("Total instruction simulated: %lld\n", cpu->tot_instructions_done);
+    printf("IPC: %f\n", cpu->clock ? (double)cpu->tot_instructions_done / cpu->clock : 0.0);
+    printf("Pipeline flushes due to branches: %lld\n", cpu->branch_flush_cnt);
+    bpred_print_stats(cpu->bpred, cpu->tot_instructions_done);
+    btb_print_stats(cpu->btb);
+
+    if(cpu->l1d)
+    {
+        printf("Stalled cycles due to data cache misses: %lld \n", cpu->mem_stall_cnt);
+        cache_print_stats(cpu->l1d, cpu->tot_instructions_done);
+        if(cpu->l2)
+            cache_print_stats(cpu->l2, cpu->tot_instructions_done);
+        if(cpu->prefetcher)
+            prefetcher_print_stats(cpu->prefetcher);
+        if(cpu->mshr)
+            mshr_print_stats(cpu->mshr);
+        if(cpu->dram)
+            dram_print_stats(cpu->dram);
+    }
+
+    if(cpu->storebuf)
+        storebuf_print_stats(cpu->storebuf);
+
+    if(cpu->l1i)
+    {
+        printf("Stalled cycles due to instruction fetch: %lld \n", cpu->fetch_stall_cnt);
+        cache_print_stats(cpu->l1i, cpu->tot_instructions_done);
+    }
+
+    if(cpu->loop)
+        loop_print_stats(cpu->loop);
+
+    if(cpu->whatif)
+        whatif_print(cpu->whatif, cpu->clock, cpu->tot_instructions_done);
+}
+
+/*
+ * Functional-only run: executes the program with the threaded interpreter,
+ * or the translator with --jit, and produces the same architectural
+ * results as CPU_run, without timing.
+ */
+int CPU_run_functional(CPU* cpu)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long budget = cpu->config.longrun ? LLONG_MAX : (long long)MAX_CPU_CYCLES * 1000;
+    enum interpStatus_enum status = cpu->config.jit ? jit_run(cpu, budget) : interp_run(cpu, budget);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
+    printf("\n");
+
+    print_registers(cpu);
+
+    if(DEBUG_STATS)
+    {
+        printf("Functional run stopped: %s\n", interp_status_name(status));
+        printf("Total instruction simulated: %lld\n", cpu->tot_instructions_done);
+        printf("Host time: %f s, simulated instructions/sec: %f\n", seconds,
+            seconds > 0 ? cpu->tot_instructions_done / seconds : 0.0);
+    }
+
+    output_memory_map_file(cpu);
+
+    return status == interp_halted ? 0 : -1;
 }
 
 void output_memory_map_file(CPU * cpu)
@@ -286,23 +1292,63 @@ void output_memory_map_file(CPU * cpu)
     fclose(fout);
 }
 
-Register*  create_registers(int size){
-    Register* regs = malloc(sizeof(*regs) * size);
-    if (!regs) {
-        return NULL;
-    }
+/*
+ * Puts every register of a register file back to its initial state.
+ */
+void reset_registers(Register* regs, int size)
+{
+    memset(regs, 0, sizeof(*regs) * size);
     for (int i=0; i<size; i++){
         regs[i].value = 0;
         regs[i].is_writing = false;
         regs[i].last_reg_update_cycle = -1;
         regs[i].reg_in_process_cnt = 0;
     }
+}
+
+Register*  create_registers(Arena* arena, int size){
+    Register* regs = arena_alloc(arena, size * sizeof(*regs));
+    if (!regs) {
+        return NULL;
+    }
+    reset_registers(regs, size);
     return regs;
 }
 
-int get_tag_by_pc(int pc)
+/*
+ * This function models the instruction cache in front of fetch. The fetch
+ * buffer holds up to fetch_width instructions of one line, leaving it
+ * costs an instruction cache access. Returns false while fetch is waiting
+ * for a line.
+ */
+bool fetch_buffer_ready(CPU* cpu)
 {
-    return pc >> 6;
+    if(!cpu->l1i)
+        return true;
+
+    int addr = cpu->pc/7 * 4;
+    if(addr < cpu->fetch_buf_start || addr >= cpu->fetch_buf_end)
+    {
+        int line_size = cpu->l1i->config.line_size;
+        int line_end = (addr / line_size + 1) * line_size;
+        int latency = cache_access(cpu->l1i, addr, false);
+
+        cpu->fetch_buf_start = addr;
+        cpu->fetch_buf_end = addr + cpu->config.fetch_width * 4;
+        if(cpu->fetch_buf_end > line_end)
+            cpu->fetch_buf_end = line_end;
+
+        if(latency > 1)
+            cpu->fetch_stall_cycles = latency - 1;
+    }
+
+    if(cpu->fetch_stall_cycles > 0)
+    {
+        cpu->fetch_stall_cycles--;
+        cpu->fetch_stall_cnt++;
+        return false;
+    }
+    return true;
 }
 
 /*
@@ -312,6 +1358,8 @@ void fetch_stage(CPU* cpu)
 {
     if(cpu->fetch.status == stage_action && !cpu->cpu_halted && cpu->pc<cpu->tot_instructions*7)
     {
+        if(!fetch_buffer_ready(cpu))
+            return;
 
         //     cpu->instruction_memory stores the instruction in followings format
         //     int opcode; -> current_instruction
@@ -361,40 +1409,44 @@ void fetch_stage(CPU* cpu)
         // Halt the cpu when ret instruction is fetched
         // if(cpu->fetch.opcode == fmt_ret)
         // {
-        //     if(!cpu->cpu_stalled && !cpu->cpu_read_stall)
+        //     if(!cpu->cpu_stalled)
         //         cpu->cpu_halted = true;
         //     //cpu->fetch.status = stage_noAction;
         // }
 
-        if(!cpu->cpu_stalled && !cpu->cpu_read_stall)
+        if(!cpu->cpu_stalled)
         {
             //cpu->pc+=7; 
             cpu->decode = cpu->fetch;
+            cpu->decode.seq = cpu->fetch_seq++;
+            if(cpu->whatif)
+                whatif_fetch(cpu->whatif, cpu->decode.seq, cpu->clock, cpu->mem_stall_cnt + cpu->fetch_stall_cnt);
 
             // If its a branch instruction we are checking if the instruction is present in
-            // BTB table using TAG and based on its presence determining the program counter
+            // BTB table using TAG and ask the direction predictor whether to use its target
             if(cpu->fetch.is_branch_instr)
             {
-                unsigned int predicted_pc = 0;
-                unsigned int index = ((cpu->pc/7 * 4) >> 2) % REG_COUNT;
-                if (cpu->BTBTable[index].tag == get_tag_by_pc(cpu->fetch.curr_pc/7 * 4)) {
-                    // We found in the BTB, use the predicted target address
-                    predicted_pc = cpu->BTBTable[index].target;
-                    // Checking prediction table for a counter value
-                    unsigned int counter = cpu->PredTable[index].counter;
-
-                    // Use the prediction to update the PC
-                    if (counter >= 4) {
-                        // We predict the branch will be taken
-                        cpu->pc = cpu->BTBTable[index].target/4 * 7;
-                    } else {
-                        // We predict the branch will not be taken
-                        cpu->pc = cpu->pc + 7;
-                    }
+                int target = -1;
+                bool predicted = bpred_predict(cpu->bpred, cpu->pc/7 * 4);
+                bool use_target = false;
+
+                if (btb_lookup(cpu->btb, cpu->pc/7 * 4, &target)) {
+                    // We found in the BTB, the target is usable if we predict taken
+                    use_target = predicted;
+                }
+
+                cpu->decode.bp_predicted = predicted;
+                cpu->decode.bp_history = cpu->bpred->history;
+                bpred_speculate(cpu->bpred, use_target);
+
+                if (use_target) {
+                    // We predict the branch will be taken
+                    cpu->pc = target/4 * 7;
                 } else {
-                    // We have a miss in the BTB, predict the next instruction address
+                    // We predict the branch will not be taken or have a miss in the BTB
                     cpu->pc = cpu->pc + 7;
                 }
+                cpu->decode.pred_next_pc = cpu->pc;
             }
             else
             {             
@@ -416,7 +1468,7 @@ void decode_stage(CPU* cpu)
 {
     if(cpu->decode.status == stage_action)
     {
-        if(!cpu->cpu_stalled && !cpu->cpu_read_stall)
+        if(!cpu->cpu_stalled)
         {
             cpu->instruction_analyse = cpu->decode;
             cpu->decode.status = stage_noAction;
@@ -433,7 +1485,8 @@ bool analyse_data_dependency(CPU* cpu)
 
     int reg1_in_process_cnt = cpu->regs[cpu->instruction_analyse.src1].reg_in_process_cnt;
     int reg2_in_process_cnt = 0;
-    int dest_in_process_cnt = cpu->regs[cpu->register_read.dest].reg_in_process_cnt;
+    // An empty register read stage has no destination
+    int dest_in_process_cnt = cpu->register_read.dest >= 0 ? cpu->regs[cpu->register_read.dest].reg_in_process_cnt : 0;
     if(!cpu->instruction_analyse.imm_flag)
         reg2_in_process_cnt = cpu->regs[cpu->instruction_analyse.src2].reg_in_process_cnt;
 
@@ -481,61 +1534,6 @@ bool analyse_data_dependency(CPU* cpu)
     return false;
 }
 
-bool analyse_rr_data_dependency(CPU* cpu)
-{
-    if(cpu->register_read.opcode == fmt_ld_imm)
-        return false;
-
-    int reg1_in_process_cnt = cpu->regs[cpu->register_read.src1].reg_in_process_cnt;
-    int reg2_in_process_cnt = 0;
-    int dest_in_process_cnt = cpu->regs[cpu->register_read.dest].reg_in_process_cnt;
-
-    if(!cpu->register_read.imm_flag)
-        reg2_in_process_cnt = cpu->regs[cpu->register_read.src2].reg_in_process_cnt;
-
-    switch (cpu->register_read.opcode )
-    {
-    case fmt_ret:
-        return false; 
-        break;
-    case fmt_set:
-        return false;
-        break;  
-    case (fmt_st):
-        return reg1_in_process_cnt > 0 || dest_in_process_cnt>0;
-        break;
-    case (fmt_ld):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_st_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_ld_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_bez_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_bgez_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_blez_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_bgtz_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    case (fmt_bltz_imm):
-        return reg1_in_process_cnt > 0;
-        break;
-    default:
-        break;
-    }
-
-    return reg1_in_process_cnt > 0 || reg2_in_process_cnt > 0;
-}
-
-
 /*
  Instruction Analyse stage
 */
@@ -545,7 +1543,7 @@ void instruction_analyse_stage(CPU* cpu)
     {
         cpu->instruction_analyse.ia_data_hazard_found = analyse_data_dependency(cpu);
 
-        if(!cpu->cpu_stalled && !cpu->cpu_read_stall)
+        if(!cpu->cpu_stalled)
         {
             cpu->register_read = cpu->instruction_analyse;
             cpu->instruction_analyse.status = stage_noAction;
@@ -555,90 +1553,127 @@ void instruction_analyse_stage(CPU* cpu)
 }
 
 
-bool can_read_reg_in_curr_cycle(CPU* cpu)
+// Registers an instruction writes when it reaches writeback
+static bool writes_register(const Stage* stage)
 {
-    int last_reg1_update_cycle = cpu->regs[cpu->register_read.src1].last_reg_update_cycle;
-    int last_reg2_update_cycle = cpu->regs[cpu->register_read.src2].last_reg_update_cycle;
+    return stage->opcode != fmt_st && stage->opcode != fmt_st_imm && stage->opcode != fmt_ret
+        && !stage->is_branch_instr;
+}
 
-    int reg1_in_process_cnt = cpu->regs[cpu->register_read.src1].reg_in_process_cnt>0;
-    int reg2_in_process_cnt = cpu->regs[cpu->register_read.src2].reg_in_process_cnt>0;
+// Stage after which the result of opcode can be forwarded
+static int result_stage(int opcode)
+{
+    if(opcode == fmt_mul || opcode == fmt_mul_imm)
+        return bypass_mul;
+    if(opcode == fmt_div || opcode == fmt_div_imm)
+        return bypass_div;
+    if(opcode == fmt_ld || opcode == fmt_ld_imm)
+        return bypass_mem2;
+    return bypass_add;
+}
 
-    int reg1 = cpu->register_read.src1;
-    int reg2 = cpu->register_read.src2;
+// Result of reading one operand in RR
+typedef struct OperandRead {
+    int value;
+    int source;                   // bypass stage it came from, -1 for the register file
+    int saved;                    // stall cycles the bypass avoided
+    enum bypassStall_enum stall;
+} OperandRead;
 
-    if(cpu->register_read.opcode == fmt_st)
-    {
-        reg2 = cpu->register_read.dest;
-        last_reg2_update_cycle = cpu->regs[cpu->register_read.dest].last_reg_update_cycle;
-    }
+/*
+ * Reads register reg for the instruction in RR through the bypass network.
+ * The later stages have already run this cycle, so each latch after RR
+ * holds what the stage before it produced. The youngest in-flight producer
+ * of reg decides: its result is forwarded when it has been computed and
+ * the stage it just left is an enabled path, otherwise RR has to wait.
+ * Without a producer in flight the register file is read, a value written
+ * back in this very cycle only through the WB path.
+ */
+static void read_operand(CPU* cpu, int reg, OperandRead* read)
+{
+    Stage* latches[] = { &cpu->multipler, &cpu->divider, &cpu->branch,
+        &cpu->memory_first, &cpu->memory_second, &cpu->writeback };
+    unsigned int paths = cpu->bypass.paths;
+
+    read->source = -1;
+    read->saved = 0;
+    read->stall = bypass_stall_none;
 
-    bool allow_read = !(last_reg1_update_cycle == cpu->clock);
-    if(!allow_read)
+    for(int stage = bypass_add; stage < bypass_wb; stage++)
     {
-        return false;
+        Stage* producer = latches[stage];
+        if(producer->status != stage_action || !writes_register(producer) || producer->dest != reg)
+            continue;
+
+        int ready = result_stage(producer->opcode);
+        if(ready > stage)
+            read->stall = ready == bypass_mem2 ? bypass_stall_load : bypass_stall_latency;
+        else if(!(paths & BYPASS_PATH(stage)))
+            read->stall = bypass_stall_path;
+        else
+        {
+            read->value = producer->dest_value;
+            read->source = stage;
+            read->saved = bypass_saved(paths, stage, ready);
+        }
+        return;
     }
-    
-    if(cpu->register_read.imm_flag)
+
+    if(cpu->regs[reg].last_reg_update_cycle == cpu->clock)
     {
-        return true;
+        if(!(paths & BYPASS_PATH(bypass_wb)))
+        {
+            read->stall = bypass_stall_path;
+            return;
+        }
+        read->source = bypass_wb;
+        read->saved = bypass_saved(paths, bypass_wb, bypass_wb);
     }
-
-    if(cpu->register_read.opcode ==fmt_st)
-        allow_read =  !(last_reg2_update_cycle == cpu->clock);
-
-    if(!cpu->register_read.imm_flag && cpu->register_read.opcode !=fmt_st)
-        allow_read =  !(last_reg2_update_cycle == cpu->clock);
-
-    return allow_read;
+    read->value = cpu->regs[reg].value;
 }
 
-bool can_use_forwarding(CPU* cpu)
+/*
+ * Source registers of the instruction in RR and the fields their values
+ * go to. Returns how many there are.
+ */
+static int register_operands(Stage* stage, int* regs, int** values)
 {
-    if(cpu->register_read.opcode == fmt_ld_imm)
-        return false;
-
-    bool reg1_in_process = false;
-    bool reg2_in_process = false;
-
-    reg1_in_process = cpu->regs[cpu->register_read.src1].reg_in_process_cnt > 0;
-    if(cpu->register_read.imm_flag==0)
-        reg2_in_process = cpu->regs[cpu->register_read.src2].reg_in_process_cnt > 0;
+    bool is_load = stage->opcode == fmt_ld || stage->opcode == fmt_ld_imm;
+    bool is_store = stage->opcode == fmt_st || stage->opcode == fmt_st_imm;
+    int count = 0;
 
-    int reg1 = cpu->register_read.src1;
-    int reg2 = cpu->register_read.src2;
+    if(stage->opcode == fmt_set || stage->opcode == fmt_ret || (is_load && stage->imm_flag))
+        return 0;
 
-    bool allow_forwarding = false;
+    regs[count] = stage->src1;
+    values[count++] = &stage->src1_value;
 
-    if(reg1_in_process)
+    // The register form of a store takes its address from dest
+    if(stage->imm_flag == 0 && is_store)
     {
-        if(cpu->forward_regs[reg1].has_value)
-        {
-            if(reg2_in_process)
-            {
-                if(cpu->forward_regs[reg2].has_value)
-                {
-                    allow_forwarding = true;   
-                }
-            }
-            else
-                allow_forwarding = true; 
-        }
+        regs[count] = stage->dest;
+        values[count++] = &stage->dest_value;
     }
-    else
+    else if(stage->imm_flag == 0 && !is_load && !is_store && !stage->is_branch_instr)
     {
-        if(reg2_in_process)
-        {
-            if(cpu->forward_regs[reg2].has_value)
-            {
-                allow_forwarding = true;   
-            }
-        }
+        regs[count] = stage->src2;
+        values[count++] = &stage->src2_value;
     }
-
-    return allow_forwarding;
+    return count;
 }
 
-
+/*
+ * True while a register the instruction in RR reads or writes waits for
+ * the data of a load that missed with MSHRs. Waiting on the destination
+ * too keeps the late fill from landing after a younger result.
+ */
+static bool waits_for_miss(CPU* cpu, const int* regs, int count)
+{
+    for(int i = 0; i < count; i++)
+        if(cpu->clock < cpu->miss_ready[regs[i]])
+            return true;
+    return writes_register(&cpu->register_read) && cpu->clock < cpu->miss_ready[cpu->register_read.dest];
+}
 
 /*
  This function performs register read and checks for opcodes of cpu registers and stores those accordingly
@@ -647,270 +1682,69 @@ void register_read_stage(CPU* cpu)
 {
     if(cpu->register_read.status == stage_action)
     {
-        cpu->cpu_read_stall = false;
+        int regs[2];
+        int* values[2];
+        OperandRead reads[2];
+        enum bypassStall_enum stall = bypass_stall_none;
 
         print_pipeline(REGISTER_READ, cpu->lines[cpu->register_read.instruction_line]);
+        cpu->register_read.ia_data_hazard_found = false;
 
-        if(cpu->register_read.ia_data_hazard_found)
+        int count = register_operands(&cpu->register_read, regs, values);
+        for(int i = 0; i < count; i++)
         {
-            cpu->register_read.ia_data_hazard_found = false;
-            cpu->cpu_stalled = true;
+            read_operand(cpu, regs[i], &reads[i]);
+            if(reads[i].stall > stall)
+                stall = reads[i].stall;
         }
-
-        cpu->cpu_stalled = analyse_rr_data_dependency(cpu);
-
-        bool use_forward_values = can_use_forwarding(cpu);
-
-        if(cpu->cpu_stalled && use_forward_values)
+        bool miss_wait = false;
+        if(cpu->mshr && stall == bypass_stall_none && waits_for_miss(cpu, regs, count))
         {
-            cpu->cpu_stalled = false;
+            stall = bypass_stall_load;
+            miss_wait = true;
+            cpu->mshr->use_stalls++;
         }
- 
-        if(!cpu->cpu_stalled && !can_read_reg_in_curr_cycle(cpu))
-            cpu->cpu_read_stall = true;
 
-        if(!cpu->cpu_stalled && (can_read_reg_in_curr_cycle(cpu) || (cpu->register_read.imm_flag && use_forward_values)))
+        cpu->cpu_stalled = stall != bypass_stall_none;
+        if(!cpu->cpu_stalled)
         {
-            cpu->cpu_read_stall = false;
-            bool reg1 = false;
-            bool reg2 = false;
-            reg1 = cpu->regs[cpu->register_read.src1].reg_in_process_cnt>0;
-
-            if(cpu->register_read.imm_flag==0)
-                reg2 = cpu->regs[cpu->register_read.src2].reg_in_process_cnt>0;
-            
-            if(cpu->register_read.opcode == fmt_add || cpu->register_read.opcode == fmt_add_imm)
-            {
-                if(cpu->register_read.imm_flag==0)
-                {
-                    if(use_forward_values)
-                    {
-                        if(reg1)
-                            cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                        else
-                            cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-
-                        if(reg2)
-                            cpu->register_read.src2_value = cpu->forward_regs[cpu->register_read.src2].value;
-                        else
-                            cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                        cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-                else
-                {
-                    if(use_forward_values)
-                        cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                    else
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-            }
-            else if(cpu->register_read.opcode == fmt_div ||cpu->register_read.opcode == fmt_div_imm){
-                if(cpu->register_read.imm_flag==0)
-                {
-                    if(use_forward_values)
-                    {
-                        if(reg1)
-                            cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                        else
-                            cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-
-                        if(reg2)
-                            cpu->register_read.src2_value = cpu->forward_regs[cpu->register_read.src2].value;
-                        else
-                            cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                        cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;                   
-                }
-                else
-                {
-                    if(use_forward_values)
-                    {
-                        cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                    }
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-            }
-            else if(cpu->register_read.opcode == fmt_ld || cpu->register_read.opcode == fmt_ld_imm){
-                if(cpu->register_read.imm_flag==0)
-                {
-                    if(use_forward_values)
-                    {
-                        cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-
-                    }
-                    else
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-                else
-                {
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-            }
-            else if(cpu->register_read.opcode == fmt_sub || cpu->register_read.opcode == fmt_sub_imm){
-                if(cpu->register_read.imm_flag==0)
-                {
-                    if(use_forward_values)
-                    {
-                        if(reg1)
-                            cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                        else
-                            cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-
-                        if(reg2)
-                            cpu->register_read.src2_value = cpu->forward_regs[cpu->register_read.src2].value;
-                        else
-                            cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                        cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-                else
-                {   
-                    if(use_forward_values)
-                    {
-                        cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                    }
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-            }
-            else if(cpu->register_read.opcode == fmt_mul || cpu->register_read.opcode == fmt_mul_imm){
-                if(cpu->register_read.imm_flag==0)
-                {
-                    if(use_forward_values)
-                    {
-                        if(reg1)
-                            cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                        else
-                            cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-
-                        if(reg2)
-                            cpu->register_read.src2_value = cpu->forward_regs[cpu->register_read.src2].value;
-                        else
-                            cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                        cpu->register_read.src2_value = cpu->regs[cpu->register_read.src2].value;
-                    }
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-                else
-                {   if(use_forward_values)
-                    {
-                        cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                    }
-                    cpu->regs[cpu->register_read.dest].is_writing = true;
-                    cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                }
-            }
-            else if(cpu->register_read.opcode == fmt_st || cpu->register_read.opcode == fmt_st_imm)
+            bool forwarded = false;
+            for(int i = 0; i < count; i++)
             {
-                if(use_forward_values)
-                {
-                    if(cpu->register_read.imm_flag==0)
-                    {
-                        reg2 = cpu->regs[cpu->register_read.dest].reg_in_process_cnt>0;
-                        if(reg1)
-                            cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                        else
-                            cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-
-                        if(reg2)
-                            cpu->register_read.dest_value = cpu->forward_regs[cpu->register_read.dest].value;
-                        else
-                            cpu->register_read.dest_value = cpu->regs[cpu->register_read.dest].value;
-
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
-                    }
-                }
-                else
+                *values[i] = reads[i].value;
+                if(reads[i].source >= 0)
                 {
-                    if(cpu->register_read.imm_flag==0)
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                        cpu->register_read.dest_value = cpu->regs[cpu->register_read.dest].value;
-                    }
-                    else
-                    {
-                        cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                    }
+                    cpu->bypass.uses[reads[i].source]++;
+                    cpu->bypass.saved[reads[i].source] += reads[i].saved;
+                    forwarded = true;
                 }
-
-                // cpu->regs[cpu->register_read.dest].is_writing = true;
-                // cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                
             }
-            else if(cpu->register_read.opcode == fmt_set){
-                if(use_forward_values)
-                {
-                    cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
+            if(forwarded)
+                cpu->forward_cnt++;
 
-                }
-                else
-                    cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-                    
+            if(writes_register(&cpu->register_read))
+            {
                 cpu->regs[cpu->register_read.dest].is_writing = true;
                 cpu->regs[cpu->register_read.dest].reg_in_process_cnt++;
-                
             }
-            else if(cpu->register_read.is_branch_instr){
-                if(use_forward_values)
-                {
-                    cpu->register_read.src1_value = cpu->forward_regs[cpu->register_read.src1].value;
 
-                }
-                else
-                    cpu->register_read.src1_value = cpu->regs[cpu->register_read.src1].value;
-            }
-              cpu->adder = cpu->register_read;
+            cpu->adder = cpu->register_read;
             cpu->register_read.status = stage_noAction;
+            if(cpu->whatif)
+                whatif_issue(cpu->whatif, cpu->adder.seq, cpu->clock, memory_stalls(cpu));
+        }
+        else if(miss_wait)
+        {
+            // Waiting for a fill is memory delay, not a data hazard
+            cpu->miss_wait_cnt++;
         }
         else
+        {
             cpu->cpu_stalled_cnt++;
+            cpu->bypass.stalls[stall]++;
+            if(cpu->whatif)
+                whatif_stall(cpu->whatif, cpu->register_read.seq);
+        }
     }
 }
 
@@ -931,8 +1765,6 @@ void adder_stage(CPU* cpu)
             else{
                 cpu->adder.dest_value = cpu->adder.imm1 + cpu->adder.src1_value;
             }
-            cpu->forward_regs[cpu->adder.dest].has_value = true;
-            cpu->forward_regs[cpu->adder.dest].value = cpu->adder.dest_value;
         }
         if(cpu->adder.opcode == fmt_sub || cpu->adder.opcode == fmt_sub_imm)
         {
@@ -943,14 +1775,10 @@ void adder_stage(CPU* cpu)
             else{
                 cpu->adder.dest_value = cpu->adder.src1_value - cpu->adder.imm1;
             }
-            cpu->forward_regs[cpu->adder.dest].has_value = true;
-            cpu->forward_regs[cpu->adder.dest].value = cpu->adder.dest_value;
         }
         if(cpu->adder.opcode == fmt_set)
         {
             cpu->adder.dest_value = cpu->adder.imm1;
-            cpu->forward_regs[cpu->adder.dest].has_value = true;
-            cpu->forward_regs[cpu->adder.dest].value = cpu->adder.dest_value;
         }
         cpu->multipler = cpu->adder;
         cpu->adder.status = stage_noAction;
@@ -965,9 +1793,6 @@ void multipler_stage(CPU* cpu)
 {
     if(cpu->multipler.status == stage_action)
     {
-        // cpu->forward_regs[cpu->multipler.dest].has_value = false;
-        // cpu->forward_regs[cpu->multipler.dest].value = false;
-
         if(cpu->multipler.opcode == fmt_mul || cpu->multipler.opcode == fmt_mul_imm)
         {
             if(cpu->multipler.imm_flag==0)
@@ -977,8 +1802,6 @@ void multipler_stage(CPU* cpu)
             else{
                 cpu->multipler.dest_value = cpu->multipler.imm1 * cpu->multipler.src1_value;
             }
-            cpu->forward_regs[cpu->multipler.dest].has_value = true;
-            cpu->forward_regs[cpu->multipler.dest].value = cpu->multipler.dest_value;
         }
 
         cpu->divider = cpu->multipler;
@@ -994,9 +1817,6 @@ void divider_stage(CPU* cpu)
 {
     if(cpu->divider.status == stage_action)
     {
-        // cpu->forward_regs[cpu->divider.dest].has_value = false;
-        // cpu->forward_regs[cpu->divider.dest].value = false;
-
         if(cpu->divider.opcode == fmt_div || cpu->divider.opcode == fmt_div_imm)
         {
             if(cpu->divider.imm_flag==0)
@@ -1006,8 +1826,6 @@ void divider_stage(CPU* cpu)
             else{
                 cpu->divider.dest_value = (int)cpu->divider.src1_value / cpu->divider.imm1;
             }
-            cpu->forward_regs[cpu->divider.dest].has_value = true;
-            cpu->forward_regs[cpu->divider.dest].value = cpu->divider.dest_value;
            
         }
         
@@ -1051,31 +1869,15 @@ void flush_pipeline(CPU *cpu)
     cpu->decode.status = stage_noAction;
     cpu->fetch.status = stage_noAction;
 
+    // Fetch restarts on the new path with an empty fetch buffer
+    cpu->fetch_buf_start = -1;
+    cpu->fetch_buf_end = -1;
+    cpu->fetch_stall_cycles = 0;
+
     cpu->cpu_stalled = false;
 }
 
 
-bool check_predicted_pc(CPU* cpu, int pc)
-{
-    if(cpu->divider.status == stage_action)
-    {
-        return cpu->divider.curr_pc == pc;
-    }
-    if(cpu->multipler.status == stage_action)
-    {
-        return cpu->multipler.curr_pc == pc;
-    }
-    if(cpu->adder.status == stage_action)
-    {
-        return cpu->adder.curr_pc == pc;
-    }
-    if(cpu->register_read.status == stage_action)
-    {
-        return cpu->register_read.curr_pc == pc;
-    }
-    return false;
-}
-
 /*
  this function passes the instruction from branch stage to mem1 
 */
@@ -1083,16 +1885,9 @@ void branch_stage(CPU* cpu)
 {
     if(cpu->branch.status == stage_action)
     {
-        // Wiping forwarding values in this stage
-        if(!cpu->branch.is_branch_instr)
-        {
-            cpu->forward_regs[cpu->branch.dest].has_value = false;
-            cpu->forward_regs[cpu->branch.dest].value = -9999;
-        }
-
-        // For a branch instruction we are checking if we have predicted the instruction
-        // correctly and based on that incrementing the counter values
-        // If instruction is not there in the BTB table a new entry is added
+        // For a branch instruction we are checking if fetch continued on the right
+        // path and training the direction predictor with the outcome
+        // The BTB entry of the branch is installed or refreshed
         if(cpu->branch.is_branch_instr)
         {
             bool result = false;
@@ -1105,68 +1900,44 @@ void branch_stage(CPU* cpu)
                 (cpu->branch.opcode == fmt_bltz_imm && cpu->branch.src1_value < 0))
                 result = true;
 
-            int next_predicted_pc = cpu->branch.imm1;
-            bool correctly_predicted = false;
-
             int curr_pc_addr = cpu->branch.curr_pc/7 * 4;
-                
-            int index = (curr_pc_addr >> 2) % REG_COUNT;
-            // Check the tag if it is found and matching the curr branch instruction
-            bool entry_found = cpu->BTBTable[index].tag == get_tag_by_pc(cpu->branch.curr_pc/7 * 4);
-
-            // If PC is found in BTB, update prediction table
-            if (entry_found) {
-                correctly_predicted = check_predicted_pc(cpu, next_predicted_pc/4 * 7);
-                if(result == true)
-                {
-                    if(correctly_predicted)
-                    {
-                        if(cpu->PredTable[index].counter<7)
-                            cpu->PredTable[index].counter++;
-                    }
-                    else
-                    {
-                        flush_pipeline(cpu);
-                        cpu->pc = cpu->branch.imm1/4 * 7;
-
-                        if(cpu->PredTable[index].counter<7)
-                            cpu->PredTable[index].counter++;
-                    }
-                }
-                else
-                {
-                    if(!correctly_predicted)
-                    {
-                        if(cpu->PredTable[index].counter>0)
-                            cpu->PredTable[index].counter--;
-                    }
-                    else
-                    {
-                        flush_pipeline(cpu);
-                        cpu->pc = cpu->branch.curr_pc+7;
-
-                        if(cpu->PredTable[index].counter>0)
-                            cpu->PredTable[index].counter--;
-                    }   
-                }
+
+            btb_update(cpu->btb, curr_pc_addr, cpu->branch.imm1);
+
+            bpred_update(cpu->bpred, curr_pc_addr, cpu->branch.bp_history, cpu->branch.bp_predicted, result);
+
+            if(cpu->loop)
+            {
+                loop_branch_resolved(cpu->loop, curr_pc_addr, result);
+                if(result && cpu->branch.imm1/4 * 7 <= cpu->branch.curr_pc)
+                    cpu->loop_branch_pc = cpu->branch.curr_pc;
             }
-            else{
-                cpu->BTBTable[index].tag = get_tag_by_pc(cpu->branch.curr_pc/7 * 4);
-                cpu->BTBTable[index].target = cpu->branch.imm1;
-                if(result)
-                {
-                    flush_pipeline(cpu);
-                    cpu->pc = cpu->branch.imm1/4 * 7;
 
-                    if(cpu->PredTable[index].counter<7)
-                        cpu->PredTable[index].counter++;
-                }
-                else
-                {
-                    if(cpu->PredTable[index].counter>0)
-                            cpu->PredTable[index].counter--;
-                }
+            if(cpu->bptrace)
+            {
+                BPTraceRecord record;
+                record.pc = curr_pc_addr;
+                record.target = cpu->branch.imm1;
+                record.opcode = cpu->branch.opcode;
+                record.taken = result;
+                bptrace_write(cpu->bptrace, &record);
+            }
+
+            // Fetch went down the wrong path, flush and repair the predictor history
+            int next_pc = result ? cpu->branch.imm1/4 * 7 : cpu->branch.curr_pc + 7;
+            bool mispredicted = cpu->branch.pred_next_pc != next_pc;
+            if(mispredicted)
+            {
+                flush_pipeline(cpu);
+                bpred_recover(cpu->bpred, cpu->branch.bp_history, result);
+                cpu->pc = next_pc;
+                cpu->branch_flush_cnt++;
             }
+
+            if(cpu->event_hook)
+                report_event(cpu, event_branch, &cpu->branch, -1, result, mispredicted);
+            if(cpu->whatif)
+                whatif_branch(cpu->whatif, cpu->branch.seq, cpu->clock, memory_stalls(cpu), mispredicted);
         }
 
         cpu->memory_first = cpu->branch;
@@ -1176,6 +1947,40 @@ void branch_stage(CPU* cpu)
 }
 
 
+/*
+ * Data cache access of the instruction in Mem1 with MSHRs. It does not
+ * hold up the pipeline: a miss takes an MSHR, waiting for one to free only
+ * when they are all busy, and an access to a line whose fill is in flight
+ * waits for that fill. A load carries on to Mem2 without its data and its
+ * destination cannot be read in RR before the data could have reached it
+ * through the bypass network.
+ */
+static void nonblocking_access(CPU* cpu, Stage* stage, unsigned int addr, int latency, bool miss)
+{
+    long long done = cpu->clock + latency - 1;
+
+    if(miss)
+    {
+        int wait = mshr_wait(cpu->mshr, cpu->clock);
+        cpu->mem_stall_cycles += wait;
+        done += wait;
+        mshr_allocate(cpu->mshr, addr, cpu->clock + wait, done);
+    }
+    else
+    {
+        MSHREntry* pending = mshr_find(cpu->mshr, addr, cpu->clock);
+        if(pending)
+        {
+            cpu->mshr->merged++;
+            if(pending->done > done)
+                done = pending->done;
+        }
+    }
+
+    if(stage->ld_flag && done > cpu->clock)
+        cpu->miss_ready[stage->dest] = done + bypass_saved(cpu->bypass.paths, bypass_mem1, bypass_mem2);
+}
+
 /*
 This function handles memory access for an instruction that has reached the "memory" stage of the CPU pipeline
 */
@@ -1212,6 +2017,80 @@ void memory_first_stage(CPU* cpu)
             }
         }
 
+        // An access outside memory stops the run before it reaches the
+        // caches or memory, like interp_bad_address for the interpreter
+        if(cpu->memory_first.ld_flag || cpu->memory_first.st_flag)
+        {
+            int addr = cpu->memory_first.st_flag ? cpu->memory_first.write_st : cpu->memory_first.addr;
+            if((unsigned int)(addr / 4) >= (unsigned int)cpu->memoryLen)
+            {
+                cpu->bad_address = true;
+                cpu->bad_address_addr = addr;
+                cpu->bad_address_pc = cpu->memory_first.curr_pc / 7 * 4;
+                cpu->memory_first.status = stage_noAction;
+                return;
+            }
+        }
+
+        if(cpu->memory_first.st_flag)
+            cpu->store_cnt++;
+        else if(cpu->memory_first.ld_flag)
+            cpu->load_cnt++;
+
+        // With a store buffer a store is buffered here instead of writing the
+        // data cache, waiting while the buffer is full, and a load to a word
+        // with a buffered store takes its value without going to the cache
+        bool buffered = false;
+        cpu->memory_first.store_forwarded = false;
+        if(cpu->storebuf && cpu->memory_first.st_flag)
+        {
+            cpu->mem_stall_cycles += storebuf_wait(cpu->storebuf, cpu->clock);
+            storebuf_insert(cpu->storebuf, cpu->memory_first.write_st, cpu->memory_first.read_st,
+                cpu->memory_first.curr_pc);
+            buffered = true;
+        }
+        else if(cpu->storebuf && cpu->memory_first.ld_flag)
+        {
+            buffered = storebuf_forward(cpu->storebuf, cpu->memory_first.addr, &cpu->memory_first.dest_value);
+            cpu->memory_first.store_forwarded = buffered;
+        }
+
+        if(cpu->addrtrace && (cpu->memory_first.ld_flag || cpu->memory_first.st_flag))
+        {
+            AddrTraceRecord record;
+            record.pc = cpu->memory_first.curr_pc/7 * 4;
+            record.is_store = cpu->memory_first.st_flag;
+            record.addr = record.is_store ? cpu->memory_first.write_st : cpu->memory_first.addr;
+            addrtrace_write(cpu->addrtrace, &record);
+        }
+
+        // Look up the data cache with the address computed above, a miss
+        // stalls the pipeline for the cycles beyond the Mem1 access unless
+        // the MSHRs let it go on
+        if(cpu->l1d && !buffered && (cpu->memory_first.ld_flag || cpu->memory_first.st_flag))
+        {
+            bool is_store = cpu->memory_first.st_flag;
+            unsigned int addr = is_store ? cpu->memory_first.write_st : cpu->memory_first.addr;
+            long long misses = cache_misses(cpu->l1d);
+
+            cpu->l1d->now = cpu->clock;
+            if(cpu->l2)
+                cpu->l2->now = cpu->clock;
+
+            int latency = cpu->coherence
+                ? coherence_access(cpu->coherence, cpu->core_id, addr, is_store, cpu->clock)
+                : cache_access(cpu->l1d, addr, is_store);
+            if(cpu->mshr)
+                nonblocking_access(cpu, &cpu->memory_first, addr, latency, cache_misses(cpu->l1d) != misses);
+            else if(latency > 1)
+                cpu->mem_stall_cycles += latency - 1;
+
+            // The prefetcher sees every demand address and whether it missed
+            if(cpu->prefetcher)
+                cpu->prefetcher->observe(cpu->prefetcher, cpu->memory_first.curr_pc, addr,
+                    cache_misses(cpu->l1d) != misses);
+        }
+
         /*
         Copy the first memory stage to the second memory stage and set the status of the first memory stage to no action.
         */
@@ -1227,7 +2106,8 @@ void memory_second_stage(CPU* cpu)
 {
     if(cpu->memory_second.status == stage_action)
     {
-        if(cpu->memory_second.opcode == fmt_ld ||cpu->memory_second.opcode == fmt_ld_imm)
+        if((cpu->memory_second.opcode == fmt_ld ||cpu->memory_second.opcode == fmt_ld_imm)
+            && !cpu->memory_second.store_forwarded)
         {
             if(cpu->memory_second.imm_flag && cpu->memory_second.ld_flag)
             {
@@ -1243,7 +2123,8 @@ void memory_second_stage(CPU* cpu)
             }
         }
 
-        if(cpu->memory_second.opcode == fmt_st ||cpu->memory_second.opcode == fmt_st_imm)
+        // A buffered store reaches memory when it drains
+        if((cpu->memory_second.opcode == fmt_st ||cpu->memory_second.opcode == fmt_st_imm) && !cpu->storebuf)
         {
             if(cpu->memory_second.imm_flag && cpu->memory_second.st_flag)
             {
@@ -1269,7 +2150,6 @@ bool writeback_stage(CPU* cpu)
 {
     if(cpu->writeback.status == stage_action)
     {
-        cpu->cpu_read_stall = false;
         cpu->writeback.status = stage_noAction;
         
         if(cpu->writeback.opcode == fmt_ret)
@@ -1277,16 +2157,27 @@ bool writeback_stage(CPU* cpu)
             //print_pipeline(WRITEBACK, cpu->lines[cpu->writeback.instruction_line]);
             cpu->tot_instructions_done++;
             cpu->writeback.dest_written = true;
+            if(cpu->storebuf)
+                storebuf_flush(cpu->storebuf, cpu->memory);
             //cpu->cpu_halted = true;
                     print_pipeline(WRITEBACK, cpu->lines[cpu->writeback.instruction_line]);
+            if(cpu->whatif)
+                whatif_retire(cpu->whatif, cpu->writeback.seq, fmt_ret, -1, -1, -1, cpu->clock, memory_stalls(cpu));
+            if(cpu->event_hook)
+            {
+                report_event(cpu, event_retire, &cpu->writeback, -1, false, false);
+                report_event(cpu, event_halt, &cpu->writeback, -1, false, false);
+            }
             return true;
         }
 
+        int written = -1;
         if(!cpu->writeback.dest_written
             && cpu->writeback.st_flag != 1
             && !cpu->writeback.is_branch_instr
         )
         {
+            written = cpu->writeback.dest;
             //to check if the destination register for the instruction has already been written to. If it has not, write the destination value (dest_value) of the writeback stage to the appropriate register in the CPU
             cpu->regs[cpu->writeback.dest].value = cpu->writeback.dest_value;
             cpu->regs[cpu->writeback.dest].has_value = true;
@@ -1316,6 +2207,11 @@ bool writeback_stage(CPU* cpu)
         cpu->tot_instructions_done++;
 
         print_pipeline(WRITEBACK, cpu->lines[cpu->writeback.instruction_line]);
+        if(cpu->whatif)
+            whatif_retire(cpu->whatif, cpu->writeback.seq, cpu->writeback.opcode, cpu->writeback.dest,
+                cpu->writeback.src1, cpu->writeback.src2, cpu->clock, memory_stalls(cpu));
+        if(cpu->event_hook)
+            report_event(cpu, event_retire, &cpu->writeback, written, false, false);
     }
 
     return false;
@@ -1385,7 +2281,8 @@ int get_instruction_count_in_input_file(FILE* file)
     char line[1000];
 
     while (fgets(line, sizeof(line), file)) { // read each line of the file into the buffer
-        line_count++; // increment the line counter variable
+        if(!blank_line(line))
+            line_count++; // increment the line counter variable
     }
 
  //   printf("The file contains %d lines\n", line_count);
@@ -1394,12 +2291,149 @@ int get_instruction_count_in_input_file(FILE* file)
 
 
 
+/*
+ * Number of tokens a line with the given opcode has, its line number
+ * included, 0 if the opcode is unknown.
+ */
+static int instruction_token_count(const char* opcode)
+{
+    if(strcmp(opcode, "ld") == 0 || strcmp(opcode, "st") == 0 || strcmp(opcode, "set") == 0)
+        return 4;
+    if(strcmp(opcode, "bez")==0 || strcmp(opcode, "bgez")==0 || strcmp(opcode, "blez")==0 || strcmp(opcode, "bgtz")==0 || strcmp(opcode, "bltz")==0)
+        return 4;
+    if(strcmp(opcode, "mul") == 0 || strcmp(opcode, "div") == 0 || strcmp(opcode, "sub") == 0 || strcmp(opcode, "add") == 0)
+        return 5;
+    if(strstr(opcode, "ret") != NULL)
+        return 2;
+    return 0;
+}
+
+static bool valid_register(int reg)
+{
+    return reg >= 0 && reg < NUM_REGS;
+}
+
+/*
+ * This function decodes one line of the input program into the 7 ints of
+ * decoded, see file_parser for their layout. line_no is the index of the
+ * line, used to find its text for printing. The line is modified. It
+ * returns false if the opcode is unknown, an operand is missing or a
+ * register does not exist. A blank line holds no instruction and is
+ * rejected as well, the parsers skip blank lines before calling it.
+ */
+bool parse_instruction_line(char* line, int* decoded, int line_no)
+{
+    char* tokens[MAX_TOKENS];
+    char* save = NULL;
+    int i = 0;
+    char* token = strtok_r(line, " \t\r\n", &save); // split the line into tokens based on spaces
+
+    while (token != NULL && i < MAX_TOKENS) { // iterate through each token
+        tokens[i] = token;
+        i++;
+        token = strtok_r(NULL, " \t\r\n", &save);
+    }
+
+    memset(decoded, 0, 7 * sizeof(int));
+    decoded[6] = line_no;
+    if(i < 2)
+        return false;
+
+    int needed = instruction_token_count(tokens[1]);
+    if(needed == 0 || i < needed)
+        return false;
+
+    if(strcmp(tokens[1], "ld") == 0)
+    {
+        if(strchr(tokens[3], '#'))
+        {
+            decoded[0] =  mapOpcode(tokens[1], 1);
+            decoded[1] = atoi(tokens[2]+1);
+            decoded[3] = atoi(tokens[3]+1);
+            decoded[5] = 1;
+        }
+        else{
+            decoded[0] =  mapOpcode(tokens[1], 0);
+            decoded[1] = atoi(tokens[2]+1);
+            decoded[2] = atoi(tokens[3]+1);
+           
+        }
+    }
+    if(strcmp(tokens[1], "st") == 0)
+    {
+        // st R1 #123
+        if(strchr(tokens[3], '#'))
+        {
+            decoded[0] =  mapOpcode(tokens[1], 1);
+            //decoded[1] = -1;
+            decoded[2] = atoi(tokens[2]+1);
+            decoded[3] = atoi(tokens[3]+1);
+            decoded[5] = 1;    
+        }
+        else{
+            decoded[0] =  mapOpcode(tokens[1], 0);
+            decoded[2] = atoi(tokens[2]+1);
+            decoded[1] = atoi(tokens[3]+1);
+           
+        }
+    }
+    if(strcmp(tokens[1], "bez")==0 || strcmp(tokens[1], "bgez")==0 || strcmp(tokens[1], "blez")==0 || strcmp(tokens[1], "bgtz")==0 || strcmp(tokens[1], "bltz")==0)       
+    {
+        decoded[0] =  mapOpcode(tokens[1], 1);
+        decoded[2] = atoi(tokens[2]+1);
+        decoded[3] = atoi(tokens[3]+1);
+        decoded[5] = 1;    
+    }
+    if(strcmp(tokens[1], "mul") == 0 || strcmp(tokens[1], "div") == 0 || strcmp(tokens[1], "sub") == 0 || strcmp(tokens[1], "add") == 0)
+    {
+
+        //strchr is similar to .contains 
+        if(strchr(tokens[4], '#'))
+        {
+            decoded[0] =  mapOpcode(tokens[1], 1);
+            decoded[1] = atoi(tokens[2]+1);
+            decoded[2] = atoi(tokens[3]+1);
+            decoded[3] = atoi(tokens[4]+1);
+            decoded[5] = 1;   // imm flag
+        }
+        else
+        {
+            decoded[0] =  mapOpcode(tokens[1], 0);
+            decoded[1] = atoi(tokens[2]+1);
+            decoded[2] = atoi(tokens[3]+1);
+            decoded[4] = atoi(tokens[4]+1);
+        }
+    }
+    if(strcmp(tokens[1], "set") == 0)
+    {
+        decoded[0] =  mapOpcode(tokens[1], 0);
+        decoded[1] = atoi(tokens[2]+1);
+        decoded[3] = atoi(tokens[3]+1);
+    }
+    // if(strcmp(tokens[1], "ret\n") == 0)
+    // {
+    if(strstr(tokens[1], "ret") != NULL)
+    {
+        char *op = "ret";
+        decoded[0] =  mapOpcode(op, 0);
+        return true;
+    }
+
+    // Every other instruction names a register in its first operand, and
+    // in its second one unless that is an immediate
+    return valid_register(decoded[1]) && valid_register(decoded[2]) && valid_register(decoded[4]);
+}
+
 /*
 The below function is opening a file for reading, getting the total number of instructions in the file, allocating memory for an array to store the instructions, and then parsing each line of the file to extract the opcode and operands for each instruction
 */
 int * file_parser(const char *filename, CPU* cpu)
 {
     FILE* fp = fopen(filename, "r"); // open the file for reading
+    if (fp == NULL) {
+        printf("Error opening file.\n");
+        exit(1);
+    }
 
     int tot_instructions = get_instruction_count_in_input_file(fp);
 
@@ -1409,120 +2443,29 @@ int * file_parser(const char *filename, CPU* cpu)
     rewind(fp);
 
     char line[MAX_LINE_SIZE];
-    char* tokens[MAX_TOKENS];
 
     int *instructions;
     int inst_cnt = 0;
+    int line_no = 0;
 
-    instructions = (int *) malloc(tot_instructions * 7 * sizeof(int));
-    
-    while (fgets(line, MAX_LINE_SIZE, fp)) { // read each line of the file into the buffer
-        int i = 0;
-        char* token = strtok(line, " "); // split the line into tokens based on spaces
-
-        while (token != NULL && i < MAX_TOKENS) { // iterate through each token
-            tokens[i] = token;
-            i++;
-            token = strtok(NULL, " ");
-        }
-
-        // print the tokens as space-separated values
-        // for (int j = 0; j < i; j++) {
-        //     printf("%s ", tokens[j]);
-        // }
-        // printf("\n");
-
-        // instructions[inst_cnt] =  -1;
-        // instructions[inst_cnt + 1] = -1;
-        //  instructions[inst_cnt + 2] = -1;
-        // //instructions[inst_cnt + 3] = -1;
-        // instructions[inst_cnt + 4] = -1;   
-        //instructions[inst_cnt + 5] = -1;  
-
-        instructions[inst_cnt + 6] = inst_cnt/7;
+    instructions = (int *) arena_alloc(cpu->arena, tot_instructions * 7 * sizeof(int));
 
     //     cpu->instruction_memory stores the instruction in followings format
-        //     int opcode; -> current_instruction
-        //     int dst; -> current_instruction + 1
-        //     int src1; -> current_instruction + 2
-        //     int imm1; -> current_instruction + 3
-        //     int src2; -> current_instruction + 4
-        //     int imm1_flag  -> current_instruction + 5
-        //     int line -> current_instruction + 6
-       
-        if(strcmp(tokens[1], "ld") == 0)
-        {
-            if(strchr(tokens[3], '#'))
-            {
-                instructions[inst_cnt] =  mapOpcode(tokens[1], 1);
-                instructions[inst_cnt + 1] = atoi(tokens[2]+1);
-                instructions[inst_cnt + 3] = atoi(tokens[3]+1);
-                instructions[inst_cnt + 5] = 1;
-            }
-            else{
-                instructions[inst_cnt] =  mapOpcode(tokens[1], 0);
-                instructions[inst_cnt + 1] = atoi(tokens[2]+1);
-                instructions[inst_cnt + 2] = atoi(tokens[3]+1);
-               
-            }
-        }
-        if(strcmp(tokens[1], "st") == 0)
-        {
-            // st R1 #123
-            if(strchr(tokens[3], '#'))
-            {
-                instructions[inst_cnt] =  mapOpcode(tokens[1], 1);
-                //instructions[inst_cnt + 1] = -1;
-                instructions[inst_cnt + 2] = atoi(tokens[2]+1);
-                instructions[inst_cnt + 3] = atoi(tokens[3]+1);
-                instructions[inst_cnt + 5] = 1;    
-            }
-            else{
-                instructions[inst_cnt] =  mapOpcode(tokens[1], 0);
-                instructions[inst_cnt + 2] = atoi(tokens[2]+1);
-                instructions[inst_cnt + 1] = atoi(tokens[3]+1);
-               
-            }
-        }
-        if(strcmp(tokens[1], "bez")==0 || strcmp(tokens[1], "bgez")==0 || strcmp(tokens[1], "blez")==0 || strcmp(tokens[1], "bgtz")==0 || strcmp(tokens[1], "bltz")==0)       
-        {
-            instructions[inst_cnt] =  mapOpcode(tokens[1], 1);
-            instructions[inst_cnt + 2] = atoi(tokens[2]+1);
-            instructions[inst_cnt + 3] = atoi(tokens[3]+1);
-            instructions[inst_cnt + 5] = 1;    
-        }
-        if(strcmp(tokens[1], "mul") == 0 || strcmp(tokens[1], "div") == 0 || strcmp(tokens[1], "sub") == 0 || strcmp(tokens[1], "add") == 0)
-        {
-
-            //strchr is similar to .contains 
-            if(strchr(tokens[4], '#'))
-            {
-                instructions[inst_cnt] =  mapOpcode(tokens[1], 1);
-                instructions[inst_cnt + 1] = atoi(tokens[2]+1);
-                instructions[inst_cnt + 2] = atoi(tokens[3]+1);
-                instructions[inst_cnt + 3] = atoi(tokens[4]+1);
-                instructions[inst_cnt + 5] = 1;   // imm flag
-            }
-            else
-            {
-                instructions[inst_cnt] =  mapOpcode(tokens[1], 0);
-                instructions[inst_cnt + 1] = atoi(tokens[2]+1);
-                instructions[inst_cnt + 2] = atoi(tokens[3]+1);
-                instructions[inst_cnt + 4] = atoi(tokens[4]+1);
-            }
-        }
-        if(strcmp(tokens[1], "set") == 0)
-        {
-            instructions[inst_cnt] =  mapOpcode(tokens[1], 0);
-            instructions[inst_cnt + 1] = atoi(tokens[2]+1);
-            instructions[inst_cnt + 3] = atoi(tokens[3]+1);
-        }
-        // if(strcmp(tokens[1], "ret\n") == 0)
-        // {
-        if(strstr(tokens[1], "ret") != NULL)
+    //     int opcode; -> current_instruction
+    //     int dst; -> current_instruction + 1
+    //     int src1; -> current_instruction + 2
+    //     int imm1; -> current_instruction + 3
+    //     int src2; -> current_instruction + 4
+    //     int imm1_flag  -> current_instruction + 5
+    //     int line -> current_instruction + 6
+    while (fgets(line, MAX_LINE_SIZE, fp)) { // read each line of the file into the buffer
+        line_no++;
+        if(blank_line(line))
+            continue;
+        if(!parse_instruction_line(line, &instructions[inst_cnt], inst_cnt/7))
         {
-            char *op = "ret";
-            instructions[inst_cnt] =  mapOpcode(op, 0);
+            printf("Error : malformed instruction on line %d of %s\n", line_no, filename);
+            exit(1);
         }
 
         inst_cnt+=7;
@@ -1537,3 +2480,55 @@ int * file_parser(const char *filename, CPU* cpu)
     return instructions;
 }
 
+/*
+ * Same as file_parser for a program held in memory, one instruction per
+ * line, blank lines skipped. It also keeps the text of the lines for
+ * printing, like get_lines. It returns NULL if a line is malformed.
+ */
+int * text_parser(const char *text, CPU* cpu)
+{
+    char line[MAX_LINE_SIZE];
+    int tot_instructions = 0;
+
+    for(const char* p = text; *p; )
+    {
+        size_t len = strcspn(p, "\n");
+        if(strspn(p, " \t\r") < len)
+            tot_instructions++;
+        p += len + (p[len] == '\n');
+    }
+    cpu->tot_instructions = tot_instructions;
+
+    int *instructions = (int *) arena_alloc(cpu->arena, (tot_instructions * 7 + 1) * sizeof(int));
+    if(!instructions)
+        return NULL;
+    const char* p = text;
+    for(int i = 0, line_no = 1; i < tot_instructions; line_no++)
+    {
+        size_t len = strcspn(p, "\n");
+        size_t copy = len < MAX_LINE_SIZE - 1 ? len : MAX_LINE_SIZE - 1;
+        bool blank = strspn(p, " \t\r") >= len;
+
+        memcpy(line, p, copy);
+        line[copy] = '\0';
+        p += len + (p[len] == '\n');
+        if(blank)
+            continue;
+
+        if(i < 150)
+        {
+            size_t shown = copy < sizeof(cpu->lines[i]) - 1 ? copy : sizeof(cpu->lines[i]) - 1;
+            memcpy(cpu->lines[i], line, shown);
+            cpu->lines[i][shown] = '\0';
+        }
+        if(!parse_instruction_line(line, &instructions[i * 7], i))
+        {
+            cpu->bad_line = line_no;
+            arena_release(cpu->arena, instructions);
+            return NULL;
+        }
+        i++;
+    }
+
+    return instructions;
+}
@@ -6,18 +6,139 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
+#include "cache.h"
+#include "prefetch.h"
+#include "storebuf.h"
+#include "mshr.h"
+#include "dram.h"
+#include "bpred.h"
+#include "btb.h"
+#include "bptrace.h"
+#include "addrtrace.h"
+#include "intervals.h"
+#include "interp.h"
+#include "jit.h"
+#include "loop.h"
+#include "whatif.h"
+#include "bypass.h"
+#include "batch.h"
+#include "coherence.h"
+#include "arena.h"
 
 #define NUM_REGS 16
 // #define MEM_SIZE 65536
 #define MAX_CPU_CYCLES 1000000
 #define DEBUG_PIPELINE 0  // Macro to enable pipeline debug messages
 #define DEBUG_STATS 1   // For debugging stats
+#define MAX_PATH_SIZE 256
 
 #define MAX_LINE_SIZE 1000 // maximum size of a line in the file
 #define MAX_TOKENS 10
 
 #define TESTING_MODE_ENABLED 1
 
+// Default data cache hierarchy, used when the data cache model is enabled
+#define DCACHE_ENABLED 0      // 0: fixed two cycle Mem1/Mem2 access
+#define L1D_SIZE 1024         // bytes
+#define L1D_ASSOC 2
+#define L1D_LINE_SIZE 16      // bytes
+#define L1D_HIT_LATENCY 1     // cycles, the Mem1 stage covers one cycle
+#define L2_ENABLED 1
+#define L2_SIZE 8192
+#define L2_ASSOC 4
+#define L2_LINE_SIZE 32
+#define L2_HIT_LATENCY 8
+#define MEM_LATENCY 50        // cycles to main memory
+
+// Non-blocking data cache (--mshrs=N), misses the L1D keeps outstanding
+// while the pipeline goes on, 0: a miss stalls everything until its fill
+#define MSHR_ENTRIES 0
+
+// Main memory timing (--dram), banks with open rows and one data bus
+// instead of MEM_LATENCY behind the data caches
+#define DRAM_ENABLED 0
+#define DRAM_BANKS 8
+#define DRAM_ROW_SIZE 2048    // bytes
+#define DRAM_TCAS 14          // cycles
+#define DRAM_TRCD 14
+#define DRAM_TRP 14
+#define DRAM_TBURST 4
+
+// Default instruction cache, indexed by the instruction byte address (pc/7*4)
+#define ICACHE_ENABLED 0      // 0: every fetch takes one cycle
+#define L1I_SIZE 512          // bytes
+#define L1I_ASSOC 2
+#define L1I_LINE_SIZE 16      // bytes, 4 instructions
+#define L1I_HIT_LATENCY 1
+#define L1I_MISS_LATENCY 20   // cycles to refill a line
+#define FETCH_WIDTH 4         // instructions held by the fetch buffer
+
+// Default data prefetcher, fills the L1D so it needs the data cache model
+#define PREFETCHER prefetch_none
+#define PREFETCH_DEGREE 2     // lines fetched ahead per trigger
+
+// Store buffer entries (--storebuf=N), 0: stores write memory from Mem2
+#define STORE_BUFFER_ENTRIES 0
+
+// Default branch direction predictor
+#define BPRED bpred_bimodal
+#define BPRED_TABLE_BITS 0    // log2 table entries, 0 picks the predictor default
+
+// Steady state loop extrapolation, timing must not depend on addresses so
+// it is only used with the cache models and traces off
+#define LOOP_EXTRAPOLATION 0
+
+// Multicore runs, cores above 1 share memory through coherent L1 data caches
+#define NUM_CORES 1
+#define QUANTUM_CYCLES 100    // cycles a core runs before meeting the others
+#define BUS_LATENCY 4         // cycles a coherence transaction holds the bus
+// Cores run their quantum at the same time and the order in which they
+// reach the bus varies from run to run, so cycle counts do too unless the
+// quantum is 1. Ordered runs take turns in core order within each quantum
+// and repeat exactly, without the parallel speedup.
+#define ORDERED_CORES 0
+
+// Parallel-in-time runs, slices above 1 simulate parts of one run on
+// separate host threads from functional snapshots
+#define SLICES 1
+#define SLICE_WARMUP 10000    // detailed instructions before each measured slice
+
+// SimPoint runs (--simpoint), the program is profiled functionally into one
+// basic block vector per interval, the intervals are clustered and only one
+// representative per cluster is simulated in detail, after SLICE_WARMUP
+// instructions of warm-up
+#define SIMPOINT_INTERVAL 100000   // instructions per interval
+#define SIMPOINT_MAX_K 10          // most clusters tried
+
+// Fork-server runs, a file of variants given with --fork=FILE is run by
+// copy-on-write children of one CPU simulated up to a common cycle
+#define FORK_AT 0             // cycles simulated before forking
+#define FORK_JOBS 0           // children running at once, 0: one per host CPU
+
+// Batch runs (--batch=FILE), the program is run functionally on every
+// memory image listed in FILE, BATCH_LANES at a time in lockstep with the
+// vector kernels of --batch.isa=auto,scalar,avx2,avx512
+#define BATCH_ISA batch_isa_auto
+
+// Long runs (--longrun) have no MAX_CPU_CYCLES cap and print no cycle by
+// cycle trace, they stop at ret or when a watchdog fires
+#define HEARTBEAT_CYCLES 100000000    // cycles between progress lines, 0: none
+#define WATCHDOG_CHECK_CYCLES 65536   // cycles between reads of the host clock
+#define LONGRUN_STALL_LIMIT 100000    // cycles without a retired instruction before --longrun gives up
+
+// Interval time series (--intervals=FILE), one record of the counters
+// below every INTERVAL_CYCLES cycles to show the phases of a run
+#define INTERVAL_CYCLES 10000
+
+// Bypass network (--bypass=add,mul,div,mem2,wb), the stages RR can take an
+// operand from instead of waiting for writeback; by default ALU results only
+#define BYPASS_PATHS (BYPASS_PATH(bypass_add) | BYPASS_PATH(bypass_mul) | BYPASS_PATH(bypass_div))
+
+// Default BTB geometry
+#define BTB_ENTRIES 16
+#define BTB_ASSOC 1           // 1: direct mapped
+#define BTB_TAG_BITS 0        // 0: full tags, otherwise partial tag width
+
 enum opcodeFmt_enum {
 	fmt_set,      // opcode, dest, imm1
 	fmt_add,      // opcode, dest, sr1, imm1
@@ -67,7 +188,7 @@ typedef struct Register
     bool is_writing;    // indicate that the register is current being written
 	                    // True: register is not ready
 						// False: register is ready
-	int last_reg_update_cycle;   // stores the recent cycle where this reg was written back
+	long long last_reg_update_cycle;   // stores the recent cycle where this reg was written back
 	int reg_in_process_cnt;   // stores total instructions with this reg in cycle
 	int regNum; 
 	bool has_value;  
@@ -97,45 +218,152 @@ typedef struct Stage
     int addr;
     bool is_branch_instr;   // To check if it is a branch instruction
     int curr_pc;       // Stores program counter for current instruction in multiple of 7
+    int pred_next_pc;  // pc fetch continued with after this branch
+    bool bp_predicted; // direction given by the branch predictor
+    unsigned long long bp_history;  // predictor history before this branch
+    long long seq;     // order in which it left IF
+    bool store_forwarded;  // load value taken from the store buffer
     enum stageStatus_enum status;
 } Stage;
 
-// BTB table entry to store instruction tag and target instruction address
-typedef struct BTBEntry{
-    int tag;
-    int target;
-} BTBEntry;
+// Events reported to an embedding program through CPU.event_hook
+enum cpuEvent_enum {
+    event_retire,    // an instruction was written back
+    event_branch,    // a branch resolved in the BR stage
+    event_halt,      // ret was written back, the run is over
+};
+
+typedef struct CPUEvent {
+    enum cpuEvent_enum type;
+    long long clock;
+    int pc;            // byte address of the instruction
+    int opcode;
+    int dest;          // register written on retire, -1 if none
+    int value;         // value written on retire
+    bool taken;        // branch outcome
+    bool mispredicted; // the branch flushed the pipeline
+} CPUEvent;
+
+typedef void (*CPUEventHook)(const CPUEvent* event, void* user);
 
-// Prediction Table entry to store counter values used to predict branching
-typedef struct PredTableEntry{
-    int counter;
-} PredTableEntry;
+// Run time configuration of the simulator, filled from the macros above
+// and overridden with --key=value options
+typedef struct SimConfig {
+    bool dcache_enabled;
+    CacheConfig l1d;
+    bool l2_enabled;
+    CacheConfig l2;
+    int mem_latency;
+    int mshrs;
+    bool dram_enabled;
+    DramConfig dram;
+    bool icache_enabled;
+    CacheConfig l1i;
+    int l1i_miss_latency;
+    int fetch_width;
+    enum prefetchType_enum prefetcher;
+    int prefetch_degree;
+    int store_buffer;
+    enum bpredType_enum bpred;
+    int bpred_table_bits;
+    int btb_entries;
+    int btb_assoc;
+    int btb_tag_bits;
+    char bptrace_file[MAX_PATH_SIZE];   // empty: no branch trace is recorded
+    char addrtrace_file[MAX_PATH_SIZE]; // empty: no address trace is recorded
+    char intervals_file[MAX_PATH_SIZE]; // empty: no interval time series
+    long long interval_cycles;
+    bool functional;          // run the functional interpreter instead of the pipeline
+    bool jit;                 // functional run with the x86-64 translator
+    bool extrapolate;         // skip loop iterations once the pipeline repeats itself
+    int cores;
+    int quantum;
+    bool ordered_cores;       // cores take turns within a quantum, repeatable
+    int bus_latency;
+    int slices;
+    long long slice_warmup;
+    bool simpoint;            // simulate only the representative intervals
+    char bbv_file[MAX_PATH_SIZE];       // empty: basic block vectors are not written
+    long long simpoint_interval;
+    int simpoint_max_k;
+    bool critpath;            // dependence graph analysis instead of a plain run
+    unsigned int whatif_features;   // idealised features studied next to the run, 0: none
+    unsigned int bypass_paths;      // stages RR can forward from, BYPASS_PATH bits
+    char fork_file[MAX_PATH_SIZE];      // empty: no fork-server run
+    char batch_file[MAX_PATH_SIZE];     // empty: no batch run over memory images
+    enum batchIsa_enum batch_isa;
+    long long fork_at;
+    int fork_jobs;
+    bool longrun;             // run to ret without the MAX_CPU_CYCLES cap
+    long long watchdog_cycles;    // 0: no cycle limit in long runs
+    double watchdog_seconds;      // 0: no wall-clock limit in long runs
+    long long heartbeat;
+} SimConfig;
 
 /* Model of CPU */
 typedef struct CPU
 {
+    Arena *arena;             // every allocation of the simulation, the CPU included
+    ArenaMark arena_mark;     // end of the CPU itself, CPU_reset rewinds to it
 	/* Integer register file */
 	Register *regs;
-	Register forward_regs[NUM_REGS];
     int pc; // Program Counter
     
     int *instruction_memory;      // file parser instructions stored here
     char* instruction_line[100];      // for printing purpose
     int tot_instructions;
     char lines[150][50] ;
+    int bad_line;        // first malformed line of the program, 0 if none
 
-    int clock;   // to track clock cycles
+    long long clock;   // to track clock cycles
     int *memory;    // Used to store memory map
     int memoryLen;
     bool cpu_stalled;   
     bool cpu_halted;     // set this flag when ret is encountered
-    bool cpu_read_stall;
-    int cpu_stalled_cnt;
-    int tot_instructions_done;
+    bool bad_address;    // a load or store went outside memory, the run stopped
+    int bad_address_addr;
+    int bad_address_pc;
+    long long cpu_stalled_cnt;
+    long long tot_instructions_done;
     bool ia_data_hazard_found;
 
-    BTBEntry BTBTable[NUM_REGS];
-    PredTableEntry PredTable[NUM_REGS];
+    BTB *btb;
+    BranchPredictor *bpred;   // direction predictor used together with the BTB
+    long long branch_flush_cnt;    // pipeline flushes due to wrong fetch path
+    BPTraceWriter *bptrace;   // resolved branch stream, NULL when not recording
+    AddrTraceFile *addrtrace; // data address stream, NULL when not recording
+    IntervalWriter *intervals;    // interval time series, NULL when not recording
+    IntervalRecord interval_base; // counter totals at the start of the current interval
+    long long load_cnt;           // loads and stores through Mem1
+    long long store_cnt;
+    long long forward_cnt;        // register reads that used forwarded values
+    BypassStats bypass;           // operands forwarded by each bypass path
+    LoopDetector *loop;       // NULL when loop extrapolation is off
+    WhatIf *whatif;           // limit study, NULL when not requested
+    long long fetch_seq;      // instructions that left IF so far
+    Coherence *coherence;     // NULL on a single core
+    int core_id;              // slot of the L1D on the coherence bus
+    CPUEventHook event_hook;  // NULL when nobody listens
+    void *event_user;
+    int loop_branch_pc;       // backward branch taken this cycle, -1 if none
+
+    SimConfig config;
+    Cache *l1d;         // NULL when the data cache model is disabled
+    Cache *l2;
+    Prefetcher *prefetcher; // NULL when no data prefetcher is configured
+    StoreBuffer *storebuf;  // NULL when stores write memory directly
+    MSHRFile *mshr;         // NULL when data cache misses block
+    Dram *dram;             // NULL when main memory has a fixed latency
+    long long miss_ready[NUM_REGS];   // cycle RR can read a register a missing load writes
+    int mem_stall_cycles;   // cycles left before the memory stages can move
+    long long mem_stall_cnt;      // total cycles lost to data cache misses
+    long long miss_wait_cnt;      // cycles RR waited for the data of a load that missed with MSHRs
+
+    Cache *l1i;             // NULL when the instruction cache model is disabled
+    int fetch_buf_start;    // byte address range held by the fetch buffer
+    int fetch_buf_end;
+    int fetch_stall_cycles; // cycles left before the fetch buffer is filled
+    long long fetch_stall_cnt;    // total cycles fetch delivered nothing due to misses
 
     Stage fetch;
     Stage decode;
@@ -151,16 +379,36 @@ typedef struct CPU
 } CPU;
 
 CPU* CPU_init(const char* filename);
+CPU* CPU_init_config(const char* filename, const SimConfig* config);
+CPU* CPU_init_buffers(const char* program, const int* memory, int memory_len, const SimConfig* config);
+bool CPU_reset(CPU* cpu, const char* program, const int* memory, int memory_len, const SimConfig* config);
+bool CPU_reconfigure(CPU* cpu, const SimConfig* config);
+
+void sim_config_defaults(SimConfig* config);
+bool sim_config_set(SimConfig* config, const char* key, const char* value);
+bool sim_config_parse_arg(SimConfig* config, const char* arg);
+const char* sim_config_check(const SimConfig* config);
 
-Register* create_registers(int size);
+Register* create_registers(Arena* arena, int size);
+void reset_registers(Register* regs, int size);
 
+bool CPU_cycle(CPU* cpu);
 int CPU_run(CPU* cpu);
+int CPU_run_long(CPU* cpu);
+void print_truncation(CPU* cpu, const char* reason);
+void print_bad_address(CPU* cpu);
+void CPU_print_stats(CPU* cpu);
+void print_registers(CPU* cpu);
+int CPU_run_functional(CPU* cpu);
 
 void CPU_stop(CPU* cpu);
 
 int get_instruction_count_in_input_file(FILE* file);
 
+void load_memory(const char* filename, CPU* cpu);
 int * file_parser(const char *filename, CPU* cpu);
+int * text_parser(const char *text, CPU* cpu);
+bool parse_instruction_line(char* line, int* decoded, int line_no);
 
 void instruction_analyse_stage(CPU* cpu);
 void register_read_stage(CPU* cpu);
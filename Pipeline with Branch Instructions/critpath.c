@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "cpu.h"
+#include "critpath.h"
+
+static const char* class_names[] = { "set", "add", "sub", "mul", "div", "ld", "st", "branch", "ret" };
+
+static const CritPath no_path;   // value available from the start
+
+static bool valid_reg(int reg)
+{
+    return reg >= 0 && reg < NUM_REGS;
+}
+
+/*
+ * Chain of an operation of class op_class reading a and b (b may be
+ * NULL): the longer input chain plus the operation itself.
+ */
+static void extend(CritPath* out, const CritPath* a, const CritPath* b, enum critpathClass_enum op_class)
+{
+    *out = b && b->ready > a->ready ? *b : *a;
+    out->ready += op_class == crit_ld ? CRITPATH_LOAD_LATENCY : 1;
+    out->ops[op_class]++;
+}
+
+/*
+ * Dependence graph state of a run. Only the chain ending in every register
+ * and in the last CRITPATH_MEM_ENTRIES stored words is kept, so memory use
+ * does not grow with the length of the run.
+ */
+typedef struct CritGraph {
+    CritPath regs[NUM_REGS];
+    CritStore *stores;
+    unsigned char *stored;    // words written so far, to count lost dependences
+    CritPath longest;         // critical path so far
+    long long reg_edges;
+    long long mem_edges;
+    long long mem_lost;       // loads whose store was evicted from the table
+} CritGraph;
+
+static const CritPath* reg_path(CritGraph* graph, int reg)
+{
+    if(graph->regs[reg].ready > 0)
+        graph->reg_edges++;
+    return &graph->regs[reg];
+}
+
+static const CritPath* load_path(CritGraph* graph, int word)
+{
+    CritStore* entry = &graph->stores[word % CRITPATH_MEM_ENTRIES];
+    if(entry->word == word)
+    {
+        graph->mem_edges++;
+        return &entry->path;
+    }
+    if(graph->stored[word])
+        graph->mem_lost++;
+    return &no_path;
+}
+
+/*
+ * Executes the program functionally and builds its dynamic dependence
+ * graph on the way: register RAW through src1/src2/dest and memory RAW
+ * through the load and store addresses. Registers are assumed renamed and
+ * branches predicted perfectly, so WAR, WAW and control dependences do not
+ * count. Leaves pc, registers, memory and tot_instructions_done as the
+ * pipeline would.
+ */
+static enum interpStatus_enum critpath_execute(CPU* cpu, CritGraph* graph, long long budget)
+{
+    int* code = cpu->instruction_memory;
+    int* memory = cpu->memory;
+    unsigned int memory_words = cpu->memoryLen;
+    int count = cpu->tot_instructions;
+    int pc = cpu->pc / 7;
+    long long executed = 0;
+    enum interpStatus_enum status = interp_limit;
+
+    while(executed < budget)
+    {
+        if(pc < 0 || pc >= count)
+        {
+            status = interp_end_of_program;
+            break;
+        }
+
+        int* decoded = &code[pc * 7];
+        int opcode = decoded[0];
+        int dest = decoded[1];
+        int src1 = decoded[2];
+        int imm = decoded[3];
+        int src2 = decoded[4];
+        bool two_regs = opcode == fmt_add || opcode == fmt_sub || opcode == fmt_mul || opcode == fmt_div
+            || opcode == fmt_st;
+        bool reads_src1 = opcode != fmt_set && opcode != fmt_ld_imm && opcode != fmt_ret;
+        bool writes_dest = opcode != fmt_st && opcode != fmt_st_imm && opcode != fmt_ret
+            && !(opcode >= fmt_bez_imm && opcode <= fmt_bltz_imm);
+        int second = opcode == fmt_st ? dest : src2;
+
+        if(opcode < fmt_set || opcode > fmt_ret)
+        {
+            // Not decoded, skipped like the interpreter does
+            executed++;
+            pc++;
+            continue;
+        }
+        if((reads_src1 && !valid_reg(src1)) || (two_regs && !valid_reg(second)) || (writes_dest && !valid_reg(dest)))
+        {
+            status = interp_bad_instruction;
+            break;
+        }
+
+        Register* regs = cpu->regs;
+        CritPath path;
+        unsigned int word;
+        int next = pc + 1;
+
+        switch (opcode)
+        {
+        case fmt_set:
+            extend(&path, &no_path, NULL, crit_set);
+            regs[dest].value = imm;
+            break;
+        case fmt_add:
+        case fmt_add_imm:
+            extend(&path, reg_path(graph, src1), two_regs ? reg_path(graph, src2) : NULL, crit_add);
+            regs[dest].value = regs[src1].value + (two_regs ? regs[src2].value : imm);
+            break;
+        case fmt_sub:
+        case fmt_sub_imm:
+            extend(&path, reg_path(graph, src1), two_regs ? reg_path(graph, src2) : NULL, crit_sub);
+            regs[dest].value = regs[src1].value - (two_regs ? regs[src2].value : imm);
+            break;
+        case fmt_mul:
+        case fmt_mul_imm:
+            extend(&path, reg_path(graph, src1), two_regs ? reg_path(graph, src2) : NULL, crit_mul);
+            regs[dest].value = regs[src1].value * (two_regs ? regs[src2].value : imm);
+            break;
+        case fmt_div:
+        case fmt_div_imm:
+        {
+            int divisor = two_regs ? regs[src2].value : imm;
+            if(divisor == 0)
+            {
+                status = interp_bad_instruction;
+                goto done;
+            }
+            extend(&path, reg_path(graph, src1), two_regs ? reg_path(graph, src2) : NULL, crit_div);
+            regs[dest].value = regs[src1].value / divisor;
+            break;
+        }
+        case fmt_ld:
+        case fmt_ld_imm:
+            word = (unsigned int)((opcode == fmt_ld ? regs[src1].value : imm) / 4);
+            if(word >= memory_words)
+            {
+                status = interp_bad_address;
+                goto done;
+            }
+            extend(&path, opcode == fmt_ld ? reg_path(graph, src1) : &no_path, load_path(graph, word), crit_ld);
+            regs[dest].value = memory[word];
+            break;
+        case fmt_st:
+        case fmt_st_imm:
+        {
+            word = (unsigned int)((opcode == fmt_st ? regs[dest].value : imm) / 4);
+            if(word >= memory_words)
+            {
+                status = interp_bad_address;
+                goto done;
+            }
+            extend(&path, reg_path(graph, src1), two_regs ? reg_path(graph, dest) : NULL, crit_st);
+            memory[word] = regs[src1].value;
+
+            CritStore* entry = &graph->stores[word % CRITPATH_MEM_ENTRIES];
+            entry->word = word;
+            entry->path = path;
+            graph->stored[word] = 1;
+            break;
+        }
+        case fmt_ret:
+            extend(&path, &no_path, NULL, crit_ret);
+            break;
+        default:
+        {
+            // Branches, a target outside the program ends it
+            int value = regs[src1].value;
+            bool taken = opcode == fmt_bez_imm ? value == 0 : opcode == fmt_bgez_imm ? value >= 0
+                : opcode == fmt_blez_imm ? value <= 0 : opcode == fmt_bgtz_imm ? value > 0 : value < 0;
+            extend(&path, reg_path(graph, src1), NULL, crit_branch);
+            if(taken)
+                next = imm / 4 >= 0 ? imm / 4 : count;
+            break;
+        }
+        }
+
+        if(writes_dest)
+            graph->regs[dest] = path;
+        if(path.ready > graph->longest.ready)
+            graph->longest = path;
+        executed++;
+
+        if(opcode == fmt_ret)
+        {
+            status = interp_halted;
+            break;
+        }
+        pc = next;
+    }
+
+done:
+    cpu->pc = pc * 7;
+    cpu->tot_instructions_done += executed;
+    if(status == interp_halted)
+        cpu->cpu_halted = true;
+    return status;
+}
+
+/*
+ * Runs the pipeline on its own without printing, for comparison with the
+ * dataflow limit. Returns false when it did not reach ret.
+ */
+static bool run_pipeline(CPU* cpu, long long max_cycles)
+{
+    for(long long i = 0; i < max_cycles; i++)
+    {
+        if(CPU_cycle(cpu))
+            return true;
+        cpu->clock++;
+    }
+    return false;
+}
+
+/*
+ * Critical path analysis. Reports the longest chain of the dynamic
+ * dependence graph, which operations it goes through and the IPC a machine
+ * limited only by those dependences would reach, next to the IPC of the
+ * configured pipeline on the same program.
+ */
+int critpath_run(const char* filename, const SimConfig* config)
+{
+    long long budget = config->longrun ? LLONG_MAX : (long long)MAX_CPU_CYCLES * 1000;
+    CritGraph graph;
+
+    CPU* cpu = CPU_init_config(filename, config);
+    if(!cpu)
+    {
+        printf("Error creating the CPU\n");
+        exit(1);
+    }
+    memset(&graph, 0, sizeof(graph));
+    graph.stores = (CritStore*)malloc(CRITPATH_MEM_ENTRIES * sizeof(CritStore));
+    graph.stored = (unsigned char*)calloc(cpu->memoryLen + 1, 1);
+    if(!graph.stores || !graph.stored)
+    {
+        printf("Error allocating the dependence graph\n");
+        exit(1);
+    }
+    for(int i = 0; i < CRITPATH_MEM_ENTRIES; i++)
+        graph.stores[i].word = -1;
+
+    enum interpStatus_enum status = critpath_execute(cpu, &graph, budget);
+    long long instructions = cpu->tot_instructions_done;
+    long long length = graph.longest.ready;
+
+    CPU* pipeline = CPU_init_config(filename, config);
+    if(!pipeline)
+    {
+        printf("Error creating the CPU\n");
+        exit(1);
+    }
+    bool halted = run_pipeline(pipeline, config->longrun ? LLONG_MAX : MAX_CPU_CYCLES);
+
+    printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
+    printf("\n");
+
+    print_registers(cpu);
+
+    if(DEBUG_STATS)
+    {
+        long long on_path = 0;
+        for(int c = 0; c < crit_class_cnt; c++)
+            on_path += graph.longest.ops[c];
+
+        printf("Functional run stopped: %s\n", interp_status_name(status));
+        printf("Dependence graph: %lld instructions, %lld register edges, %lld memory edges\n",
+            instructions, graph.reg_edges, graph.mem_edges);
+        if(graph.mem_lost)
+            printf("Memory dependences lost to store table conflicts: %lld\n", graph.mem_lost);
+        printf("Critical path: %lld cycles through %lld instructions\n", length, on_path);
+        printf("%8s %14s %12s %8s\n", "class", "instructions", "cycles", "share");
+        for(int c = 0; c < crit_class_cnt; c++)
+        {
+            long long cycles = graph.longest.ops[c] * (c == crit_ld ? CRITPATH_LOAD_LATENCY : 1);
+            if(graph.longest.ops[c])
+                printf("%8s %14lld %12lld %7.2f%%\n", class_names[c], graph.longest.ops[c], cycles,
+                    length ? 100.0 * cycles / length : 0.0);
+        }
+        printf("Dataflow-limited IPC: %f\n", length ? (double)instructions / length : 0.0);
+
+        double pipeline_ipc = pipeline->clock ? (double)pipeline->tot_instructions_done / pipeline->clock : 0.0;
+        printf("Pipeline: %lld cycles, IPC %f, %f%% of the dataflow limit\n", pipeline->clock, pipeline_ipc,
+            length && instructions ? 100.0 * pipeline_ipc * length / instructions : 0.0);
+        if(halted && instructions)
+            printf("Pipeline overhead: %f cycles per instruction above the dependences\n",
+                (double)(pipeline->clock - length) / instructions);
+        else if(!halted)
+            printf("The pipeline run did not reach ret, use --longrun to compare whole runs\n");
+    }
+
+    output_memory_map_file(cpu);
+
+    CPU_stop(pipeline);
+    CPU_stop(cpu);
+    free(graph.stores);
+    free(graph.stored);
+    return status == interp_halted ? 0 : -1;
+}
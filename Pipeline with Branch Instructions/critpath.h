@@ -0,0 +1,40 @@
+#ifndef _CRITPATH_H_
+#define _CRITPATH_H_
+
+#define CRITPATH_MEM_ENTRIES 4096   // stored words tracked at once, direct mapped
+#define CRITPATH_LOAD_LATENCY 2     // Mem1 and Mem2, every other operation takes one cycle
+
+// Operation classes the critical path is broken down into
+enum critpathClass_enum {
+    crit_set,
+    crit_add,
+    crit_sub,
+    crit_mul,
+    crit_div,
+    crit_ld,
+    crit_st,
+    crit_branch,
+    crit_ret,
+    crit_class_cnt
+};
+
+/*
+ * The longest dependence chain ending in a value: the cycle it becomes
+ * available and how many operations of each class are on the chain.
+ */
+typedef struct CritPath {
+    long long ready;
+    long long ops[crit_class_cnt];
+} CritPath;
+
+// Chain of the last store to a memory word
+typedef struct CritStore {
+    int word;                 // -1 when the entry is free
+    CritPath path;
+} CritStore;
+
+struct SimConfig;
+
+int critpath_run(const char* filename, const struct SimConfig* config);
+
+#endif
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "dram.h"
+
+/*
+ * This function allocates the main memory model with every bank precharged.
+ */
+Dram* dram_create(Arena* arena, DramConfig config)
+{
+    Dram* dram = (Dram*)arena_alloc(arena, sizeof(Dram));
+    if (!dram) {
+        return NULL;
+    }
+    memset(dram, 0, sizeof(Dram));
+    dram->arena = arena;
+
+    if(config.banks < 1)
+        config.banks = 1;
+    if(config.row_size < 4)
+        config.row_size = 4;
+    dram->config = config;
+
+    dram->banks = (DramBank*)arena_alloc(arena, config.banks * sizeof(DramBank));
+    if (!dram->banks) {
+        arena_release(arena, dram);
+        return NULL;
+    }
+    for(int b = 0; b < config.banks; b++)
+    {
+        dram->banks[b].open_row = -1;
+        dram->banks[b].ready = 0;
+    }
+    return dram;
+}
+
+void dram_free(Dram* dram)
+{
+    if(dram)
+    {
+        arena_release(dram->arena, dram->banks);
+        arena_release(dram->arena, dram);
+    }
+}
+
+/*
+ * This function performs one line transfer requested at cycle now and
+ * returns its latency: the wait for the bank, the row commands the open
+ * row calls for, then the wait for the data bus and the burst. Rows are
+ * interleaved across the banks so consecutive rows can be open at once.
+ */
+int dram_access(Dram* dram, unsigned int addr, bool is_write, long long now)
+{
+    unsigned int row_index = addr / dram->config.row_size;
+    DramBank* bank = &dram->banks[row_index % dram->config.banks];
+    int row = row_index / dram->config.banks;
+    long long start = bank->ready > now ? bank->ready : now;
+    int commands;
+
+    if(bank->open_row == row)
+    {
+        dram->row_hits++;
+        commands = dram->config.t_cas;
+    }
+    else if(bank->open_row < 0)
+    {
+        dram->row_empty++;
+        commands = dram->config.t_rcd + dram->config.t_cas;
+    }
+    else
+    {
+        dram->row_conflicts++;
+        commands = dram->config.t_rp + dram->config.t_rcd + dram->config.t_cas;
+    }
+    bank->open_row = row;
+
+    long long data = start + commands;
+    if(dram->bus_ready > data)
+        data = dram->bus_ready;
+    long long done = data + dram->config.t_burst;
+
+    // Column accesses to the open row are pipelined, the bank takes the
+    // next command one burst after this column access
+    dram->queue_cycles += (start - now) + (data - start - commands);
+    dram->bus_ready = done;
+    bank->ready = data - dram->config.t_cas + dram->config.t_burst;
+
+    if(is_write)
+        dram->writes++;
+    else
+    {
+        dram->reads++;
+        dram->read_cycles += done - now;
+    }
+    return (int)(done - now);
+}
+
+/*
+ * This function prints the row buffer behaviour and the queueing of the
+ * accesses that reached main memory.
+ */
+void dram_print_stats(Dram* dram)
+{
+    long long accesses = dram->reads + dram->writes;
+
+    printf("DRAM: %d banks x %dB rows, tCAS %d, tRCD %d, tRP %d, burst %d\n", dram->config.banks,
+        dram->config.row_size, dram->config.t_cas, dram->config.t_rcd, dram->config.t_rp, dram->config.t_burst);
+    printf("DRAM accesses: %lld reads, %lld writes, row hits: %lld, empty: %lld, conflicts: %lld\n",
+        dram->reads, dram->writes, dram->row_hits, dram->row_empty, dram->row_conflicts);
+    printf("DRAM row hit rate: %f, average read latency: %f, queueing cycles: %lld\n",
+        accesses ? (double)dram->row_hits / accesses : 0.0,
+        dram->reads ? (double)dram->read_cycles / dram->reads : 0.0, dram->queue_cycles);
+}
@@ -0,0 +1,44 @@
+#ifndef _DRAM_H_
+#define _DRAM_H_
+#include <stdbool.h>
+#include "arena.h"
+
+// Geometry and timing of main memory, latencies in CPU cycles
+typedef struct DramConfig {
+    int banks;
+    int row_size;      // bytes per row of one bank
+    int t_cas;         // column access, read from an open row
+    int t_rcd;         // row activation before the column access
+    int t_rp;          // precharge, closing the open row of a bank
+    int t_burst;       // cycles the data bus carries one line
+} DramConfig;
+
+// One bank, rows are left open after an access (open page policy)
+typedef struct DramBank {
+    int open_row;      // -1: precharged
+    long long ready;   // cycle the bank can start the next access
+} DramBank;
+
+/* Main memory behind the last cache level, banks share one data bus */
+typedef struct Dram {
+    DramConfig config;
+    DramBank *banks;
+    long long bus_ready;      // cycle the data bus is free
+
+    long long reads;
+    long long writes;
+    long long row_hits;       // the row was already open
+    long long row_empty;      // the bank was precharged
+    long long row_conflicts;  // another row had to be closed first
+    long long queue_cycles;   // cycles accesses waited for a busy bank or the bus
+    long long read_cycles;    // total latency of the reads
+    Arena *arena;
+} Dram;
+
+Dram* dram_create(Arena* arena, DramConfig config);
+void dram_free(Dram* dram);
+
+int dram_access(Dram* dram, unsigned int addr, bool is_write, long long now);
+void dram_print_stats(Dram* dram);
+
+#endif
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "cpu.h"
+#include "forkserver.h"
+
+// Statistics a child sends back when its run is over
+typedef struct ForkResult {
+    bool halted;
+    long long cycles;
+    long long instructions;
+    long long stalls;
+    long long flushes;
+    long long predictions;
+    long long mispredictions;
+    long long l1d_misses;         // -1 without the data cache model
+    long long l1i_misses;         // -1 without the instruction cache model
+    unsigned int memory_hash;     // FNV-1a of the final memory
+} ForkResult;
+
+typedef struct ForkVariant {
+    char options[MAX_VARIANT_LINE];   // the line of the variants file
+    SimConfig config;
+    char memory_file[MAX_PATH_SIZE];  // empty: memory of the fork point
+    pid_t pid;
+    int pipe;
+    bool reported;
+    ForkResult result;
+} ForkVariant;
+
+static double elapsed(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Reads the variants file, one variant per line. Empty lines and lines
+ * starting with # are skipped. Returns the number of variants or -1 when
+ * a line has an invalid option.
+ */
+static int parse_variants(const char* filename, const SimConfig* base, ForkVariant* variants)
+{
+    char line[MAX_VARIANT_LINE];
+    int count = 0;
+    int line_no = 0;
+
+    FILE* file = fopen(filename, "r");
+    if(!file)
+    {
+        printf("Error opening %s\n", filename);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), file))
+    {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char* start = line + strspn(line, " \t");
+        if(*start == '\0' || *start == '#')
+            continue;
+        if(count == MAX_FORK_VARIANTS)
+        {
+            printf("More than %d variants, the rest are ignored\n", MAX_FORK_VARIANTS);
+            break;
+        }
+
+        ForkVariant* variant = &variants[count];
+        memset(variant, 0, sizeof(*variant));
+        strcpy(variant->options, start);
+        variant->config = *base;
+
+        char* save;
+        for(char* token = strtok_r(start, " \t", &save); token; token = strtok_r(NULL, " \t", &save))
+        {
+            if(strncmp(token, "--memory=", 9) == 0 && strlen(token + 9) < MAX_PATH_SIZE)
+                strcpy(variant->memory_file, token + 9);
+            else if(!sim_config_parse_arg(&variant->config, token))
+            {
+                printf("Error : invalid option %s on line %d of %s\n", token, line_no, filename);
+                fclose(file);
+                return -1;
+            }
+        }
+        const char* invalid = sim_config_check(&variant->config);
+        if(invalid)
+        {
+            printf("Error : invalid %s on line %d of %s\n", invalid, line_no, filename);
+            fclose(file);
+            return -1;
+        }
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+/*
+ * Runs the CPU until ret or until clock cycles have been simulated in
+ * total, counted like CPU_run.
+ */
+static bool run_to(CPU* cpu, long long cycles)
+{
+    for(long long i = cpu->clock - 1; i < cycles; i++)
+    {
+        if(CPU_cycle(cpu))
+            return true;
+        cpu->clock++;
+    }
+    return false;
+}
+
+/*
+ * Child side: switches to the variant, finishes the run and writes the
+ * result to fd.
+ */
+static void run_variant(CPU* cpu, bool halted, ForkVariant* variant, int fd)
+{
+    ForkResult result;
+
+    if(!CPU_reconfigure(cpu, &variant->config))
+        _exit(1);
+    if(variant->memory_file[0])
+        load_memory(variant->memory_file, cpu);
+    if(!halted)
+        halted = run_to(cpu, cpu->config.longrun ? LLONG_MAX : MAX_CPU_CYCLES);
+
+    memset(&result, 0, sizeof(result));
+    result.halted = halted && !cpu->bad_address;
+    result.cycles = cpu->clock;
+    result.instructions = cpu->tot_instructions_done;
+    result.stalls = cpu->cpu_stalled_cnt;
+    result.flushes = cpu->branch_flush_cnt;
+    result.predictions = cpu->bpred->predictions;
+    result.mispredictions = cpu->bpred->mispredictions;
+    result.l1d_misses = cpu->l1d ? cache_misses(cpu->l1d) : -1;
+    result.l1i_misses = cpu->l1i ? cache_misses(cpu->l1i) : -1;
+    result.memory_hash = 2166136261u;
+    for(int i = 0; i < cpu->memoryLen; i++)
+        result.memory_hash = (result.memory_hash ^ (unsigned int)cpu->memory[i]) * 16777619u;
+
+    // The result is far smaller than PIPE_BUF, so the write is atomic
+    if(write(fd, &result, sizeof(result)) != sizeof(result))
+        _exit(1);
+}
+
+/*
+ * Waits for any child and collects its result.
+ */
+static void reap_child(ForkVariant* variants, int count)
+{
+    int status;
+    pid_t pid = wait(&status);
+    if(pid < 0)
+        return;
+
+    for(int v = 0; v < count; v++)
+    {
+        ForkVariant* variant = &variants[v];
+        if(variant->pid != pid)
+            continue;
+
+        variant->reported = WIFEXITED(status) && WEXITSTATUS(status) == 0
+            && read(variant->pipe, &variant->result, sizeof(ForkResult)) == sizeof(ForkResult);
+        close(variant->pipe);
+        variant->pid = 0;
+        break;
+    }
+}
+
+int fork_run(const char* filename, const SimConfig* config)
+{
+    struct timespec start, forked, end;
+
+    SimConfig base = *config;
+    if(base.bptrace_file[0] || base.addrtrace_file[0] || base.intervals_file[0] || base.whatif_features
+        || base.extrapolate || base.functional)
+        printf("Traces, extrapolation and functional runs are not forked, ignored\n");
+    base.bptrace_file[0] = '\0';
+    base.addrtrace_file[0] = '\0';
+    base.intervals_file[0] = '\0';
+    base.whatif_features = 0;
+    base.extrapolate = false;
+    base.functional = false;
+    base.jit = false;
+    base.fork_file[0] = '\0';
+
+    ForkVariant* variants = (ForkVariant*)calloc(MAX_FORK_VARIANTS, sizeof(ForkVariant));
+    if(!variants)
+    {
+        printf("Error allocating variants\n");
+        exit(1);
+    }
+    int count = parse_variants(config->fork_file, &base, variants);
+    if(count < 0)
+    {
+        free(variants);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The shared prefix of every variant, simulated once
+    CPU* cpu = CPU_init_config(filename, &base);
+    if(!cpu)
+    {
+        printf("Error creating the CPU\n");
+        free(variants);
+        return -1;
+    }
+    long long max_cycles = config->longrun ? LLONG_MAX : MAX_CPU_CYCLES;
+    long long fork_at = config->fork_at < max_cycles ? config->fork_at : max_cycles;
+    bool halted = run_to(cpu, fork_at);
+    long long fork_cycle = cpu->clock;
+    long long fork_instructions = cpu->tot_instructions_done;
+
+    clock_gettime(CLOCK_MONOTONIC, &forked);
+
+    int jobs = config->fork_jobs > 0 ? config->fork_jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(jobs < 1)
+        jobs = 1;
+    int running = 0;
+
+    for(int v = 0; v < count; v++)
+    {
+        ForkVariant* variant = &variants[v];
+        int fds[2];
+
+        while(running >= jobs)
+        {
+            reap_child(variants, v);
+            running--;
+        }
+
+        if(pipe(fds) != 0)
+        {
+            printf("Error creating the pipe of variant %d\n", v);
+            continue;
+        }
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            close(fds[0]);
+            run_variant(cpu, halted, variant, fds[1]);
+            _exit(0);
+        }
+
+        close(fds[1]);
+        if(pid < 0)
+        {
+            printf("Error forking variant %d\n", v);
+            close(fds[0]);
+            continue;
+        }
+        variant->pid = pid;
+        variant->pipe = fds[0];
+        running++;
+    }
+    while(running > 0)
+    {
+        reap_child(variants, count);
+        running--;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(DEBUG_STATS)
+    {
+        printf("Fork point: cycle %lld, %lld instructions retired%s\n", fork_cycle, fork_instructions,
+            halted ? ", program already halted" : "");
+        printf("%4s %10s %12s %9s %8s %12s %11s %11s %9s  %s\n", "var", "cycles", "instructions", "IPC",
+            "flushes", "mispredicted", "L1D misses", "L1I misses", "memory", "options");
+        for(int v = 0; v < count; v++)
+        {
+            ForkVariant* variant = &variants[v];
+            ForkResult* r = &variant->result;
+
+            if(!variant->reported)
+            {
+                printf("%4d %10s %12s %9s %8s %12s %11s %11s %9s  %s\n", v, "failed", "-", "-", "-", "-", "-",
+                    "-", "-", variant->options);
+                continue;
+            }
+            printf("%4d %10lld %12lld %9f %8lld %12lld %11lld %11lld  %08x  %s%s\n", v, r->cycles, r->instructions,
+                r->cycles ? (double)r->instructions / r->cycles : 0.0, r->flushes, r->mispredictions,
+                r->l1d_misses, r->l1i_misses, r->memory_hash, variant->options,
+                r->halted ? "" : " (did not reach ret)");
+        }
+        printf("Variants: %d, %d at a time, host time: %f s to the fork point, %f s forked\n",
+            count, jobs, elapsed(&start, &forked), elapsed(&forked, &end));
+    }
+
+    CPU_stop(cpu);
+    free(variants);
+    return 0;
+}
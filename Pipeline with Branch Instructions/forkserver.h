@@ -0,0 +1,18 @@
+#ifndef _FORKSERVER_H_
+#define _FORKSERVER_H_
+
+#define MAX_FORK_VARIANTS 1024
+#define MAX_VARIANT_LINE 1024
+
+struct SimConfig;
+
+/*
+ * Fork-server run. The program and memory image are loaded once and
+ * simulated up to config->fork_at cycles, then one copy-on-write child per
+ * line of config->fork_file finishes the run with that line's options
+ * (--key=value, plus --memory=FILE for another memory image) and reports
+ * its statistics back through a pipe.
+ */
+int fork_run(const char* filename, const struct SimConfig* config);
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "interp.h"
+
+/*
+ * One pre-decoded instruction. Operands are bound to the interpreter's
+ * register array and branch targets to their op, so a handler only has to
+ * dereference and jump to the next handler.
+ */
+typedef struct ThreadedOp {
+    const void *handler;
+    int *dest;
+    const int *src1;
+    const int *src2;       // second source, or the address register of st
+    int imm;
+    struct ThreadedOp *target;
+    long long taken;       // times the branch was taken, for profiles
+} ThreadedOp;
+
+static const char* interp_status_names[] = {
+    "halted", "end of program", "instruction limit", "bad memory address", "bad instruction"
+};
+
+const char* interp_status_name(enum interpStatus_enum status)
+{
+    return interp_status_names[status];
+}
+
+static bool valid_reg(int reg)
+{
+    return reg >= 0 && reg < NUM_REGS;
+}
+
+enum interpStatus_enum interp_run(CPU* cpu, long long max_instructions)
+{
+    return interp_run_profile(cpu, max_instructions, NULL);
+}
+
+enum interpStatus_enum interp_run_profile(CPU* cpu, long long max_instructions, long long* taken)
+{
+    // Handler of every opcode, the label addresses are only known in here
+    static const void* handlers[] = {
+        [fmt_set] = &&op_set,
+        [fmt_add] = &&op_add,
+        [fmt_add_imm] = &&op_add_imm,
+        [fmt_sub] = &&op_sub,
+        [fmt_sub_imm] = &&op_sub_imm,
+        [fmt_div] = &&op_div,
+        [fmt_div_imm] = &&op_div_imm,
+        [fmt_mul] = &&op_mul,
+        [fmt_mul_imm] = &&op_mul_imm,
+        [fmt_ld] = &&op_ld,
+        [fmt_ld_imm] = &&op_ld_imm,
+        [fmt_st] = &&op_st,
+        [fmt_st_imm] = &&op_st_imm,
+        [fmt_bez_imm] = &&op_bez,
+        [fmt_bgez_imm] = &&op_bgez,
+        [fmt_blez_imm] = &&op_blez,
+        [fmt_bgtz_imm] = &&op_bgtz,
+        [fmt_bltz_imm] = &&op_bltz,
+        [fmt_ret] = &&op_ret,
+    };
+
+    int regs[NUM_REGS];
+    int count = cpu->tot_instructions;
+    ThreadedOp* ops = (ThreadedOp*)calloc(count + 1, sizeof(ThreadedOp));
+    if (!ops) {
+        return interp_bad_instruction;
+    }
+
+    for(int r = 0; r < NUM_REGS; r++)
+        regs[r] = cpu->regs[r].value;
+
+    // Translate the decoded program, see fetch_stage for the field layout
+    for(int i = 0; i < count; i++)
+    {
+        int *decoded = &cpu->instruction_memory[i * 7];
+        int opcode = decoded[0];
+        int dest = decoded[1];
+        int src1 = decoded[2];
+        int imm1 = decoded[3];
+        int src2 = decoded[4];
+        ThreadedOp* op = &ops[i];
+
+        op->imm = imm1;
+        if(opcode < fmt_set || opcode > fmt_ret)
+        {
+            op->handler = &&op_nop;
+            continue;
+        }
+        op->handler = handlers[opcode];
+
+        switch (opcode)
+        {
+        case fmt_ret:
+            break;
+        case fmt_set:
+        case fmt_ld_imm:
+            if(!valid_reg(dest))
+                op->handler = &&op_bad;
+            op->dest = &regs[dest & (NUM_REGS - 1)];
+            break;
+        case fmt_st:
+            if(!valid_reg(dest) || !valid_reg(src1))
+                op->handler = &&op_bad;
+            op->src1 = &regs[src1 & (NUM_REGS - 1)];
+            op->src2 = &regs[dest & (NUM_REGS - 1)];
+            break;
+        case fmt_st_imm:
+            if(!valid_reg(src1))
+                op->handler = &&op_bad;
+            op->src1 = &regs[src1 & (NUM_REGS - 1)];
+            break;
+        case fmt_bez_imm:
+        case fmt_bgez_imm:
+        case fmt_blez_imm:
+        case fmt_bgtz_imm:
+        case fmt_bltz_imm:
+        {
+            int target = imm1 / 4;
+            if(!valid_reg(src1))
+                op->handler = &&op_bad;
+            op->src1 = &regs[src1 & (NUM_REGS - 1)];
+            op->target = (target >= 0 && target < count) ? &ops[target] : &ops[count];
+            break;
+        }
+        default:
+            // Register-register and register-immediate arithmetic, ld
+            if(!valid_reg(dest) || !valid_reg(src1) || ((opcode == fmt_add || opcode == fmt_sub
+                || opcode == fmt_mul || opcode == fmt_div) && !valid_reg(src2)))
+                op->handler = &&op_bad;
+            op->dest = &regs[dest & (NUM_REGS - 1)];
+            op->src1 = &regs[src1 & (NUM_REGS - 1)];
+            op->src2 = &regs[src2 & (NUM_REGS - 1)];
+            break;
+        }
+    }
+    ops[count].handler = &&op_end;
+
+    int* memory = cpu->memory;
+    unsigned int memory_words = cpu->memoryLen;
+    long long executed = 0;
+    enum interpStatus_enum status;
+    ThreadedOp* op = &ops[cpu->pc / 7 < count ? cpu->pc / 7 : count];
+    unsigned int word;
+
+#define DISPATCH_NEXT()  do { executed++; op++; goto *op->handler; } while(0)
+#define TAKE_BRANCH(cond) do { \
+        executed++; \
+        if(cond) { \
+            op->taken++; \
+            op = op->target; \
+            if(executed >= max_instructions) { status = interp_limit; goto done; } \
+        } \
+        else \
+            op++; \
+        goto *op->handler; \
+    } while(0)
+
+    goto *op->handler;
+
+op_set:
+    *op->dest = op->imm;
+    DISPATCH_NEXT();
+op_add:
+    *op->dest = *op->src1 + *op->src2;
+    DISPATCH_NEXT();
+op_add_imm:
+    *op->dest = *op->src1 + op->imm;
+    DISPATCH_NEXT();
+op_sub:
+    *op->dest = *op->src1 - *op->src2;
+    DISPATCH_NEXT();
+op_sub_imm:
+    *op->dest = *op->src1 - op->imm;
+    DISPATCH_NEXT();
+op_mul:
+    *op->dest = *op->src1 * *op->src2;
+    DISPATCH_NEXT();
+op_mul_imm:
+    *op->dest = op->imm * *op->src1;
+    DISPATCH_NEXT();
+op_div:
+    *op->dest = *op->src1 / *op->src2;
+    DISPATCH_NEXT();
+op_div_imm:
+    *op->dest = *op->src1 / op->imm;
+    DISPATCH_NEXT();
+op_ld:
+    word = (unsigned int)(*op->src1 / 4);
+    if(word >= memory_words) { status = interp_bad_address; goto done; }
+    *op->dest = memory[word];
+    DISPATCH_NEXT();
+op_ld_imm:
+    word = (unsigned int)(op->imm / 4);
+    if(word >= memory_words) { status = interp_bad_address; goto done; }
+    *op->dest = memory[word];
+    DISPATCH_NEXT();
+op_st:
+    word = (unsigned int)(*op->src2 / 4);
+    if(word >= memory_words) { status = interp_bad_address; goto done; }
+    memory[word] = *op->src1;
+    DISPATCH_NEXT();
+op_st_imm:
+    word = (unsigned int)(op->imm / 4);
+    if(word >= memory_words) { status = interp_bad_address; goto done; }
+    memory[word] = *op->src1;
+    DISPATCH_NEXT();
+op_bez:
+    TAKE_BRANCH(*op->src1 == 0);
+op_bgez:
+    TAKE_BRANCH(*op->src1 >= 0);
+op_blez:
+    TAKE_BRANCH(*op->src1 <= 0);
+op_bgtz:
+    TAKE_BRANCH(*op->src1 > 0);
+op_bltz:
+    TAKE_BRANCH(*op->src1 < 0);
+op_nop:
+    DISPATCH_NEXT();
+op_ret:
+    executed++;
+    status = interp_halted;
+    goto done;
+op_bad:
+    status = interp_bad_instruction;
+    goto done;
+op_end:
+    status = interp_end_of_program;
+
+#undef DISPATCH_NEXT
+#undef TAKE_BRANCH
+
+done:
+    for(int r = 0; r < NUM_REGS; r++)
+        cpu->regs[r].value = regs[r];
+    cpu->pc = (int)(op - ops) * 7;
+    cpu->tot_instructions_done += executed;
+    if(status == interp_halted)
+        cpu->cpu_halted = true;
+    if(taken)
+        for(int i = 0; i < count; i++)
+            taken[i] += ops[i].taken;
+
+    free(ops);
+    return status;
+}
@@ -0,0 +1,32 @@
+#ifndef _INTERP_H_
+#define _INTERP_H_
+
+struct CPU;
+
+// Why the functional interpreter stopped
+enum interpStatus_enum {
+    interp_halted,          // ret executed
+    interp_end_of_program,  // fell off the last instruction
+    interp_limit,           // instruction budget used up
+    interp_bad_address,     // ld/st outside the memory map
+    interp_bad_instruction, // register number outside the register file
+};
+
+/*
+ * Direct-threaded functional interpreter. Executes the decoded program from
+ * cpu->pc on the architectural registers and memory of cpu, without any
+ * timing, and leaves pc, registers, memory and tot_instructions_done as the
+ * pipeline would after retiring the same instructions.
+ */
+enum interpStatus_enum interp_run(struct CPU* cpu, long long max_instructions);
+
+/*
+ * Same as interp_run, and adds to taken[i] the times the branch at
+ * instruction i was taken. Everything else a profile needs follows from
+ * these counts and the entry pc, see simpoint.c.
+ */
+enum interpStatus_enum interp_run_profile(struct CPU* cpu, long long max_instructions, long long* taken);
+
+const char* interp_status_name(enum interpStatus_enum status);
+
+#endif
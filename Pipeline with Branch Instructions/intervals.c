@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "intervals.h"
+
+#define INTERVALS_RECORD_SIZE (INTERVALS_FIELDS * 8)
+#define INTERVALS_MAX_ROW 512   // longest CSV row, with room to spare
+
+static void write_header(IntervalWriter* writer)
+{
+    IntervalHeader header;
+    header.magic = INTERVALS_MAGIC;
+    header.version = INTERVALS_VERSION;
+    header.interval = writer->interval;
+    header.records = writer->records;
+    fwrite(&header, sizeof(header), 1, writer->file);
+}
+
+static void put_u64(unsigned char* buf, unsigned long long value)
+{
+    for(int i = 0; i < 8; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static void flush_buffer(IntervalWriter* writer)
+{
+    if(writer->used > 0)
+        fwrite(writer->buf, 1, writer->used, writer->file);
+    writer->used = 0;
+}
+
+static bool ends_with(const char* s, const char* suffix)
+{
+    size_t len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+/*
+ * This function creates an interval file, CSV when filename ends in .csv.
+ * Returns NULL if it cannot be opened.
+ */
+IntervalWriter* intervals_open(const char* filename, long long interval)
+{
+    IntervalWriter* writer = (IntervalWriter*)calloc(1, sizeof(IntervalWriter));
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->csv = ends_with(filename, ".csv");
+    writer->interval = interval;
+    writer->file = fopen(filename, writer->csv ? "w" : "wb");
+    if (writer->file == NULL) {
+        printf("Error opening interval file %s\n", filename);
+        free(writer);
+        return NULL;
+    }
+    // Records are gathered in writer->buf, stdio needs no buffer of its own
+    setvbuf(writer->file, NULL, _IONBF, 0);
+
+    if(writer->csv)
+        fprintf(writer->file, "start,cycles,instructions,ipc,data_stalls,mem_stalls,fetch_stalls,"
+            "flushes,mispredictions,loads,stores,forwards\n");
+    else
+        write_header(writer);   // the record count is filled in by intervals_close
+    return writer;
+}
+
+void intervals_write(IntervalWriter* writer, const IntervalRecord* record)
+{
+    if(INTERVALS_BUFFER_SIZE - writer->used < INTERVALS_MAX_ROW)
+        flush_buffer(writer);
+
+    unsigned char* out = writer->buf + writer->used;
+    if(writer->csv)
+    {
+        writer->used += snprintf((char*)out, INTERVALS_MAX_ROW,
+            "%lld,%lld,%lld,%f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+            record->start, record->cycles, record->instructions,
+            record->cycles ? (double)record->instructions / record->cycles : 0.0,
+            record->data_stalls, record->mem_stalls, record->fetch_stalls, record->flushes,
+            record->mispredictions, record->loads, record->stores, record->forwards);
+    }
+    else
+    {
+        const long long* fields = &record->start;
+        for(int i = 0; i < INTERVALS_FIELDS; i++)
+            put_u64(out + 8 * i, fields[i]);
+        writer->used += INTERVALS_RECORD_SIZE;
+    }
+    writer->records++;
+}
+
+void intervals_close(IntervalWriter* writer)
+{
+    if(!writer)
+        return;
+
+    flush_buffer(writer);
+    if(!writer->csv)
+    {
+        rewind(writer->file);
+        write_header(writer);
+    }
+    fclose(writer->file);
+    free(writer);
+}
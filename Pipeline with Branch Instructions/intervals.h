@@ -0,0 +1,53 @@
+#ifndef _INTERVALS_H_
+#define _INTERVALS_H_
+#include <stdbool.h>
+#include <stdio.h>
+
+#define INTERVALS_MAGIC 0x53545649u   // "IVTS"
+#define INTERVALS_VERSION 1
+#define INTERVALS_BUFFER_SIZE 65536   // bytes formatted before each fwrite
+
+/*
+ * Interval time series of a run, one record every interval cycles. A file
+ * named *.csv gets a header line and one text row per record, any other
+ * name a binary header (host byte order) followed by the records as
+ * INTERVALS_FIELDS little endian 64 bit words, in the order of the struct.
+ * The record count is patched when the file is closed.
+ */
+typedef struct IntervalHeader {
+    unsigned int magic;
+    unsigned int version;
+    long long interval;        // cycles per record, the last one may be shorter
+    long long records;
+} IntervalHeader;
+
+typedef struct IntervalRecord {
+    long long start;           // first cycle of the interval
+    long long cycles;
+    long long instructions;    // retired in the interval
+    long long data_stalls;     // register read stalled by a data hazard
+    long long mem_stalls;      // cycles lost to data cache misses
+    long long fetch_stalls;    // cycles fetch waited for the instruction cache
+    long long flushes;         // pipeline flushes due to branches
+    long long mispredictions;  // wrong direction predictions
+    long long loads;           // loads leaving Mem1
+    long long stores;          // stores leaving Mem1
+    long long forwards;        // register reads served by forwarding
+} IntervalRecord;
+
+#define INTERVALS_FIELDS 11
+
+typedef struct IntervalWriter {
+    FILE *file;
+    bool csv;
+    long long interval;
+    long long records;
+    size_t used;                              // bytes waiting in buf
+    unsigned char buf[INTERVALS_BUFFER_SIZE];
+} IntervalWriter;
+
+IntervalWriter* intervals_open(const char* filename, long long interval);
+void intervals_write(IntervalWriter* writer, const IntervalRecord* record);
+void intervals_close(IntervalWriter* writer);
+
+#endif
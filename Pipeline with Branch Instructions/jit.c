@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#include <sys/mman.h>
+
+// Why a translated block returned to the dispatcher
+enum jitExit_enum {
+    jit_exit_continue,      // next block is at exit_pc, exit_slot may be chained
+    jit_exit_halted,
+    jit_exit_bad_address,
+    jit_exit_bad_instruction,
+};
+
+/*
+ * State shared with the translated code, which keeps a pointer to it in
+ * rdi and the memory base in rsi. Registers come first so that register r
+ * is at [rdi + 4*r].
+ */
+typedef struct JitContext {
+    int regs[NUM_REGS];
+    int *memory;
+    unsigned long long memory_words;
+    long long executed;
+    long long budget;
+    unsigned char *exit_slot;   // jmp of the block exit taken, NULL: do not chain
+    int exit_pc;                // instruction index to continue at
+    int exit_reason;
+} JitContext;
+
+typedef struct Jit {
+    unsigned char *code;
+    unsigned char *end;
+    unsigned char *limit;
+    unsigned char **blocks;     // translated entry of every instruction index
+    bool *leaders;              // first instructions of basic blocks
+    const int *program;         // decoded instructions, see fetch_stage
+    int count;
+} Jit;
+
+typedef void (*JitEntry)(JitContext* ctx, unsigned char* block);
+
+#define CTX(field) ((int)offsetof(JitContext, field))
+#define REG(r) ((int)offsetof(JitContext, regs) + 4 * (r))
+
+// Room left for the largest translation of one instruction and its exits
+#define JIT_MAX_INSN_BYTES 256
+
+static void emit8(Jit* jit, unsigned int value)
+{
+    *jit->end++ = (unsigned char)value;
+}
+
+static void emit32(Jit* jit, unsigned int value)
+{
+    memcpy(jit->end, &value, 4);
+    jit->end += 4;
+}
+
+static void emit64(Jit* jit, unsigned long long value)
+{
+    memcpy(jit->end, &value, 8);
+    jit->end += 8;
+}
+
+/* op r32, [rdi + disp32] with the given opcode and register field */
+static void emit_rdi_mem(Jit* jit, unsigned int opcode, int reg, int disp)
+{
+    if(opcode > 0xff)
+        emit8(jit, opcode >> 8);
+    emit8(jit, opcode & 0xff);
+    emit8(jit, 0x80 | (reg << 3) | 7);
+    emit32(jit, disp);
+}
+
+/* mov dword [rdi + disp32], imm32 */
+static void emit_store_imm(Jit* jit, int disp, int imm)
+{
+    emit_rdi_mem(jit, 0xc7, 0, disp);
+    emit32(jit, imm);
+}
+
+/* eax = eax / 4 rounded towards zero, as C does for the address */
+static void emit_word_index(Jit* jit)
+{
+    emit8(jit, 0x99);                                  // cdq
+    emit8(jit, 0x83); emit8(jit, 0xe2); emit8(jit, 0x03); // and edx, 3
+    emit8(jit, 0x01); emit8(jit, 0xd0);                // add eax, edx
+    emit8(jit, 0xc1); emit8(jit, 0xf8); emit8(jit, 0x02); // sar eax, 2
+}
+
+/*
+ * Leaves the block before instruction index pc, which has not executed,
+ * block_left instructions of the block were counted in advance.
+ */
+static void emit_exit(Jit* jit, int pc, int block_left, enum jitExit_enum reason)
+{
+    if(block_left > 0)
+    {
+        emit8(jit, 0x48);
+        emit_rdi_mem(jit, 0x81, 5, CTX(executed));     // sub qword [rdi+executed], imm32
+        emit32(jit, block_left);
+    }
+    emit_store_imm(jit, CTX(exit_pc), pc);
+    emit_store_imm(jit, CTX(exit_reason), reason);
+    emit8(jit, 0xc3);                                  // ret
+}
+
+/*
+ * Checks a word index in eax against the memory map, and leaves through a
+ * bad address exit when it is outside.
+ */
+static void emit_bounds_check(Jit* jit, int pc, int block_left)
+{
+    emit8(jit, 0x48);
+    emit_rdi_mem(jit, 0x3b, 0, CTX(memory_words));      // cmp rax, [rdi+memory_words]
+    emit8(jit, 0x0f); emit8(jit, 0x82);                // jb ok
+    unsigned char* skip = jit->end;
+    emit32(jit, 0);
+    emit_exit(jit, pc, block_left, jit_exit_bad_address);
+    int offset = (int)(jit->end - (skip + 4));
+    memcpy(skip, &offset, 4);
+}
+
+/*
+ * Block exit towards instruction index next. Once the budget is checked
+ * it jumps through a patchable jmp, which first points at the code right
+ * after it that returns to the dispatcher, and is redirected to the next
+ * block's entry once that is translated.
+ */
+static void emit_chain_exit(Jit* jit, int next)
+{
+    // mov rax, [rdi+executed]; cmp rax, [rdi+budget]; jge unchained
+    emit8(jit, 0x48);
+    emit_rdi_mem(jit, 0x8b, 0, CTX(executed));
+    emit8(jit, 0x48);
+    emit_rdi_mem(jit, 0x3b, 0, CTX(budget));
+    emit8(jit, 0x7d);
+    emit8(jit, 5);
+
+    unsigned char* slot = jit->end;
+    emit8(jit, 0xe9);                                  // jmp rel32
+    emit32(jit, 0);
+
+    // Unchained path, the dispatcher chains the slot unless out of budget
+    emit8(jit, 0x48); emit8(jit, 0xb8);                // mov rax, imm64
+    emit64(jit, (unsigned long long)(size_t)slot);
+    emit8(jit, 0x48);
+    emit_rdi_mem(jit, 0x89, 0, CTX(exit_slot));        // mov [rdi+exit_slot], rax
+    emit_exit(jit, next, 0, jit_exit_continue);
+}
+
+static bool valid_reg(int reg)
+{
+    return reg >= 0 && reg < NUM_REGS;
+}
+
+static bool is_branch(int opcode)
+{
+    return opcode >= fmt_bez_imm && opcode <= fmt_bltz_imm;
+}
+
+static bool operands_valid(int* decoded)
+{
+    int opcode = decoded[0];
+    int dest = decoded[1];
+    int src1 = decoded[2];
+    int src2 = decoded[4];
+
+    switch (opcode)
+    {
+    case fmt_set:
+    case fmt_ld_imm:
+        return valid_reg(dest);
+    case fmt_st:
+        return valid_reg(dest) && valid_reg(src1);
+    case fmt_st_imm:
+        return valid_reg(src1);
+    case fmt_add:
+    case fmt_sub:
+    case fmt_mul:
+    case fmt_div:
+        return valid_reg(dest) && valid_reg(src1) && valid_reg(src2);
+    case fmt_add_imm:
+    case fmt_sub_imm:
+    case fmt_mul_imm:
+    case fmt_div_imm:
+    case fmt_ld:
+        return valid_reg(dest) && valid_reg(src1);
+    default:
+        // ret, unknown opcodes and branches (checked with their src1)
+        return !is_branch(opcode) || valid_reg(src1);
+    }
+}
+
+/*
+ * Translates the basic block starting at instruction index start, returns
+ * its entry or NULL when the code buffer is full.
+ */
+static unsigned char* translate_block(Jit* jit, int start, unsigned int memory_words)
+{
+    // Block extent: up to a branch or ret, the next leader or the end, a
+    // longer straight line is split into blocks chained to each other
+    int end = start;
+    while(end < jit->count && end - start < JIT_MAX_BLOCK)
+    {
+        int opcode = jit->program[end * 7];
+        end++;
+        if(is_branch(opcode) || opcode == fmt_ret || (end < jit->count && jit->leaders[end]))
+            break;
+    }
+
+    if(jit->limit - jit->end < (long)(end - start + 2) * JIT_MAX_INSN_BYTES)
+        return NULL;
+
+    unsigned char* entry = jit->end;
+    int length = end - start;
+
+    // Count the whole block up front, early exits give back what they skip
+    emit8(jit, 0x48);
+    emit_rdi_mem(jit, 0x81, 0, CTX(executed));         // add qword [rdi+executed], imm32
+    emit32(jit, length);
+
+    for(int pc = start; pc < end; pc++)
+    {
+        const int *decoded = &jit->program[pc * 7];
+        int opcode = decoded[0];
+        int dest = decoded[1];
+        int src1 = decoded[2];
+        int imm1 = decoded[3];
+        int src2 = decoded[4];
+        int left = end - pc;
+        unsigned int word = (unsigned int)(imm1 / 4);
+
+        if(!operands_valid((int*)decoded))
+        {
+            emit_exit(jit, pc, left, jit_exit_bad_instruction);
+            return entry;
+        }
+
+        switch (opcode)
+        {
+        case fmt_set:
+            emit_store_imm(jit, REG(dest), imm1);
+            break;
+        case fmt_add:
+        case fmt_sub:
+        case fmt_mul:
+            emit_rdi_mem(jit, 0x8b, 0, REG(src1));          // mov eax, src1
+            if(opcode == fmt_add)
+                emit_rdi_mem(jit, 0x03, 0, REG(src2));      // add eax, src2
+            else if(opcode == fmt_sub)
+                emit_rdi_mem(jit, 0x2b, 0, REG(src2));      // sub eax, src2
+            else
+                emit_rdi_mem(jit, 0x0faf, 0, REG(src2));    // imul eax, src2
+            emit_rdi_mem(jit, 0x89, 0, REG(dest));
+            break;
+        case fmt_add_imm:
+        case fmt_sub_imm:
+        case fmt_mul_imm:
+            emit_rdi_mem(jit, 0x8b, 0, REG(src1));
+            if(opcode == fmt_add_imm)
+                emit8(jit, 0x05);                           // add eax, imm32
+            else if(opcode == fmt_sub_imm)
+                emit8(jit, 0x2d);                           // sub eax, imm32
+            else
+            {
+                emit8(jit, 0x69); emit8(jit, 0xc0);         // imul eax, eax, imm32
+            }
+            emit32(jit, imm1);
+            emit_rdi_mem(jit, 0x89, 0, REG(dest));
+            break;
+        case fmt_div:
+            emit_rdi_mem(jit, 0x8b, 0, REG(src1));
+            emit8(jit, 0x99);                               // cdq
+            emit_rdi_mem(jit, 0xf7, 7, REG(src2));          // idiv dword src2
+            emit_rdi_mem(jit, 0x89, 0, REG(dest));
+            break;
+        case fmt_div_imm:
+            emit_rdi_mem(jit, 0x8b, 0, REG(src1));
+            emit8(jit, 0xb9); emit32(jit, imm1);            // mov ecx, imm32
+            emit8(jit, 0x99);
+            emit8(jit, 0xf7); emit8(jit, 0xf9);             // idiv ecx
+            emit_rdi_mem(jit, 0x89, 0, REG(dest));
+            break;
+        case fmt_ld:
+            emit_rdi_mem(jit, 0x8b, 0, REG(src1));
+            emit_word_index(jit);
+            emit_bounds_check(jit, pc, left);
+            emit8(jit, 0x8b); emit8(jit, 0x04); emit8(jit, 0x86); // mov eax, [rsi+rax*4]
+            emit_rdi_mem(jit, 0x89, 0, REG(dest));
+            break;
+        case fmt_st:
+            emit_rdi_mem(jit, 0x8b, 0, REG(dest));          // address register
+            emit_word_index(jit);
+            emit_bounds_check(jit, pc, left);
+            emit_rdi_mem(jit, 0x8b, 1, REG(src1));          // mov ecx, src1
+            emit8(jit, 0x89); emit8(jit, 0x0c); emit8(jit, 0x86); // mov [rsi+rax*4], ecx
+            break;
+        case fmt_ld_imm:
+        case fmt_st_imm:
+            // The address is known, only its bounds check is done here
+            if(word >= memory_words)
+            {
+                emit_exit(jit, pc, left, jit_exit_bad_address);
+                return entry;
+            }
+            if(opcode == fmt_ld_imm)
+            {
+                emit8(jit, 0x8b); emit8(jit, 0x86); emit32(jit, word * 4); // mov eax, [rsi+disp32]
+                emit_rdi_mem(jit, 0x89, 0, REG(dest));
+            }
+            else
+            {
+                emit_rdi_mem(jit, 0x8b, 1, REG(src1));
+                emit8(jit, 0x89); emit8(jit, 0x8e); emit32(jit, word * 4); // mov [rsi+disp32], ecx
+            }
+            break;
+        case fmt_bez_imm:
+        case fmt_bgez_imm:
+        case fmt_blez_imm:
+        case fmt_bgtz_imm:
+        case fmt_bltz_imm:
+        {
+            static const unsigned char jcc[] = {
+                [fmt_bez_imm - fmt_bez_imm] = 0x84,     // je
+                [fmt_bgez_imm - fmt_bez_imm] = 0x8d,    // jge
+                [fmt_blez_imm - fmt_bez_imm] = 0x8e,    // jle
+                [fmt_bgtz_imm - fmt_bez_imm] = 0x8f,    // jg
+                [fmt_bltz_imm - fmt_bez_imm] = 0x8c,    // jl
+            };
+            int target = imm1 / 4;
+            if(target < 0 || target >= jit->count)
+                target = jit->count;
+
+            emit_rdi_mem(jit, 0x83, 7, REG(src1));          // cmp dword src1, 0
+            emit8(jit, 0);
+            emit8(jit, 0x0f); emit8(jit, jcc[opcode - fmt_bez_imm]);
+            unsigned char* taken = jit->end;
+            emit32(jit, 0);
+            emit_chain_exit(jit, pc + 1);
+            int offset = (int)(jit->end - (taken + 4));
+            memcpy(taken, &offset, 4);
+            emit_chain_exit(jit, target);
+            return entry;
+        }
+        case fmt_ret:
+            emit_exit(jit, pc, 0, jit_exit_halted);
+            return entry;
+        default:
+            // Unknown opcodes retire as nops, like in the pipeline
+            break;
+        }
+    }
+
+    // Fell into the next leader, the next part of a split block or off the
+    // end of the program
+    emit_chain_exit(jit, end);
+    return entry;
+}
+
+/*
+ * Marks the first instruction of every basic block: the start of the
+ * program, every branch target and the instruction after every branch.
+ */
+static void find_leaders(Jit* jit)
+{
+    jit->leaders[0] = true;
+    for(int pc = 0; pc < jit->count; pc++)
+    {
+        int opcode = jit->program[pc * 7];
+        if(!is_branch(opcode) && opcode != fmt_ret)
+            continue;
+        if(pc + 1 < jit->count)
+            jit->leaders[pc + 1] = true;
+        int target = jit->program[pc * 7 + 3] / 4;
+        if(is_branch(opcode) && target >= 0 && target < jit->count)
+            jit->leaders[target] = true;
+    }
+}
+
+/*
+ * Drops every translation, used when the code buffer is full.
+ */
+static void jit_flush(Jit* jit)
+{
+    jit->end = jit->code;
+    memset(jit->blocks, 0, jit->count * sizeof(unsigned char*));
+}
+
+enum interpStatus_enum jit_run(CPU* cpu, long long max_instructions)
+{
+    int count = cpu->tot_instructions;
+    Jit jit;
+
+    memset(&jit, 0, sizeof(jit));
+    jit.count = count;
+    jit.program = cpu->instruction_memory;
+    jit.code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit.blocks = (unsigned char**)calloc(count + 1, sizeof(unsigned char*));
+    jit.leaders = (bool*)calloc(count + 1, sizeof(bool));
+    if(jit.code == MAP_FAILED || !jit.blocks || !jit.leaders)
+    {
+        if(jit.code != MAP_FAILED)
+            munmap(jit.code, JIT_CODE_SIZE);
+        free(jit.blocks);
+        free(jit.leaders);
+        return interp_run(cpu, max_instructions);
+    }
+    jit.limit = jit.code + JIT_CODE_SIZE;
+    find_leaders(&jit);
+
+    // Entry stub: the block to run comes in rsi and is replaced by the memory base
+    jit.end = jit.code;
+    emit8(&jit, 0x48); emit8(&jit, 0x89); emit8(&jit, 0xf0);   // mov rax, rsi
+    emit8(&jit, 0x48);
+    emit_rdi_mem(&jit, 0x8b, 6, CTX(memory));                   // mov rsi, [rdi+memory]
+    emit8(&jit, 0xff); emit8(&jit, 0xe0);                       // jmp rax
+    JitEntry enter = (JitEntry)(void*)jit.code;
+    jit.code = jit.end;
+
+    JitContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    for(int r = 0; r < NUM_REGS; r++)
+        ctx.regs[r] = cpu->regs[r].value;
+    ctx.memory = cpu->memory;
+    ctx.memory_words = (unsigned int)cpu->memoryLen;
+    ctx.budget = max_instructions;
+
+    enum interpStatus_enum status;
+    bool interpret = false;
+    unsigned char* chain_slot = NULL;
+    int pc = cpu->pc / 7 < count ? cpu->pc / 7 : count;
+
+    while(true)
+    {
+        if(pc >= count)
+        {
+            status = interp_end_of_program;
+            break;
+        }
+        if(ctx.executed >= max_instructions)
+        {
+            status = interp_limit;
+            break;
+        }
+
+        unsigned char* block = jit.blocks[pc];
+        if(!block)
+        {
+            block = translate_block(&jit, pc, ctx.memory_words);
+            if(!block)
+            {
+                jit_flush(&jit);
+                chain_slot = NULL;
+                block = translate_block(&jit, pc, ctx.memory_words);
+            }
+            if(!block)
+            {
+                // Does not fit an empty buffer either, the interpreter finishes
+                status = interp_limit;
+                interpret = true;
+                break;
+            }
+            jit.blocks[pc] = block;
+        }
+
+        // Link the exit we came from straight to this block
+        if(chain_slot)
+        {
+            int offset = (int)(block - (chain_slot + 5));
+            memcpy(chain_slot + 1, &offset, 4);
+        }
+
+        ctx.exit_slot = NULL;
+        enter(&ctx, block);
+        pc = ctx.exit_pc;
+        chain_slot = ctx.exit_slot;
+
+        if(ctx.exit_reason == jit_exit_halted)
+        {
+            status = interp_halted;
+            break;
+        }
+        if(ctx.exit_reason == jit_exit_bad_address)
+        {
+            status = interp_bad_address;
+            break;
+        }
+        if(ctx.exit_reason == jit_exit_bad_instruction)
+        {
+            status = interp_bad_instruction;
+            break;
+        }
+    }
+
+    for(int r = 0; r < NUM_REGS; r++)
+        cpu->regs[r].value = ctx.regs[r];
+    cpu->pc = pc * 7;
+    cpu->tot_instructions_done += ctx.executed;
+    if(status == interp_halted)
+        cpu->cpu_halted = true;
+
+    munmap(enter, JIT_CODE_SIZE);
+    free(jit.blocks);
+    free(jit.leaders);
+    if(interpret)
+        status = interp_run(cpu, max_instructions - ctx.executed);
+    return status;
+}
+
+#else
+
+enum interpStatus_enum jit_run(CPU* cpu, long long max_instructions)
+{
+    return interp_run(cpu, max_instructions);
+}
+
+#endif
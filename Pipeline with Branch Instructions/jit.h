@@ -0,0 +1,18 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+#include "interp.h"
+
+#define JIT_CODE_SIZE (16 * 1024 * 1024)   // bytes of executable code buffer
+#define JIT_MAX_BLOCK 4096                  // instructions per block, longer runs are split
+
+struct CPU;
+
+/*
+ * Dynamic binary translator. Basic blocks of the decoded program are
+ * translated to x86-64 on first use and chained to each other by patching
+ * their exits, the result is the same as interp_run. On other hosts, or
+ * when no executable memory is available, it falls back to interp_run.
+ */
+enum interpStatus_enum jit_run(struct CPU* cpu, long long max_instructions);
+
+#endif
@@ -0,0 +1,672 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "cpu.h"
+#include "loop.h"
+
+#define VALUE_LATCHES 7     // adder to writeback, the stages holding operand values
+#define LATCH_MEMORY_SECOND 5
+#define LATCH_WRITEBACK 6
+#define LOOP_SNAPSHOTS 8    // iteration starts kept while following, > 3 + 2
+
+/*
+ * Stage holding operand values by distance from the adder, an instruction
+ * in latch n is processed by that stage in the next cycle.
+ */
+static Stage* value_latch(CPU* cpu, int level)
+{
+    switch (level)
+    {
+    case 0:
+        return &cpu->adder;
+    case 1:
+        return &cpu->multipler;
+    case 2:
+        return &cpu->divider;
+    case 3:
+        return &cpu->branch;
+    case 4:
+        return &cpu->memory_first;
+    case 5:
+        return &cpu->memory_second;
+    default:
+        return &cpu->writeback;
+    }
+}
+
+/*
+ * Latch after which an arithmetic result exists, the adder computes set,
+ * add and sub, the multiplier mul and the divider div.
+ */
+static int compute_level(int opcode)
+{
+    if(opcode == fmt_mul || opcode == fmt_mul_imm)
+        return 1;
+    if(opcode == fmt_div || opcode == fmt_div_imm)
+        return 2;
+    return 0;
+}
+
+static bool valid_reg(int reg)
+{
+    return reg >= 0 && reg < NUM_REGS;
+}
+
+static bool valid_address(CPU* cpu, int addr)
+{
+    return addr / 4 >= 0 && addr / 4 < cpu->memoryLen;
+}
+
+static bool is_branch(int opcode)
+{
+    return opcode >= fmt_bez_imm && opcode <= fmt_bltz_imm;
+}
+
+LoopDetector* loop_create(void)
+{
+    return (LoopDetector*)calloc(1, sizeof(LoopDetector));
+}
+
+void loop_free(LoopDetector* loop)
+{
+    if(!loop)
+        return;
+    free(loop->undo);
+    free(loop);
+}
+
+/*
+ * Called by the branch stage for every resolved branch, pc is the byte
+ * address of the branch.
+ */
+void loop_branch_resolved(LoopDetector* loop, unsigned int pc, bool taken)
+{
+    loop->trace[loop->resolved % LOOP_TRACE_SIZE] = (int)(pc << 1 | taken);
+    loop->resolved++;
+}
+
+static unsigned long long hash_int(unsigned long long hash, long long value)
+{
+    for(int i = 0; i < 8; i++)
+        hash = (hash ^ ((unsigned long long)value >> (i * 8) & 0xff)) * 1099511628211ull;
+    return hash;
+}
+
+static unsigned long long hash_stage(unsigned long long hash, Stage* stage, unsigned long long history_mask)
+{
+    hash = hash_int(hash, stage->status);
+    hash = hash_int(hash, stage->curr_pc);
+    hash = hash_int(hash, stage->opcode);
+    hash = hash_int(hash, stage->dest);
+    hash = hash_int(hash, stage->src1);
+    hash = hash_int(hash, stage->src2);
+    hash = hash_int(hash, stage->imm_flag);
+    hash = hash_int(hash, stage->ld_flag);
+    hash = hash_int(hash, stage->st_flag);
+    hash = hash_int(hash, stage->is_branch_instr);
+    hash = hash_int(hash, stage->ia_data_hazard_found);
+    hash = hash_int(hash, stage->dest_written);
+    hash = hash_int(hash, stage->pred_next_pc);
+    hash = hash_int(hash, stage->bp_predicted);
+    hash = hash_int(hash, stage->bp_history & history_mask);
+    return hash;
+}
+
+/*
+ * Hash of everything the timing of the following cycles depends on. Data
+ * values only matter through branch outcomes, which are checked separately,
+ * and register update cycles are never compared across a cycle boundary.
+ */
+static unsigned long long state_hash(CPU* cpu)
+{
+    Stage* stages[] = {
+        &cpu->fetch, &cpu->decode, &cpu->instruction_analyse, &cpu->register_read,
+        &cpu->adder, &cpu->multipler, &cpu->divider, &cpu->branch,
+        &cpu->memory_first, &cpu->memory_second, &cpu->writeback,
+    };
+    unsigned long long history_mask = bpred_history_mask(cpu->bpred);
+    unsigned long long hash = 14695981039346656037ull;
+
+    for(int i = 0; i < (int)(sizeof(stages) / sizeof(stages[0])); i++)
+        hash = hash_stage(hash, stages[i], history_mask);
+
+    hash = hash_int(hash, cpu->pc);
+    hash = hash_int(hash, cpu->cpu_stalled);
+    hash = hash_int(hash, cpu->cpu_halted);
+    hash = hash_int(hash, cpu->ia_data_hazard_found);
+    hash = hash_int(hash, cpu->mem_stall_cycles);
+    hash = hash_int(hash, cpu->fetch_buf_start);
+    hash = hash_int(hash, cpu->fetch_buf_end);
+    hash = hash_int(hash, cpu->fetch_stall_cycles);
+
+    for(int r = 0; r < NUM_REGS; r++)
+    {
+        hash = hash_int(hash, cpu->regs[r].is_writing);
+        hash = hash_int(hash, cpu->regs[r].has_value);
+        hash = hash_int(hash, cpu->regs[r].reg_in_process_cnt);
+    }
+
+    hash = bpred_state_hash(cpu->bpred, hash);
+    return btb_state_hash(cpu->btb, hash);
+}
+
+static void read_counters(CPU* cpu, LoopCounters* counters)
+{
+    counters->clock = cpu->clock;
+    counters->instructions = cpu->tot_instructions_done;
+    counters->stalls = cpu->cpu_stalled_cnt;
+    counters->bypass = cpu->bypass;
+    counters->flushes = cpu->branch_flush_cnt;
+    counters->resolved = cpu->loop->resolved;
+    counters->predictions = cpu->bpred->predictions;
+    counters->mispredictions = cpu->bpred->mispredictions;
+    counters->branches_seen = cpu->bpred->branches_seen;
+    counters->reset_room = bpred_updates_before_reset(cpu->bpred);
+    counters->btb_lookups = cpu->btb->lookups;
+    counters->btb_hits = cpu->btb->hits;
+    counters->btb_alias_hits = cpu->btb->alias_hits;
+    counters->btb_conflict_evictions = cpu->btb->conflict_evictions;
+}
+
+static bool store_word(CPU* cpu, LoopDetector* loop, int word, int value)
+{
+    if(loop->undo_len == loop->undo_cap)
+    {
+        int capacity = loop->undo_cap ? loop->undo_cap * 2 : 1024;
+        LoopUndo* undo = realloc(loop->undo, capacity * sizeof(LoopUndo));
+        if(!undo)
+            return false;
+        loop->undo = undo;
+        loop->undo_cap = capacity;
+    }
+
+    loop->undo[loop->undo_len].word = word;
+    loop->undo[loop->undo_len].value = cpu->memory[word];
+    loop->undo_len++;
+    cpu->memory[word] = value;
+    return true;
+}
+
+static void undo_stores(CPU* cpu, LoopDetector* loop, int mark)
+{
+    while(loop->undo_len > mark)
+    {
+        loop->undo_len--;
+        cpu->memory[loop->undo[loop->undo_len].word] = loop->undo[loop->undo_len].value;
+    }
+}
+
+/*
+ * Result of an arithmetic opcode as the pipeline computes it, false for a
+ * division the host cannot perform.
+ */
+static bool alu_result(int opcode, int src1, int src2, int imm1, int* result)
+{
+    switch (opcode)
+    {
+    case fmt_set:
+        *result = imm1;
+        return true;
+    case fmt_add:
+        *result = src1 + src2;
+        return true;
+    case fmt_add_imm:
+        *result = imm1 + src1;
+        return true;
+    case fmt_sub:
+        *result = src1 - src2;
+        return true;
+    case fmt_sub_imm:
+        *result = src1 - imm1;
+        return true;
+    case fmt_mul:
+        *result = src1 * src2;
+        return true;
+    case fmt_mul_imm:
+        *result = imm1 * src1;
+        return true;
+    case fmt_div:
+    case fmt_div_imm:
+    {
+        int divisor = opcode == fmt_div ? src2 : imm1;
+        if(divisor == 0 || (src1 == INT_MIN && divisor == -1))
+            return false;
+        *result = src1 / divisor;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/*
+ * Executes the instruction at pc (a multiple of 7) on regs and the memory
+ * of cpu, stores go through the undo log. branch is set to the trace
+ * record of a branch, -1 otherwise. Returns false for anything that is not
+ * followed: ret, bad operands, addresses or divisions.
+ */
+static bool exec_instruction(CPU* cpu, LoopDetector* loop, int* regs, int* pc, int* branch)
+{
+    if(*pc < 0 || *pc >= cpu->tot_instructions * 7)
+        return false;
+
+    int *decoded = &cpu->instruction_memory[*pc];
+    int opcode = decoded[0];
+    int dest = decoded[1];
+    int src1 = decoded[2];
+    int imm1 = decoded[3];
+    int src2 = decoded[4];
+    int next_pc = *pc + 7;
+    int addr;
+    int value;
+
+    *branch = -1;
+    switch (opcode)
+    {
+    case fmt_set:
+        if(!valid_reg(dest))
+            return false;
+        regs[dest] = imm1;
+        break;
+    case fmt_add:
+    case fmt_sub:
+    case fmt_mul:
+    case fmt_div:
+        if(!valid_reg(dest) || !valid_reg(src1) || !valid_reg(src2)
+            || !alu_result(opcode, regs[src1], regs[src2], imm1, &value))
+            return false;
+        regs[dest] = value;
+        break;
+    case fmt_add_imm:
+    case fmt_sub_imm:
+    case fmt_mul_imm:
+    case fmt_div_imm:
+        if(!valid_reg(dest) || !valid_reg(src1) || !alu_result(opcode, regs[src1], 0, imm1, &value))
+            return false;
+        regs[dest] = value;
+        break;
+    case fmt_ld:
+    case fmt_ld_imm:
+        if(!valid_reg(dest) || (opcode == fmt_ld && !valid_reg(src1)))
+            return false;
+        addr = opcode == fmt_ld ? regs[src1] : imm1;
+        if(!valid_address(cpu, addr))
+            return false;
+        regs[dest] = cpu->memory[addr / 4];
+        break;
+    case fmt_st:
+    case fmt_st_imm:
+        if(!valid_reg(src1) || (opcode == fmt_st && !valid_reg(dest)))
+            return false;
+        addr = opcode == fmt_st ? regs[dest] : imm1;
+        if(!valid_address(cpu, addr) || !store_word(cpu, loop, addr / 4, regs[src1]))
+            return false;
+        break;
+    case fmt_bez_imm:
+    case fmt_bgez_imm:
+    case fmt_blez_imm:
+    case fmt_bgtz_imm:
+    case fmt_bltz_imm:
+    {
+        if(!valid_reg(src1))
+            return false;
+        value = regs[src1];
+        bool taken = (opcode == fmt_bez_imm && value == 0) ||
+            (opcode == fmt_bgez_imm && value >= 0) ||
+            (opcode == fmt_bgtz_imm && value > 0) ||
+            (opcode == fmt_blez_imm && value <= 0) ||
+            (opcode == fmt_bltz_imm && value < 0);
+        *branch = (int)((unsigned int)(*pc / 7 * 4) << 1 | taken);
+        if(taken)
+            next_pc = imm1 / 4 * 7;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    *pc = next_pc;
+    return true;
+}
+
+static bool settle(int* field, int value, bool apply)
+{
+    if(apply)
+        *field = value;
+    return *field == value;
+}
+
+/*
+ * Values a latch holds for its instruction, given the registers before it
+ * executes: operands once read, results once computed and memory addresses
+ * once the first memory stage ran. Forwarded operands are read from these
+ * latches, so they need nothing else.
+ */
+static bool latch_values(CPU* cpu, Stage* stage, int level, const int* regs, bool apply)
+{
+    int opcode = stage->opcode;
+    int src1 = valid_reg(stage->src1) ? regs[stage->src1] : 0;
+    int src2 = valid_reg(stage->src2) ? regs[stage->src2] : 0;
+    int addr_reg = valid_reg(stage->dest) ? regs[stage->dest] : 0;
+    bool ok = true;
+    int value;
+    int addr;
+
+    switch (opcode)
+    {
+    case fmt_add:
+    case fmt_sub:
+    case fmt_mul:
+    case fmt_div:
+        ok = settle(&stage->src2_value, src2, apply) && ok;
+        // fall through
+    case fmt_add_imm:
+    case fmt_sub_imm:
+    case fmt_mul_imm:
+    case fmt_div_imm:
+        ok = settle(&stage->src1_value, src1, apply) && ok;
+        // fall through
+    case fmt_set:
+        if(!alu_result(opcode, src1, src2, stage->imm1, &value))
+            return false;
+        if(level > compute_level(opcode))
+            ok = settle(&stage->dest_value, value, apply) && ok;
+        break;
+    case fmt_ld:
+    case fmt_ld_imm:
+        if(opcode == fmt_ld)
+            ok = settle(&stage->src1_value, src1, apply) && ok;
+        addr = opcode == fmt_ld ? src1 : stage->imm1;
+        if(level >= LATCH_MEMORY_SECOND)
+            ok = settle(&stage->addr, addr, apply) && ok;
+        if(level == LATCH_WRITEBACK)
+        {
+            if(!valid_address(cpu, addr))
+                return false;
+            ok = settle(&stage->dest_value, cpu->memory[addr / 4], apply) && ok;
+        }
+        break;
+    case fmt_st:
+    case fmt_st_imm:
+        if(opcode == fmt_st)
+            ok = settle(&stage->dest_value, addr_reg, apply) && ok;
+        ok = settle(&stage->src1_value, src1, apply) && ok;
+        if(level >= LATCH_MEMORY_SECOND)
+        {
+            ok = settle(&stage->read_st, src1, apply) && ok;
+            ok = settle(&stage->write_st, opcode == fmt_st ? addr_reg : stage->imm1, apply) && ok;
+        }
+        break;
+    default:
+        if(!is_branch(opcode))
+            return false;
+        ok = settle(&stage->src1_value, src1, apply) && ok;
+        break;
+    }
+    return ok;
+}
+
+/*
+ * Rebuilds the values held by the adder to writeback latches by executing the in-flight instructions, oldest first,
+ * on the current registers and memory. With apply false the values are only
+ * compared, which tells whether the pipeline agrees with plain execution at
+ * this point; with apply true they are written.
+ */
+static bool revalue_pipeline(CPU* cpu, LoopDetector* loop, bool apply)
+{
+    int regs[NUM_REGS];
+    int mark = loop->undo_len;
+    int pc = -1;
+    bool ok = true;
+
+    for(int r = 0; r < NUM_REGS; r++)
+        regs[r] = cpu->regs[r].value;
+
+    for(int level = VALUE_LATCHES - 1; level >= 0 && ok; level--)
+    {
+        Stage* stage = value_latch(cpu, level);
+        int branch;
+
+        if(stage->status != stage_action)
+            continue;
+        if(pc < 0)
+            pc = stage->curr_pc;
+
+        ok = stage->curr_pc == pc
+            && latch_values(cpu, stage, level, regs, apply)
+            && exec_instruction(cpu, loop, regs, &pc, &branch);
+    }
+
+    undo_stores(cpu, loop, mark);
+
+    // The store in writeback has already been done by the second memory stage
+    if(ok && apply && cpu->writeback.status == stage_action
+        && (cpu->writeback.opcode == fmt_st || cpu->writeback.opcode == fmt_st_imm))
+        cpu->memory[cpu->writeback.write_st / 4] = cpu->writeback.read_st;
+    return ok;
+}
+
+/*
+ * The oldest in-flight instruction, which is on the right path, and how
+ * many in-flight instructions have already left the branch stage.
+ */
+static int oldest_in_flight(CPU* cpu, int* passed)
+{
+    Stage* stages[] = {
+        &cpu->writeback, &cpu->memory_second, &cpu->memory_first, &cpu->branch,
+        &cpu->divider, &cpu->multipler, &cpu->adder, &cpu->register_read,
+        &cpu->instruction_analyse, &cpu->decode,
+    };
+    int pc = -1;
+
+    *passed = 0;
+    for(int i = 0; i < (int)(sizeof(stages) / sizeof(stages[0])); i++)
+    {
+        if(stages[i]->status != stage_action)
+            continue;
+        if(pc < 0)
+            pc = stages[i]->curr_pc;
+        if(stages[i] == &cpu->writeback || stages[i] == &cpu->memory_second
+            || stages[i] == &cpu->memory_first)
+            (*passed)++;
+    }
+    return pc < 0 ? cpu->pc : pc;
+}
+
+/*
+ * Executes iterations of length instructions from pc on the architectural
+ * state and counts how many resolve exactly the branches of the recorded
+ * iteration, starting at trace index first. The branch stage runs passed
+ * instructions ahead of retirement, so each iteration is checked on the
+ * branches shifted by that much. Registers and memory are left at the
+ * start of the first iteration that is not followed, with the stores of
+ * the followed ones still in the undo log.
+ */
+static long long follow_iterations(CPU* cpu, LoopDetector* loop, int pc, int passed,
+    long long length, long long first, long long branch_cnt, long long max_iterations)
+{
+    int regs[NUM_REGS];
+    int snapshot_regs[LOOP_SNAPSHOTS][NUM_REGS];
+    int snapshot_undo[LOOP_SNAPSHOTS];
+    long long next_snapshot = 0;
+    long long iterations = 0;
+    long long executed = 0;
+    long long branch_index = 0;
+
+    for(int r = 0; r < NUM_REGS; r++)
+        regs[r] = cpu->regs[r].value;
+
+    while(iterations < max_iterations)
+    {
+        // Start of iteration n, where the state is kept if n is the last one followed
+        if(executed == next_snapshot * length)
+        {
+            int slot = next_snapshot % LOOP_SNAPSHOTS;
+            memcpy(snapshot_regs[slot], regs, sizeof(regs));
+            snapshot_undo[slot] = loop->undo_len;
+            next_snapshot++;
+        }
+
+        // All branches of the iteration resolved as recorded
+        if(executed == passed + (iterations + 1) * length)
+        {
+            if(branch_index != branch_cnt)
+                break;
+            iterations++;
+            branch_index = 0;
+            continue;
+        }
+
+        int branch;
+        if(!exec_instruction(cpu, loop, regs, &pc, &branch))
+            break;
+        if(branch >= 0 && executed >= passed)
+        {
+            if(branch_index == branch_cnt
+                || loop->trace[(first + branch_index) % LOOP_TRACE_SIZE] != branch)
+                break;
+            branch_index++;
+        }
+        executed++;
+    }
+
+    int slot = iterations % LOOP_SNAPSHOTS;
+    undo_stores(cpu, loop, snapshot_undo[slot]);
+    for(int r = 0; r < NUM_REGS; r++)
+        cpu->regs[r].value = snapshot_regs[slot][r];
+    return iterations;
+}
+
+/*
+ * Called at the end of a cycle in which the backward branch at branch_pc
+ * resolved taken. If the pipeline is in the same state as at the previous
+ * iteration, the following iterations are executed functionally for as
+ * long as they take the same branch path, at most max_cycles worth of
+ * them, and the pipeline is moved to the state it would reach at the end
+ * of the last one. Returns the cycles skipped.
+ */
+long long loop_extrapolate(CPU* cpu, int branch_pc, long long max_cycles)
+{
+    LoopDetector* loop = cpu->loop;
+    LoopEntry* entry = &loop->table[branch_pc / 7 % LOOP_TABLE_SIZE];
+    unsigned long long hash = state_hash(cpu);
+    LoopCounters last;
+    LoopCounters now;
+    bool recurred = false;
+
+    if(entry->pc != branch_pc)
+    {
+        memset(entry, 0, sizeof(LoopEntry));
+        entry->pc = branch_pc;
+    }
+
+    // The most recent visit in the same state gives the shortest period
+    for(int back = 1; back <= LOOP_HISTORY && !recurred; back++)
+    {
+        LoopState* state = &entry->states[(entry->next + LOOP_HISTORY - back) % LOOP_HISTORY];
+        if(state->valid && state->hash == hash)
+        {
+            last = state->counters;
+            recurred = true;
+        }
+    }
+
+    read_counters(cpu, &now);
+    entry->states[entry->next].valid = true;
+    entry->states[entry->next].hash = hash;
+    entry->states[entry->next].counters = now;
+    entry->next = (entry->next + 1) % LOOP_HISTORY;
+    if(!recurred)
+        return 0;
+
+    long long cycles = now.clock - last.clock;
+    long long length = now.instructions - last.instructions;
+    long long branch_cnt = now.resolved - last.resolved;
+    if(cycles <= 0 || length <= 0 || branch_cnt > LOOP_TRACE_SIZE)
+        return 0;
+
+    // A periodic predictor reset inside the recorded iteration breaks the pattern
+    if(last.reset_room >= 0 && last.reset_room < branch_cnt)
+        return 0;
+
+    long long max_iterations = max_cycles / cycles - 1;
+    if(now.reset_room >= 0 && branch_cnt > 0 && now.reset_room / branch_cnt < max_iterations)
+        max_iterations = now.reset_room / branch_cnt;
+    if(max_iterations < 1)
+        return 0;
+
+    // In-flight values can only be rebuilt if they are what plain execution gives
+    if(!revalue_pipeline(cpu, loop, false))
+        return 0;
+
+    // Kept to back out if the new in-flight values cannot be computed
+    int saved_regs[NUM_REGS];
+    Stage saved_latches[VALUE_LATCHES];
+    int mark = loop->undo_len;
+
+    for(int r = 0; r < NUM_REGS; r++)
+        saved_regs[r] = cpu->regs[r].value;
+    for(int level = 0; level < VALUE_LATCHES; level++)
+        saved_latches[level] = *value_latch(cpu, level);
+
+    int passed;
+    int pc = oldest_in_flight(cpu, &passed);
+    long long iterations = follow_iterations(cpu, loop, pc, passed, length,
+        last.resolved, branch_cnt, max_iterations);
+
+    if(iterations > 0 && !revalue_pipeline(cpu, loop, true))
+    {
+        undo_stores(cpu, loop, mark);
+        for(int r = 0; r < NUM_REGS; r++)
+            cpu->regs[r].value = saved_regs[r];
+        for(int level = 0; level < VALUE_LATCHES; level++)
+            *value_latch(cpu, level) = saved_latches[level];
+        iterations = 0;
+    }
+
+    // The stores of the followed iterations stay
+    loop->undo_len = mark;
+    if(iterations == 0)
+        return 0;
+
+    // Absolute times move with the clock, counters grow by whole iterations
+    long long skipped = iterations * cycles;
+    for(int r = 0; r < NUM_REGS; r++)
+        if(cpu->regs[r].last_reg_update_cycle > last.clock)
+            cpu->regs[r].last_reg_update_cycle += skipped;
+
+    cpu->clock += skipped;
+    cpu->tot_instructions_done += iterations * length;
+    cpu->cpu_stalled_cnt += iterations * (now.stalls - last.stalls);
+    bypass_extrapolate(&cpu->bypass, &last.bypass, &now.bypass, iterations);
+    cpu->branch_flush_cnt += iterations * (now.flushes - last.flushes);
+    cpu->bpred->predictions += iterations * (now.predictions - last.predictions);
+    cpu->bpred->mispredictions += iterations * (now.mispredictions - last.mispredictions);
+    cpu->bpred->branches_seen += iterations * (now.branches_seen - last.branches_seen);
+    cpu->btb->lookups += iterations * (now.btb_lookups - last.btb_lookups);
+    cpu->btb->hits += iterations * (now.btb_hits - last.btb_hits);
+    cpu->btb->alias_hits += iterations * (now.btb_alias_hits - last.btb_alias_hits);
+    cpu->btb->conflict_evictions += iterations * (now.btb_conflict_evictions - last.btb_conflict_evictions);
+
+    // Earlier visits were recorded with the skipped branches missing from the trace
+    for(int i = 0; i < LOOP_TABLE_SIZE; i++)
+        memset(loop->table[i].states, 0, sizeof(loop->table[i].states));
+    entry->states[0].valid = true;
+    entry->states[0].hash = hash;
+    read_counters(cpu, &entry->states[0].counters);
+    entry->next = 1;
+
+    loop->loops++;
+    loop->iterations += iterations;
+    loop->cycles_skipped += skipped;
+    loop->instructions_skipped += iterations * length;
+    return skipped;
+}
+
+void loop_print_stats(LoopDetector* loop)
+{
+    printf("Loop extrapolation: %lld loops, %lld iterations, %lld cycles and %lld instructions skipped\n",
+        loop->loops, loop->iterations, loop->cycles_skipped, loop->instructions_skipped);
+}
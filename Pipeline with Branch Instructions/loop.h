@@ -0,0 +1,80 @@
+#ifndef _LOOP_H_
+#define _LOOP_H_
+#include <stdbool.h>
+#include "bypass.h"
+
+#define LOOP_TABLE_SIZE 64      // backward branches tracked, direct mapped by pc
+#define LOOP_TRACE_SIZE 4096    // resolved branches kept, bounds one iteration
+#define LOOP_HISTORY 4          // back edge visits compared, the longest period found
+
+struct CPU;
+
+// Counters that grow by the same amount every iteration of a steady loop
+typedef struct LoopCounters {
+    long long clock;
+    long long instructions;
+    long long stalls;
+    BypassStats bypass;
+    long long flushes;
+    long long resolved;           // branches resolved since the start
+    long long predictions;
+    long long mispredictions;
+    long long branches_seen;
+    long long btb_lookups;
+    long long btb_hits;
+    long long btb_alias_hits;
+    long long btb_conflict_evictions;
+    long long reset_room;         // predictor updates before its periodic reset
+} LoopCounters;
+
+// Pipeline state seen when a backward branch resolved taken
+typedef struct LoopState {
+    bool valid;
+    unsigned long long hash;
+    LoopCounters counters;
+} LoopState;
+
+// Last visits of one backward branch, an iteration may span several of
+// them when the loop body alternates between paths
+typedef struct LoopEntry {
+    int pc;
+    int next;                     // slot of the next visit
+    LoopState states[LOOP_HISTORY];
+} LoopEntry;
+
+typedef struct LoopUndo {
+    int word;
+    int value;
+} LoopUndo;
+
+/*
+ * Steady state detector. At the end of every cycle in which a backward
+ * branch resolved taken, the timing state of the pipeline (stage contents,
+ * hazard tracking, predictor and BTB, without data values or absolute
+ * times) is hashed. When it matches the state of one of the last visits,
+ * the iterations that follow the same branch path are executed
+ * functionally and their cycles are added without simulating them.
+ */
+typedef struct LoopDetector {
+    LoopEntry table[LOOP_TABLE_SIZE];
+    int trace[LOOP_TRACE_SIZE];   // byte address << 1 | taken of resolved branches
+    long long resolved;
+
+    LoopUndo *undo;               // memory writes of functional execution
+    int undo_len;
+    int undo_cap;
+
+    long long loops;              // extrapolations done
+    long long iterations;
+    long long cycles_skipped;
+    long long instructions_skipped;
+} LoopDetector;
+
+LoopDetector* loop_create(void);
+void loop_free(LoopDetector* loop);
+
+void loop_branch_resolved(LoopDetector* loop, unsigned int pc, bool taken);
+long long loop_extrapolate(struct CPU* cpu, int branch_pc, long long max_cycles);
+void loop_print_stats(LoopDetector* loop);
+
+#endif
@@ -8,11 +8,60 @@
 #include <stdlib.h>
 #include <string.h>
 #include "cpu.h"
+#include "multicore.h"
+#include "slice.h"
+#include "forkserver.h"
+#include "batch.h"
+#include "simpoint.h"
+#include "critpath.h"
 
-void run_cpu_fun(const char * filename){
+void run_cpu_fun(const char * filename, const SimConfig * config){
 
-    CPU *cpu = CPU_init(filename);
-    CPU_run(cpu);
+    if(config->fork_file[0])
+    {
+        fork_run(filename, config);
+        return;
+    }
+    if(config->batch_file[0])
+    {
+        batch_run(filename, config);
+        return;
+    }
+    if(config->cores > 1)
+    {
+        Multicore *mc = multicore_create(filename, config);
+        multicore_run(mc);
+        multicore_free(mc);
+        return;
+    }
+    if(config->slices > 1)
+    {
+        slice_run(filename, config);
+        return;
+    }
+    if(config->simpoint || config->bbv_file[0])
+    {
+        simpoint_run(filename, config);
+        return;
+    }
+    if(config->critpath)
+    {
+        critpath_run(filename, config);
+        return;
+    }
+
+    CPU *cpu = CPU_init_config(filename, config);
+    if(!cpu)
+    {
+        printf("Error creating the CPU\n");
+        exit(1);
+    }
+    if(config->functional)
+        CPU_run_functional(cpu);
+    else if(config->longrun)
+        CPU_run_long(cpu);
+    else
+        CPU_run(cpu);
     CPU_stop(cpu);
 }
 
@@ -22,8 +71,23 @@ int main(int argc, const char * argv[]) {
         return -1;
     }
     char* filename = (char*)argv[1];
+
+    // Optional --key=value settings follow the program file
+    SimConfig config;
+    sim_config_defaults(&config);
+    for (int i=2; i<argc; i++) {
+        if (!sim_config_parse_arg(&config, argv[i])) {
+            fprintf(stderr, "Error : invalid option %s\n", argv[i]);
+            return -1;
+        }
+    }
+    const char* invalid = sim_config_check(&config);
+    if (invalid) {
+        fprintf(stderr, "Error : invalid %s\n", invalid);
+        return -1;
+    }
     
-    run_cpu_fun(filename);
+    run_cpu_fun(filename, &config);
     
     return 0;
 }
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "mshr.h"
+
+/*
+ * This function creates a file of the given number of MSHRs for a cache
+ * with lines of line_size bytes, none means misses block and NULL is
+ * returned.
+ */
+MSHRFile* mshr_create(Arena* arena, int entries, int line_size)
+{
+    if(entries <= 0)
+        return NULL;
+
+    MSHRFile* mshr = (MSHRFile*)arena_alloc(arena, sizeof(MSHRFile));
+    if (!mshr) {
+        return NULL;
+    }
+    memset(mshr, 0, sizeof(MSHRFile));
+    mshr->arena = arena;
+    mshr->entries = (MSHREntry*)arena_alloc(arena, entries * sizeof(MSHREntry));
+    if (!mshr->entries) {
+        arena_release(arena, mshr);
+        return NULL;
+    }
+    for(int i = 0; i < entries; i++)
+        mshr->entries[i].done = -1;
+    mshr->capacity = entries;
+    mshr->line_size = line_size;
+    mshr->covered_until = -1;
+    return mshr;
+}
+
+void mshr_free(MSHRFile* mshr)
+{
+    if(mshr)
+    {
+        arena_release(mshr->arena, mshr->entries);
+        arena_release(mshr->arena, mshr);
+    }
+}
+
+// Fill in flight at clock for the line holding addr, NULL if none
+MSHREntry* mshr_find(MSHRFile* mshr, unsigned int addr, long long clock)
+{
+    unsigned int line = addr / mshr->line_size;
+    for(int i = 0; i < mshr->capacity; i++)
+    {
+        if(mshr->entries[i].done >= clock && mshr->entries[i].line == line)
+            return &mshr->entries[i];
+    }
+    return NULL;
+}
+
+/*
+ * Cycles a miss at clock waits for a free entry, 0 when there is one.
+ */
+int mshr_wait(MSHRFile* mshr, long long clock)
+{
+    long long first_free = -1;
+    for(int i = 0; i < mshr->capacity; i++)
+    {
+        if(mshr->entries[i].done < clock)
+            return 0;
+        if(first_free < 0 || mshr->entries[i].done < first_free)
+            first_free = mshr->entries[i].done;
+    }
+
+    int wait = (int)(first_free - clock + 1);
+    mshr->full_stalls++;
+    mshr->full_cycles += wait;
+    return wait;
+}
+
+/*
+ * Records a miss outstanding from cycle start to done in a free entry,
+ * mshr_wait has made sure there is one at start.
+ */
+void mshr_allocate(MSHRFile* mshr, unsigned int addr, long long start, long long done)
+{
+    MSHREntry* entry = NULL;
+    int outstanding = 1;
+
+    for(int i = 0; i < mshr->capacity; i++)
+    {
+        if(mshr->entries[i].done >= start)
+            outstanding++;
+        else if(!entry)
+            entry = &mshr->entries[i];
+    }
+    if(!entry)
+        return;
+
+    entry->line = addr / mshr->line_size;
+    entry->done = done;
+    mshr->misses++;
+    mshr->busy_cycles += done - start + 1;
+    if(outstanding > mshr->max_outstanding)
+        mshr->max_outstanding = outstanding;
+
+    // Misses start in cycle order, so the cycles covered so far end at
+    // covered_until
+    long long from = start > mshr->covered_until ? start : mshr->covered_until + 1;
+    if(done >= from)
+        mshr->covered_cycles += done - from + 1;
+    if(done > mshr->covered_until)
+        mshr->covered_until = done;
+}
+
+/*
+ * This function prints the misses handled and the memory-level parallelism,
+ * the average number of misses outstanding while there was at least one.
+ */
+void mshr_print_stats(MSHRFile* mshr)
+{
+    printf("MSHRs: %d entries, %lld misses, %lld merged, at most %d outstanding\n", mshr->capacity,
+        mshr->misses, mshr->merged, mshr->max_outstanding);
+    printf("MSHRs full: %lld misses, %lld stall cycles\n", mshr->full_stalls, mshr->full_cycles);
+    printf("Stalled cycles waiting for load misses: %lld\n", mshr->use_stalls);
+    printf("Memory-level parallelism: %f\n",
+        mshr->covered_cycles ? (double)mshr->busy_cycles / mshr->covered_cycles : 0.0);
+}
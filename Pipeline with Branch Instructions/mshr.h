@@ -0,0 +1,43 @@
+#ifndef _MSHR_H_
+#define _MSHR_H_
+#include <stdbool.h>
+#include "arena.h"
+
+// One outstanding L1D miss
+typedef struct MSHREntry {
+    unsigned int line;     // line address
+    long long done;        // last cycle of the fill, free after it
+} MSHREntry;
+
+/*
+ * Miss status holding registers of the L1D. A miss takes an entry until
+ * its fill arrives and the pipeline goes on meanwhile, a later miss to the
+ * same line waits for that fill instead of taking another entry. When
+ * every entry is busy the next miss waits for the first one to free.
+ */
+typedef struct MSHRFile {
+    int capacity;
+    int line_size;
+    MSHREntry *entries;
+
+    long long misses;         // misses that took an entry
+    long long merged;         // accesses that waited for a fill already in flight
+    long long full_stalls;    // misses that found every entry busy
+    long long full_cycles;    // cycles the pipeline waited for an entry
+    long long use_stalls;     // cycles RR waited for the data of a missing load
+    long long busy_cycles;    // sum over misses of the cycles they were outstanding
+    long long covered_cycles; // cycles with at least one miss outstanding
+    long long covered_until;
+    int max_outstanding;
+    Arena *arena;
+} MSHRFile;
+
+MSHRFile* mshr_create(Arena* arena, int entries, int line_size);
+void mshr_free(MSHRFile* mshr);
+
+MSHREntry* mshr_find(MSHRFile* mshr, unsigned int addr, long long clock);
+int mshr_wait(MSHRFile* mshr, long long clock);
+void mshr_allocate(MSHRFile* mshr, unsigned int addr, long long start, long long done);
+void mshr_print_stats(MSHRFile* mshr);
+
+#endif
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <limits.h>
+#include "cpu.h"
+#include "multicore.h"
+
+/*
+ * Waits until every core finished the current quantum. The last one to
+ * arrive decides whether the run is over before the others are released,
+ * so all threads see the same answer. Like CPU_run_long it gives up when
+ * no core retired anything for LONGRUN_STALL_LIMIT cycles.
+ */
+static void quantum_barrier(Multicore* mc)
+{
+    pthread_mutex_lock(&mc->barrier_lock);
+    unsigned int generation = mc->barrier_generation;
+
+    if(++mc->barrier_waiting == mc->num_cores)
+    {
+        bool all_halted = true;
+        long long retired = 0;
+        for(int core = 0; core < mc->num_cores; core++)
+        {
+            all_halted &= mc->halted[core];
+            retired += mc->cores[core]->tot_instructions_done;
+        }
+
+        mc->quanta++;
+        mc->cycles += mc->quantum;
+        if(retired != mc->retired)
+        {
+            mc->retired = retired;
+            mc->progress = mc->cycles;
+        }
+        else if(mc->cycles - mc->progress > LONGRUN_STALL_LIMIT)
+            mc->stalled = true;
+        mc->finished = all_halted || mc->stalled || mc->cycles >= mc->max_cycles;
+        mc->barrier_waiting = 0;
+        mc->barrier_generation++;
+        pthread_cond_broadcast(&mc->barrier_cond);
+    }
+    else
+    {
+        while(generation == mc->barrier_generation)
+            pthread_cond_wait(&mc->barrier_cond, &mc->barrier_lock);
+    }
+    pthread_mutex_unlock(&mc->barrier_lock);
+}
+
+/*
+ * Ordered runs: waits until the previous cores finished the quantum.
+ */
+static void wait_turn(Multicore* mc, int core)
+{
+    pthread_mutex_lock(&mc->barrier_lock);
+    while(mc->turn != core)
+        pthread_cond_wait(&mc->barrier_cond, &mc->barrier_lock);
+    pthread_mutex_unlock(&mc->barrier_lock);
+}
+
+static void pass_turn(Multicore* mc)
+{
+    pthread_mutex_lock(&mc->barrier_lock);
+    mc->turn = (mc->turn + 1) % mc->num_cores;
+    pthread_cond_broadcast(&mc->barrier_cond);
+    pthread_mutex_unlock(&mc->barrier_lock);
+}
+
+/*
+ * Runs one core a quantum at a time until every core executed ret or the
+ * cycle limit is reached. A halted core keeps meeting the others at the
+ * barrier.
+ */
+static void* core_thread(void* arg)
+{
+    CoreThread* thread = (CoreThread*)arg;
+    Multicore* mc = thread->mc;
+    CPU* cpu = mc->cores[thread->core];
+
+    while(!mc->finished)
+    {
+        long long end = mc->cycles + mc->quantum;
+        if(end > mc->max_cycles)
+            end = mc->max_cycles;
+
+        if(mc->ordered)
+            wait_turn(mc, thread->core);
+        for(long long i = mc->cycles; i < end && !mc->halted[thread->core]; i++)
+        {
+            if(CPU_cycle(cpu))
+                mc->halted[thread->core] = true;
+            else
+                cpu->clock++;
+        }
+        if(mc->ordered)
+            pass_turn(mc);
+        quantum_barrier(mc);
+    }
+    return NULL;
+}
+
+/*
+ * This function creates config->cores cores running the program in
+ * filename. Options that cannot be shared between cores are turned off.
+ */
+Multicore* multicore_create(const char* filename, const SimConfig* config)
+{
+    Multicore* mc = (Multicore*)calloc(1, sizeof(Multicore));
+    if (!mc) {
+        return NULL;
+    }
+
+    mc->num_cores = config->cores < 1 ? 1 : config->cores > MAX_CORES ? MAX_CORES : config->cores;
+    mc->quantum = config->quantum > 0 ? config->quantum : 1;
+    mc->ordered = config->ordered_cores;
+    mc->max_cycles = config->longrun ? LLONG_MAX : MAX_CPU_CYCLES;
+    pthread_mutex_init(&mc->barrier_lock, NULL);
+    pthread_cond_init(&mc->barrier_cond, NULL);
+
+    // Every access has to go through a coherent private L1D
+    SimConfig core_config = *config;
+    core_config.dcache_enabled = true;
+    core_config.l1d.write_back = true;
+    core_config.l1d.write_allocate = true;
+    core_config.l2_enabled = false;
+    if(core_config.prefetcher != prefetch_none)
+        printf("Prefetching is not modelled with several cores, ignored\n");
+    core_config.prefetcher = prefetch_none;
+    if(core_config.store_buffer > 0)
+        printf("Store buffers are not modelled with several cores, ignored\n");
+    core_config.store_buffer = 0;
+    if(core_config.mshrs > 0 || core_config.dram_enabled)
+        printf("Non-blocking caches and the DRAM model are not modelled with several cores, ignored\n");
+    core_config.mshrs = 0;
+    core_config.dram_enabled = false;
+    if(core_config.bptrace_file[0] || core_config.addrtrace_file[0] || core_config.intervals_file[0]
+        || core_config.whatif_features || core_config.extrapolate || core_config.functional)
+        printf("Traces, extrapolation and functional runs need a single core, ignored\n");
+    core_config.bptrace_file[0] = '\0';
+    core_config.addrtrace_file[0] = '\0';
+    core_config.whatif_features = 0;
+    core_config.intervals_file[0] = '\0';
+    core_config.extrapolate = false;
+    core_config.functional = false;
+    core_config.jit = false;
+
+    mc->bus = coherence_create(config->bus_latency);
+    if(config->l2_enabled)
+        mc->l2 = cache_create(NULL, "L2", config->l2, NULL, config->mem_latency);
+
+    for(int core = 0; core < mc->num_cores; core++)
+    {
+        CPU* cpu = CPU_init_config(filename, &core_config);
+        if(!cpu)
+        {
+            printf("Error creating core %d\n", core);
+            exit(1);
+        }
+
+        cpu->l1d->next_level = mc->l2;
+        cpu->coherence = mc->bus;
+        cpu->core_id = coherence_attach(mc->bus, cpu->l1d);
+        cpu->regs[CORE_ID_REG].value = core;
+
+        // All cores work on the memory image loaded by core 0
+        if(core > 0)
+        {
+            cpu->memory = mc->cores[0]->memory;
+            cpu->memoryLen = mc->cores[0]->memoryLen;
+        }
+
+        mc->cores[core] = cpu;
+        mc->threads[core].mc = mc;
+        mc->threads[core].core = core;
+    }
+
+    return mc;
+}
+
+/*
+ * This function de-allocates the cores, the shared L2 and the bus.
+ */
+void multicore_free(Multicore* mc)
+{
+    if(!mc)
+        return;
+    // Core 0 owns the shared memory, the others only point to it
+    for(int core = mc->num_cores - 1; core >= 0; core--)
+        CPU_stop(mc->cores[core]);
+    cache_free(mc->l2);
+    coherence_free(mc->bus);
+    pthread_mutex_destroy(&mc->barrier_lock);
+    pthread_cond_destroy(&mc->barrier_cond);
+    free(mc);
+}
+
+/*
+ * Multicore simulation loop, prints the registers and stats of each core
+ * followed by the shared L2, the coherence traffic and the totals.
+ */
+int multicore_run(Multicore* mc)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int core = 0; core < mc->num_cores; core++)
+    {
+        if(pthread_create(&mc->threads[core].thread, NULL, core_thread, &mc->threads[core]) != 0)
+        {
+            printf("Error starting the thread of core %d\n", core);
+            exit(1);
+        }
+    }
+    for(int core = 0; core < mc->num_cores; core++)
+        pthread_join(mc->threads[core].thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long long cycles = 0;
+    long long instructions = 0;
+
+    for(int core = 0; core < mc->num_cores; core++)
+    {
+        CPU* cpu = mc->cores[core];
+
+        printf("=============== CORE %d ==========\n", core);
+        printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
+        printf("\n");
+
+        print_registers(cpu);
+
+        if(DEBUG_STATS)
+        {
+            if(cpu->bad_address)
+                printf("Core %d stopped: access to address %d outside memory by %04d\n", core,
+                    cpu->bad_address_addr, cpu->bad_address_pc);
+            else if(!mc->halted[core])
+                printf("Core %d did not reach ret\n", core);
+            CPU_print_stats(cpu);
+        }
+
+        if(cpu->clock > cycles)
+            cycles = cpu->clock;
+        instructions += cpu->tot_instructions_done;
+    }
+
+    if(DEBUG_STATS)
+    {
+        printf("=============== ALL CORES ==========\n");
+        if(mc->stalled)
+            printf("Run stopped: no instruction retired for %d cycles\n", LONGRUN_STALL_LIMIT);
+        if(mc->l2)
+            cache_print_stats(mc->l2, instructions);
+        coherence_print_stats(mc->bus);
+        printf("Total execution cycles: %lld\n", cycles);
+        printf("Total instruction simulated: %lld\n", instructions);
+        printf("IPC: %f\n", cycles ? (double)instructions / cycles : 0.0);
+        printf("Quanta: %lld of %d cycles%s, host time: %f s\n", mc->quanta, mc->quantum,
+            mc->ordered ? ", cores in turn" : "", seconds);
+    }
+
+    output_memory_map_file(mc->cores[0]);
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef _MULTICORE_H_
+#define _MULTICORE_H_
+#include <stdbool.h>
+#include <pthread.h>
+#include "coherence.h"
+
+#define CORE_ID_REG 15   // register that holds the core number at start
+
+struct CPU;
+struct SimConfig;
+
+// Host thread running one core
+typedef struct CoreThread {
+    struct Multicore *mc;
+    int core;
+    pthread_t thread;
+} CoreThread;
+
+/*
+ * Several cores running the same program on one shared memory, with
+ * private L1 data caches kept coherent by a MESI bus and an optional
+ * shared L2 behind them. Every core runs on its own host thread and the
+ * threads meet at a barrier after each quantum of cycles, so no core gets
+ * more than one quantum ahead of another. Core k starts with k in
+ * register CORE_ID_REG to split the work.
+ *
+ * Within a quantum the order in which the threads reach the bus depends on
+ * the host, so cycle counts differ between runs of the same program unless
+ * the quantum is 1. With ordered set the threads take turns in core order
+ * within each quantum instead, which repeats exactly at the cost of the
+ * host parallelism.
+ */
+typedef struct Multicore {
+    int num_cores;
+    struct CPU *cores[MAX_CORES];
+    CoreThread threads[MAX_CORES];
+    bool halted[MAX_CORES];
+    Coherence *bus;
+    Cache *l2;              // shared by all cores, NULL when disabled
+
+    int quantum;            // cycles between barriers
+    bool ordered;           // cores run their quantum one after the other
+    int turn;               // core whose turn it is when ordered
+    long long cycles;       // cycles every core has been given so far
+    long long max_cycles;   // MAX_CPU_CYCLES, unlimited with --longrun
+    long long quanta;
+    long long retired;      // instructions all cores had retired at progress
+    long long progress;     // last barrier after which some core retired
+    bool stalled;           // no core retired for LONGRUN_STALL_LIMIT cycles
+    bool finished;          // decided by the last thread at the barrier
+
+    pthread_mutex_t barrier_lock;
+    pthread_cond_t barrier_cond;
+    int barrier_waiting;
+    unsigned int barrier_generation;
+} Multicore;
+
+Multicore* multicore_create(const char* filename, const struct SimConfig* config);
+void multicore_free(Multicore* mc);
+
+int multicore_run(Multicore* mc);
+
+#endif
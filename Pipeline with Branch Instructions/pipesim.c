@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "pipesim.h"
+
+static PipeSim* wrap_cpu(CPU* cpu)
+{
+    if(!cpu)
+        return NULL;
+
+    PipeSim* sim = (PipeSim*)calloc(1, sizeof(PipeSim));
+    if(!sim)
+    {
+        CPU_stop(cpu);
+        return NULL;
+    }
+    sim->cpu = cpu;
+    return sim;
+}
+
+/*
+ * Creates a simulation of program, given as the text of an input file,
+ * on a copy of memory_words words of memory. config may be NULL for the
+ * compile time defaults; traces are still written if it asks for them.
+ * Returns NULL if a line of program is malformed.
+ */
+PipeSim* pipesim_create(const char* program, const int* memory, int memory_words, const SimConfig* config)
+{
+    return wrap_cpu(CPU_init_buffers(program, memory, memory_words, config));
+}
+
+/*
+ * Same as pipesim_create for a program file, memory comes from
+ * ./memory_map.txt like for the command line simulator.
+ */
+PipeSim* pipesim_create_file(const char* program_file, const SimConfig* config)
+{
+    return wrap_cpu(CPU_init_config(program_file, config));
+}
+
+/*
+ * Replaces the program and memory of sim and starts it over in the arena
+ * of the previous run. The event hook stays installed. Returns false when
+ * the arena could not grow or a line of program is malformed, sim must
+ * then only be freed or asked pipesim_bad_line.
+ */
+bool pipesim_reload(PipeSim* sim, const char* program, const int* memory, int memory_words, const SimConfig* config)
+{
+    CPUEventHook hook = sim->cpu->event_hook;
+    void* user = sim->cpu->event_user;
+
+    sim->halted = false;
+    sim->bad_address = false;
+    if(!CPU_reset(sim->cpu, program, memory, memory_words, config))
+        return false;
+    pipesim_set_event_hook(sim, hook, user);
+    return true;
+}
+
+void pipesim_free(PipeSim* sim)
+{
+    if(!sim)
+        return;
+    CPU_stop(sim->cpu);
+    free(sim);
+}
+
+/*
+ * Simulates up to cycles clock cycles, fewer if the program halts or a
+ * load or store goes outside memory, and returns how many were simulated.
+ * The clock is counted like CPU_run, so it holds the total execution
+ * cycles once the program halted.
+ */
+long long pipesim_step(PipeSim* sim, long long cycles)
+{
+    long long done = 0;
+
+    while(done < cycles && !sim->halted && !sim->bad_address)
+    {
+        done++;
+        if(!CPU_cycle(sim->cpu))
+            sim->cpu->clock++;
+        else if(sim->cpu->bad_address)
+            sim->bad_address = true;
+        else
+            sim->halted = true;
+    }
+    return done;
+}
+
+/*
+ * Simulates until condition returns true, the program halts or max_cycles
+ * have passed, and returns the cycles simulated. A NULL condition runs to
+ * the end of the program.
+ */
+long long pipesim_run_until(PipeSim* sim, PipeSimCondition condition, void* user, long long max_cycles)
+{
+    long long done = 0;
+
+    while(done < max_cycles && !sim->halted && !sim->bad_address)
+    {
+        done += pipesim_step(sim, 1);
+        if(condition && condition(sim, user))
+            break;
+    }
+    return done;
+}
+
+bool pipesim_halted(PipeSim* sim)
+{
+    return sim->halted;
+}
+
+/*
+ * True when the run stopped at a load or store outside memory; the byte
+ * address and the address of the instruction are stored if asked for.
+ */
+bool pipesim_bad_address(PipeSim* sim, int* addr, int* pc)
+{
+    if(sim->bad_address && addr)
+        *addr = sim->cpu->bad_address_addr;
+    if(sim->bad_address && pc)
+        *pc = sim->cpu->bad_address_pc;
+    return sim->bad_address;
+}
+
+/*
+ * Line number, from 1, of the malformed line that made pipesim_reload
+ * fail, 0 when it failed for lack of memory.
+ */
+int pipesim_bad_line(PipeSim* sim)
+{
+    return sim->cpu->bad_line;
+}
+
+/*
+ * Architectural value of a register, as written back so far.
+ */
+int pipesim_reg(PipeSim* sim, int reg)
+{
+    if(reg < 0 || reg >= NUM_REGS)
+        return 0;
+    return sim->cpu->regs[reg].value;
+}
+
+/*
+ * Byte address of the next instruction fetch.
+ */
+int pipesim_pc(PipeSim* sim)
+{
+    return sim->cpu->pc / 7 * 4;
+}
+
+/*
+ * Returns the simulated memory, one int per 4 byte word.
+ */
+const int* pipesim_memory(PipeSim* sim, int* memory_words)
+{
+    if(memory_words)
+        *memory_words = sim->cpu->memoryLen;
+    return sim->cpu->memory;
+}
+
+/*
+ * Reads the word at byte address addr like ld does, returns false when it
+ * is outside the memory.
+ */
+bool pipesim_load_word(PipeSim* sim, int addr, int* value)
+{
+    if(addr < 0 || addr / 4 >= sim->cpu->memoryLen)
+        return false;
+    *value = sim->cpu->memory[addr / 4];
+    return true;
+}
+
+void pipesim_counters(PipeSim* sim, PipeSimCounters* counters)
+{
+    CPU* cpu = sim->cpu;
+
+    memset(counters, 0, sizeof(PipeSimCounters));
+    counters->cycles = cpu->clock;
+    counters->instructions = cpu->tot_instructions_done;
+    counters->stall_cycles = cpu->cpu_stalled_cnt;
+    counters->branch_flushes = cpu->branch_flush_cnt;
+    counters->predictions = cpu->bpred->predictions;
+    counters->mispredictions = cpu->bpred->mispredictions;
+    counters->btb_lookups = cpu->btb->lookups;
+    counters->btb_hits = cpu->btb->hits;
+    if(cpu->l1d)
+    {
+        counters->l1d_hits = cache_hits(cpu->l1d);
+        counters->l1d_misses = cache_misses(cpu->l1d);
+        counters->mem_stall_cycles = cpu->mem_stall_cnt + cpu->miss_wait_cnt;
+    }
+    if(cpu->l1i)
+    {
+        counters->l1i_hits = cache_hits(cpu->l1i);
+        counters->l1i_misses = cache_misses(cpu->l1i);
+        counters->fetch_stall_cycles = cpu->fetch_stall_cnt;
+    }
+}
+
+/*
+ * Installs a function called for every retired instruction, resolved
+ * branch and the halt, NULL removes it.
+ */
+void pipesim_set_event_hook(PipeSim* sim, CPUEventHook hook, void* user)
+{
+    sim->cpu->event_hook = hook;
+    sim->cpu->event_user = user;
+}
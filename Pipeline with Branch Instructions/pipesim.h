@@ -0,0 +1,59 @@
+#ifndef _PIPESIM_H_
+#define _PIPESIM_H_
+#include <stdbool.h>
+#include "cpu.h"
+
+/*
+ * Embedding API. A PipeSim is created from a program and a memory image
+ * held by the caller, advanced a number of cycles or until a condition
+ * holds, and queried in between. Nothing is printed or written to files.
+ * Simulations are independent of each other and can run on different
+ * threads.
+ */
+typedef struct PipeSim {
+    CPU *cpu;
+    bool halted;              // ret was written back
+    bool bad_address;         // a load or store went outside memory
+} PipeSim;
+
+// Counters of a simulation, all since it was created
+typedef struct PipeSimCounters {
+    long long cycles;
+    long long instructions;
+    long long stall_cycles;       // data hazard stalls
+    long long branch_flushes;
+    long long predictions;
+    long long mispredictions;
+    long long btb_lookups;
+    long long btb_hits;
+    long long l1d_hits;           // 0 without the data cache model
+    long long l1d_misses;
+    long long mem_stall_cycles;
+    long long l1i_hits;           // 0 without the instruction cache model
+    long long l1i_misses;
+    long long fetch_stall_cycles;
+} PipeSimCounters;
+
+// Checked after every cycle of pipesim_run_until, true stops the run
+typedef bool (*PipeSimCondition)(PipeSim* sim, void* user);
+
+PipeSim* pipesim_create(const char* program, const int* memory, int memory_words, const SimConfig* config);
+PipeSim* pipesim_create_file(const char* program_file, const SimConfig* config);
+bool pipesim_reload(PipeSim* sim, const char* program, const int* memory, int memory_words, const SimConfig* config);
+void pipesim_free(PipeSim* sim);
+
+long long pipesim_step(PipeSim* sim, long long cycles);
+long long pipesim_run_until(PipeSim* sim, PipeSimCondition condition, void* user, long long max_cycles);
+bool pipesim_halted(PipeSim* sim);
+bool pipesim_bad_address(PipeSim* sim, int* addr, int* pc);
+int pipesim_bad_line(PipeSim* sim);
+
+int pipesim_reg(PipeSim* sim, int reg);
+int pipesim_pc(PipeSim* sim);
+const int* pipesim_memory(PipeSim* sim, int* memory_words);
+bool pipesim_load_word(PipeSim* sim, int addr, int* value);
+void pipesim_counters(PipeSim* sim, PipeSimCounters* counters);
+
+void pipesim_set_event_hook(PipeSim* sim, CPUEventHook hook, void* user);
+
+#endif
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "prefetch.h"
+
+static const char* prefetch_names[] = { "none", "nextline", "stride", "stream" };
+
+static unsigned int line_of(Prefetcher* prefetcher, unsigned int addr)
+{
+    return addr / prefetcher->target->config.line_size;
+}
+
+static void prefetch_line(Prefetcher* prefetcher, unsigned int line)
+{
+    cache_prefetch(prefetcher->target, line * prefetcher->target->config.line_size);
+}
+
+/*
+ * Next-line: every access brings in the following degree lines.
+ */
+static void observe_next_line(Prefetcher* prefetcher, int pc, unsigned int addr, bool miss)
+{
+    unsigned int line = line_of(prefetcher, addr);
+
+    prefetcher->triggers++;
+    for(int i = 1; i <= prefetcher->degree; i++)
+        prefetch_line(prefetcher, line + i);
+}
+
+/*
+ * Stride: a PC that keeps moving by the same distance gets its next degree
+ * addresses prefetched.
+ */
+static void observe_stride(Prefetcher* prefetcher, int pc, unsigned int addr, bool miss)
+{
+    StrideEntry* entry = &prefetcher->stride_table[(pc / 7) % STRIDE_TABLE_SIZE];
+
+    if(entry->pc != pc)
+    {
+        entry->pc = pc;
+        entry->last_addr = addr;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+
+    int stride = (int)(addr - entry->last_addr);
+    if(stride != 0 && stride == entry->stride)
+    {
+        if(entry->confidence < 3)
+            entry->confidence++;
+    }
+    else
+    {
+        if(entry->confidence > 0)
+            entry->confidence--;
+        else
+            entry->stride = stride;
+    }
+    entry->last_addr = addr;
+
+    if(entry->confidence >= 2 && entry->stride != 0)
+    {
+        prefetcher->triggers++;
+        for(int i = 1; i <= prefetcher->degree; i++)
+            cache_prefetch(prefetcher->target, addr + i * entry->stride);
+    }
+}
+
+/*
+ * Stream: two misses to consecutive lines start a stream, every access to
+ * the head of a stream keeps it degree lines ahead of demand.
+ */
+static void observe_stream(Prefetcher* prefetcher, int pc, unsigned int addr, bool miss)
+{
+    unsigned int line = line_of(prefetcher, addr);
+    StreamBuffer* stream = NULL;
+
+    for(int i = 0; i < STREAM_BUFFERS; i++)
+    {
+        StreamBuffer* candidate = &prefetcher->streams[i];
+        if(candidate->valid && line >= candidate->next_line && line <= candidate->head_line)
+        {
+            stream = candidate;
+            break;
+        }
+    }
+
+    if(stream)
+    {
+        stream->next_line = line + 1;
+        stream->stamp = ++prefetcher->stamp;
+        prefetcher->triggers++;
+        while(stream->head_line < line + prefetcher->degree)
+            prefetch_line(prefetcher, ++stream->head_line);
+        return;
+    }
+
+    if(!miss)
+        return;
+
+    // Allocate a stream on a miss that continues a recent one, replacing
+    // the least recently used stream
+    StreamBuffer* victim = &prefetcher->streams[0];
+    for(int i = 0; i < STREAM_BUFFERS; i++)
+    {
+        StreamBuffer* candidate = &prefetcher->streams[i];
+        if(candidate->valid && candidate->next_line == line && candidate->head_line < line)
+        {
+            victim = candidate;
+            break;
+        }
+        if(!candidate->valid || candidate->stamp < victim->stamp)
+            victim = candidate;
+    }
+
+    if(victim->valid && victim->next_line == line)
+    {
+        // Second sequential miss, start running ahead
+        victim->next_line = line + 1;
+        victim->head_line = line;
+        victim->stamp = ++prefetcher->stamp;
+        prefetcher->triggers++;
+        while(victim->head_line < line + prefetcher->degree)
+            prefetch_line(prefetcher, ++victim->head_line);
+    }
+    else
+    {
+        // Remember the miss as a stream candidate
+        victim->valid = true;
+        victim->next_line = line + 1;
+        victim->head_line = line;
+        victim->stamp = ++prefetcher->stamp;
+    }
+}
+
+/*
+ * This function creates a prefetcher that fills the target cache.
+ */
+Prefetcher* prefetcher_create(Arena* arena, enum prefetchType_enum type, int degree, Cache* target)
+{
+    if(type == prefetch_none || !target)
+        return NULL;
+
+    Prefetcher* prefetcher = (Prefetcher*)arena_alloc(arena, sizeof(Prefetcher));
+    if (!prefetcher) {
+        return NULL;
+    }
+    prefetcher->arena = arena;
+
+    prefetcher->type = type;
+    prefetcher->degree = degree > 0 ? degree : 1;
+    prefetcher->target = target;
+
+    for(int i = 0; i < STRIDE_TABLE_SIZE; i++)
+        prefetcher->stride_table[i].pc = -1;
+
+    switch (type)
+    {
+    case prefetch_next_line:
+        prefetcher->observe = observe_next_line;
+        break;
+    case prefetch_stride:
+        prefetcher->observe = observe_stride;
+        break;
+    case prefetch_stream:
+        prefetcher->observe = observe_stream;
+        break;
+    default:
+        arena_release(arena, prefetcher);
+        return NULL;
+    }
+
+    return prefetcher;
+}
+
+void prefetcher_free(Prefetcher* prefetcher)
+{
+    if(prefetcher)
+        arena_release(prefetcher->arena, prefetcher);
+}
+
+bool prefetcher_parse_type(const char* name, enum prefetchType_enum* type)
+{
+    for(int i = prefetch_none; i <= prefetch_stream; i++)
+    {
+        if(strcmp(name, prefetch_names[i]) == 0)
+        {
+            *type = (enum prefetchType_enum)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* prefetcher_name(enum prefetchType_enum type)
+{
+    return prefetch_names[type];
+}
+
+/*
+ * This function prints the prefetcher configuration and the accuracy,
+ * coverage and timeliness measured at its target cache.
+ */
+void prefetcher_print_stats(Prefetcher* prefetcher)
+{
+    printf("Prefetcher: %s, degree %d, triggers: %lld\n", prefetcher_name(prefetcher->type),
+        prefetcher->degree, prefetcher->triggers);
+    cache_print_prefetch_stats(prefetcher->target);
+}
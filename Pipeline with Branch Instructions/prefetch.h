@@ -0,0 +1,53 @@
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+#include <stdbool.h>
+#include "cache.h"
+
+#define STRIDE_TABLE_SIZE 64   // per-PC entries of the stride prefetcher
+#define STREAM_BUFFERS 4       // sequential streams tracked at once
+
+enum prefetchType_enum {
+    prefetch_none,
+    prefetch_next_line,   // fetch the next degree lines after every access
+    prefetch_stride,      // per-PC stride detection
+    prefetch_stream,      // sequential miss streams running ahead of demand
+};
+
+// Per-PC entry of the stride prefetcher
+typedef struct StrideEntry {
+    int pc;
+    unsigned int last_addr;
+    int stride;
+    int confidence;    // 2-bit, prefetch once it reaches 2
+} StrideEntry;
+
+// One tracked sequential stream
+typedef struct StreamBuffer {
+    bool valid;
+    unsigned int next_line;   // next line the demand stream is expected to touch
+    unsigned int head_line;   // last line prefetched for this stream
+    unsigned long long stamp; // last use, the oldest stream is replaced
+} StreamBuffer;
+
+/* Data prefetcher observing the addresses computed in memory_first_stage */
+typedef struct Prefetcher {
+    enum prefetchType_enum type;
+    int degree;               // lines fetched ahead per trigger
+    Cache *target;            // level the prefetches are filled into
+    void (*observe)(struct Prefetcher* prefetcher, int pc, unsigned int addr, bool miss);
+
+    StrideEntry stride_table[STRIDE_TABLE_SIZE];
+    StreamBuffer streams[STREAM_BUFFERS];
+    unsigned long long stamp;
+
+    long long triggers;       // observations that produced prefetches
+    Arena *arena;             // NULL: allocated on the heap
+} Prefetcher;
+
+Prefetcher* prefetcher_create(Arena* arena, enum prefetchType_enum type, int degree, Cache* target);
+void prefetcher_free(Prefetcher* prefetcher);
+bool prefetcher_parse_type(const char* name, enum prefetchType_enum* type);
+const char* prefetcher_name(enum prefetchType_enum type);
+void prefetcher_print_stats(Prefetcher* prefetcher);
+
+#endif
@@ -0,0 +1,663 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include "cpu.h"
+#include "simpoint.h"
+
+// Static basic blocks of the decoded program. A block ends with a branch
+// or ret, or just before an instruction a branch jumps to.
+typedef struct BlockMap {
+    int count;
+    int *block_of;        // block of every instruction
+    int *length;          // instructions of every block
+    int *last;            // last instruction of every block
+} BlockMap;
+
+// Functional profile, one basic block vector per interval
+typedef struct Profile {
+    int intervals;
+    int cap;
+    long long *start;     // instructions retired before the interval
+    long long *length;    // instructions of the interval
+    long long *bbv;       // intervals x blocks, instructions executed in each block
+} Profile;
+
+// Clustering of the intervals for one k
+typedef struct Clustering {
+    int *assign;          // cluster of every interval
+    double *centres;      // k x dims
+    double sse;
+    double bic;
+} Clustering;
+
+static enum interpStatus_enum functional_run(CPU* cpu, long long max_instructions)
+{
+    return cpu->config.jit ? jit_run(cpu, max_instructions) : interp_run(cpu, max_instructions);
+}
+
+static double elapsed(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static bool is_branch(int opcode)
+{
+    return opcode >= fmt_bez_imm && opcode <= fmt_bltz_imm;
+}
+
+// Instruction a branch jumps to, -1 when it leaves the program
+static int branch_target(CPU* cpu, int i)
+{
+    int target = cpu->instruction_memory[i * 7 + 3] / 4;
+    return target >= 0 && target < cpu->tot_instructions ? target : -1;
+}
+
+static void find_blocks(CPU* cpu, BlockMap* map)
+{
+    int count = cpu->tot_instructions;
+    bool* leader = (bool*)calloc(count + 1, sizeof(bool));
+    map->block_of = (int*)calloc(count + 1, sizeof(int));
+    map->length = (int*)calloc(count + 1, sizeof(int));
+    map->last = (int*)calloc(count + 1, sizeof(int));
+    if(!leader || !map->block_of || !map->length || !map->last)
+    {
+        printf("Error allocating the basic block map\n");
+        exit(1);
+    }
+
+    leader[0] = true;
+    for(int i = 0; i < count; i++)
+    {
+        int opcode = cpu->instruction_memory[i * 7];
+        if(is_branch(opcode) && branch_target(cpu, i) >= 0)
+            leader[branch_target(cpu, i)] = true;
+        if(is_branch(opcode) || opcode == fmt_ret)
+            leader[i + 1] = true;
+    }
+
+    map->count = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(leader[i])
+            map->count++;
+        int block = map->count - 1;
+        map->block_of[i] = block;
+        map->length[block]++;
+        map->last[block] = i;
+    }
+    free(leader);
+}
+
+/*
+ * Turns the taken branch counts of one interval into the instructions
+ * executed in every block. An interval starts at entry and stops at the
+ * target of a taken branch, exit, without executing it (exit is -1 after
+ * ret or the end of the program). Blocks are only entered at their first
+ * instruction, so the entries of a block are the branches taken to it plus
+ * the executions of the block before that did not leave it by a branch.
+ */
+static void interval_bbv(CPU* cpu, const BlockMap* map, const long long* taken, int entry, int exit, long long* bbv)
+{
+    memset(bbv, 0, map->count * sizeof(long long));
+
+    // Entries first, turned into instructions below
+    for(int i = 0; i < cpu->tot_instructions; i++)
+    {
+        int target = branch_target(cpu, i);
+        if(is_branch(cpu->instruction_memory[i * 7]) && target >= 0)
+            bbv[map->block_of[target]] += taken[i];
+    }
+    if(entry < cpu->tot_instructions)
+        bbv[map->block_of[entry]]++;
+    if(exit >= 0 && exit < cpu->tot_instructions)
+        bbv[map->block_of[exit]]--;
+
+    long long fall_through = 0;
+    for(int block = 0; block < map->count; block++)
+    {
+        long long executed = bbv[block] + fall_through;
+        int last = map->last[block];
+        int opcode = cpu->instruction_memory[last * 7];
+
+        if(opcode == fmt_ret)
+            fall_through = 0;
+        else if(is_branch(opcode))
+            fall_through = executed - taken[last];
+        else
+            fall_through = executed;
+        bbv[block] = executed * map->length[block];
+    }
+}
+
+static long long* profile_add(Profile* profile, int blocks, long long start, long long length)
+{
+    if(profile->intervals == profile->cap)
+    {
+        int cap = profile->cap ? profile->cap * 2 : 64;
+        long long* starts = (long long*)realloc(profile->start, cap * sizeof(long long));
+        long long* lengths = starts ? (long long*)realloc(profile->length, cap * sizeof(long long)) : NULL;
+        long long* bbv = lengths ? (long long*)realloc(profile->bbv, (size_t)cap * blocks * sizeof(long long)) : NULL;
+        if(starts)
+            profile->start = starts;
+        if(lengths)
+            profile->length = lengths;
+        if(!bbv)
+            return NULL;
+        profile->bbv = bbv;
+        profile->cap = cap;
+    }
+
+    int r = profile->intervals++;
+    profile->start[r] = start;
+    profile->length[r] = length;
+    return &profile->bbv[(size_t)r * blocks];
+}
+
+/*
+ * Runs the program functionally to the end, or to budget instructions,
+ * and records a basic block vector every interval instructions. The
+ * interpreter only stops on a taken branch, so intervals end at the first
+ * one after interval instructions.
+ */
+static enum interpStatus_enum profile_run(CPU* cpu, const BlockMap* map, long long interval, long long budget,
+    Profile* profile)
+{
+    enum interpStatus_enum status = interp_limit;
+    long long* taken = (long long*)calloc(cpu->tot_instructions + 1, sizeof(long long));
+    if(!taken)
+    {
+        printf("Error allocating the profile\n");
+        exit(1);
+    }
+
+    while(status == interp_limit && cpu->tot_instructions_done < budget)
+    {
+        long long start = cpu->tot_instructions_done;
+        int entry = cpu->pc / 7;
+
+        memset(taken, 0, (cpu->tot_instructions + 1) * sizeof(long long));
+        status = interp_run_profile(cpu, budget - start < interval ? budget - start : interval, taken);
+        if(cpu->tot_instructions_done == start)
+            break;
+
+        long long* bbv = profile_add(profile, map->count, start, cpu->tot_instructions_done - start);
+        if(!bbv)
+        {
+            printf("Error allocating the profile\n");
+            exit(1);
+        }
+        interval_bbv(cpu, map, taken, entry, status == interp_limit ? cpu->pc / 7 : -1, bbv);
+    }
+
+    free(taken);
+    return status;
+}
+
+/*
+ * Writes the profile in the text format of the SimPoint tools, one line
+ * per interval with the non-zero blocks numbered from 1.
+ */
+static void write_bbv(const char* filename, const Profile* profile, int blocks)
+{
+    FILE* file = fopen(filename, "w");
+    if(!file)
+    {
+        printf("Error opening basic block vector file %s\n", filename);
+        return;
+    }
+
+    for(int r = 0; r < profile->intervals; r++)
+    {
+        const long long* bbv = &profile->bbv[(size_t)r * blocks];
+        fputc('T', file);
+        for(int block = 0; block < blocks; block++)
+            if(bbv[block])
+                fprintf(file, ":%d:%lld ", block + 1, bbv[block]);
+        fputc('\n', file);
+    }
+    fclose(file);
+}
+
+// Small deterministic generator, runs are reproducible across hosts
+static double next_random(unsigned int* state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 8) / 16777216.0;
+}
+
+/*
+ * Normalises every vector to fractions of its interval and, with more
+ * than SIMPOINT_DIMS blocks, projects it onto SIMPOINT_DIMS random
+ * directions.
+ */
+static double* project(const Profile* profile, int blocks, int* dims)
+{
+    int d = blocks > SIMPOINT_DIMS ? SIMPOINT_DIMS : blocks;
+    double* points = (double*)calloc((size_t)profile->intervals * d + 1, sizeof(double));
+    double* matrix = NULL;
+    unsigned int seed = 1;
+
+    if(blocks > SIMPOINT_DIMS)
+    {
+        matrix = (double*)malloc((size_t)blocks * d * sizeof(double));
+        for(int i = 0; matrix && i < blocks * d; i++)
+            matrix[i] = 2.0 * next_random(&seed) - 1.0;
+    }
+    if(!points || (blocks > SIMPOINT_DIMS && !matrix))
+    {
+        printf("Error allocating the projection\n");
+        exit(1);
+    }
+
+    for(int r = 0; r < profile->intervals; r++)
+    {
+        double* point = &points[(size_t)r * d];
+        for(int block = 0; block < blocks; block++)
+        {
+            double share = (double)profile->bbv[(size_t)r * blocks + block] / profile->length[r];
+            if(share == 0.0)
+                continue;
+            if(matrix)
+                for(int j = 0; j < d; j++)
+                    point[j] += share * matrix[block * d + j];
+            else
+                point[block] = share;
+        }
+    }
+
+    free(matrix);
+    *dims = d;
+    return points;
+}
+
+static double distance(const double* a, const double* b, int dims)
+{
+    double sum = 0.0;
+    for(int j = 0; j < dims; j++)
+        sum += (a[j] - b[j]) * (a[j] - b[j]);
+    return sum;
+}
+
+/*
+ * Lloyd's k-means from k distinct intervals picked with seed, returns the
+ * sum of squared distances to the centres.
+ */
+static double kmeans(const double* points, int n, int dims, int k, unsigned int seed, int* assign, double* centres)
+{
+    int* order = (int*)malloc(n * sizeof(int));
+    int* sizes = (int*)malloc(k * sizeof(int));
+    if(!order || !sizes)
+    {
+        printf("Error allocating the clustering\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < n; i++)
+        order[i] = i;
+    for(int c = 0; c < k; c++)
+    {
+        int pick = c + (int)(next_random(&seed) * (n - c));
+        int tmp = order[c];
+        order[c] = order[pick];
+        order[pick] = tmp;
+        memcpy(&centres[c * dims], &points[(size_t)order[c] * dims], dims * sizeof(double));
+    }
+    for(int i = 0; i < n; i++)
+        assign[i] = -1;
+
+    for(int iteration = 0; iteration < SIMPOINT_ITERATIONS; iteration++)
+    {
+        bool changed = false;
+        for(int i = 0; i < n; i++)
+        {
+            int best = 0;
+            double best_distance = distance(&points[(size_t)i * dims], centres, dims);
+            for(int c = 1; c < k; c++)
+            {
+                double d = distance(&points[(size_t)i * dims], &centres[c * dims], dims);
+                if(d < best_distance)
+                {
+                    best_distance = d;
+                    best = c;
+                }
+            }
+            changed |= assign[i] != best;
+            assign[i] = best;
+        }
+        if(!changed)
+            break;
+
+        // An empty cluster keeps its centre
+        memset(sizes, 0, k * sizeof(int));
+        for(int i = 0; i < n; i++)
+            sizes[assign[i]]++;
+        for(int c = 0; c < k; c++)
+            if(sizes[c])
+                memset(&centres[c * dims], 0, dims * sizeof(double));
+        for(int i = 0; i < n; i++)
+            for(int j = 0; j < dims; j++)
+                centres[assign[i] * dims + j] += points[(size_t)i * dims + j];
+        for(int c = 0; c < k; c++)
+            for(int j = 0; sizes[c] && j < dims; j++)
+                centres[c * dims + j] /= sizes[c];
+    }
+
+    double sse = 0.0;
+    for(int i = 0; i < n; i++)
+        sse += distance(&points[(size_t)i * dims], &centres[assign[i] * dims], dims);
+
+    free(sizes);
+    free(order);
+    return sse;
+}
+
+/*
+ * Bayesian information criterion of a clustering, modelling every cluster
+ * as a spherical Gaussian with one shared variance (Pelleg and Moore).
+ */
+static double bic_score(const Clustering* clustering, int n, int dims, int k)
+{
+    int* sizes = (int*)calloc(k, sizeof(int));
+    if(!sizes)
+    {
+        printf("Error allocating the clustering\n");
+        exit(1);
+    }
+    for(int i = 0; i < n; i++)
+        sizes[clustering->assign[i]]++;
+
+    double variance = n > k ? clustering->sse / ((double)dims * (n - k)) : 0.0;
+    if(variance < 1e-12)
+        variance = 1e-12;
+
+    double likelihood = -0.5 * n * dims * log(2.0 * M_PI * variance) - 0.5 * dims * (n - k);
+    for(int c = 0; c < k; c++)
+        if(sizes[c])
+            likelihood += sizes[c] * log((double)sizes[c] / n);
+
+    double parameters = (k - 1) + (double)k * dims + 1;
+    free(sizes);
+    return likelihood - 0.5 * parameters * log((double)n);
+}
+
+/*
+ * Clusters the intervals for every k up to max_k and returns the smallest
+ * k whose BIC score reaches SIMPOINT_BIC_THRESHOLD of the range of scores,
+ * the rule of the SimPoint tools. Every clustering is kept in results.
+ */
+static int choose_clustering(const double* points, int n, int dims, int max_k, Clustering* results)
+{
+    double best = -HUGE_VAL;
+    double worst = HUGE_VAL;
+
+    for(int k = 1; k <= max_k; k++)
+    {
+        Clustering* result = &results[k - 1];
+        int* assign = (int*)malloc(n * sizeof(int));
+        double* centres = (double*)malloc((size_t)k * dims * sizeof(double));
+        result->assign = (int*)malloc(n * sizeof(int));
+        result->centres = (double*)malloc((size_t)k * dims * sizeof(double));
+        if(!assign || !centres || !result->assign || !result->centres)
+        {
+            printf("Error allocating the clustering\n");
+            exit(1);
+        }
+
+        result->sse = HUGE_VAL;
+        for(int s = 0; s < SIMPOINT_SEEDS; s++)
+        {
+            double sse = kmeans(points, n, dims, k, 1000u * k + s, assign, centres);
+            if(sse < result->sse)
+            {
+                result->sse = sse;
+                memcpy(result->assign, assign, n * sizeof(int));
+                memcpy(result->centres, centres, (size_t)k * dims * sizeof(double));
+            }
+        }
+        free(assign);
+        free(centres);
+
+        result->bic = bic_score(result, n, dims, k);
+        if(result->bic > best)
+            best = result->bic;
+        if(result->bic < worst)
+            worst = result->bic;
+    }
+
+    for(int k = 1; k <= max_k; k++)
+        if(results[k - 1].bic >= worst + SIMPOINT_BIC_THRESHOLD * (best - worst))
+            return k;
+    return max_k;
+}
+
+static int compare_interval(const void* a, const void* b)
+{
+    return ((const SimPoint*)a)->interval - ((const SimPoint*)b)->interval;
+}
+
+/*
+ * Picks the interval closest to the centre of every non-empty cluster and
+ * weights it by the instructions of its cluster. Returns the number of
+ * simulation points, sorted by interval.
+ */
+static int pick_simpoints(const Profile* profile, const double* points, int dims, int k,
+    const Clustering* clustering, long long total, SimPoint* simpoints)
+{
+    int count = 0;
+
+    for(int c = 0; c < k; c++)
+    {
+        SimPoint* sp = &simpoints[count];
+        long long instructions = 0;
+        double best = HUGE_VAL;
+
+        memset(sp, 0, sizeof(*sp));
+        for(int r = 0; r < profile->intervals; r++)
+        {
+            if(clustering->assign[r] != c)
+                continue;
+            double d = distance(&points[(size_t)r * dims], &clustering->centres[c * dims], dims);
+            if(d < best)
+            {
+                best = d;
+                sp->interval = r;
+            }
+            sp->members++;
+            instructions += profile->length[r];
+        }
+        if(sp->members == 0)
+            continue;
+        sp->weight = total ? (double)instructions / total : 0.0;
+        count++;
+    }
+
+    qsort(simpoints, count, sizeof(SimPoint), compare_interval);
+    return count;
+}
+
+/*
+ * SimPoint run. The program is executed functionally once to record a
+ * basic block vector per interval, written to config->bbv_file when
+ * given. The vectors are clustered with k-means and every cluster is
+ * represented by its interval nearest to the centre. With --simpoint those
+ * intervals are simulated in detail on their own host threads from
+ * functional checkpoints, like slices, and their cycles per instruction
+ * weighted by the size of their clusters give the estimate for the whole
+ * program.
+ */
+int simpoint_run(const char* filename, const SimConfig* config)
+{
+    struct timespec start, clustered, end;
+    long long budget = config->longrun ? LLONG_MAX : (long long)MAX_CPU_CYCLES * 1000;
+    long long interval = config->simpoint_interval > 0 ? config->simpoint_interval : 1;
+    long long warmup = config->slice_warmup > 0 ? config->slice_warmup : 0;
+
+    SimConfig detail_config = *config;
+    if(detail_config.bptrace_file[0] || detail_config.addrtrace_file[0] || detail_config.intervals_file[0]
+        || detail_config.whatif_features || detail_config.extrapolate)
+        printf("Traces and extrapolation need a single run, ignored\n");
+    detail_config.bptrace_file[0] = '\0';
+    detail_config.addrtrace_file[0] = '\0';
+    detail_config.intervals_file[0] = '\0';
+    detail_config.whatif_features = 0;
+    detail_config.bbv_file[0] = '\0';
+    detail_config.extrapolate = false;
+    detail_config.functional = false;
+    detail_config.simpoint = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The profiling run also provides the final architectural state
+    BlockMap map;
+    Profile profile;
+    memset(&profile, 0, sizeof(profile));
+    CPU* golden = CPU_init_config(filename, &detail_config);
+    if(!golden)
+    {
+        printf("Error creating the CPU\n");
+        exit(1);
+    }
+    find_blocks(golden, &map);
+    enum interpStatus_enum status = profile_run(golden, &map, interval, budget, &profile);
+    long long total = golden->tot_instructions_done;
+
+    if(config->bbv_file[0])
+        write_bbv(config->bbv_file, &profile, map.count);
+
+    int dims = 0;
+    int n = profile.intervals;
+    int max_k = config->simpoint_max_k < 1 ? 1 : config->simpoint_max_k;
+    if(max_k > n)
+        max_k = n;
+
+    double* points = project(&profile, map.count, &dims);
+    Clustering* clusterings = (Clustering*)calloc(max_k + 1, sizeof(Clustering));
+    SimPoint* simpoints = (SimPoint*)calloc(max_k + 1, sizeof(SimPoint));
+    if(!clusterings || !simpoints)
+    {
+        printf("Error allocating the clustering\n");
+        exit(1);
+    }
+    int k = n > 0 ? choose_clustering(points, n, dims, max_k, clusterings) : 0;
+    int count = k > 0 ? pick_simpoints(&profile, points, dims, k, &clusterings[k - 1], total, simpoints) : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &clustered);
+
+    if(config->simpoint && count > 0)
+    {
+        CPU* snapshot = CPU_init_config(filename, &detail_config);
+        if(!snapshot)
+        {
+            printf("Error creating the CPU\n");
+            exit(1);
+        }
+        for(int i = 0; i < count; i++)
+        {
+            Slice* slice = &simpoints[i].slice;
+            long long first = profile.start[simpoints[i].interval];
+            long long from = first > warmup ? first - warmup : 0;
+
+            if(from > snapshot->tot_instructions_done)
+                functional_run(snapshot, from - snapshot->tot_instructions_done);
+
+            // As with slices the warm-up starts wherever the functional run stopped
+            from = snapshot->tot_instructions_done;
+            if(first < from)
+                first = from;
+            slice->start = first;
+            slice->warmup = first - from;
+            slice->length = profile.length[simpoints[i].interval];
+            slice->cpu = slice_checkpoint(filename, &detail_config, snapshot);
+        }
+        CPU_stop(snapshot);
+
+        for(int i = 0; i < count; i++)
+        {
+            if(pthread_create(&simpoints[i].slice.thread, NULL, slice_simulate, &simpoints[i].slice) != 0)
+            {
+                printf("Error starting the thread of simulation point %d\n", i);
+                exit(1);
+            }
+        }
+        for(int i = 0; i < count; i++)
+            pthread_join(simpoints[i].slice.thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double cpi = 0.0;
+    long long detailed = 0;
+    bool complete = true;
+    for(int i = 0; i < count; i++)
+    {
+        Slice* slice = &simpoints[i].slice;
+        if(slice->length)
+            cpi += simpoints[i].weight * slice->cycles / slice->length;
+        detailed += slice->warmup + slice->length;
+        complete &= slice->complete;
+    }
+
+    printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
+    printf("\n");
+
+    print_registers(golden);
+
+    if(DEBUG_STATS)
+    {
+        printf("Functional run stopped: %s\n", interp_status_name(status));
+        printf("Basic blocks: %d, intervals: %d of %lld instructions, clusters: %d of at most %d\n",
+            map.count, n, interval, k, max_k);
+        for(int i = 0; i < count; i++)
+        {
+            SimPoint* sp = &simpoints[i];
+            Slice* slice = &sp->slice;
+            long long first = profile.start[sp->interval];
+
+            printf("SimPoint %d: interval %d, instructions %lld-%lld, %d intervals, weight %f", i, sp->interval,
+                first, first + profile.length[sp->interval], sp->members, sp->weight);
+            if(config->simpoint)
+                printf(", warm-up %lld, cycles %lld, IPC %f%s", slice->warmup, slice->cycles,
+                    slice->cycles ? (double)slice->length / slice->cycles : 0.0,
+                    slice->complete ? "" : " (incomplete)");
+            printf("\n");
+        }
+        printf("Total instruction simulated: %lld\n", total);
+        if(config->simpoint)
+        {
+            if(!complete)
+                printf("Some simulation points stopped early, the estimate is too low\n");
+            printf("Weighted IPC: %f\n", cpi > 0 ? 1.0 / cpi : 0.0);
+            printf("Estimated execution cycles: %lld\n", (long long)(cpi * total + 0.5));
+            printf("Detailed instructions: %lld (%f%% of the program)\n", detailed,
+                total ? 100.0 * detailed / total : 0.0);
+        }
+        printf("Host time: %f s profiling and clustering, %f s detailed\n",
+            elapsed(&start, &clustered), elapsed(&clustered, &end));
+    }
+
+    output_memory_map_file(golden);
+
+    for(int i = 0; i < count; i++)
+        if(simpoints[i].slice.cpu)
+            CPU_stop(simpoints[i].slice.cpu);
+    for(int c = 0; c < max_k; c++)
+    {
+        free(clusterings[c].assign);
+        free(clusterings[c].centres);
+    }
+    free(clusterings);
+    free(simpoints);
+    free(points);
+    free(profile.start);
+    free(profile.length);
+    free(profile.bbv);
+    free(map.block_of);
+    free(map.length);
+    free(map.last);
+    CPU_stop(golden);
+
+    return complete ? 0 : -1;
+}
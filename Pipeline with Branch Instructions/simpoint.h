@@ -0,0 +1,25 @@
+#ifndef _SIMPOINT_H_
+#define _SIMPOINT_H_
+#include "slice.h"
+
+#define SIMPOINT_DIMS 15          // basic block vectors are projected to this many dimensions
+#define SIMPOINT_SEEDS 5          // k-means runs per k, the best one is kept
+#define SIMPOINT_ITERATIONS 100   // most k-means iterations of a run
+#define SIMPOINT_BIC_THRESHOLD 0.9   // smallest k reaching this share of the best BIC score
+
+struct SimConfig;
+
+/*
+ * Representative of one cluster of intervals, simulated in detail as a
+ * slice measuring exactly that interval.
+ */
+typedef struct SimPoint {
+    int interval;             // index of the interval closest to the cluster centre
+    int members;              // intervals in the cluster
+    double weight;            // share of all instructions executed in the cluster
+    Slice slice;
+} SimPoint;
+
+int simpoint_run(const char* filename, const struct SimConfig* config);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _SIMPROTO_H_
+#define _SIMPROTO_H_
+#include <stdint.h>
+#include "pipesim.h"
+
+/*
+ * Wire format of the simulation daemon (tools/pipesimd.c). Both ends run
+ * on the same host over a Unix socket, so the structs are sent as they are
+ * in native byte order. A client writes any number of jobs and reads one
+ * result per job; results come back in completion order, tagged with the
+ * job_id the client chose.
+ *
+ * Job:    SimJobHeader, program text, memory_words int32 words, options
+ * Result: SimResultHeader, memory_words int32 words
+ *
+ * The options are the command line --key=value settings separated by
+ * newlines.
+ */
+#define SIMPROTO_JOB_MAGIC 0x314a5350      // "PSJ1"
+#define SIMPROTO_RESULT_MAGIC 0x31525350   // "PSR1"
+
+#define SIMPROTO_MAX_PROGRAM (1 << 20)     // bytes
+#define SIMPROTO_MAX_MEMORY (1 << 24)      // words
+#define SIMPROTO_MAX_OPTIONS 4096          // bytes
+
+#define SIMPROTO_WANT_MEMORY 0x1           // send the final memory back
+
+enum simprotoStatus_enum {
+    simproto_halted,          // ret was written back
+    simproto_cycle_limit,     // max_cycles passed first
+    simproto_bad_config,      // an option was not recognised
+    simproto_no_memory,       // the daemon could not allocate the job
+    simproto_bad_request,     // malformed job, the connection is closed
+    simproto_bad_program,     // a line of the program is malformed
+    simproto_bad_address      // a load or store went outside memory, the
+                              // result holds the state at that point
+};
+
+typedef struct SimJobHeader {
+    uint32_t magic;
+    uint32_t job_id;
+    uint32_t program_len;
+    uint32_t memory_words;
+    uint32_t option_len;
+    uint32_t flags;
+    uint64_t max_cycles;      // 0 for MAX_CPU_CYCLES
+} SimJobHeader;
+
+typedef struct SimResultHeader {
+    uint32_t magic;
+    uint32_t job_id;
+    int32_t status;
+    uint32_t memory_words;
+    int32_t regs[NUM_REGS];
+    PipeSimCounters counters;
+} SimResultHeader;
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <limits.h>
+#include "cpu.h"
+#include "slice.h"
+
+// Clock samples taken by a slice, in the order they are reached
+enum sliceMark_enum {
+    mark_tail_in,     // start of the warm-up tail
+    mark_start,       // start of the measured part
+    mark_tail_out,    // start of the measured tail
+    mark_end,
+    mark_cnt
+};
+
+static enum interpStatus_enum functional_run(CPU* cpu, long long max_instructions)
+{
+    return cpu->config.jit ? jit_run(cpu, max_instructions) : interp_run(cpu, max_instructions);
+}
+
+static double elapsed(struct timespec* start, struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Simulates one slice in detail. The clock of a mark is the cycle in which
+ * the retired instruction count reached it.
+ */
+void* slice_simulate(void* arg)
+{
+    Slice* slice = (Slice*)arg;
+    CPU* cpu = slice->cpu;
+    long long marks[mark_cnt];
+    long long clocks[mark_cnt];
+    long long stalls = 0;
+    long long flushes = 0;
+    long long retired = 0;
+    long long progress = cpu->clock;
+    int reached = 0;
+
+    marks[mark_tail_in] = slice->warmup - slice->overlap_in;
+    marks[mark_start] = slice->warmup;
+    marks[mark_tail_out] = slice->warmup + slice->length - slice->overlap_out;
+    marks[mark_end] = slice->warmup + slice->length;
+
+    while(reached < mark_cnt && marks[reached] <= 0)
+        clocks[reached++] = 0;
+
+    while(reached < mark_cnt)
+    {
+        bool done = CPU_cycle(cpu);
+
+        while(reached < mark_cnt && (done || cpu->tot_instructions_done >= marks[reached]))
+        {
+            if(reached == mark_start)
+            {
+                stalls = cpu->cpu_stalled_cnt;
+                flushes = cpu->branch_flush_cnt;
+            }
+            clocks[reached++] = cpu->clock;
+        }
+        if(done)
+            break;
+
+        // A pipeline that stopped retiring will not reach the end
+        if(cpu->tot_instructions_done != retired)
+        {
+            retired = cpu->tot_instructions_done;
+            progress = cpu->clock;
+        }
+        else if(cpu->clock - progress > SLICE_STALL_LIMIT)
+            break;
+
+        cpu->clock++;
+    }
+
+    slice->complete = reached == mark_cnt && cpu->tot_instructions_done >= marks[mark_end];
+    while(reached < mark_cnt)
+        clocks[reached++] = cpu->clock;
+
+    slice->cycles = clocks[mark_end] - clocks[mark_start];
+    slice->tail_in_cycles = clocks[mark_start] - clocks[mark_tail_in];
+    slice->tail_out_cycles = clocks[mark_end] - clocks[mark_tail_out];
+    slice->stalls = cpu->cpu_stalled_cnt - stalls;
+    slice->flushes = cpu->branch_flush_cnt - flushes;
+    return NULL;
+}
+
+/*
+ * Creates a CPU with a cold pipeline in the architectural state of
+ * snapshot, a CPU run functionally from the same program.
+ */
+CPU* slice_checkpoint(const char* filename, const SimConfig* config, const CPU* snapshot)
+{
+    CPU* cpu = CPU_init_config(filename, config);
+    if(!cpu)
+    {
+        printf("Error creating the CPU\n");
+        exit(1);
+    }
+    cpu->pc = snapshot->pc;
+    for(int r = 0; r < NUM_REGS; r++)
+        cpu->regs[r].value = snapshot->regs[r].value;
+    memcpy(cpu->memory, snapshot->memory, snapshot->memoryLen * sizeof(int));
+    return cpu;
+}
+
+/*
+ * Error estimate of slice k. Its warm-up tail and the measured tail of
+ * slice k-1 are the same instructions; a difference in their cycles per
+ * instruction means the cold start has not settled (or settled into a
+ * different steady state) and is assumed to hold for the whole slice.
+ */
+static long long boundary_error(Slice* slices, int k)
+{
+    if(k == 0 || slices[k].overlap_in == 0)
+        return 0;
+    long long diff = llabs(slices[k - 1].tail_out_cycles - slices[k].tail_in_cycles);
+    return (diff * slices[k].length + slices[k].overlap_in - 1) / slices[k].overlap_in;
+}
+
+/*
+ * Parallel-in-time run. The program is first executed functionally to
+ * find its length, then again to take an architectural snapshot where
+ * every slice starts its warm-up. The slices are simulated in detail on
+ * their own host threads and their cycles added up, with the boundary
+ * errors summed into an error estimate. Unlike CPU_run the length is only
+ * limited by the functional instruction budget.
+ */
+int slice_run(const char* filename, const SimConfig* config)
+{
+    struct timespec start, snapshots, end;
+    long long budget = config->longrun ? LLONG_MAX : (long long)MAX_CPU_CYCLES * 1000;
+
+    SimConfig slice_config = *config;
+    if(slice_config.bptrace_file[0] || slice_config.addrtrace_file[0] || slice_config.intervals_file[0]
+        || slice_config.whatif_features || slice_config.extrapolate)
+        printf("Traces and extrapolation need a single run, ignored\n");
+    slice_config.bptrace_file[0] = '\0';
+    slice_config.addrtrace_file[0] = '\0';
+    slice_config.intervals_file[0] = '\0';
+    slice_config.whatif_features = 0;
+    slice_config.extrapolate = false;
+    slice_config.functional = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The reference run also provides the final architectural state
+    CPU* golden = CPU_init_config(filename, &slice_config);
+    if(!golden)
+    {
+        printf("Error creating the CPU\n");
+        exit(1);
+    }
+    enum interpStatus_enum status = functional_run(golden, budget);
+    long long total = golden->tot_instructions_done;
+
+    int count = config->slices < 1 ? 1 : config->slices > MAX_SLICES ? MAX_SLICES : config->slices;
+    if(count > total)
+        count = total > 0 ? (int)total : 1;
+    long long warmup = config->slice_warmup > 0 ? config->slice_warmup : 0;
+
+    Slice* slices = (Slice*)calloc(count, sizeof(Slice));
+    CPU* snapshot = CPU_init_config(filename, &slice_config);
+    if(!slices || !snapshot)
+    {
+        printf("Error allocating slices\n");
+        exit(1);
+    }
+
+    for(int k = 0; k < count; k++)
+    {
+        Slice* slice = &slices[k];
+        long long first = total * k / count;
+        long long from = k == 0 ? 0 : first > warmup ? first - warmup : 0;
+
+        if(from > snapshot->tot_instructions_done)
+            functional_run(snapshot, from - snapshot->tot_instructions_done);
+
+        // The budget is only checked on taken branches and can overshoot,
+        // the warm-up starts wherever the functional run stopped
+        from = snapshot->tot_instructions_done;
+        if(first < from)
+            first = from;
+        slice->start = first;
+        slice->warmup = first - from;
+
+        slice->cpu = slice_checkpoint(filename, &slice_config, snapshot);
+    }
+    CPU_stop(snapshot);
+
+    for(int k = 0; k < count; k++)
+    {
+        long long next = k + 1 < count ? slices[k + 1].start : total;
+        slices[k].length = next > slices[k].start ? next - slices[k].start : 0;
+    }
+    for(int k = 1; k < count; k++)
+    {
+        long long overlap = slices[k].warmup / 2;
+        if(overlap > slices[k - 1].length)
+            overlap = slices[k - 1].length;
+        slices[k].overlap_in = overlap;
+        slices[k - 1].overlap_out = overlap;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &snapshots);
+    for(int k = 0; k < count; k++)
+    {
+        if(pthread_create(&slices[k].thread, NULL, slice_simulate, &slices[k]) != 0)
+        {
+            printf("Error starting the thread of slice %d\n", k);
+            exit(1);
+        }
+    }
+    for(int k = 0; k < count; k++)
+        pthread_join(slices[k].thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long long cycles = 0;
+    long long error = 0;
+    long long stalls = 0;
+    long long flushes = 0;
+    bool complete = true;
+    for(int k = 0; k < count; k++)
+    {
+        cycles += slices[k].cycles;
+        stalls += slices[k].stalls;
+        flushes += slices[k].flushes;
+        complete &= slices[k].complete;
+        error += boundary_error(slices, k);
+    }
+
+    printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
+    printf("\n");
+
+    print_registers(golden);
+
+    if(DEBUG_STATS)
+    {
+        printf("Functional run stopped: %s\n", interp_status_name(status));
+        for(int k = 0; k < count; k++)
+        {
+            Slice* slice = &slices[k];
+            printf("Slice %d: instructions %lld-%lld, warm-up %lld, cycles %lld, IPC %f, boundary error %lld%s\n",
+                k, slice->start, slice->start + slice->length, slice->warmup, slice->cycles,
+                slice->cycles ? (double)slice->length / slice->cycles : 0.0,
+                boundary_error(slices, k),
+                slice->complete ? "" : " (incomplete)");
+        }
+        if(!complete)
+            printf("Some slices stopped early, the totals are too low\n");
+        printf("Stalled cycles due to data hazard: %lld \n", stalls);
+        printf("Total execution cycles: %lld\n", cycles);
+        printf("Total instruction simulated: %lld\n", total);
+        printf("IPC: %f\n", cycles ? (double)total / cycles : 0.0);
+        printf("Pipeline flushes due to branches: %lld\n", flushes);
+        printf("Estimated error: +/- %lld cycles (%f%%)\n", error,
+            cycles ? 100.0 * error / cycles : 0.0);
+        printf("Slices: %d, warm-up %lld instructions, host time: %f s functional, %f s detailed\n",
+            count, warmup, elapsed(&start, &snapshots), elapsed(&snapshots, &end));
+    }
+
+    output_memory_map_file(golden);
+
+    for(int k = 0; k < count; k++)
+        CPU_stop(slices[k].cpu);
+    free(slices);
+    CPU_stop(golden);
+
+    return complete ? 0 : -1;
+}
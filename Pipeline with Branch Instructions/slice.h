@@ -0,0 +1,40 @@
+#ifndef _SLICE_H_
+#define _SLICE_H_
+#include <stdbool.h>
+#include <pthread.h>
+
+#define MAX_SLICES 256
+#define SLICE_STALL_LIMIT 100000   // cycles without a retired instruction before a slice gives up
+
+struct CPU;
+struct SimConfig;
+
+/*
+ * One contiguous part of the run, simulated in detail from an architectural
+ * snapshot. The first warmup instructions only warm up the pipeline,
+ * predictor and caches; the next length instructions are measured. The
+ * clock is also sampled over the warm-up tail and the measured tail, which
+ * cover the same instructions as the neighbouring slices.
+ */
+typedef struct Slice {
+    struct CPU *cpu;
+    long long start;          // instructions retired before the measured part
+    long long warmup;
+    long long length;
+    long long overlap_in;     // warm-up tail compared with the previous slice
+    long long overlap_out;    // measured tail compared with the next slice
+
+    long long cycles;         // cycles of the measured part
+    long long tail_in_cycles;
+    long long tail_out_cycles;
+    long long stalls;         // data hazard stalls in the measured part
+    long long flushes;        // branch flushes in the measured part
+    bool complete;            // reached its last instruction
+    pthread_t thread;
+} Slice;
+
+int slice_run(const char* filename, const struct SimConfig* config);
+struct CPU* slice_checkpoint(const char* filename, const struct SimConfig* config, const struct CPU* snapshot);
+void* slice_simulate(void* arg);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "storebuf.h"
+
+/*
+ * This function creates a store buffer of the given number of entries,
+ * none means stores write memory directly and NULL is returned.
+ */
+StoreBuffer* storebuf_create(Arena* arena, int entries)
+{
+    if(entries <= 0)
+        return NULL;
+
+    StoreBuffer* storebuf = (StoreBuffer*)arena_alloc(arena, sizeof(StoreBuffer));
+    if (!storebuf) {
+        return NULL;
+    }
+    memset(storebuf, 0, sizeof(StoreBuffer));
+    storebuf->arena = arena;
+    storebuf->entries = (StoreEntry*)arena_alloc(arena, (entries + 1) * sizeof(StoreEntry));
+    if (!storebuf->entries) {
+        arena_release(arena, storebuf);
+        return NULL;
+    }
+    storebuf->capacity = entries;
+    storebuf->drain_done = -1;
+    return storebuf;
+}
+
+void storebuf_free(StoreBuffer* storebuf)
+{
+    if(storebuf)
+    {
+        arena_release(storebuf->arena, storebuf->entries);
+        arena_release(storebuf->arena, storebuf);
+    }
+}
+
+static StoreEntry* entry_at(StoreBuffer* storebuf, int i)
+{
+    return &storebuf->entries[(storebuf->head + i) % (storebuf->capacity + 1)];
+}
+
+/*
+ * Cycles a store arriving now waits for a free entry, 0 when there is one.
+ * The oldest store has always started draining, so a full buffer frees an
+ * entry when its write completes.
+ */
+int storebuf_wait(StoreBuffer* storebuf, long long clock)
+{
+    if(storebuf->count < storebuf->capacity)
+        return 0;
+
+    int wait = storebuf->drain_done > clock ? (int)(storebuf->drain_done - clock) : 1;
+    storebuf->full_stalls++;
+    storebuf->full_cycles += wait;
+    return wait;
+}
+
+void storebuf_insert(StoreBuffer* storebuf, unsigned int addr, int value, int pc)
+{
+    StoreEntry* entry = entry_at(storebuf, storebuf->count);
+    entry->addr = addr;
+    entry->value = value;
+    entry->pc = pc;
+    storebuf->count++;
+    storebuf->stores++;
+    if(storebuf->count > storebuf->max_count && storebuf->count <= storebuf->capacity)
+        storebuf->max_count = storebuf->count;
+}
+
+/*
+ * Store-to-load forwarding: value of the youngest buffered store to the
+ * word of addr. Returns false when no buffered store matches.
+ */
+bool storebuf_forward(StoreBuffer* storebuf, unsigned int addr, int* value)
+{
+    for(int i = storebuf->count - 1; i >= 0; i--)
+    {
+        StoreEntry* entry = entry_at(storebuf, i);
+        if(entry->addr / 4 == addr / 4)
+        {
+            *value = entry->value;
+            storebuf->forwards++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Store to drain next, NULL when the buffer is empty
+StoreEntry* storebuf_oldest(StoreBuffer* storebuf)
+{
+    return storebuf->count ? entry_at(storebuf, 0) : NULL;
+}
+
+// The oldest store has been written, it reaches memory and leaves
+void storebuf_retire(StoreBuffer* storebuf, int* memory)
+{
+    StoreEntry* entry = entry_at(storebuf, 0);
+    memory[entry->addr / 4] = entry->value;
+    storebuf->head = (storebuf->head + 1) % (storebuf->capacity + 1);
+    storebuf->count--;
+    storebuf->drain_done = -1;
+}
+
+/*
+ * Writes every buffered store to memory at once, when the program ends
+ * and the memory image has to be complete.
+ */
+void storebuf_flush(StoreBuffer* storebuf, int* memory)
+{
+    storebuf->flushed += storebuf->count;
+    while(storebuf->count)
+        storebuf_retire(storebuf, memory);
+}
+
+void storebuf_print_stats(StoreBuffer* storebuf)
+{
+    printf("Store buffer: %d entries, %lld stores, at most %d buffered\n", storebuf->capacity,
+        storebuf->stores, storebuf->max_count);
+    printf("Store-to-load forwarding: %lld loads\n", storebuf->forwards);
+    printf("Store buffer full: %lld stores, %lld stall cycles\n", storebuf->full_stalls, storebuf->full_cycles);
+    if(storebuf->flushed)
+        printf("Stores drained at the end of the program: %lld\n", storebuf->flushed);
+}
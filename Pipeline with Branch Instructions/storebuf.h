@@ -0,0 +1,45 @@
+#ifndef _STOREBUF_H_
+#define _STOREBUF_H_
+#include <stdbool.h>
+#include "arena.h"
+
+// One store waiting to be written to memory
+typedef struct StoreEntry {
+    unsigned int addr;        // byte address
+    int value;
+    int pc;                   // of the store, for the prefetcher
+} StoreEntry;
+
+/*
+ * Store buffer between Mem1 and the data cache. Stores enter in program
+ * order and drain from the oldest, one at a time, while the pipeline goes
+ * on; loads read the youngest buffered store to the same word.
+ */
+typedef struct StoreBuffer {
+    int capacity;
+    int count;
+    int head;                 // oldest entry
+    StoreEntry *entries;      // capacity + 1, a store waiting for a slot is held in the extra one
+    long long drain_done;     // cycle the write of the oldest store completes, -1 when none started
+
+    long long stores;
+    long long forwards;       // loads served from the buffer
+    long long full_stalls;    // stores that found the buffer full
+    long long full_cycles;    // cycles the pipeline waited for a free entry
+    long long flushed;        // stores still buffered when the program ended
+    int max_count;
+    Arena *arena;
+} StoreBuffer;
+
+StoreBuffer* storebuf_create(Arena* arena, int entries);
+void storebuf_free(StoreBuffer* storebuf);
+
+int storebuf_wait(StoreBuffer* storebuf, long long clock);
+void storebuf_insert(StoreBuffer* storebuf, unsigned int addr, int value, int pc);
+bool storebuf_forward(StoreBuffer* storebuf, unsigned int addr, int* value);
+StoreEntry* storebuf_oldest(StoreBuffer* storebuf);
+void storebuf_retire(StoreBuffer* storebuf, int* memory);
+void storebuf_flush(StoreBuffer* storebuf, int* memory);
+void storebuf_print_stats(StoreBuffer* storebuf);
+
+#endif
@@ -0,0 +1,246 @@
+//
+//  bpreplay.c
+//  Pipeline
+//
+//  Replays a branch trace recorded with --bptrace=FILE through many branch
+//  predictor configurations at once, spread over host threads. The trace
+//  is streamed in chunks every thread replays before the next is read, so
+//  memory use does not grow with its length.
+//
+//  Build: gcc -O2 -pthread -o bpreplay tools/bpreplay.c bptrace.c bpred.c arena.c
+//  Usage: bpreplay trace.bpt [-j threads] [name:bits ...]
+//         without configurations every predictor is swept over 4..14 bits
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../bpred.h"
+#include "../bptrace.h"
+
+#define MAX_CONFIGS 256
+#define REPLAY_CHUNK 65536    // records read at a time
+
+typedef struct ReplayConfig {
+    enum bpredType_enum type;
+    int table_bits;
+    BranchPredictor *bp;      // NULL when it could not be created
+    long long predictions;
+    long long mispredictions;
+    int actual_bits;
+} ReplayConfig;
+
+typedef struct ReplayJob {
+    const BPTraceRecord *records;
+    int count;                // records in the current chunk, 0 at the end
+    long long chunk;          // number of the current chunk
+    int busy;                 // threads still replaying it
+    ReplayConfig *configs;
+    int config_cnt;
+    int threads;
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_ready;
+    pthread_cond_t chunk_done;
+} ReplayJob;
+
+typedef struct ReplayWorker {
+    ReplayJob *job;
+    int index;                // replays configs index, index + threads, ...
+} ReplayWorker;
+
+/*
+ * Runs one predictor over a chunk of the trace. The history is updated
+ * with the real outcome after every branch, i.e. a pipeline that repairs
+ * its speculative history on every flush.
+ */
+void replay_chunk(const BPTraceRecord* records, int count, ReplayConfig* config)
+{
+    BranchPredictor* bp = config->bp;
+    if(!bp)
+        return;
+
+    for(int i = 0; i < count; i++)
+    {
+        unsigned long long history = bp->history;
+        bool predicted = bpred_predict(bp, records[i].pc);
+        bpred_update(bp, records[i].pc, history, predicted, records[i].taken);
+        bpred_speculate(bp, records[i].taken);
+    }
+}
+
+void* replay_worker(void* arg)
+{
+    ReplayWorker* worker = arg;
+    ReplayJob* job = worker->job;
+    long long seen = 0;
+
+    while(1)
+    {
+        pthread_mutex_lock(&job->lock);
+        while(job->chunk == seen)
+            pthread_cond_wait(&job->chunk_ready, &job->lock);
+        seen = job->chunk;
+        int count = job->count;
+        pthread_mutex_unlock(&job->lock);
+
+        if(count == 0)
+            break;
+        for(int c = worker->index; c < job->config_cnt; c += job->threads)
+            replay_chunk(job->records, count, &job->configs[c]);
+
+        pthread_mutex_lock(&job->lock);
+        if(--job->busy == 0)
+            pthread_cond_signal(&job->chunk_done);
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Hands the next count records to every thread and waits until all of
+ * them replayed it. A count of 0 lets the threads finish.
+ */
+void replay_next(ReplayJob* job, const BPTraceRecord* records, int count)
+{
+    pthread_mutex_lock(&job->lock);
+    job->records = records;
+    job->count = count;
+    job->busy = job->threads;
+    job->chunk++;
+    pthread_cond_broadcast(&job->chunk_ready);
+    while(count > 0 && job->busy > 0)
+        pthread_cond_wait(&job->chunk_done, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+}
+
+bool parse_config(const char* arg, ReplayConfig* config)
+{
+    char name[32];
+    const char* colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+
+    if(len >= sizeof(name))
+        return false;
+    memcpy(name, arg, len);
+    name[len] = '\0';
+
+    memset(config, 0, sizeof(*config));
+    config->table_bits = colon ? atoi(colon + 1) : 0;
+    if(config->table_bits > BPRED_MAX_TABLE_BITS)
+        return false;
+    return bpred_parse_type(name, &config->type);
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc<=1) {
+        fprintf(stderr, "Error : missing required args\n");
+        return -1;
+    }
+
+    static ReplayConfig configs[MAX_CONFIGS];
+    int config_cnt = 0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i=2; i<argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if (config_cnt < MAX_CONFIGS && parse_config(argv[i], &configs[config_cnt])) {
+            config_cnt++;
+        }
+        else {
+            fprintf(stderr, "Error : invalid predictor %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    // Default sweep over every predictor and table size
+    if (config_cnt == 0) {
+        for (int type=bpred_bimodal; type<=bpred_tage; type++) {
+            for (int bits=4; bits<=14; bits+=2) {
+                configs[config_cnt].type = (enum bpredType_enum)type;
+                configs[config_cnt].table_bits = bits;
+                config_cnt++;
+            }
+        }
+    }
+
+    BPTraceHeader header;
+    BPTraceReader* reader = bptrace_reader_open(argv[1], &header);
+    if (!reader) {
+        return -1;
+    }
+    BPTraceRecord* records = malloc(REPLAY_CHUNK * sizeof(BPTraceRecord));
+    if (!records) {
+        bptrace_reader_close(reader);
+        return -1;
+    }
+
+    for (int i=0; i<config_cnt; i++)
+        configs[i].bp = bpred_create(NULL, configs[i].type, configs[i].table_bits);
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > config_cnt)
+        threads = config_cnt;
+
+    ReplayJob job;
+    memset(&job, 0, sizeof(job));
+    job.configs = configs;
+    job.config_cnt = config_cnt;
+    job.threads = threads;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.chunk_ready, NULL);
+    pthread_cond_init(&job.chunk_done, NULL);
+
+    pthread_t* workers = malloc(threads * sizeof(pthread_t));
+    ReplayWorker* slots = malloc(threads * sizeof(ReplayWorker));
+    for (int i=0; i<threads; i++) {
+        slots[i].job = &job;
+        slots[i].index = i;
+        pthread_create(&workers[i], NULL, replay_worker, &slots[i]);
+    }
+
+    int count;
+    long long branches = 0;
+    do {
+        count = bptrace_read(reader, records, REPLAY_CHUNK);
+        branches += count;
+        replay_next(&job, records, count);
+    } while (count > 0);
+    for (int i=0; i<threads; i++)
+        pthread_join(workers[i], NULL);
+    bptrace_reader_close(reader);
+    header.branches = branches;
+
+    for (int i=0; i<config_cnt; i++) {
+        BranchPredictor* bp = configs[i].bp;
+        if (!bp)
+            continue;
+        configs[i].predictions = bp->predictions;
+        configs[i].mispredictions = bp->mispredictions;
+        configs[i].actual_bits = bp->table_bits;
+        bpred_free(bp);
+    }
+
+    printf("Trace: %lld branches, %lld instructions, %d configurations on %d threads\n",
+        header.branches, header.instructions, config_cnt, threads);
+    printf("%-12s %8s %14s %14s %10s %10s\n", "predictor", "entries", "predictions", "mispredicted", "accuracy", "MPKI");
+    for (int i=0; i<config_cnt; i++) {
+        ReplayConfig* config = &configs[i];
+        printf("%-12s %8d %14lld %14lld %10f %10f\n", bpred_name(config->type), 1 << config->actual_bits,
+            config->predictions, config->mispredictions,
+            config->predictions ? 1.0 - (double)config->mispredictions / config->predictions : 0.0,
+            header.instructions ? (double)config->mispredictions * 1000.0 / header.instructions : 0.0);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.chunk_ready);
+    pthread_cond_destroy(&job.chunk_done);
+    free(workers);
+    free(slots);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,439 @@
+//
+//  pipesimd.c
+//  Pipeline
+//
+//  Long-lived simulation daemon. Jobs (program, memory image, options) are
+//  read from clients on a Unix socket in the format of simproto.h and run
+//  on a pool of worker threads. Every worker owns one simulator created at
+//  start up and reloads it for each job, so the CPU, register file, memory
+//  and decoded program are reused rather than allocated per job. Results
+//  are written back as soon as a job finishes, in any order.
+//
+//  Build: gcc -O2 -pthread -o pipesimd tools/pipesimd.c pipesim.c cpu.c bpred.c btb.c
+//         cache.c prefetch.c coherence.c loop.c interp.c jit.c bptrace.c addrtrace.c arena.c
+//         intervals.c whatif.c bypass.c storebuf.c mshr.c dram.c batch.c
+//  Usage: pipesimd [-s socket] [-j workers]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../pipesim.h"
+#include "../simproto.h"
+
+#define DEFAULT_SOCKET "/tmp/pipesimd.sock"
+#define QUEUE_LIMIT 256       // queued jobs before the readers block
+
+// Largest structures a job may ask for, every worker's simulator lives in this process
+#define JOB_MAX_CACHE_SIZE (4 << 20)   // bytes per cache level
+#define JOB_MAX_BPRED_BITS 20
+#define JOB_MAX_BTB_ENTRIES 65536
+#define JOB_MAX_ENTRIES 1024           // MSHRs, store buffer entries, DRAM banks
+#define JOB_MAX_DEGREE 64              // prefetch degree and fetch width
+
+typedef struct Connection {
+    int fd;
+    int refs;                 // reader thread plus queued and running jobs
+    pthread_mutex_t lock;     // refs and writes of results
+} Connection;
+
+typedef struct Job {
+    Connection *conn;
+    SimJobHeader header;
+    char *program;
+    int *memory;
+    char *options;
+    struct Job *next;
+} Job;
+
+typedef struct JobQueue {
+    Job *head;
+    Job *tail;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} JobQueue;
+
+static JobQueue queue = {
+    NULL, NULL, 0,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+static char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static bool read_full(int fd, void* buf, size_t len)
+{
+    char* p = buf;
+    while(len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+    while(len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void connection_unref(Connection* conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    bool last = --conn->refs == 0;
+    pthread_mutex_unlock(&conn->lock);
+
+    if(last)
+    {
+        close(conn->fd);
+        pthread_mutex_destroy(&conn->lock);
+        free(conn);
+    }
+}
+
+static void job_free(Job* job)
+{
+    free(job->program);
+    free(job->memory);
+    free(job->options);
+    free(job);
+}
+
+/*
+ * Sends a result and the memory after it as one message; workers finishing
+ * jobs of the same client take turns. A client that went away is only
+ * noticed by its reader thread.
+ */
+static void send_result(Connection* conn, SimResultHeader* result, const int* memory)
+{
+    pthread_mutex_lock(&conn->lock);
+    if(write_full(conn->fd, result, sizeof(*result)) && result->memory_words)
+        write_full(conn->fd, memory, result->memory_words * sizeof(int));
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static void send_status(Connection* conn, uint32_t job_id, enum simprotoStatus_enum status)
+{
+    SimResultHeader result;
+
+    memset(&result, 0, sizeof(result));
+    result.magic = SIMPROTO_RESULT_MAGIC;
+    result.job_id = job_id;
+    result.status = status;
+    send_result(conn, &result, NULL);
+}
+
+static void queue_push(Job* job)
+{
+    pthread_mutex_lock(&queue.lock);
+    while(queue.count >= QUEUE_LIMIT)
+        pthread_cond_wait(&queue.not_full, &queue.lock);
+    if(queue.tail)
+        queue.tail->next = job;
+    else
+        queue.head = job;
+    queue.tail = job;
+    queue.count++;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+static Job* queue_pop(void)
+{
+    pthread_mutex_lock(&queue.lock);
+    while(!queue.head)
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    Job* job = queue.head;
+    queue.head = job->next;
+    if(!queue.head)
+        queue.tail = NULL;
+    queue.count--;
+    pthread_cond_signal(&queue.not_full);
+    pthread_mutex_unlock(&queue.lock);
+    return job;
+}
+
+/*
+ * Tells whether every structure config sizes stays within the job limits.
+ */
+static bool job_config_bounded(const SimConfig* config)
+{
+    return config->l1d.size <= JOB_MAX_CACHE_SIZE && config->l2.size <= JOB_MAX_CACHE_SIZE
+        && config->l1i.size <= JOB_MAX_CACHE_SIZE && config->bpred_table_bits <= JOB_MAX_BPRED_BITS
+        && config->btb_entries <= JOB_MAX_BTB_ENTRIES && config->mshrs <= JOB_MAX_ENTRIES
+        && config->store_buffer <= JOB_MAX_ENTRIES && config->dram.banks <= JOB_MAX_ENTRIES
+        && config->prefetch_degree <= JOB_MAX_DEGREE && config->fetch_width <= JOB_MAX_DEGREE;
+}
+
+/*
+ * Builds the configuration of a job from its option lines, false when an
+ * option is invalid or sizes a structure beyond the job limits. Traces
+ * would be written on the daemon's host and are always turned off.
+ */
+static bool job_config(Job* job, SimConfig* config)
+{
+    sim_config_defaults(config);
+    for(char* line = job->options; line && *line; )
+    {
+        char* end = strchr(line, '\n');
+        if(end)
+            *end = '\0';
+        if(*line && !sim_config_parse_arg(config, line))
+            return false;
+        line = end ? end + 1 : line + strlen(line);
+    }
+    config->bptrace_file[0] = '\0';
+    config->addrtrace_file[0] = '\0';
+    config->intervals_file[0] = '\0';
+    config->whatif_features = 0;
+    return sim_config_check(config) == NULL && job_config_bounded(config);
+}
+
+/*
+ * Runs a job and sends its result. Returns false when the simulator could
+ * not be reloaded and has to be replaced.
+ */
+static bool run_job(PipeSim* sim, Job* job)
+{
+    SimConfig config;
+    SimResultHeader result;
+    long long max_cycles = job->header.max_cycles ? (long long)job->header.max_cycles : MAX_CPU_CYCLES;
+
+    if(!job_config(job, &config))
+    {
+        send_status(job->conn, job->header.job_id, simproto_bad_config);
+        return true;
+    }
+    if(!pipesim_reload(sim, job->program, job->memory, job->header.memory_words, &config))
+    {
+        send_status(job->conn, job->header.job_id,
+            pipesim_bad_line(sim) > 0 ? simproto_bad_program : simproto_no_memory);
+        return false;
+    }
+
+    pipesim_step(sim, max_cycles);
+
+    memset(&result, 0, sizeof(result));
+    result.magic = SIMPROTO_RESULT_MAGIC;
+    result.job_id = job->header.job_id;
+    if(pipesim_halted(sim))
+        result.status = simproto_halted;
+    else
+        result.status = pipesim_bad_address(sim, NULL, NULL) ? simproto_bad_address : simproto_cycle_limit;
+    for(int r = 0; r < NUM_REGS; r++)
+        result.regs[r] = pipesim_reg(sim, r);
+    pipesim_counters(sim, &result.counters);
+
+    int words = 0;
+    const int* memory = pipesim_memory(sim, &words);
+    if(job->header.flags & SIMPROTO_WANT_MEMORY)
+        result.memory_words = words;
+    send_result(job->conn, &result, memory);
+    return true;
+}
+
+static void* worker_thread(void* arg)
+{
+    PipeSim** slot = arg;
+    PipeSim* sim = *slot;
+
+    while(1)
+    {
+        Job* job = queue_pop();
+
+        if(!run_job(sim, job))
+        {
+            pipesim_free(sim);
+            sim = pipesim_create("", NULL, 0, NULL);
+            if(!sim)
+            {
+                fprintf(stderr, "Error : out of memory\n");
+                exit(1);
+            }
+            *slot = sim;
+        }
+        connection_unref(job->conn);
+        job_free(job);
+    }
+    return NULL;
+}
+
+/*
+ * Reads a job from the connection, returns false at the end of the stream
+ * or on a malformed job; the latter is answered before returning.
+ */
+static bool read_job(Connection* conn, Job** out)
+{
+    SimJobHeader header;
+
+    if(!read_full(conn->fd, &header, sizeof(header)))
+        return false;
+    if(header.magic != SIMPROTO_JOB_MAGIC || header.program_len > SIMPROTO_MAX_PROGRAM
+        || header.memory_words > SIMPROTO_MAX_MEMORY || header.option_len > SIMPROTO_MAX_OPTIONS)
+    {
+        send_status(conn, header.job_id, simproto_bad_request);
+        return false;
+    }
+
+    Job* job = (Job*)calloc(1, sizeof(Job));
+    if(job)
+    {
+        job->header = header;
+        job->program = (char*)malloc(header.program_len + 1);
+        job->memory = (int*)malloc(header.memory_words * sizeof(int) + 1);
+        job->options = (char*)malloc(header.option_len + 1);
+    }
+    if(!job || !job->program || !job->memory || !job->options)
+    {
+        send_status(conn, header.job_id, simproto_no_memory);
+        if(job)
+            job_free(job);
+        return false;
+    }
+
+    if(!read_full(conn->fd, job->program, header.program_len)
+        || !read_full(conn->fd, job->memory, header.memory_words * sizeof(int))
+        || !read_full(conn->fd, job->options, header.option_len))
+    {
+        job_free(job);
+        return false;
+    }
+    job->program[header.program_len] = '\0';
+    job->options[header.option_len] = '\0';
+    *out = job;
+    return true;
+}
+
+static void* reader_thread(void* arg)
+{
+    Connection* conn = arg;
+    Job* job;
+
+    while(read_job(conn, &job))
+    {
+        pthread_mutex_lock(&conn->lock);
+        conn->refs++;
+        pthread_mutex_unlock(&conn->lock);
+
+        job->conn = conn;
+        queue_push(job);
+    }
+
+    // Results of queued jobs are still sent, no more jobs are read
+    shutdown(conn->fd, SHUT_RD);
+    connection_unref(conn);
+    return NULL;
+}
+
+static void stop_daemon(int sig)
+{
+    (void)sig;
+    unlink(socket_path);
+    _exit(0);
+}
+
+int main(int argc, const char * argv[]) {
+    const char* path = DEFAULT_SOCKET;
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+            path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+            workers = atoi(argv[++i]);
+        }
+        else {
+            fprintf(stderr, "Error : invalid argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (workers < 1)
+        workers = 1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error : socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(socket_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+        || listen(listen_fd, 64) < 0) {
+        perror("Error : socket");
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_daemon);
+    signal(SIGTERM, stop_daemon);
+
+    // Simulators are allocated once and grow to the largest job they ran
+    PipeSim** sims = calloc(workers, sizeof(PipeSim*));
+    pthread_t thread;
+    for (int i=0; i<workers; i++) {
+        sims[i] = pipesim_create("", NULL, 0, NULL);
+        if (!sims[i] || pthread_create(&thread, NULL, worker_thread, &sims[i]) != 0) {
+            fprintf(stderr, "Error : cannot start worker %d\n", i);
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    printf("pipesimd: listening on %s with %d workers\n", path, workers);
+    fflush(stdout);
+
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Error : accept");
+            break;
+        }
+
+        Connection* conn = calloc(1, sizeof(Connection));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->lock, NULL);
+        if (pthread_create(&thread, NULL, reader_thread, conn) != 0) {
+            connection_unref(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    unlink(path);
+    return 0;
+}
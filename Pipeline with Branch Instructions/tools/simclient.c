@@ -0,0 +1,275 @@
+//
+//  simclient.c
+//  Pipeline
+//
+//  Sends jobs to pipesimd and prints one line per result. The same program
+//  and memory image are submitted -n times, all written before the results
+//  are read, which also makes this a throughput test of the daemon.
+//
+//  Build: gcc -O2 -pthread -o simclient tools/simclient.c
+//  Usage: simclient [-s socket] [-n jobs] [-c max_cycles] [-o memory_output.txt]
+//                   program.txt memory_map.txt [--key=value ...]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../simproto.h"
+
+#define DEFAULT_SOCKET "/tmp/pipesimd.sock"
+
+typedef struct Submission {
+    int fd;
+    int jobs;
+    SimJobHeader header;
+    const char *program;
+    const int *memory;
+    const char *options;
+} Submission;
+
+static bool read_full(int fd, void* buf, size_t len)
+{
+    char* p = buf;
+    while(len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+    while(len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static char* read_text(const char* filename, size_t* len)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error : cannot open %s\n", filename);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* text = malloc(size + 1);
+    if (text && fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    if (text) {
+        text[size] = '\0';
+        *len = size;
+    }
+    return text;
+}
+
+static int* read_memory(const char* filename, int* words)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error : cannot open %s\n", filename);
+        return NULL;
+    }
+
+    int cap = 1024, count = 0, value;
+    int* memory = malloc(cap * sizeof(int));
+    while (memory && fscanf(file, "%d", &value) == 1) {
+        if (count == cap) {
+            cap *= 2;
+            int* grown = realloc(memory, cap * sizeof(int));
+            if (!grown) {
+                free(memory);
+                memory = NULL;
+                break;
+            }
+            memory = grown;
+        }
+        memory[count++] = value;
+    }
+    fclose(file);
+    *words = count;
+    return memory;
+}
+
+/*
+ * Writes every job while main reads the results, so neither side of the
+ * socket can fill up and stall the other.
+ */
+static void* submit_thread(void* arg)
+{
+    Submission* sub = arg;
+
+    for (int i=0; i<sub->jobs; i++) {
+        sub->header.job_id = i;
+        if (!write_full(sub->fd, &sub->header, sizeof(sub->header))
+            || !write_full(sub->fd, sub->program, sub->header.program_len)
+            || !write_full(sub->fd, sub->memory, sub->header.memory_words * sizeof(int))
+            || !write_full(sub->fd, sub->options, sub->header.option_len))
+            break;
+    }
+    shutdown(sub->fd, SHUT_WR);
+    return NULL;
+}
+
+static const char* status_name(int status)
+{
+    static const char* names[] = { "halted", "cycle limit", "bad config", "no memory", "bad request",
+        "bad program", "bad address" };
+    return status >= 0 && status <= simproto_bad_address ? names[status] : "unknown";
+}
+
+int main(int argc, const char * argv[]) {
+    const char* path = DEFAULT_SOCKET;
+    const char* output = NULL;
+    const char* files[2];
+    int file_cnt = 0;
+    int jobs = 1;
+    unsigned long long max_cycles = 0;
+    static char options[SIMPROTO_MAX_OPTIONS];
+    size_t option_len = 0;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+            path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+            jobs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+            max_cycles = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+            output = argv[++i];
+        }
+        else if (strncmp(argv[i], "--", 2) == 0) {
+            size_t len = strlen(argv[i]);
+            if (option_len + len + 1 > sizeof(options)) {
+                fprintf(stderr, "Error : too many options\n");
+                return -1;
+            }
+            memcpy(options + option_len, argv[i], len);
+            option_len += len;
+            options[option_len++] = '\n';
+        }
+        else if (file_cnt < 2) {
+            files[file_cnt++] = argv[i];
+        }
+        else {
+            fprintf(stderr, "Error : invalid argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (file_cnt != 2) {
+        fprintf(stderr, "Error : missing required args\n");
+        return -1;
+    }
+    if (jobs < 1)
+        jobs = 1;
+
+    size_t program_len = 0;
+    int memory_words = 0;
+    char* program = read_text(files[0], &program_len);
+    int* memory = read_memory(files[1], &memory_words);
+    if (!program || !memory)
+        return -1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Error : connect");
+        return -1;
+    }
+
+    Submission sub;
+    memset(&sub, 0, sizeof(sub));
+    sub.fd = fd;
+    sub.jobs = jobs;
+    sub.header.magic = SIMPROTO_JOB_MAGIC;
+    sub.header.program_len = program_len;
+    sub.header.memory_words = memory_words;
+    sub.header.option_len = option_len;
+    sub.header.flags = output ? SIMPROTO_WANT_MEMORY : 0;
+    sub.header.max_cycles = max_cycles;
+    sub.program = program;
+    sub.memory = memory;
+    sub.options = options;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, submit_thread, &sub);
+
+    int* result_memory = malloc((memory_words + 1) * sizeof(int));
+    int received = 0;
+    SimResultHeader result;
+    while (received < jobs && read_full(fd, &result, sizeof(result))) {
+        if (result.magic != SIMPROTO_RESULT_MAGIC || result.memory_words > (uint32_t)memory_words) {
+            fprintf(stderr, "Error : malformed result\n");
+            break;
+        }
+        if (!read_full(fd, result_memory, result.memory_words * sizeof(int)))
+            break;
+        received++;
+
+        PipeSimCounters* c = &result.counters;
+        printf("job %u: %s, cycles %lld, instructions %lld, IPC %f, flushes %lld, stalls %lld\n",
+            result.job_id, status_name(result.status), c->cycles, c->instructions,
+            c->cycles ? (double)c->instructions / c->cycles : 0.0, c->branch_flushes, c->stall_cycles);
+
+        if (output && result.memory_words) {
+            FILE* fout = fopen(output, "w");
+            if (fout) {
+                for (uint32_t i=0; i<result.memory_words; i++)
+                    fprintf(fout, "%d ", result_memory[i]);
+                fclose(fout);
+            }
+        }
+        if (result.status == simproto_bad_request)
+            break;
+    }
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d of %d jobs in %f s, %f jobs/s\n", received, jobs, seconds, seconds > 0 ? received / seconds : 0.0);
+
+    close(fd);
+    free(result_memory);
+    free(memory);
+    free(program);
+    return received == jobs ? 0 : -1;
+}
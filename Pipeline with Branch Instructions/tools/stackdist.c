@@ -0,0 +1,403 @@
+//
+//  stackdist.c
+//  Pipeline
+//
+//  Computes LRU stack (reuse) distances of an address trace recorded with
+//  --addrtrace=FILE and prints miss-ratio curves for every cache size in a
+//  single pass. For each line size and each number of sets the per-set
+//  stack distance of every access is found with an order statistic treap
+//  keyed by (set, last access time). Inclusion of LRU then gives the misses
+//  of every associativity for that number of sets, so each associativity
+//  family and the fully associative curve come out of the same pass.
+//
+//  Build: gcc -O2 -o stackdist tools/stackdist.c addrtrace.c
+//  Usage: stackdist trace.adt [-l 16,32,64] [-s max_sets] [-a max_assoc]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "../addrtrace.h"
+
+#define MAX_LINE_SIZES 8
+#define DIST_BUCKETS 34       // bucket 0: distance 0, bucket b: [2^(b-1), 2^b)
+#define TIME_BITS 40
+
+typedef struct TreapNode {
+    unsigned long long key;
+    unsigned int priority;
+    int left;
+    int right;
+    int size;
+} TreapNode;
+
+/* Order statistic treap, nodes live in one growable array */
+typedef struct Treap {
+    TreapNode *nodes;
+    int capacity;
+    int used;
+    int free_list;     // erased nodes, linked through left
+    int root;          // -1 when empty
+} Treap;
+
+typedef struct LastUse {
+    unsigned int line;
+    unsigned long long time;   // 0: empty slot
+} LastUse;
+
+/* Line to last access time map, open addressing */
+typedef struct LastUseMap {
+    LastUse *slots;
+    unsigned int capacity;
+    unsigned int count;
+} LastUseMap;
+
+typedef struct LineSizeStats {
+    int line_size;
+    int offset_bits;
+    LastUseMap last_use;
+    Treap *treaps;                         // one per set count
+    long long (*histograms)[DIST_BUCKETS]; // one per set count
+    long long cold_misses;
+} LineSizeStats;
+
+static unsigned int random_state = 12345;
+
+static unsigned int next_random(void)
+{
+    random_state = random_state * 1103515245u + 12345u;
+    return random_state ^ (random_state >> 16);
+}
+
+static int node_size(Treap* treap, int node)
+{
+    return node < 0 ? 0 : treap->nodes[node].size;
+}
+
+static void node_fix(Treap* treap, int node)
+{
+    TreapNode* n = &treap->nodes[node];
+    n->size = 1 + node_size(treap, n->left) + node_size(treap, n->right);
+}
+
+/*
+ * Splits a subtree into keys < key and keys >= key.
+ */
+static void treap_split(Treap* treap, int node, unsigned long long key, int* less, int* greater)
+{
+    if(node < 0)
+    {
+        *less = -1;
+        *greater = -1;
+        return;
+    }
+
+    TreapNode* n = &treap->nodes[node];
+    if(n->key < key)
+    {
+        treap_split(treap, n->right, key, &treap->nodes[node].right, greater);
+        *less = node;
+    }
+    else
+    {
+        treap_split(treap, n->left, key, less, &treap->nodes[node].left);
+        *greater = node;
+    }
+    node_fix(treap, node);
+}
+
+static int treap_merge(Treap* treap, int left, int right)
+{
+    if(left < 0)
+        return right;
+    if(right < 0)
+        return left;
+
+    if(treap->nodes[left].priority > treap->nodes[right].priority)
+    {
+        treap->nodes[left].right = treap_merge(treap, treap->nodes[left].right, right);
+        node_fix(treap, left);
+        return left;
+    }
+    treap->nodes[right].left = treap_merge(treap, left, treap->nodes[right].left);
+    node_fix(treap, right);
+    return right;
+}
+
+static void treap_insert(Treap* treap, unsigned long long key)
+{
+    int node;
+    if(treap->free_list >= 0)
+    {
+        node = treap->free_list;
+        treap->free_list = treap->nodes[node].left;
+    }
+    else
+    {
+        if(treap->used == treap->capacity)
+        {
+            treap->capacity = treap->capacity ? treap->capacity * 2 : 1024;
+            treap->nodes = realloc(treap->nodes, treap->capacity * sizeof(TreapNode));
+            if(!treap->nodes)
+            {
+                fprintf(stderr, "Error : out of memory\n");
+                exit(1);
+            }
+        }
+        node = treap->used++;
+    }
+
+    treap->nodes[node].key = key;
+    treap->nodes[node].priority = next_random();
+    treap->nodes[node].left = -1;
+    treap->nodes[node].right = -1;
+    treap->nodes[node].size = 1;
+
+    int less, greater;
+    treap_split(treap, treap->root, key, &less, &greater);
+    treap->root = treap_merge(treap, treap_merge(treap, less, node), greater);
+}
+
+static void treap_erase(Treap* treap, unsigned long long key)
+{
+    int less, middle, greater;
+    treap_split(treap, treap->root, key, &less, &greater);
+    treap_split(treap, greater, key + 1, &middle, &greater);
+    if(middle >= 0)
+    {
+        treap->nodes[middle].left = treap->free_list;
+        treap->free_list = middle;
+    }
+    treap->root = treap_merge(treap, less, greater);
+}
+
+/*
+ * Number of keys strictly below key.
+ */
+static long long treap_rank(Treap* treap, unsigned long long key)
+{
+    long long rank = 0;
+    int node = treap->root;
+
+    while(node >= 0)
+    {
+        TreapNode* n = &treap->nodes[node];
+        if(n->key < key)
+        {
+            rank += node_size(treap, n->left) + 1;
+            node = n->right;
+        }
+        else
+            node = n->left;
+    }
+    return rank;
+}
+
+static unsigned int hash_line(unsigned int line)
+{
+    return line * 2654435761u;
+}
+
+/*
+ * Returns the slot of line, inserting an empty one when missing.
+ */
+static LastUse* last_use_slot(LastUseMap* map, unsigned int line)
+{
+    if(map->count * 2 >= map->capacity)
+    {
+        LastUse* old = map->slots;
+        unsigned int old_capacity = map->capacity;
+
+        map->capacity = old_capacity ? old_capacity * 2 : 1024;
+        map->slots = calloc(map->capacity, sizeof(LastUse));
+        if(!map->slots)
+        {
+            fprintf(stderr, "Error : out of memory\n");
+            exit(1);
+        }
+        map->count = 0;
+        for(unsigned int i = 0; i < old_capacity; i++)
+        {
+            if(old[i].time)
+            {
+                *last_use_slot(map, old[i].line) = old[i];
+                map->count++;
+            }
+        }
+        free(old);
+    }
+
+    unsigned int mask = map->capacity - 1;
+    unsigned int index = hash_line(line) & mask;
+    while(map->slots[index].time && map->slots[index].line != line)
+        index = (index + 1) & mask;
+
+    map->slots[index].line = line;
+    return &map->slots[index];
+}
+
+static int distance_bucket(long long distance)
+{
+    int bucket = 0;
+    while(distance > 0)
+    {
+        bucket++;
+        distance >>= 1;
+    }
+    return bucket;
+}
+
+/*
+ * Accesses at distance >= capacity lines miss in an LRU set of that
+ * capacity (capacity is a power of two).
+ */
+static long long misses_at(long long* histogram, long long cold, int capacity)
+{
+    long long misses = cold;
+    for(int bucket = distance_bucket(capacity); bucket < DIST_BUCKETS; bucket++)
+        misses += histogram[bucket];
+    return misses;
+}
+
+static void process_access(LineSizeStats* stats, int set_counts, unsigned int addr, unsigned long long time)
+{
+    unsigned int line = addr >> stats->offset_bits;
+    LastUse* slot = last_use_slot(&stats->last_use, line);
+    unsigned long long last = slot->time;
+
+    if(!last)
+    {
+        stats->last_use.count++;
+        stats->cold_misses++;
+    }
+    slot->time = time;
+
+    for(int s = 0; s < set_counts; s++)
+    {
+        unsigned long long set = line & ((1u << s) - 1);
+        unsigned long long base = set << TIME_BITS;
+        Treap* treap = &stats->treaps[s];
+
+        if(last)
+        {
+            // Distinct lines of this set touched since the last use
+            long long distance = treap_rank(treap, base + (1ull << TIME_BITS))
+                - treap_rank(treap, base + last + 1);
+            stats->histograms[s][distance_bucket(distance)]++;
+            treap_erase(treap, base + last);
+        }
+        treap_insert(treap, base + time);
+    }
+}
+
+static int parse_line_sizes(const char* list, int* line_sizes)
+{
+    int count = 0;
+    const char* p = list;
+    while(*p && count < MAX_LINE_SIZES)
+    {
+        line_sizes[count++] = atoi(p);
+        p = strchr(p, ',');
+        if(!p)
+            break;
+        p++;
+    }
+    return count;
+}
+
+static int log2_int(int value)
+{
+    int bits = 0;
+    while((1 << bits) < value)
+        bits++;
+    return bits;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc<=1) {
+        fprintf(stderr, "Error : missing required args\n");
+        return -1;
+    }
+
+    int line_sizes[MAX_LINE_SIZES] = { 8, 16, 32, 64 };
+    int line_size_cnt = 4;
+    int max_sets = 1024;
+    int max_assoc = 16;
+
+    for (int i=2; i+1<argc; i+=2) {
+        if (strcmp(argv[i], "-l") == 0)
+            line_size_cnt = parse_line_sizes(argv[i+1], line_sizes);
+        else if (strcmp(argv[i], "-s") == 0)
+            max_sets = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-a") == 0)
+            max_assoc = atoi(argv[i+1]);
+        else {
+            fprintf(stderr, "Error : invalid option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    AddrTraceHeader header;
+    AddrTraceFile* trace = addrtrace_open_read(argv[1], &header);
+    if (!trace) {
+        return -1;
+    }
+
+    int set_counts = log2_int(max_sets) + 1;
+    LineSizeStats stats[MAX_LINE_SIZES];
+    memset(stats, 0, sizeof(stats));
+    for (int l=0; l<line_size_cnt; l++) {
+        stats[l].line_size = line_sizes[l];
+        stats[l].offset_bits = log2_int(line_sizes[l]);
+        stats[l].treaps = calloc(set_counts, sizeof(Treap));
+        stats[l].histograms = calloc(set_counts, sizeof(*stats[l].histograms));
+        for (int s=0; s<set_counts; s++) {
+            stats[l].treaps[s].root = -1;
+            stats[l].treaps[s].free_list = -1;
+        }
+    }
+
+    AddrTraceRecord record;
+    unsigned long long time = 0;
+    while (addrtrace_read(trace, &record)) {
+        time++;
+        for (int l=0; l<line_size_cnt; l++)
+            process_access(&stats[l], set_counts, record.addr, time);
+    }
+    addrtrace_close(trace, -1);
+
+    printf("# %llu accesses, %lld instructions\n", time, header.instructions);
+    printf("line_size,assoc,sets,size_bytes,misses,miss_ratio,mpki\n");
+    for (int l=0; l<line_size_cnt; l++) {
+        LineSizeStats* st = &stats[l];
+
+        // Fixed associativity families, one curve per associativity
+        for (int assoc=1; assoc<=max_assoc; assoc*=2) {
+            for (int s=0; s<set_counts; s++) {
+                long long misses = misses_at(st->histograms[s], st->cold_misses, assoc);
+                printf("%d,%d,%d,%lld,%lld,%f,%f\n", st->line_size, assoc, 1 << s,
+                    (long long)st->line_size * assoc * (1 << s), misses,
+                    time ? (double)misses / time : 0.0,
+                    header.instructions ? misses * 1000.0 / header.instructions : 0.0);
+            }
+        }
+
+        // Fully associative curve, a single set of growing capacity
+        for (long long lines=1; lines <= (1ll << (DIST_BUCKETS - 2)); lines*=2) {
+            long long misses = misses_at(st->histograms[0], st->cold_misses, (int)lines);
+            printf("%d,full,1,%lld,%lld,%f,%f\n", st->line_size, st->line_size * lines, misses,
+                time ? (double)misses / time : 0.0,
+                header.instructions ? misses * 1000.0 / header.instructions : 0.0);
+            if(misses == st->cold_misses)
+                break;
+        }
+
+        for (int s=0; s<set_counts; s++)
+            free(st->treaps[s].nodes);
+        free(st->treaps);
+        free(st->histograms);
+        free(st->last_use.slots);
+    }
+    return 0;
+}
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "whatif.h"
+
+#define WHATIF_ISSUE_DEPTH 3      // IF to RR: ID, IA and RR itself
+#define WHATIF_BRANCH_DEPTH 4     // RR to BR: ADD, MUL, DIV
+#define WHATIF_WB_DEPTH 7         // RR to WB through every stage
+
+static const char* feature_keys[] = { "bp", "fwd", "mem", "struct" };
+static const char* feature_names[] = { "perfect branch prediction", "full forwarding",
+    "zero-latency memory", "no structural hazards" };
+
+/*
+ * What one retired instruction needs from the timelines: its registers,
+ * forwarding latency, whether it flushed, and the delays the real run
+ * showed beyond the edges of the model, split by cause.
+ */
+typedef struct WhatIfStep {
+    int dest;                 // -1 when no register is written
+    int srcs[2];              // -1 when unused
+    int depth;                // cycles from issue until the result can be forwarded
+    bool is_load;
+    bool mispredicted;
+    long long redirect;       // cycles from the resolution of a flushing branch to the next fetch
+    long long fetch_mem, fetch_other;
+    long long issue_data, issue_mem, issue_other;
+    long long branch_mem, branch_other;
+    long long wb_mem, wb_other;
+} WhatIfStep;
+
+static long long max_ll(long long a, long long b)
+{
+    return a > b ? a : b;
+}
+
+// Part of a delay explained by a cause that accounts for at most limit cycles
+static long long take(long long* delay, long long limit)
+{
+    if(limit < 0)
+        limit = 0;
+    long long part = *delay < 0 ? 0 : *delay < limit ? *delay : limit;
+    *delay -= part;
+    return part;
+}
+
+/*
+ * This function parses the features of --whatif, a comma separated list of
+ * bp, fwd, mem and struct. A bare --whatif studies all of them.
+ */
+bool whatif_parse_features(const char* value, unsigned int* features)
+{
+    char token[16];
+
+    *features = 0;
+    if(strcmp(value, "1") == 0 || strcmp(value, "all") == 0)
+    {
+        *features = whatif_all;
+        return true;
+    }
+    if(strcmp(value, "0") == 0)
+        return true;
+
+    while(*value)
+    {
+        size_t len = strcspn(value, ",");
+        int f;
+        if(len >= sizeof(token))
+            return false;
+        memcpy(token, value, len);
+        token[len] = '\0';
+        for(f = 0; f < 4 && strcmp(token, feature_keys[f]) != 0; f++);
+        if(f == 4)
+            return false;
+        *features |= 1u << f;
+        value += len + (value[len] == ',');
+    }
+    return true;
+}
+
+WhatIf* whatif_create(unsigned int features)
+{
+    WhatIf* whatif = (WhatIf*)calloc(1, sizeof(WhatIf));
+    if(!whatif)
+    {
+        printf("Error allocating the what-if study\n");
+        exit(1);
+    }
+
+    whatif->features = features;
+    whatif->scenarios[whatif->scenario_cnt++].features = 0;
+    for(int f = 0; f < 4; f++)
+        if(features & (1u << f))
+            whatif->scenarios[whatif->scenario_cnt++].features = 1u << f;
+    if(whatif->scenario_cnt > 2)
+        whatif->scenarios[whatif->scenario_cnt++].features = features;   // all of them together
+
+    for(int s = 0; s < whatif->scenario_cnt; s++)
+        whatif->scenarios[s].times.branch = -1;
+    for(int i = 0; i < WHATIF_WINDOW; i++)
+        whatif->window[i].seq = -1;
+    return whatif;
+}
+
+void whatif_free(WhatIf* whatif)
+{
+    free(whatif);
+}
+
+/*
+ * The hooks below record the detailed run. seq numbers every instruction
+ * leaving IF, wrong-path ones included, and selects its window entry.
+ */
+void whatif_fetch(WhatIf* whatif, long long seq, long long clock, long long stalls)
+{
+    WhatIfEntry* entry = &whatif->window[seq % WHATIF_WINDOW];
+    memset(entry, 0, sizeof(WhatIfEntry));
+    entry->seq = seq;
+    entry->fetch = clock;
+    entry->fetch_stalls = stalls;
+    entry->issue = -1;
+    entry->branch = -1;
+}
+
+void whatif_stall(WhatIf* whatif, long long seq)
+{
+    WhatIfEntry* entry = &whatif->window[seq % WHATIF_WINDOW];
+    if(entry->seq == seq)
+        entry->data_stalls++;
+}
+
+void whatif_issue(WhatIf* whatif, long long seq, long long clock, long long freeze)
+{
+    WhatIfEntry* entry = &whatif->window[seq % WHATIF_WINDOW];
+    if(entry->seq == seq)
+    {
+        entry->issue = clock;
+        entry->issue_freeze = freeze;
+    }
+}
+
+void whatif_branch(WhatIf* whatif, long long seq, long long clock, long long freeze, bool mispredicted)
+{
+    WhatIfEntry* entry = &whatif->window[seq % WHATIF_WINDOW];
+    if(entry->seq == seq)
+    {
+        entry->branch = clock;
+        entry->branch_freeze = freeze;
+        entry->mispredicted = mispredicted;
+    }
+}
+
+/*
+ * Earliest cycles of the nodes of the next instruction on timeline t,
+ * with the edges of the features removed.
+ */
+static long long fetch_bound(const WhatIfTimes* t, unsigned int features, const WhatIfStep* step)
+{
+    long long bound = t->fetch + 1;
+    if(!(features & whatif_structural))
+        bound = max_ll(bound, t->issue[WHATIF_ISSUE_DEPTH - 1]);
+    if(!(features & whatif_perfect_bp) && t->branch >= 0)
+        bound = max_ll(bound, t->branch + step->redirect);
+    return bound;
+}
+
+static long long issue_bound(const WhatIfTimes* t, unsigned int features, const WhatIfStep* step, long long fetch)
+{
+    long long bound = fetch + WHATIF_ISSUE_DEPTH;
+    if(!(features & whatif_structural))
+        bound = max_ll(bound, t->issue[0] + 1);
+    for(int i = 0; i < 2; i++)
+        if(step->srcs[i] >= 0)
+            bound = max_ll(bound, t->avail[step->srcs[i]]);
+    return bound;
+}
+
+static long long writeback_bound(const WhatIfTimes* t, unsigned int features, long long issue)
+{
+    long long bound = issue + WHATIF_WB_DEPTH;
+    if(!(features & whatif_structural))
+        bound = max_ll(bound, t->writeback + 1);
+    return bound;
+}
+
+/*
+ * Places the instruction of step on timeline t, keeping the delays whose
+ * cause is not idealised away, and moves the timeline past it.
+ */
+static void advance(WhatIfTimes* t, unsigned int features, const WhatIfStep* step)
+{
+    bool mem = features & whatif_memory;
+    bool other = !(features & whatif_structural);
+
+    long long fetch = fetch_bound(t, features, step) + (mem ? 0 : step->fetch_mem) + (other ? step->fetch_other : 0);
+    fetch = max_ll(fetch, t->fetch + 1);
+
+    long long issue = issue_bound(t, features, step, fetch) + (mem ? 0 : step->issue_mem)
+        + (other ? step->issue_other : 0) + (features & whatif_forwarding ? 0 : step->issue_data);
+    issue = max_ll(issue, fetch + WHATIF_ISSUE_DEPTH);
+
+    long long writeback = writeback_bound(t, features, issue) + (mem ? 0 : step->wb_mem) + (other ? step->wb_other : 0);
+    writeback = max_ll(writeback, issue + WHATIF_WB_DEPTH);
+
+    t->fetch = fetch;
+    t->issue[2] = t->issue[1];
+    t->issue[1] = t->issue[0];
+    t->issue[0] = issue;
+    t->writeback = writeback;
+    t->end = max_ll(t->end, writeback);
+    t->branch = -1;
+    if(step->mispredicted)
+    {
+        long long branch = issue + WHATIF_BRANCH_DEPTH + (mem ? 0 : step->branch_mem) + (other ? step->branch_other : 0);
+        t->branch = max_ll(branch, issue + WHATIF_BRANCH_DEPTH);
+    }
+    if(step->dest >= 0)
+        t->avail[step->dest] = issue + step->depth + (step->is_load && !mem ? step->wb_mem : 0);
+}
+
+// Registers read and written, in the operand layout of cpu.h
+static void decode_step(WhatIfStep* step, int opcode, int dest, int src1, int src2)
+{
+    bool two_regs = opcode == fmt_add || opcode == fmt_sub || opcode == fmt_mul || opcode == fmt_div;
+    bool branch = opcode >= fmt_bez_imm && opcode <= fmt_bltz_imm;
+
+    step->dest = -1;
+    step->srcs[0] = -1;
+    step->srcs[1] = -1;
+    step->depth = 1;
+    step->is_load = opcode == fmt_ld || opcode == fmt_ld_imm;
+
+    if(opcode != fmt_set && opcode != fmt_ld_imm && opcode != fmt_ret)
+        step->srcs[0] = src1;
+    if(two_regs)
+        step->srcs[1] = src2;
+    else if(opcode == fmt_st)
+        step->srcs[1] = dest;
+    if(opcode != fmt_st && opcode != fmt_st_imm && opcode != fmt_ret && !branch)
+        step->dest = dest;
+
+    if(opcode == fmt_mul || opcode == fmt_mul_imm)
+        step->depth = 2;
+    else if(opcode == fmt_div || opcode == fmt_div_imm)
+        step->depth = 3;
+    else if(step->is_load)
+        step->depth = WHATIF_WB_DEPTH - 1;
+
+    for(int i = 0; i < 2; i++)
+        if(step->srcs[i] >= WHATIF_REGS)
+            step->srcs[i] = -1;
+    if(step->dest >= WHATIF_REGS)
+        step->dest = -1;
+}
+
+/*
+ * Called at writeback. Explains the real times of the instruction against
+ * the edges of the real timeline, then advances every scenario by it.
+ */
+void whatif_retire(WhatIf* whatif, long long seq, int opcode, int dest, int src1, int src2,
+    long long clock, long long freeze)
+{
+    WhatIfEntry* entry = &whatif->window[seq % WHATIF_WINDOW];
+    WhatIfTimes* real = &whatif->scenarios[0].times;
+    WhatIfStep step;
+    long long delay;
+
+    if(entry->seq != seq || entry->issue < 0)
+    {
+        whatif->lost++;
+        return;
+    }
+
+    memset(&step, 0, sizeof(step));
+    decode_step(&step, opcode, dest, src1, src2);
+    step.mispredicted = entry->mispredicted;
+    if(real->branch >= 0)
+        step.redirect = entry->fetch - real->branch;
+
+    delay = entry->fetch - fetch_bound(real, 0, &step);
+    step.fetch_mem = take(&delay, entry->fetch_stalls - whatif->last_fetch_stalls);
+    step.fetch_other = delay;
+
+    delay = entry->issue - issue_bound(real, 0, &step, entry->fetch);
+    step.issue_data = take(&delay, entry->data_stalls);
+    step.issue_mem = take(&delay, entry->issue_freeze - whatif->last_issue_freeze);
+    step.issue_other = delay;
+
+    if(entry->branch >= 0)
+    {
+        delay = entry->branch - entry->issue - WHATIF_BRANCH_DEPTH;
+        step.branch_mem = take(&delay, entry->branch_freeze - entry->issue_freeze);
+        step.branch_other = delay;
+    }
+
+    delay = clock - writeback_bound(real, 0, entry->issue);
+    step.wb_mem = take(&delay, freeze - max_ll(entry->issue_freeze, whatif->last_wb_freeze));
+    step.wb_other = delay;
+
+    for(int s = 0; s < whatif->scenario_cnt; s++)
+        advance(&whatif->scenarios[s].times, whatif->scenarios[s].features, &step);
+
+    whatif->last_fetch_stalls = entry->fetch_stalls;
+    whatif->last_issue_freeze = entry->issue_freeze;
+    whatif->last_wb_freeze = freeze;
+    whatif->retired++;
+    entry->seq = -1;
+}
+
+static void scenario_name(unsigned int features, char* name, size_t size)
+{
+    name[0] = '\0';
+    if(!features)
+    {
+        snprintf(name, size, "real model");
+        return;
+    }
+    if(features != (features & -features))
+    {
+        snprintf(name, size, "all of the above");
+        return;
+    }
+    for(int f = 0; f < 4; f++)
+        if(features & (1u << f))
+        {
+            size_t len = strlen(name);
+            snprintf(name + len, size - len, "%s%s", len ? " + " : "", feature_names[f]);
+        }
+}
+
+/*
+ * Prints the scenarios next to each other. cycles is the length of the
+ * detailed run, the real model replay should come out the same.
+ */
+void whatif_print(WhatIf* whatif, long long cycles, long long instructions)
+{
+    char name[128];
+    long long real = whatif->scenarios[0].times.end;
+
+    printf("What-if limit study over %lld instructions:\n", whatif->retired);
+    printf("%-44s %14s %10s %9s\n", "scenario", "cycles", "IPC", "speedup");
+    for(int s = 0; s < whatif->scenario_cnt; s++)
+    {
+        long long end = whatif->scenarios[s].times.end;
+        scenario_name(whatif->scenarios[s].features, name, sizeof(name));
+        printf("%-44s %14lld %10f %8.3fx\n", name, end, end ? (double)instructions / end : 0.0,
+            end ? (double)real / end : 0.0);
+    }
+    if(whatif->lost)
+        printf("Instructions left out of the study: %lld\n", whatif->lost);
+    if(real != cycles)
+        printf("The real model replay ends at %lld, the run at %lld cycles\n", real, cycles);
+}
@@ -0,0 +1,81 @@
+#ifndef _WHATIF_H_
+#define _WHATIF_H_
+#include <stdbool.h>
+
+#define WHATIF_WINDOW 64          // fetched instructions tracked until they retire
+#define WHATIF_REGS 16            // NUM_REGS of cpu.h
+#define WHATIF_MAX_SCENARIOS 6    // the real model, every feature alone, all together
+
+// Idealised features of a limit study, combined as bits
+enum whatifFeature_enum {
+    whatif_perfect_bp = 1,        // no flush after a branch
+    whatif_forwarding = 2,        // results forwarded from every stage
+    whatif_memory = 4,            // no data or instruction cache stalls
+    whatif_structural = 8,        // a stalled instruction holds up nothing behind it
+    whatif_all = 15
+};
+
+// Times of one fetched instruction in the detailed run, until it retires
+typedef struct WhatIfEntry {
+    long long seq;
+    long long fetch;              // cycle it left IF
+    long long fetch_stalls;       // memory and fetch stall cycles of the run by then
+    long long issue;              // cycle it left RR
+    long long issue_freeze;
+    long long branch;             // cycle it resolved in BR, branches only
+    long long branch_freeze;
+    bool mispredicted;
+    int data_stalls;              // cycles RR stalled on it
+} WhatIfEntry;
+
+// Pipeline timeline of one scenario, as far as the next instruction needs it
+typedef struct WhatIfTimes {
+    long long fetch;
+    long long issue[3];           // last three issues, issue[0] the latest
+    long long writeback;
+    long long branch;             // resolution of the last instruction if it flushed, -1 otherwise
+    long long avail[WHATIF_REGS]; // first cycle RR can have each register with full forwarding
+    long long end;                // last writeback so far
+} WhatIfTimes;
+
+typedef struct WhatIfScenario {
+    unsigned int features;
+    WhatIfTimes times;
+} WhatIfScenario;
+
+/*
+ * Limit study from a single detailed run. Every retired instruction is
+ * placed on a simple in-order timeline: fetch, issue from RR, branch
+ * resolution and writeback, linked by pipeline depth, in-order bandwidth,
+ * full-forwarding data dependences and the redirect after a flush. The
+ * delay each node of the real run shows beyond those edges is split into
+ * data hazard, memory and structural parts. Every scenario then replays
+ * the same instruction, in step, with the edges and delays of its
+ * idealised features removed, so the scenario with none reproduces the
+ * real run exactly.
+ */
+typedef struct WhatIf {
+    unsigned int features;
+    int scenario_cnt;
+    WhatIfScenario scenarios[WHATIF_MAX_SCENARIOS];   // [0] replays the real model
+    long long last_fetch_stalls;  // stall counters of the run at the nodes of the last instruction
+    long long last_issue_freeze;
+    long long last_wb_freeze;
+    long long retired;
+    long long lost;               // retired instructions no longer in the window
+    WhatIfEntry window[WHATIF_WINDOW];
+} WhatIf;
+
+bool whatif_parse_features(const char* value, unsigned int* features);
+WhatIf* whatif_create(unsigned int features);
+void whatif_free(WhatIf* whatif);
+
+void whatif_fetch(WhatIf* whatif, long long seq, long long clock, long long stalls);
+void whatif_stall(WhatIf* whatif, long long seq);
+void whatif_issue(WhatIf* whatif, long long seq, long long clock, long long freeze);
+void whatif_branch(WhatIf* whatif, long long seq, long long clock, long long freeze, bool mispredicted);
+void whatif_retire(WhatIf* whatif, long long seq, int opcode, int dest, int src1, int src2,
+    long long clock, long long freeze);
+void whatif_print(WhatIf* whatif, long long cycles, long long instructions);
+
+#endif
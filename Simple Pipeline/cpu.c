@@ -92,7 +92,7 @@ CPU* CPU_init(const char* filename)
     get_lines(filename, cpu);
     cpu->regs= create_registers(REG_COUNT);
     cpu->memory = load_memory("./memory_map.txt");
-    cpu->instruction_memory = file_parser(filename);
+    cpu->instruction_memory = file_parser(filename, cpu);
 
     cpu->pc = 0;   
     cpu->clock = 1;
@@ -137,21 +137,31 @@ void print_registers(CPU *cpu){
 }
 
 /*
- *  CPU CPU simulation loop
+ *  CPU CPU simulation loop. Without a cap the run also stops when nothing
+ *  retires for STALL_LIMIT cycles, as when fetch ran off the end of a
+ *  program without ret.
  */
 int CPU_run(CPU* cpu)
 {
-    for(int i=0; i < MAX_CPU_CYCLES;i++)
+    bool halted = false;
+    bool stalled = false;
+    long long retired = cpu->tot_instructions_done;
+    long long progress = cpu->clock;
+
+    for(long long i=0; MAX_CPU_CYCLES == 0 || i < MAX_CPU_CYCLES;i++)
     {
         if(DEBUG_PIPELINE)
         {
             printf("================================\n");
-            printf("Clock Cycle #: %d \n", cpu->clock);
+            printf("Clock Cycle #: %lld \n", cpu->clock);
             printf("--------------------------------\n");
         }
         
         if(writeback_stage(cpu))
+        {
+            halted = true;
             break;
+        }
 
         memory_second_stage(cpu);
         memory_first_stage(cpu);
@@ -167,20 +177,38 @@ int CPU_run(CPU* cpu)
         //printf("=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n");
         //print_registers(cpu);
 
+        // A pipeline that stopped retiring will not reach ret
+        if(cpu->tot_instructions_done != retired)
+        {
+            retired = cpu->tot_instructions_done;
+            progress = cpu->clock;
+        }
+        else if(cpu->clock - progress > STALL_LIMIT)
+        {
+            stalled = true;
+            break;
+        }
+
         cpu->clock++;
     } 
   
     print_registers(cpu);
 
+    // The statistics only cover the cycles simulated before the cap
+    if(stalled)
+        printf("Run truncated: no instruction retired for %d cycles at cycle %lld before ret\n", STALL_LIMIT, cpu->clock);
+    else if(!halted)
+        printf("Run truncated: MAX_CPU_CYCLES (%d) reached at cycle %lld before ret\n", MAX_CPU_CYCLES, cpu->clock);
+
     if(DEBUG_STATS)
     {
-        printf("Stalled cycles due to structural hazard: %d \n", cpu->cpu_stalled_cnt);
-        printf("Total execution cycles: %d \n", cpu->clock);
-        printf("Total instruction simulated: %d\n", cpu->tot_instructions_done);
-        printf("IPC: %f \n", (float)cpu->tot_instructions_done/cpu->clock);
+        printf("Stalled cycles due to structural hazard: %lld \n", cpu->cpu_stalled_cnt);
+        printf("Total execution cycles: %lld \n", cpu->clock);
+        printf("Total instruction simulated: %lld\n", cpu->tot_instructions_done);
+        printf("IPC: %f \n", (double)cpu->tot_instructions_done/cpu->clock);
     }
    
-    return 0;
+    return halted ? 0 : -1;
 }
 
 Register*  create_registers(int size){
@@ -201,7 +229,7 @@ Register*  create_registers(int size){
  */
 void fetch_stage(CPU* cpu)
 {
-    if(cpu->fetch.status == stage_action && !cpu->cpu_stalled && !cpu->cpu_halted)
+    if(cpu->fetch.status == stage_action && !cpu->cpu_stalled && !cpu->cpu_halted && cpu->pc < cpu->tot_instructions*7)
     {
 
         //     cpu->instruction_memory stores the instruction in followings format
@@ -577,11 +605,12 @@ int get_instruction_count_in_input_file(FILE* file)
 /*
 The below function is opening a file for reading, getting the total number of instructions in the file, allocating memory for an array to store the instructions, and then parsing each line of the file to extract the opcode and operands for each instruction
 */
-int * file_parser(const char *filename)
+int * file_parser(const char *filename, CPU* cpu)
 {
     FILE* fp = fopen(filename, "r"); // open the file for reading
 
     int tot_instructions = get_instruction_count_in_input_file(fp);
+    cpu->tot_instructions = tot_instructions;
 
     //rewind function sets the file position to the beginning of the file
     rewind(fp);
@@ -9,7 +9,8 @@
 
 #define NUM_REGS 128
 // #define MEM_SIZE 65536
-#define MAX_CPU_CYCLES 10000
+#define MAX_CPU_CYCLES 10000   // 0: run until ret
+#define STALL_LIMIT 100000     // cycles without a retired instruction before a run gives up
 #define DEBUG_PIPELINE 0
 #define DEBUG_STATS 1
 
@@ -89,15 +90,16 @@ typedef struct CPU
     int pc; // Program Counter
     
     int *instruction_memory;      // file parser instructions stored here
+    int tot_instructions;         // instructions in instruction_memory
     char* instruction_line[100];      // for printing purpose
     char lines[150][50] ;
 
-    int clock;   // to track clock cycles
+    long long clock;   // to track clock cycles
     int *memory;    // Used to store memory map
     bool cpu_stalled;   
     bool cpu_halted;     // set this flag when ret is encountered
-    int cpu_stalled_cnt;
-    int tot_instructions_done;
+    long long cpu_stalled_cnt;
+    long long tot_instructions_done;
 
     Stage fetch;
     Stage decode;
@@ -122,7 +124,7 @@ void CPU_stop(CPU* cpu);
 
 int get_instruction_count_in_input_file(FILE* file);
 
-int * file_parser(const char *filename);
+int * file_parser(const char *filename, CPU* cpu);
 
 void instruction_analyse_stage(CPU* cpu);
 void register_read_stage(CPU* cpu);